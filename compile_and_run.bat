@@ -14,7 +14,7 @@ if %ERRORLEVEL% NEQ 0 (
 )
 
 REM Compile the program
-g++ -std=c++17 -O3 -Wall -Wextra -o order_book_analysis.exe order_book_analysis.cpp
+g++ -std=c++17 -O3 -Wall -Wextra -pthread -o order_book_analysis.exe order_book_analysis.cpp
 
 if %ERRORLEVEL% EQU 0 (
     echo Compilation successful!
@@ -1,12 +1,107 @@
 """
 Generate charts from C++ order book analysis results
 """
+import os
+import struct
+
 import pandas as pd
 import matplotlib.pyplot as plt
 import numpy as np
 
+OBCOL_MAGIC = b'OBCOL\0\0\0'
+OBCOL_END = b'OBCOLEND'
+
+
+def _decode_delta_varint(chunk, rows):
+    """Decode a DeltaInt64 chunk (zigzag LEB128 deltas) into int64 values"""
+    if rows == 0:
+        return np.zeros(0, dtype=np.int64)
+    data = np.asarray(chunk, dtype=np.uint8)
+    ends = np.flatnonzero(data < 0x80)
+    starts = np.concatenate(([0], ends[:-1] + 1))
+    position = np.arange(data.size) - np.repeat(starts, ends - starts + 1)
+    payload = (data & 0x7F).astype(np.uint64) << (7 * position).astype(np.uint64)
+    zigzag = np.bitwise_or.reduceat(payload, starts)
+    deltas = (zigzag >> np.uint64(1)).astype(np.int64) ^ -(zigzag & np.uint64(1)).astype(np.int64)
+    return np.cumsum(deltas)
+
+
+def read_obcol_columns(path):
+    """Load a .obcol file written by the C++ ColumnarWriter as numpy arrays
+
+    Returns (columns, metadata): an ordered dict of column name -> array
+    and the file's key/value metadata. The file is memory mapped; Float64
+    columns of single-row-group files are views of the mapping (no copy),
+    int64 columns are decoded.
+    """
+    raw = np.memmap(path, dtype=np.uint8, mode='r')
+    if raw.size < 80 or bytes(raw[:8]) != OBCOL_MAGIC or bytes(raw[-8:]) != OBCOL_END:
+        raise ValueError(f'{path}: not an .obcol file')
+    (footer,) = struct.unpack_from('<Q', raw, raw.size - 16)
+    version, ncols, nrows, ngroups, nmeta = struct.unpack_from('<IIQII', raw, footer)
+    if version != 1:
+        raise ValueError(f'{path}: unsupported .obcol version {version}')
+    cursor = footer + struct.calcsize('<IIQII')
+
+    columns = []
+    for _ in range(ncols):
+        encoding, _reserved, length = struct.unpack_from('<BBH', raw, cursor)
+        cursor += 4
+        columns.append((bytes(raw[cursor:cursor + length]).decode(), encoding))
+        cursor += length
+    metadata = {}
+    for _ in range(nmeta):
+        (klen,) = struct.unpack_from('<H', raw, cursor)
+        key = bytes(raw[cursor + 2:cursor + 2 + klen]).decode()
+        cursor += 2 + klen
+        (vlen,) = struct.unpack_from('<I', raw, cursor)
+        metadata[key] = bytes(raw[cursor + 4:cursor + 4 + vlen]).decode()
+        cursor += 4 + vlen
+
+    parts = {name: [] for name, _ in columns}
+    for _ in range(ngroups):
+        (rows,) = struct.unpack_from('<Q', raw, cursor)
+        cursor += 8
+        for name, encoding in columns:
+            offset, length = struct.unpack_from('<QQ', raw, cursor)
+            cursor += 16
+            chunk = raw[offset:offset + length]
+            if encoding == 0:
+                parts[name].append(chunk.view('<f8'))
+            else:
+                parts[name].append(_decode_delta_varint(chunk, rows))
+
+    table = {}
+    for name, encoding in columns:
+        if not parts[name]:
+            table[name] = np.zeros(0, dtype=np.float64 if encoding == 0 else np.int64)
+        elif len(parts[name]) == 1:
+            table[name] = parts[name][0]
+        else:
+            table[name] = np.concatenate(parts[name])
+        if len(table[name]) != nrows:
+            raise ValueError(f'{path}: column {name} has {len(table[name])} rows, expected {nrows}')
+    return table, metadata
+
+
+def read_obcol(path):
+    """Load a .obcol file as a DataFrame (metadata in DataFrame.attrs)"""
+    table, metadata = read_obcol_columns(path)
+    frame = pd.DataFrame(table)
+    frame.attrs.update(metadata)
+    return frame
+
+
+def load_impact(symbol, side):
+    """Impact curve of one side: <SYM>_<side>_impact.obcol if present, else the CSV"""
+    stem = f'{symbol}_{side}_impact'
+    if os.path.exists(stem + '.obcol'):
+        return read_obcol(stem + '.obcol')
+    return pd.read_csv(stem + '.csv')
+
+
 def create_cpp_charts():
-    """Create charts from C++ generated CSV files"""
+    """Create charts from C++ generated result files (.obcol or CSV)"""
     
     symbols = ['CRWV', 'FROG', 'SOUN']
     
@@ -16,9 +111,9 @@ def create_cpp_charts():
     
     for i, symbol in enumerate(symbols):
         try:
-            # Load C++ generated CSV files
-            buy_impact = pd.read_csv(f'{symbol}_buy_impact.csv')
-            sell_impact = pd.read_csv(f'{symbol}_sell_impact.csv')
+            # Load C++ generated result files
+            buy_impact = load_impact(symbol, 'buy')
+            sell_impact = load_impact(symbol, 'sell')
             
             # Plot buy side impact
             axes[0, i].plot(buy_impact['order_size'], buy_impact['impact_bps'], 
@@ -79,8 +174,8 @@ def create_comparison_chart(symbols):
     
     for i, symbol in enumerate(symbols):
         try:
-            buy_impact = pd.read_csv(f'{symbol}_buy_impact.csv')
-            sell_impact = pd.read_csv(f'{symbol}_sell_impact.csv')
+            buy_impact = load_impact(symbol, 'buy')
+            sell_impact = load_impact(symbol, 'sell')
             
             # Buy side comparison
             ax1.plot(buy_impact['order_size'], buy_impact['impact_bps'], 
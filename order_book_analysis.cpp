@@ -17,6 +17,9 @@
  * g_buy(X) = (VWAP_execution - Mid_Price) / Mid_Price
  * g_sell(X) = (Mid_Price - VWAP_execution) / Mid_Price
  * 
+ * Library use: compile with -DORDER_BOOK_ANALYSIS_NO_MAIN to leave out
+ * main() and drive OrderBookAnalyzer or ImpactService directly.
+ * 
  * @author Blockhouse Work Trial Task Implementation
  * @date July 2025
  * @version 1.0
@@ -27,6 +30,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include <numeric>
 #include <sstream>
@@ -34,9 +38,379 @@
 #include <filesystem>
 #include <chrono>
 #include <cmath>
+#include <charconv>
+#include <string_view>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+#include <set>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include <cstdio>
+#include <bitset>
+
+#ifdef ORDER_BOOK_ANALYSIS_ZSTD
+#include <zstd.h>  // .csv.zst / .dbn.zst input (make ZSTD=1)
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ORDER_BOOK_X86_KERNELS 1  ///< AVX2/AVX-512 impact kernels are compiled in
+#endif
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>  // CPU affinity of the --batch node groups
+#endif
 
 namespace fs = std::filesystem;
 
+/// Number of bid/ask levels carried by each MBP-10 row
+constexpr std::size_t kBookLevels = 10;
+/// Column index of bid_px_00 in the Databento MBP-10 CSV schema
+constexpr std::size_t kFirstLevelColumn = 13;
+/// Columns per level: bid_px, ask_px, bid_sz, ask_sz, bid_ct, ask_ct
+constexpr std::size_t kColumnsPerLevel = 6;
+/// Minimum column count for a usable row (up to and including ask_sz_09)
+constexpr std::size_t kMinRowColumns = 71;
+/// Shortest valid MBP-10 CSV row: kMinRowColumns - 1 commas, a newline and one character per best price
+constexpr std::size_t kMinRowBytes = kMinRowColumns + 2;
+/// Rows per impact work unit; fixed so partial sums merge identically for any thread count
+constexpr size_t kImpactChunkRows = 16384;
+/// Target bytes per parse task when a large CSV file is split into line-aligned ranges
+constexpr uint64_t kParseRangeBytes = 1 << 20;
+/// Upper bound on the byte ranges of one file
+constexpr uint64_t kMaxParseRanges = 256;
+/// Decompressed bytes produced per zstd streaming step
+constexpr size_t kDecompressChunkBytes = 1 << 20;
+
+/**
+ * @enum LoaderMode
+ * @brief Selects the CSV ingestion path used by OrderBookAnalyzer::loadData
+ */
+enum class LoaderMode {
+    Stream,  ///< std::getline + split() + std::stod (original path)
+    Mapped   ///< Memory-mapped file parsed in place with std::from_chars
+};
+
+/**
+ * @enum ImpactEngine
+ * @brief Selects how the impact curve g(X) is evaluated
+ */
+enum class ImpactEngine {
+    Reference,        ///< Re-walk every snapshot for each order size
+    CumulativeDepth,  ///< One forward level walk per snapshot for the whole grid
+    Simd,             ///< Branch-free level walk over 4/8 snapshots per vector
+    FixedPoint        ///< Cumulative walk on int64 1e-9 price ticks (exact notional sums)
+};
+
+/**
+ * @enum SamplingMode
+ * @brief Which valid rows of the selected day files are analyzed
+ */
+enum class SamplingMode {
+    Full,            ///< Every valid row
+    Head,            ///< First N valid rows of each file
+    EveryKth,        ///< Every k-th valid row of each file
+    TimeStratified,  ///< One row per each of N equal time bins of each file's session
+    Reservoir        ///< Uniform random sample of N rows per symbol (seeded)
+};
+
+/**
+ * @enum Averaging
+ * @brief How snapshots are weighted in the impact average
+ */
+enum class Averaging {
+    PerSnapshot,  ///< Every valid row counts once (default)
+    TimeWeighted  ///< Distinct consecutive book states weighted by how long they lasted
+};
+
+/**
+ * @enum OutputFormat
+ * @brief File format of the result tables
+ */
+enum class OutputFormat {
+    Csv,       ///< Text CSV (default)
+    Columnar,  ///< Binary .obcol files (ColumnarWriter)
+    Both       ///< CSV and .obcol side by side
+};
+
+/**
+ * @enum PartialFillPolicy
+ * @brief How an order larger than a snapshot's visible depth is priced
+ */
+enum class PartialFillPolicy {
+    Average,     ///< VWAP of the visible shares only (default; understates large orders)
+    Skip,        ///< Leave the snapshot out of that size's average
+    Extrapolate  ///< Fill the remainder on the book continued past its last level
+};
+
+/**
+ * @enum BookFlag
+ * @brief Book conditions flagged by BookQuality::scan(), combined as a bit set
+ */
+enum BookFlag : unsigned {
+    kBookCrossed = 1,  ///< Best bid above best ask
+    kBookLocked = 2,   ///< Best bid equal to best ask
+    kBookStale = 4     ///< ts_event earlier than a preceding row's
+};
+
+/**
+ * @struct IngestSpec
+ * @brief File selection and row sampling applied by the loaders
+ * 
+ * Day files are always taken in sorted (date) order.
+ */
+struct IngestSpec {
+    SamplingMode mode = SamplingMode::Full;  ///< Row sampling strategy
+    size_t count = 0;       ///< N for Head/TimeStratified/Reservoir, k for EveryKth
+    uint64_t seed = 42;     ///< Reservoir sampling seed
+    int max_files = 0;      ///< Day files per symbol (0 = all)
+};
+
+/**
+ * @struct AnalyzerOptions
+ * @brief Runtime configuration for OrderBookAnalyzer
+ */
+struct AnalyzerOptions {
+    LoaderMode loader = LoaderMode::Mapped;           ///< CSV ingestion path
+    IngestSpec ingest;                                ///< File selection and row sampling
+    ImpactEngine engine = ImpactEngine::CumulativeDepth; ///< g(X) evaluation strategy
+    int grid_step = 10;                               ///< Order size spacing (shares)
+    int max_shares = 500;                             ///< Largest order size (shares)
+    int threads = 0;                                  ///< Worker threads (0 = hardware concurrency)
+    bool streaming = false;                           ///< Accumulate while parsing, keep no snapshots
+    Averaging averaging = Averaging::PerSnapshot;     ///< Impact average weighting
+    int bucket_minutes = 0;                           ///< Intraday surface bucket width (0 = no surfaces)
+    bool distribution = false;                        ///< Also estimate per-size std dev and quantiles
+    int schedule_shares = 0;                          ///< Parent order split over the surface buckets (0 = off)
+    double schedule_min_fill = 0.5;                   ///< Share of a bucket's book weight that must fill a child size
+    double live_half_life = 60.0;                     ///< Live estimator decay half-life in seconds (0 = none)
+    int live_rate = 0;                                ///< Replay pacing in updates per second (0 = unpaced)
+    bool use_cache = true;                            ///< Read/write binary snapshot caches
+    std::string cache_dir;                            ///< Cache root (empty = output or user cache folder)
+    std::string metrics_path;                         ///< JSON instrumentation summary (empty = disabled)
+    std::string partials_dir;                         ///< Write per-day partial results here instead of curves
+    int shard_index = 0;                              ///< This worker's shard (with partials_dir)
+    int shard_count = 1;                              ///< Number of shards the day files are split into
+    std::vector<std::string> symbols;                 ///< Symbols to analyze (empty = discover)
+    std::string start_date;                           ///< First day included, "YYYY-MM-DD" (empty = no limit)
+    std::string end_date;                             ///< Last day included, "YYYY-MM-DD" (empty = no limit)
+    std::string output_dir;                           ///< Folder for result CSVs (empty = current directory)
+    int prefetch_mb = 256;                            ///< Read-ahead window of run() in MiB (0 = no prefetching)
+    OutputFormat output_format = OutputFormat::Csv;   ///< Format of impact curves and surfaces
+    bool snapshot_detail = false;                     ///< Write per-snapshot impacts to <SYM>_snapshots.obcol
+    bool piecewise = false;                           ///< Also build the exact breakpoint curves
+    std::vector<int64_t> impact_at;                   ///< Order sizes to evaluate on the exact curves
+    bool batch = false;                               ///< Analyze symbols concurrently, one group per NUMA node
+    int numa_nodes = 0;                               ///< Node groups for batch (0 = one per detected node)
+    unsigned exclude_books = 0;                       ///< BookFlag bits whose rows are dropped after loading
+    PartialFillPolicy partial_fills = PartialFillPolicy::Average; ///< Pricing of sizes beyond the visible depth
+};
+
+/**
+ * @class MappedFile
+ * @brief Read-only memory mapping of an entire file
+ * 
+ * The mapping is released when the object goes out of scope. Empty files
+ * are reported as successfully opened with size() == 0.
+ */
+class MappedFile {
+private:
+    const char* bytes = nullptr;   ///< Start of the mapped region
+    std::size_t length = 0;        ///< Size of the mapped region in bytes
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#endif
+    
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+    
+    /**
+     * @brief Map a file into memory
+     * @param path File to map
+     * @return true if the file was opened and mapped
+     */
+    bool open(const fs::path& path) {
+        close();
+#ifdef _WIN32
+        file_handle = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size)) { close(); return false; }
+        length = static_cast<std::size_t>(file_size.QuadPart);
+        if (length == 0) return true;
+        mapping_handle = CreateFileMappingW(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_handle == nullptr) { close(); return false; }
+        bytes = static_cast<const char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+        if (bytes == nullptr) { close(); return false; }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length > 0) {
+            void* region = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (region == MAP_FAILED) { ::close(fd); length = 0; return false; }
+            madvise(region, length, MADV_SEQUENTIAL);
+            bytes = static_cast<const char*>(region);
+        }
+        ::close(fd);  // The mapping stays valid after the descriptor is closed
+#endif
+        return true;
+    }
+    
+    /**
+     * @brief Release the mapping (safe to call repeatedly)
+     */
+    void close() {
+#ifdef _WIN32
+        if (bytes != nullptr) UnmapViewOfFile(bytes);
+        if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+        if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+        mapping_handle = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (bytes != nullptr) munmap(const_cast<char*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+    
+    const char* data() const { return bytes; }
+    std::size_t size() const { return length; }
+    std::string_view view() const { return std::string_view(bytes, length); }
+};
+
+/**
+ * @brief Parse a decimal field in place
+ * @param field Field text (not null-terminated)
+ * @param value Receives the parsed value
+ * @return true if a number was parsed from the start of the field
+ * 
+ * Mirrors std::stod on the values found in Databento CSVs: leading
+ * characters must form a number, anything after it is ignored.
+ */
+inline bool parseField(std::string_view field, double& value) {
+    auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+    return result.ec == std::errc();
+}
+
+/**
+ * @brief Parse an integer field in place
+ * @param field Field text (not null-terminated)
+ * @param value Receives the parsed value
+ * @return true if an integer was parsed from the start of the field
+ */
+inline bool parseField(std::string_view field, int& value) {
+    auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+    return result.ec == std::errc();
+}
+
+/**
+ * @brief Days since 1970-01-01 for a proleptic Gregorian date
+ * @param y Year
+ * @param m Month (1-12)
+ * @param d Day of month (1-31)
+ * @return Signed day count relative to the Unix epoch
+ */
+constexpr int64_t daysFromCivil(int64_t y, int64_t m, int64_t d) {
+    y -= m <= 2 ? 1 : 0;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const int64_t yoe = y - era * 400;
+    const int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/**
+ * @brief Parse a Databento timestamp into nanoseconds since the Unix epoch
+ * @param text Either integer nanoseconds or ISO-8601 UTC
+ *             ("2025-04-03T13:30:00.123456789Z", fraction optional)
+ * @param ns Receives the timestamp
+ * @return true if the text was recognised
+ */
+inline bool parseTimestamp(std::string_view text, int64_t& ns) {
+    if (text.size() < 19 || text[4] != '-') {
+        auto result = std::from_chars(text.data(), text.data() + text.size(), ns);
+        return result.ec == std::errc();
+    }
+    auto number = [&](size_t pos, size_t len, int64_t& out) {
+        auto result = std::from_chars(text.data() + pos, text.data() + pos + len, out);
+        return result.ec == std::errc() && result.ptr == text.data() + pos + len;
+    };
+    int64_t y, mo, d, h, mi, sec;
+    if (!number(0, 4, y) || !number(5, 2, mo) || !number(8, 2, d) ||
+        !number(11, 2, h) || !number(14, 2, mi) || !number(17, 2, sec)) {
+        return false;
+    }
+    int64_t fraction = 0;
+    size_t digits = 0;
+    if (text.size() > 19 && text[19] == '.') {
+        for (size_t i = 20; i < text.size() && digits < 9 && text[i] >= '0' && text[i] <= '9'; ++i, ++digits) {
+            fraction = fraction * 10 + (text[i] - '0');
+        }
+    }
+    for (; digits < 9; ++digits) fraction *= 10;
+    ns = (((daysFromCivil(y, mo, d) * 24 + h) * 60 + mi) * 60 + sec) * 1000000000LL + fraction;
+    return true;
+}
+
+/**
+ * @brief Split one CSV row into its leading fields without copying
+ * @param line Row text without the trailing newline
+ * @param fields Receives views of the first N fields
+ * @return Number of fields found, capped at N
+ * 
+ * Follows the token count of split(): a trailing delimiter does not
+ * produce an extra empty field and an empty line has no fields.
+ */
+template <std::size_t N>
+std::size_t splitFields(std::string_view line, std::array<std::string_view, N>& fields) {
+    if (line.empty()) return 0;
+    std::size_t count = 0;
+    std::size_t start = 0;
+    while (count < N) {
+        std::size_t comma = line.find(',', start);
+        if (comma == std::string_view::npos) {
+            fields[count++] = line.substr(start);
+            break;
+        }
+        fields[count++] = line.substr(start, comma - start);
+        start = comma + 1;
+        if (start == line.size()) break;
+    }
+    return count;
+}
+
 /**
  * @struct OrderBookLevel
  * @brief Represents a single price level in the order book
@@ -67,7 +441,6 @@ struct OrderBookLevel {
  */
 struct OrderBookSnapshot {
     std::string timestamp;                        ///< Event timestamp from data
-    std::string date;                            ///< Date extracted from filename
     std::vector<OrderBookLevel> bids;            ///< Bid levels (sorted high to low)
     std::vector<OrderBookLevel> asks;            ///< Ask levels (sorted low to high)
     
@@ -120,456 +493,8346 @@ struct OrderBookSnapshot {
     }
 };
 
-/**
- * @struct ImpactResult
- * @brief Stores the results of temporary impact analysis for a specific order size
- */
-struct ImpactResult {
-    int order_size;      ///< Order size in shares
-    double avg_impact;   ///< Average impact as decimal (e.g., 0.001 = 0.1%)
-    double impact_bps;   ///< Average impact in basis points (e.g., 10.0 = 10 bps)
-};
+struct BookQuality;
 
 /**
- * @class OrderBookAnalyzer
- * @brief Main class for analyzing temporary price impact using order book data
- * 
- * This class implements a comprehensive analysis framework for calculating
- * temporary price impact functions g_s(X) using real market microstructure data.
- * It processes MBP-10 format CSV files and simulates order execution to
- * determine realistic market impact across different order sizes.
+ * @class SnapshotStore
+ * @brief Columnar (structure-of-arrays) storage for order book snapshots
  * 
- * Features:
- * - Loads and parses MBP-10 format order book data
- * - Calculates VWAP-based temporary impact functions
- * - Supports multiple symbols and large datasets
- * - Generates detailed impact analysis results
+ * Row i occupies elements [i * kBookLevels, (i + 1) * kBookLevels) of each
+ * price/size column, so a full book walk touches contiguous memory and a
+ * symbol-month of data costs a handful of large allocations instead of
+ * several small ones per snapshot. Dates are interned once per file and
+ * referenced by a 16-bit day index.
  * 
- * Usage:
- * @code
- * OrderBookAnalyzer analyzer(".");
- * analyzer.analyzeAllSymbols();
- * @endcode
+ * quality holds the loader's BookQuality scan of the rows; every method
+ * that adds or removes rows drops it, so a present scan always describes
+ * the current rows. Code writing the level columns of existing rows must
+ * reset it too.
  */
-class OrderBookAnalyzer {
-private:
-    std::string data_folder;                                        ///< Root folder containing symbol data
-    std::vector<std::string> symbols = {"CRWV", "FROG", "SOUN"};   ///< Symbols to analyze
-    std::map<std::string, std::vector<OrderBookSnapshot>> data;    ///< Loaded order book data
-    
+class SnapshotStore {
 public:
+    std::vector<double> bid_px;    ///< Bid prices, N x kBookLevels
+    std::vector<double> ask_px;    ///< Ask prices, N x kBookLevels
+    std::vector<int> bid_sz;       ///< Bid sizes, N x kBookLevels
+    std::vector<int> ask_sz;       ///< Ask sizes, N x kBookLevels
+    std::vector<int64_t> ts_ns;    ///< Event timestamps (ts_event), nanoseconds since epoch
+    std::vector<uint16_t> day;     ///< Index into days for each row
+    std::vector<std::string> days; ///< Interned dates ("YYYY-MM-DD")
+    std::vector<double> weight;    ///< Optional row weights in seconds; empty = every row weighs 1
+    std::shared_ptr<const BookQuality> quality;  ///< Scan of the rows (null = not scanned, or rows changed)
+    
+    size_t size() const { return ts_ns.size(); }
+    bool empty() const { return ts_ns.empty(); }
+    double rowWeight(size_t row) const { return weight.empty() ? 1.0 : weight[row]; }
+    
     /**
-     * @brief Constructor
-     * @param folder Root folder containing symbol subdirectories with CSV files
+     * @brief Reserve capacity for a number of rows
+     * @param rows Expected row count
      */
-    explicit OrderBookAnalyzer(const std::string& folder) : data_folder(folder) {}
+    void reserve(size_t rows) {
+        bid_px.reserve(rows * kBookLevels);
+        ask_px.reserve(rows * kBookLevels);
+        bid_sz.reserve(rows * kBookLevels);
+        ask_sz.reserve(rows * kBookLevels);
+        ts_ns.reserve(rows);
+        day.reserve(rows);
+    }
     
     /**
-     * @brief Utility function to split strings by delimiter
-     * @param str Input string to split
-     * @param delimiter Character to split on
-     * @return Vector of string tokens
+     * @brief Intern a date string
+     * @param date Date label (taken from the file name)
+     * @return Day index to store with each row of that date
      */
-    std::vector<std::string> split(const std::string& str, char delimiter) {
-        std::vector<std::string> tokens;
-        std::stringstream ss(str);
-        std::string token;
-        while (std::getline(ss, token, delimiter)) {
-            tokens.push_back(token);
-        }
-        return tokens;
+    uint16_t addDay(const std::string& date) {
+        auto it = std::find(days.begin(), days.end(), date);
+        if (it != days.end()) return static_cast<uint16_t>(it - days.begin());
+        days.push_back(date);
+        return static_cast<uint16_t>(days.size() - 1);
     }
     
     /**
-     * @brief Load order book data for a specific symbol
-     * @param symbol Stock symbol (e.g., "CRWV", "FROG", "SOUN")
-     * @param max_files Maximum number of CSV files to load per symbol
-     * @return true if data was successfully loaded, false otherwise
+     * @brief Append a zero-filled row to be written in place
+     * @param timestamp Row timestamp in nanoseconds
+     * @param day_index Interned day index
+     * @return Index of the new row
      * 
-     * This function loads MBP-10 format CSV files from the symbol's subdirectory.
-     * Each file contains order book snapshots with 10 levels of bid/ask data.
-     * The function parses the CSV according to Databento MBP-10 schema.
+     * The weight column is left alone; code building a weighted store
+     * pushes the row's weight itself.
      */
-    bool loadData(const std::string& symbol, int max_files = 3) {
-        std::cout << "Loading data for " << symbol << "..." << std::endl;
-        
-        std::string symbol_folder = data_folder + "/" + symbol;
-        std::vector<OrderBookSnapshot> snapshots;
-        
-        int files_loaded = 0;
-        for (const auto& entry : fs::directory_iterator(symbol_folder)) {
-            if (files_loaded >= max_files) break;
-            
-            if (entry.path().extension() == ".csv") {
-                std::cout << "  Loading file: " << entry.path().filename() << std::endl;
-                
-                std::ifstream file(entry.path());
-                if (!file.is_open()) continue;
-                
-                std::string line;
-                std::getline(file, line); // Skip header
-                
-                int rows_loaded = 0;
-                while (std::getline(file, line) && rows_loaded < 10000) { // Limit rows per file
-                    auto tokens = split(line, ',');
-                    if (tokens.size() < 71U) continue; // Need at least 71 columns for bid_sz_09/ask_sz_09
-                    
-                    OrderBookSnapshot snapshot;
-                    snapshot.timestamp = tokens[0];
-                    
-                    // Extract date from filename
-                    std::string filename = entry.path().filename().string();
-                    size_t pos = filename.find('_');
-                    if (pos != std::string::npos) {
-                        snapshot.date = filename.substr(pos + 1, 10);
-                    }
-                    
-                    // Initialize with 10 levels each
-                    snapshot.bids.resize(10);
-                    snapshot.asks.resize(10);
-                    
-                    try {
-                        // Parse bid and ask levels based on actual CSV structure
-                        // MBP-10 Pattern: bid_px_XX at 13+6*i, ask_px_XX at 14+6*i, bid_sz_XX at 15+6*i, ask_sz_XX at 16+6*i
-                        for (int i = 0; i < 10; ++i) {
-                            // Calculate column indices for this level
-                            size_t bid_px_col = static_cast<size_t>(13 + (6 * i));  // bid_px_00 at 13, bid_px_01 at 19, etc.
-                            size_t ask_px_col = static_cast<size_t>(14 + (6 * i));  // ask_px_00 at 14, ask_px_01 at 20, etc.
-                            size_t bid_sz_col = static_cast<size_t>(15 + (6 * i));  // bid_sz_00 at 15, bid_sz_01 at 21, etc.
-                            size_t ask_sz_col = static_cast<size_t>(16 + (6 * i));  // ask_sz_00 at 16, ask_sz_01 at 22, etc.
-                            
-                            // Parse bid price and size (with bounds checking)
-                            if (bid_px_col < tokens.size() && !tokens[bid_px_col].empty()) {
-                                snapshot.bids[static_cast<size_t>(i)].price = std::stod(tokens[bid_px_col]);
-                            }
-                            if (bid_sz_col < tokens.size() && !tokens[bid_sz_col].empty()) {
-                                snapshot.bids[static_cast<size_t>(i)].size = std::stoi(tokens[bid_sz_col]);
-                            }
-                            
-                            // Parse ask price and size (with bounds checking)
-                            if (ask_px_col < tokens.size() && !tokens[ask_px_col].empty()) {
-                                snapshot.asks[static_cast<size_t>(i)].price = std::stod(tokens[ask_px_col]);
-                            }
-                            if (ask_sz_col < tokens.size() && !tokens[ask_sz_col].empty()) {
-                                snapshot.asks[static_cast<size_t>(i)].size = std::stoi(tokens[ask_sz_col]);
-                            }
-                        }
-                        
-                        // Only add if we have valid best bid and ask
-                        if (snapshot.bids[0].price > 0 && snapshot.asks[0].price > 0) {
-                            snapshots.push_back(snapshot);
-                            rows_loaded++;
-                        }
-                    } catch (const std::exception& e) {
-                        // Skip invalid rows
-                        continue;
-                    }
-                }
-                
-                files_loaded++;
-                std::cout << "    Loaded " << rows_loaded << " valid snapshots" << std::endl;
-            }
-        }
-        
-        if (!snapshots.empty()) {
-            data[symbol] = std::move(snapshots);
-            std::cout << "Total snapshots for " << symbol << ": " << data[symbol].size() << std::endl;
-            return true;
-        }
-        
-        return false;
+    size_t addRow(int64_t timestamp, uint16_t day_index) {
+        quality.reset();
+        bid_px.resize(bid_px.size() + kBookLevels, 0.0);
+        ask_px.resize(ask_px.size() + kBookLevels, 0.0);
+        bid_sz.resize(bid_sz.size() + kBookLevels, 0);
+        ask_sz.resize(ask_sz.size() + kBookLevels, 0);
+        ts_ns.push_back(timestamp);
+        day.push_back(day_index);
+        return ts_ns.size() - 1;
     }
+    
     /**
-     * @brief Calculate temporary price impact function g_s(X) for given order book data
-     * @param snapshots Vector of order book snapshots to analyze
-     * @param side Order side: "buy" for buy orders, "sell" for sell orders
-     * @param max_shares Maximum order size to analyze (in shares)
-     * @return Vector of ImpactResult containing impact analysis for each order size
-     * 
-     * This function implements the core temporary impact calculation using VWAP simulation.
-     * For each order size from 10 to max_shares (in steps of 10), it simulates order
-     * execution by walking through order book levels and calculating the volume-weighted
-     * average price (VWAP) achieved.
-     * 
-     * Mathematical Model:
-     * - Buy orders: g_buy(X) = (VWAP_execution - Mid_Price) / Mid_Price
-     * - Sell orders: g_sell(X) = (Mid_Price - VWAP_execution) / Mid_Price
-     * 
-     * The algorithm:
-     * 1. For each order size X
-     * 2. For each order book snapshot
-     * 3. Simulate order execution by consuming liquidity level by level
-     * 4. Calculate VWAP and compare to mid-price
-     * 5. Average impact across all snapshots
+     * @brief Remove the last row (used when a row fails validation)
      */
-    std::vector<ImpactResult> calculateTemporaryImpact(
-        const std::vector<OrderBookSnapshot>& snapshots, 
-        const std::string& side, 
-        int max_shares = 500) {
-        
-        std::cout << "Calculating " << side << " side temporary impact..." << std::endl;
-        
-        std::vector<ImpactResult> results;
-        
-        // Analyze impact for order sizes from 10 to max_shares in steps of 10
-        for (int order_size = 10; order_size <= max_shares; order_size += 10) {
-            std::vector<double> impacts;
-            
-            // Calculate impact for this order size across all snapshots
-            for (const auto& snapshot : snapshots) {
-                double mid_price = snapshot.getMidPrice();
-                if (mid_price <= 0) continue;  // Skip invalid snapshots
-                
-                double total_cost = 0.0;
-                int total_shares = 0;
-                int remaining = order_size;
-                
-                if (side == "buy") {
-                    // For buy orders, walk through ask levels (consume ask-side liquidity)
-                    for (const auto& level : snapshot.asks) {
-                        if (remaining <= 0 || level.price <= 0 || level.size <= 0) break;
-                        
-                        int take = std::min(remaining, level.size);
-                        total_cost += static_cast<double>(take) * level.price;
-                        total_shares += take;
-                        remaining -= take;
-                    }
-                } else {
-                    // For sell orders, walk through bid levels (consume bid-side liquidity)
-                    for (const auto& level : snapshot.bids) {
-                        if (remaining <= 0 || level.price <= 0 || level.size <= 0) break;
-                        
-                        int take = std::min(remaining, level.size);
-                        total_cost += static_cast<double>(take) * level.price;
-                        total_shares += take;
-                        remaining -= take;
-                    }
-                }
-                
-                // Calculate VWAP and impact if we executed any shares
-                if (total_shares > 0) {
-                    double avg_price = total_cost / static_cast<double>(total_shares);
-                    double impact;
-                    
-                    // Calculate impact based on order side
-                    if (side == "buy") {
-                        // Buy impact: how much more expensive than mid-price
-                        impact = (avg_price - mid_price) / mid_price;
-                    } else {
-                        // Sell impact: how much cheaper than mid-price  
-                        impact = (mid_price - avg_price) / mid_price;
-                    }
-                    
-                    impacts.push_back(impact);
-                }
+    void popRow() {
+        quality.reset();
+        if (!weight.empty() && weight.size() == size()) weight.pop_back();
+        bid_px.resize(bid_px.size() - kBookLevels);
+        ask_px.resize(ask_px.size() - kBookLevels);
+        bid_sz.resize(bid_sz.size() - kBookLevels);
+        ask_sz.resize(ask_sz.size() - kBookLevels);
+        ts_ns.pop_back();
+        day.pop_back();
+    }
+    
+    /**
+     * @brief Append a row-oriented snapshot
+     * @param snapshot Snapshot to copy (at most kBookLevels levels per side)
+     * @param day_index Interned day index
+     */
+    void append(const OrderBookSnapshot& snapshot, uint16_t day_index) {
+        int64_t timestamp = 0;
+        parseTimestamp(snapshot.timestamp, timestamp);
+        size_t row = addRow(timestamp, day_index);
+        for (size_t i = 0; i < kBookLevels; ++i) {
+            if (i < snapshot.bids.size()) {
+                bid_px[row * kBookLevels + i] = snapshot.bids[i].price;
+                bid_sz[row * kBookLevels + i] = snapshot.bids[i].size;
             }
-            
-            // Calculate average impact for this order size
-            if (!impacts.empty()) {
-                double avg_impact = std::accumulate(impacts.begin(), impacts.end(), 0.0) / static_cast<double>(impacts.size());
-                results.push_back({
-                    order_size,
-                    avg_impact,
-                    avg_impact * 10000.0  // Convert to basis points
-                });
+            if (i < snapshot.asks.size()) {
+                ask_px[row * kBookLevels + i] = snapshot.asks[i].price;
+                ask_sz[row * kBookLevels + i] = snapshot.asks[i].size;
             }
         }
-        
-        return results;
     }
     
     /**
-     * @brief Analyze a single symbol and generate complete impact analysis
-     * @param symbol Stock symbol to analyze (e.g., "CRWV", "FROG", "SOUN")
-     * 
-     * This function performs a complete analysis of temporary price impact for
-     * a single symbol. It loads the data, calculates impact functions for both
-     * buy and sell orders, generates statistics, and saves results to CSV files.
-     * 
-     * Output includes:
-     * - Basic market statistics (mid-price, spread, depth)
-     * - Buy-side impact analysis
-     * - Sell-side impact analysis
-     * - Sample results display
-     * - CSV files for detailed analysis
+     * @brief Append all rows of another store, re-interning its dates
+     * @param other Store to copy from
      */
-    void analyzeSymbol(const std::string& symbol) {
-        std::cout << "\n=== Analyzing " << symbol << " ===" << std::endl;
-        
+    void appendStore(const SnapshotStore& other) {
+        std::vector<uint16_t> remap(other.days.size());
+        for (size_t d = 0; d < other.days.size(); ++d) remap[d] = addDay(other.days[d]);
+        quality.reset();
+        bid_px.insert(bid_px.end(), other.bid_px.begin(), other.bid_px.end());
+        ask_px.insert(ask_px.end(), other.ask_px.begin(), other.ask_px.end());
+        bid_sz.insert(bid_sz.end(), other.bid_sz.begin(), other.bid_sz.end());
+        ask_sz.insert(ask_sz.end(), other.ask_sz.begin(), other.ask_sz.end());
+        if (!weight.empty() || !other.weight.empty()) {
+            weight.resize(size(), 1.0);
+            weight.insert(weight.end(), other.weight.begin(), other.weight.end());
+            weight.resize(size() + other.size(), 1.0);
+        }
+        ts_ns.insert(ts_ns.end(), other.ts_ns.begin(), other.ts_ns.end());
+        for (uint16_t d : other.day) day.push_back(remap[d]);
+    }
+    
+    /**
+     * @brief Append a copy of one row of another store
+     * @param other Source store
+     * @param row Source row
+     * @param day_index Day index of the copy in this store
+     * @return Index of the new row
+     */
+    size_t copyRow(const SnapshotStore& other, size_t row, uint16_t day_index) {
+        size_t out = addRow(other.ts_ns[row], day_index);
+        std::copy_n(other.bidPrices(row), kBookLevels, bid_px.begin() + out * kBookLevels);
+        std::copy_n(other.askPrices(row), kBookLevels, ask_px.begin() + out * kBookLevels);
+        std::copy_n(other.bidSizes(row), kBookLevels, bid_sz.begin() + out * kBookLevels);
+        std::copy_n(other.askSizes(row), kBookLevels, ask_sz.begin() + out * kBookLevels);
+        return out;
+    }
+    
+    /**
+     * @brief True if two rows have the same prices and sizes on every level
+     */
+    static bool sameBook(const SnapshotStore& a, size_t row_a, const SnapshotStore& b, size_t row_b) {
+        return std::equal(a.bidPrices(row_a), a.bidPrices(row_a) + kBookLevels, b.bidPrices(row_b)) &&
+               std::equal(a.askPrices(row_a), a.askPrices(row_a) + kBookLevels, b.askPrices(row_b)) &&
+               std::equal(a.bidSizes(row_a), a.bidSizes(row_a) + kBookLevels, b.bidSizes(row_b)) &&
+               std::equal(a.askSizes(row_a), a.askSizes(row_a) + kBookLevels, b.askSizes(row_b));
+    }
+    
+    const double* bidPrices(size_t row) const { return bid_px.data() + row * kBookLevels; }
+    const double* askPrices(size_t row) const { return ask_px.data() + row * kBookLevels; }
+    const int* bidSizes(size_t row) const { return bid_sz.data() + row * kBookLevels; }
+    const int* askSizes(size_t row) const { return ask_sz.data() + row * kBookLevels; }
+    
+    /**
+     * @brief Mid-price of a row
+     * @return Mid-price in dollars, 0.0 if invalid data
+     */
+    double midPrice(size_t row) const {
+        double bid = bid_px[row * kBookLevels];
+        double ask = ask_px[row * kBookLevels];
+        return (bid > 0 && ask > 0) ? (bid + ask) / 2.0 : 0.0;
+    }
+    
+    /**
+     * @brief Bid-ask spread of a row
+     * @return Spread in dollars, 0.0 if invalid data
+     */
+    double spread(size_t row) const {
+        double bid = bid_px[row * kBookLevels];
+        double ask = ask_px[row * kBookLevels];
+        return (bid > 0 && ask > 0) ? ask - bid : 0.0;
+    }
+    
+    /**
+     * @brief Total size over all bid levels of a row
+     */
+    int64_t totalBidDepth(size_t row) const {
+        const int* sizes = bidSizes(row);
+        return std::accumulate(sizes, sizes + kBookLevels, int64_t{0});
+    }
+    
+    /**
+     * @brief Total size over all ask levels of a row
+     */
+    int64_t totalAskDepth(size_t row) const {
+        const int* sizes = askSizes(row);
+        return std::accumulate(sizes, sizes + kBookLevels, int64_t{0});
+    }
+    
+    /**
+     * @brief Keep only the given rows, compacting in place
+     * @param rows Ascending row indices to keep
+     */
+    void keepRows(const std::vector<size_t>& rows) {
+        quality.reset();
+        size_t out = 0;
+        for (size_t row : rows) {
+            if (row != out) {
+                std::copy_n(bid_px.begin() + row * kBookLevels, kBookLevels, bid_px.begin() + out * kBookLevels);
+                std::copy_n(ask_px.begin() + row * kBookLevels, kBookLevels, ask_px.begin() + out * kBookLevels);
+                std::copy_n(bid_sz.begin() + row * kBookLevels, kBookLevels, bid_sz.begin() + out * kBookLevels);
+                std::copy_n(ask_sz.begin() + row * kBookLevels, kBookLevels, ask_sz.begin() + out * kBookLevels);
+                ts_ns[out] = ts_ns[row];
+                day[out] = day[row];
+                if (!weight.empty()) weight[out] = weight[row];
+            }
+            ++out;
+        }
+        truncate(out);
+    }
+    
+    /**
+     * @brief Drop all rows, keeping interned days and allocated capacity
+     */
+    void clearRows() { truncate(0); }
+    
+    /**
+     * @brief Keep only the first rows
+     * @param rows Maximum number of rows to keep
+     */
+    void truncate(size_t rows) {
+        if (rows >= size()) return;
+        quality.reset();
+        bid_px.resize(rows * kBookLevels);
+        ask_px.resize(rows * kBookLevels);
+        bid_sz.resize(rows * kBookLevels);
+        ask_sz.resize(rows * kBookLevels);
+        ts_ns.resize(rows);
+        day.resize(rows);
+        if (!weight.empty()) weight.resize(rows);
+    }
+    
+    /**
+     * @brief Approximate heap footprint of the stored rows
+     * @return Bytes used by the column vectors (excluding spare capacity)
+     */
+    size_t memoryBytes() const {
+        return size() * (kBookLevels * (2 * sizeof(double) + 2 * sizeof(int)) + sizeof(int64_t) + sizeof(uint16_t)) +
+               weight.size() * sizeof(double);
+    }
+};
+
+/**
+ * @struct BookQuality
+ * @brief Per-row condition bitmasks and visible depth of a SnapshotStore
+ * 
+ * Built by one scan() of each day file after loading and kept with the
+ * store (SnapshotStore::quality), so the screen and the impact engines
+ * test a bit or read a depth instead of re-walking the levels for every
+ * order size. Bit r of a mask is bit r % 64 of word r / 64. A side's
+ * visible levels are those before its first level with a non-positive
+ * price or size, as in the impact walks. Rows without a positive best bid
+ * and ask are never flagged crossed or locked; the engines skip them
+ * anyway. A row is stale if an earlier row of the same day has a later
+ * ts_event, whether the day is scanned whole or in streamed batches.
+ */
+struct BookQuality {
+    std::vector<uint64_t> crossed;    ///< Best bid above best ask
+    std::vector<uint64_t> locked;     ///< Best bid equal to best ask
+    std::vector<uint64_t> stale;      ///< ts_event earlier than a preceding row's of the same day
+    std::vector<uint8_t> bid_levels;  ///< Visible bid levels
+    std::vector<uint8_t> ask_levels;  ///< Visible ask levels
+    std::vector<int64_t> bid_depth;   ///< Shares on the visible bid levels
+    std::vector<int64_t> ask_depth;   ///< Shares on the visible ask levels
+    
+    /**
+     * @struct Counts
+     * @brief Flagged rows per condition, and rows dropped by a screen
+     */
+    struct Counts {
+        uint64_t crossed = 0;
+        uint64_t locked = 0;
+        uint64_t stale = 0;
+        uint64_t excluded = 0;
+        
+        void merge(const Counts& other) {
+            crossed += other.crossed;
+            locked += other.locked;
+            stale += other.stale;
+            excluded += other.excluded;
+        }
+    };
+    
+    /**
+     * @struct Clock
+     * @brief Stale-detection state carried from one scanned batch to the next
+     */
+    struct Clock {
+        int64_t latest_ts = std::numeric_limits<int64_t>::min();  ///< Latest ts_event of the day so far
+        int day = -1;                                             ///< Day index of latest_ts (-1 = none yet)
+    };
+    
+    size_t rows() const { return bid_levels.size(); }
+    
+    /**
+     * @brief Flag and measure every row of a store
+     * @param store Rows to scan
+     * @param clock Stale state before the first row; updated, so the
+     *        batches of one store (same day indices) are scanned with
+     *        their history
+     * 
+     * The depth loop is branch-free (a running "still visible" mask over
+     * the fixed level count) and the flags are built 64 rows per word, so
+     * the compiler can unroll and vectorize both without per-row branches.
+     */
+    void scan(const SnapshotStore& store, Clock& clock) {
+        const size_t rows = store.size();
+        const size_t words = (rows + 63) / 64;
+        crossed.assign(words, 0);
+        locked.assign(words, 0);
+        stale.assign(words, 0);
+        bid_levels.resize(rows);
+        ask_levels.resize(rows);
+        bid_depth.resize(rows);
+        ask_depth.resize(rows);
+        
+        for (size_t row = 0; row < rows; ++row) {
+            const double* bid_prices = store.bidPrices(row);
+            const double* ask_prices = store.askPrices(row);
+            const int* bid_sizes = store.bidSizes(row);
+            const int* ask_sizes = store.askSizes(row);
+            int bid_open = 1, ask_open = 1;
+            int bids = 0, asks = 0;
+            int64_t bid_shares = 0, ask_shares = 0;
+            for (size_t i = 0; i < kBookLevels; ++i) {
+                bid_open &= (bid_prices[i] > 0) & (bid_sizes[i] > 0);
+                ask_open &= (ask_prices[i] > 0) & (ask_sizes[i] > 0);
+                bids += bid_open;
+                asks += ask_open;
+                bid_shares += bid_open * static_cast<int64_t>(bid_sizes[i]);
+                ask_shares += ask_open * static_cast<int64_t>(ask_sizes[i]);
+            }
+            bid_levels[row] = static_cast<uint8_t>(bids);
+            ask_levels[row] = static_cast<uint8_t>(asks);
+            bid_depth[row] = bid_shares;
+            ask_depth[row] = ask_shares;
+        }
+        
+        for (size_t w = 0; w < words; ++w) {
+            const size_t first = w * 64;
+            const size_t last = std::min(rows, first + 64);
+            uint64_t crossed_bits = 0, locked_bits = 0, stale_bits = 0;
+            for (size_t row = first; row < last; ++row) {
+                const double bid = store.bid_px[row * kBookLevels];
+                const double ask = store.ask_px[row * kBookLevels];
+                const uint64_t valid = (bid > 0) & (ask > 0);
+                const uint64_t shift = row - first;
+                crossed_bits |= (valid & (bid > ask)) << shift;
+                locked_bits |= (valid & (bid == ask)) << shift;
+                if (store.day[row] != clock.day) clock = Clock{std::numeric_limits<int64_t>::min(), store.day[row]};
+                stale_bits |= static_cast<uint64_t>(store.ts_ns[row] < clock.latest_ts) << shift;
+                clock.latest_ts = std::max(clock.latest_ts, store.ts_ns[row]);
+            }
+            crossed[w] = crossed_bits;
+            locked[w] = locked_bits;
+            stale[w] = stale_bits;
+        }
+    }
+    
+    /**
+     * @brief Scan a store on its own (its first row starts a day)
+     */
+    void scan(const SnapshotStore& store) {
+        Clock clock;
+        scan(store, clock);
+    }
+    
+    /**
+     * @brief Append the scan of the rows appended after this scan's rows
+     * 
+     * Exact for stores scanned per day file, as the loaders do.
+     */
+    void append(const BookQuality& other) {
+        const size_t offset = rows();
+        const size_t total = offset + other.rows();
+        for (auto* mask : {&crossed, &locked, &stale}) mask->resize((total + 63) / 64, 0);
+        for (size_t w = 0; w < other.crossed.size(); ++w) {
+            const size_t first = offset + w * 64;
+            const size_t word = first / 64;
+            const size_t shift = first % 64;
+            const std::vector<uint64_t>* from[] = {&other.crossed, &other.locked, &other.stale};
+            std::vector<uint64_t>* to[] = {&crossed, &locked, &stale};
+            for (size_t m = 0; m < 3; ++m) {
+                const uint64_t bits = (*from[m])[w];
+                (*to[m])[word] |= bits << shift;
+                if (shift && word + 1 < to[m]->size()) (*to[m])[word + 1] |= bits >> (64 - shift);
+            }
+        }
+        bid_levels.insert(bid_levels.end(), other.bid_levels.begin(), other.bid_levels.end());
+        ask_levels.insert(ask_levels.end(), other.ask_levels.begin(), other.ask_levels.end());
+        bid_depth.insert(bid_depth.end(), other.bid_depth.begin(), other.bid_depth.end());
+        ask_depth.insert(ask_depth.end(), other.ask_depth.begin(), other.ask_depth.end());
+    }
+    
+    /**
+     * @brief Scan of the given rows, for a store compacted with SnapshotStore::keepRows()
+     * @param keep Ascending row indices
+     */
+    BookQuality subset(const std::vector<size_t>& keep) const {
+        BookQuality out;
+        const size_t words = (keep.size() + 63) / 64;
+        out.crossed.assign(words, 0);
+        out.locked.assign(words, 0);
+        out.stale.assign(words, 0);
+        out.bid_levels.reserve(keep.size());
+        out.ask_levels.reserve(keep.size());
+        out.bid_depth.reserve(keep.size());
+        out.ask_depth.reserve(keep.size());
+        for (size_t i = 0; i < keep.size(); ++i) {
+            const size_t row = keep[i];
+            out.crossed[i / 64] |= static_cast<uint64_t>(test(crossed, row)) << (i % 64);
+            out.locked[i / 64] |= static_cast<uint64_t>(test(locked, row)) << (i % 64);
+            out.stale[i / 64] |= static_cast<uint64_t>(test(stale, row)) << (i % 64);
+            out.bid_levels.push_back(bid_levels[row]);
+            out.ask_levels.push_back(ask_levels[row]);
+            out.bid_depth.push_back(bid_depth[row]);
+            out.ask_depth.push_back(ask_depth[row]);
+        }
+        return out;
+    }
+    
+    static bool test(const std::vector<uint64_t>& mask, size_t row) {
+        return (mask[row / 64] >> (row % 64)) & 1;
+    }
+    
+    static uint64_t count(const std::vector<uint64_t>& mask) {
+        uint64_t total = 0;
+        for (uint64_t word : mask) total += static_cast<uint64_t>(std::bitset<64>(word).count());
+        return total;
+    }
+    
+    /**
+     * @brief Number of flagged rows per condition (excluded is left at 0)
+     */
+    Counts counts() const {
+        Counts out;
+        out.crossed = count(crossed);
+        out.locked = count(locked);
+        out.stale = count(stale);
+        return out;
+    }
+    
+    /**
+     * @brief Rows carrying none of the given conditions
+     * @param flags BookFlag bits
+     * @param rows Store size the masks were built for
+     * @return Ascending row indices, for SnapshotStore::keepRows()
+     */
+    std::vector<size_t> rowsWithout(unsigned flags, size_t rows) const {
+        std::vector<size_t> keep;
+        keep.reserve(rows);
+        for (size_t w = 0; w * 64 < rows; ++w) {
+            uint64_t drop = 0;
+            if (flags & kBookCrossed) drop |= crossed[w];
+            if (flags & kBookLocked) drop |= locked[w];
+            if (flags & kBookStale) drop |= stale[w];
+            const size_t last = std::min(rows, w * 64 + 64);
+            for (size_t row = w * 64; row < last; ++row) {
+                if (!((drop >> (row % 64)) & 1)) keep.push_back(row);
+            }
+        }
+        return keep;
+    }
+};
+
+/**
+ * @brief The store's BookQuality scan, made (and kept with the store) on first use
+ */
+inline const BookQuality& qualityOf(SnapshotStore& store) {
+    if (!store.quality) {
+        auto quality = std::make_shared<BookQuality>();
+        quality->scan(store);
+        store.quality = std::move(quality);
+    }
+    return *store.quality;
+}
+
+/**
+ * @brief SnapshotStore::keepRows() that carries a present scan over to the kept rows
+ */
+inline void keepScannedRows(SnapshotStore& store, const std::vector<size_t>& keep) {
+    const std::shared_ptr<const BookQuality> quality = store.quality;
+    store.keepRows(keep);
+    if (quality) store.quality = std::make_shared<BookQuality>(quality->subset(keep));
+}
+
+/**
+ * @struct PriceTraits
+ * @brief Arithmetic of a price representation
+ * 
+ * Notional is the type of size x price sums; Mid2 holds bid + ask, i.e.
+ * twice the mid price, which is exact for tick prices.
+ */
+template <typename PriceT>
+struct PriceTraits;
+
+template <>
+struct PriceTraits<double> {
+    using Notional = double;
+    static double fromDollars(double price) { return price; }
+    static double toDollars(double value) { return value; }
+};
+
+template <>
+struct PriceTraits<int64_t> {
+    using Notional = int64_t;
+    static constexpr double kTicksPerDollar = 1e9;  ///< Databento fixed-point scale
+    static int64_t fromDollars(double price) { return std::llround(price * kTicksPerDollar); }
+    static double toDollars(int64_t ticks) { return static_cast<double>(ticks) / kTicksPerDollar; }
+};
+
+/**
+ * @struct FixedDepthSnapshot
+ * @brief Book snapshot with a compile-time level count and price type
+ * @tparam Levels Levels per side; loops over it unroll
+ * @tparam PriceT double dollars or int64_t 1e-9 ticks
+ * 
+ * Row-oriented counterpart of OrderBookSnapshot without heap storage:
+ * with Levels = 10 and int64 ticks a snapshot is 248 bytes, against about
+ * 400 bytes (plus two allocations) for the vector-based snapshot.
+ */
+template <size_t Levels, typename PriceT>
+struct FixedDepthSnapshot {
+    static constexpr size_t kLevels = Levels;
+    using Traits = PriceTraits<PriceT>;
+    
+    int64_t ts_ns = 0;                    ///< Timestamp, nanoseconds since epoch
+    std::array<PriceT, Levels> bid_px{};  ///< Bid prices, best first
+    std::array<PriceT, Levels> ask_px{};  ///< Ask prices, best first
+    std::array<int32_t, Levels> bid_sz{}; ///< Bid sizes
+    std::array<int32_t, Levels> ask_sz{}; ///< Ask sizes
+    
+    /**
+     * @brief Copy the first Levels levels of a store row
+     */
+    static FixedDepthSnapshot fromStore(const SnapshotStore& store, size_t row) {
+        static_assert(Levels <= kBookLevels, "store holds kBookLevels levels");
+        FixedDepthSnapshot snapshot;
+        snapshot.ts_ns = store.ts_ns[row];
+        const double* bids = store.bidPrices(row);
+        const double* asks = store.askPrices(row);
+        for (size_t i = 0; i < Levels; ++i) {
+            snapshot.bid_px[i] = Traits::fromDollars(bids[i]);
+            snapshot.ask_px[i] = Traits::fromDollars(asks[i]);
+            snapshot.bid_sz[i] = store.bidSizes(row)[i];
+            snapshot.ask_sz[i] = store.askSizes(row)[i];
+        }
+        return snapshot;
+    }
+    
+    /**
+     * @brief True when both best prices are positive (mid price defined)
+     */
+    bool hasMid() const { return bid_px[0] > 0 && ask_px[0] > 0; }
+    
+    /**
+     * @brief Bid + ask of the top level (twice the mid price)
+     */
+    typename Traits::Notional mid2() const {
+        return static_cast<typename Traits::Notional>(bid_px[0]) + ask_px[0];
+    }
+};
+
+/**
+ * @brief Rows 0, k, 2k, ... of a store
+ * @param rows Number of rows
+ * @param k Stride (k <= 1 keeps every row)
+ */
+inline std::vector<size_t> sampleEveryKth(size_t rows, size_t k) {
+    std::vector<size_t> keep;
+    k = std::max<size_t>(k, 1);
+    keep.reserve(rows / k + 1);
+    for (size_t row = 0; row < rows; row += k) keep.push_back(row);
+    return keep;
+}
+
+/**
+ * @brief First row of each of `bins` equal-width time bins
+ * @param store Rows of one day file
+ * @param bins Number of bins spanning the first to the last timestamp
+ * @return Ascending indices of the kept rows (at most `bins`)
+ * 
+ * Spreads the sample over the whole session instead of the open, so busy
+ * periods with many updates do not dominate the sample.
+ */
+inline std::vector<size_t> sampleTimeStratified(const SnapshotStore& store, size_t bins) {
+    std::vector<size_t> keep;
+    const size_t rows = store.size();
+    if (rows == 0 || bins == 0) return keep;
+    
+    const auto bounds = std::minmax_element(store.ts_ns.begin(), store.ts_ns.end());
+    const double first = static_cast<double>(*bounds.first);
+    const double span = static_cast<double>(*bounds.second) - first + 1.0;
+    std::vector<char> taken(bins, 0);
+    for (size_t row = 0; row < rows; ++row) {
+        size_t bin = static_cast<size_t>((static_cast<double>(store.ts_ns[row]) - first) / span * static_cast<double>(bins));
+        bin = std::min(bin, bins - 1);
+        if (!taken[bin]) {
+            taken[bin] = 1;
+            keep.push_back(row);
+        }
+    }
+    return keep;
+}
+
+/**
+ * @brief Uniform sample of `target` rows without replacement (Algorithm R)
+ * @param rows Number of rows to sample from
+ * @param target Sample size
+ * @param seed Generator seed; equal seeds give equal samples
+ * @return Ascending indices of the kept rows
+ */
+inline std::vector<size_t> sampleReservoir(size_t rows, size_t target, uint64_t seed) {
+    std::vector<size_t> keep;
+    if (rows <= target) return sampleEveryKth(rows, 1);
+    keep.reserve(target);
+    std::mt19937_64 rng(seed);
+    for (size_t row = 0; row < rows; ++row) {
+        if (row < target) {
+            keep.push_back(row);
+        } else {
+            uint64_t slot = rng() % (row + 1);
+            if (slot < target) keep[static_cast<size_t>(slot)] = row;
+        }
+    }
+    std::sort(keep.begin(), keep.end());
+    return keep;
+}
+
+/**
+ * @class ReservoirSampler
+ * @brief Algorithm R over rows that arrive in batches, holding at most `target` rows
+ * 
+ * Makes the same draws as sampleReservoir() over the concatenated rows,
+ * so a symbol sampled file by file (or streamed batch by batch) keeps the
+ * same rows as sampling the whole store, while memory stays O(target)
+ * instead of O(all rows).
+ */
+class ReservoirSampler {
+public:
+    ReservoirSampler(size_t target, uint64_t seed) : target(target), rng(seed) {}
+    
+    /**
+     * @brief Offer every row of a batch, in order
+     */
+    void add(const SnapshotStore& batch) {
+        std::vector<uint16_t> remap(batch.days.size());
+        for (size_t d = 0; d < batch.days.size(); ++d) remap[d] = sample.addDay(batch.days[d]);
+        for (size_t row = 0; row < batch.size(); ++row, ++seen) {
+            const uint16_t day_index = remap[batch.day[row]];
+            if (seen < target) {
+                sample.copyRow(batch, row, day_index);
+                arrival.push_back(seen);
+                continue;
+            }
+            const uint64_t slot = rng() % (seen + 1);
+            if (slot >= target) continue;
+            const size_t out = static_cast<size_t>(slot);
+            std::copy_n(batch.bidPrices(row), kBookLevels, sample.bid_px.begin() + out * kBookLevels);
+            std::copy_n(batch.askPrices(row), kBookLevels, sample.ask_px.begin() + out * kBookLevels);
+            std::copy_n(batch.bidSizes(row), kBookLevels, sample.bid_sz.begin() + out * kBookLevels);
+            std::copy_n(batch.askSizes(row), kBookLevels, sample.ask_sz.begin() + out * kBookLevels);
+            sample.ts_ns[out] = batch.ts_ns[row];
+            sample.day[out] = day_index;
+            arrival[out] = seen;
+        }
+    }
+    
+    /**
+     * @brief Rows offered so far
+     */
+    size_t rowsSeen() const { return seen; }
+    
+    /**
+     * @brief The sample in arrival order (the sampler is left empty)
+     */
+    SnapshotStore take() {
+        std::vector<size_t> order(sample.size());
+        std::iota(order.begin(), order.end(), size_t{0});
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return arrival[a] < arrival[b]; });
+        SnapshotStore out;
+        out.days = sample.days;
+        out.reserve(order.size());
+        for (size_t slot : order) out.copyRow(sample, slot, sample.day[slot]);
+        sample = SnapshotStore();
+        arrival.clear();
+        return out;
+    }
+    
+private:
+    size_t target;
+    std::mt19937_64 rng;
+    size_t seen = 0;              ///< Rows offered so far
+    SnapshotStore sample;         ///< Current reservoir, one row per slot
+    std::vector<size_t> arrival;  ///< Arrival index of each slot's row
+};
+
+/**
+ * @enum FeedSchema
+ * @brief Databento CSV schema of a day file, detected from its header
+ */
+enum class FeedSchema {
+    Mbp10,   ///< Full 10-level book on every row
+    Mbp1,    ///< Top of book on every row
+    Mbo,     ///< Individual order events (add/cancel/modify/...)
+    Unknown  ///< No recognised header; read as MBP-10 by position
+};
+
+inline const char* schemaName(FeedSchema schema) {
+    switch (schema) {
+        case FeedSchema::Mbp10: return "mbp-10";
+        case FeedSchema::Mbp1:  return "mbp-1";
+        case FeedSchema::Mbo:   return "mbo";
+        default:                return "unknown";
+    }
+}
+
+/**
+ * @struct FeedColumns
+ * @brief Schema and column positions of the fields the event loader reads
+ */
+struct FeedColumns {
+    static constexpr size_t kMaxColumns = 32;   ///< Event rows are split up to this many fields
+    static constexpr size_t kMissing = std::numeric_limits<size_t>::max();
+    
+    FeedSchema schema = FeedSchema::Unknown;
+    size_t ts_event = kMissing;
+    size_t action = kMissing;
+    size_t side = kMissing;
+    size_t price = kMissing;
+    size_t size = kMissing;
+    size_t order_id = kMissing;
+    size_t flags = kMissing;
+    size_t bid_px = kMissing;   ///< bid_px_00 (MBP-1)
+    size_t ask_px = kMissing;   ///< ask_px_00 (MBP-1)
+    size_t bid_sz = kMissing;   ///< bid_sz_00 (MBP-1)
+    size_t ask_sz = kMissing;   ///< ask_sz_00 (MBP-1)
+    size_t min_fields = 0;      ///< Fields a row needs to cover every used column
+    
+    /**
+     * @brief Detect the schema and locate columns from a header row
+     * 
+     * MBO headers carry order_id, MBP-10 headers bid_px_09 and MBP-1
+     * headers only bid_px_00. Event schemas whose columns are missing or
+     * beyond kMaxColumns are reported as Unknown.
+     */
+    static FeedColumns fromHeader(std::string_view header) {
+        FeedColumns columns;
+        if (!header.empty() && header.back() == '\r') header.remove_suffix(1);
+        bool deep_book = false;
+        size_t index = 0;
+        for (size_t start = 0; start <= header.size(); ++index) {
+            size_t comma = header.find(',', start);
+            if (comma == std::string_view::npos) comma = header.size();
+            std::string_view name = header.substr(start, comma - start);
+            start = comma + 1;
+            
+            if (name == "ts_event") columns.ts_event = index;
+            else if (name == "action") columns.action = index;
+            else if (name == "side") columns.side = index;
+            else if (name == "price") columns.price = index;
+            else if (name == "size") columns.size = index;
+            else if (name == "order_id") columns.order_id = index;
+            else if (name == "flags") columns.flags = index;
+            else if (name == "bid_px_00") columns.bid_px = index;
+            else if (name == "ask_px_00") columns.ask_px = index;
+            else if (name == "bid_sz_00") columns.bid_sz = index;
+            else if (name == "ask_sz_00") columns.ask_sz = index;
+            else if (name == "bid_px_09") deep_book = true;
+        }
+        
+        std::vector<size_t> used;
+        if (columns.order_id != kMissing) {
+            columns.schema = FeedSchema::Mbo;
+            used = {columns.ts_event, columns.action, columns.side, columns.price, columns.size, columns.order_id};
+        } else if (deep_book) {
+            columns.schema = FeedSchema::Mbp10;
+            return columns;
+        } else if (columns.bid_px != kMissing) {
+            columns.schema = FeedSchema::Mbp1;
+            used = {columns.ts_event, columns.bid_px, columns.ask_px, columns.bid_sz, columns.ask_sz};
+        } else {
+            return columns;
+        }
+        if (columns.flags != kMissing) used.push_back(columns.flags);
+        for (size_t column : used) {
+            if (column >= kMaxColumns) {  // also catches kMissing
+                columns.schema = FeedSchema::Unknown;
+                return columns;
+            }
+            columns.min_fields = std::max(columns.min_fields, column + 1);
+        }
+        return columns;
+    }
+};
+
+/**
+ * @struct DbnBidAskPair
+ * @brief One book level of a DBN MBP-10 record
+ */
+struct DbnBidAskPair {
+    int64_t bid_px;    ///< Bid price, 1e-9 units (kDbnUndefPrice if empty)
+    int64_t ask_px;    ///< Ask price, 1e-9 units (kDbnUndefPrice if empty)
+    uint32_t bid_sz;   ///< Bid size
+    uint32_t ask_sz;   ///< Ask size
+    uint32_t bid_ct;   ///< Bid order count
+    uint32_t ask_ct;   ///< Ask order count
+};
+
+/**
+ * @struct DbnMbp10Msg
+ * @brief Databento DBN MBP-10 record (rtype 0x0A), little-endian, 368 bytes
+ * 
+ * Field order and sizes are those of the DBN specification (versions 1-3
+ * share this record); the first four fields are the common RecordHeader,
+ * whose length byte counts 4-byte words.
+ */
+struct DbnMbp10Msg {
+    uint8_t length;            ///< Record size / 4
+    uint8_t rtype;             ///< 0x0A for MBP-10
+    uint16_t publisher_id;
+    uint32_t instrument_id;
+    uint64_t ts_event;         ///< Matching-engine time, ns since the epoch
+    int64_t price;
+    uint32_t size;
+    char action;
+    char side;
+    uint8_t flags;
+    uint8_t depth;
+    uint64_t ts_recv;
+    int32_t ts_in_delta;
+    uint32_t sequence;
+    DbnBidAskPair levels[kBookLevels];
+};
+static_assert(sizeof(DbnMbp10Msg) == 368, "DbnMbp10Msg must match the DBN MBP-10 record layout");
+
+constexpr uint8_t kDbnMbp10RType = 0x0A;                                  ///< rtype of MBP-10 records
+constexpr int64_t kDbnUndefPrice = std::numeric_limits<int64_t>::max();  ///< Empty level price
+constexpr size_t kDbnRecordHeaderBytes = 16;                              ///< Common record header
+
+/**
+ * @brief Offset of the first record of a DBN stream
+ * @param data Start of the stream ("DBN", version byte, uint32 metadata length, metadata)
+ * @param size Bytes available
+ * @return Offset after the metadata; 0 if data is not DBN (or the metadata
+ *         is not complete yet)
+ */
+inline size_t dbnRecordsOffset(const char* data, size_t size) {
+    if (size < 8 || std::memcmp(data, "DBN", 3) != 0 || data[3] < 1 || data[3] > 3) return 0;
+    uint32_t metadata_bytes = 0;
+    std::memcpy(&metadata_bytes, data + 4, sizeof(metadata_bytes));
+    const size_t offset = 8 + static_cast<size_t>(metadata_bytes);
+    return offset <= size ? offset : 0;
+}
+
+/**
+ * @brief Whether a file name is a day file the loaders read
+ * 
+ * Databento CSV (.csv), DBN (.dbn) and their zstd-compressed forms
+ * (.csv.zst, .dbn.zst).
+ */
+inline bool isDayFile(const fs::path& path) {
+    const std::string name = path.filename().string();
+    auto ends_with = [&](const char* suffix) {
+        const size_t n = std::strlen(suffix);
+        return name.size() > n && name.compare(name.size() - n, n, suffix) == 0;
+    };
+    return ends_with(".csv") || ends_with(".dbn") || ends_with(".csv.zst") || ends_with(".dbn.zst");
+}
+
+/**
+ * @class IncrementalBook
+ * @brief Price-level book maintained from MBO order events
+ * 
+ * Each side is a flat vector of (price, size) levels sorted so that the
+ * best price is at the back: bids ascending, asks descending. Most events
+ * touch the top of the book, so inserts and erases move only a few
+ * elements and the top-N read is a short backwards scan. Resting orders
+ * are tracked by id so cancels and modifies can find their level.
+ * 
+ * Event semantics follow Databento MBO: Add inserts an order, Cancel
+ * removes `size` shares of it, Modify replaces its price and size, Clear
+ * empties the book, and Trade/Fill/None leave it unchanged (the resulting
+ * book changes arrive as separate cancel or modify events).
+ */
+class IncrementalBook {
+public:
+    /**
+     * @struct Level
+     * @brief Aggregated resting size at one price
+     */
+    struct Level {
+        int64_t price;  ///< 1e-9 dollar ticks
+        int64_t size;   ///< Shares
+    };
+    
+    /**
+     * @brief Apply one MBO event
+     * @param action 'A', 'C', 'M', 'R', 'T', 'F' or 'N'
+     * @param side 'B' (bid) or 'A' (ask); other sides are ignored
+     * @param price Order price in ticks
+     * @param size Order size (Add/Modify) or cancelled shares (Cancel)
+     * @param order_id Exchange order id
+     */
+    void apply(char action, char side, int64_t price, int64_t size, uint64_t order_id) {
+        switch (action) {
+            case 'A':
+                if ((side == 'B' || side == 'A') && size > 0) {
+                    orders[order_id] = {side, price, size};
+                    adjust(side, price, size);
+                }
+                break;
+            case 'C': {
+                auto it = orders.find(order_id);
+                if (it == orders.end()) break;
+                int64_t removed = std::min(size, it->second.size);
+                adjust(it->second.side, it->second.price, -removed);
+                it->second.size -= removed;
+                if (it->second.size <= 0) orders.erase(it);
+                break;
+            }
+            case 'M': {
+                auto it = orders.find(order_id);
+                if (it == orders.end()) {
+                    apply('A', side, price, size, order_id);  // modify of an unseen order acts as an add
+                    break;
+                }
+                adjust(it->second.side, it->second.price, -it->second.size);
+                if (size <= 0) {
+                    orders.erase(it);
+                    break;
+                }
+                it->second.price = price;
+                it->second.size = size;
+                adjust(it->second.side, price, size);
+                break;
+            }
+            case 'R':
+                clear();
+                break;
+            default:
+                break;  // Trade, Fill, None: no book change
+        }
+    }
+    
+    void clear() {
+        orders.clear();
+        bids.clear();
+        asks.clear();
+    }
+    
+    /**
+     * @brief True when both sides have at least one level
+     */
+    bool hasBothSides() const { return !bids.empty() && !asks.empty(); }
+    
+    /**
+     * @brief Write the top kBookLevels levels per side into a store row
+     * 
+     * Missing levels are left untouched (zero in a fresh row) and sizes
+     * beyond the int range are clamped.
+     */
+    void writeTop(double* bid_px, int* bid_sz, double* ask_px, int* ask_sz) const {
+        auto write = [](const std::vector<Level>& levels, double* px, int* sz) {
+            size_t depth = std::min(levels.size(), kBookLevels);
+            for (size_t i = 0; i < depth; ++i) {
+                const Level& level = levels[levels.size() - 1 - i];
+                px[i] = static_cast<double>(level.price) / 1e9;
+                sz[i] = static_cast<int>(std::min<int64_t>(level.size, std::numeric_limits<int>::max()));
+            }
+        };
+        write(bids, bid_px, bid_sz);
+        write(asks, ask_px, ask_sz);
+    }
+    
+private:
+    /**
+     * @struct Order
+     * @brief Resting order state
+     */
+    struct Order {
+        char side;
+        int64_t price;
+        int64_t size;
+    };
+    
+    std::unordered_map<uint64_t, Order> orders;  ///< Resting orders by id
+    std::vector<Level> bids;                     ///< Ascending price, best last
+    std::vector<Level> asks;                     ///< Descending price, best last
+    
+    /**
+     * @brief Add delta shares at a price, creating or erasing the level
+     */
+    void adjust(char side, int64_t price, int64_t delta) {
+        std::vector<Level>& levels = side == 'B' ? bids : asks;
+        // Slot of price in the side's sort order
+        auto it = side == 'B'
+            ? std::lower_bound(levels.begin(), levels.end(), price,
+                               [](const Level& level, int64_t p) { return level.price < p; })
+            : std::lower_bound(levels.begin(), levels.end(), price,
+                               [](const Level& level, int64_t p) { return level.price > p; });
+        if (it != levels.end() && it->price == price) {
+            it->size += delta;
+            if (it->size <= 0) levels.erase(it);
+        } else if (delta > 0) {
+            levels.insert(it, Level{price, delta});
+        }
+    }
+};
+
+/**
+ * @brief Random hex token for private scratch folders and temporary file names
+ * 
+ * Mixes std::random_device with the clock, so processes sharing a folder
+ * (or a platform with a deterministic random_device) still get distinct
+ * names.
+ */
+inline std::string uniqueToken() {
+    std::random_device device;
+    const uint64_t clock = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    const uint64_t random = (static_cast<uint64_t>(device()) << 32) ^ device();
+    std::ostringstream out;
+    out << std::hex << (random ^ (clock * 0x9E3779B97F4A7C15ULL));
+    return out.str();
+}
+
+/**
+ * @class SnapshotCache
+ * @brief Versioned binary columnar cache of one parsed day file
+ * 
+ * Layout: a fixed Header followed by the columns ts_ns (int64 x N),
+ * bid_px and ask_px (int64 ticks of 1e-9 dollars, N x kBookLevels each) and
+ * bid_sz and ask_sz (int32, N x kBookLevels each). A cache holds every valid
+ * row of its source file and is only used while the source's size and
+ * modification time match the values recorded in the header.
+ * 
+ * Prices parsed from Databento's 9-decimal text are exact multiples of
+ * 1e-9, so ticks / 1e9 reproduces the parsed double bit for bit; a store
+ * holding any price that would not round-trip is not cached.
+ */
+class SnapshotCache {
+public:
+    static constexpr uint32_t kVersion = 2;       ///< Bump when the layout changes (2: ts_event timestamps)
+    static constexpr double kPriceScale = 1e9;    ///< Ticks per dollar
+    
+    /**
+     * @struct Header
+     * @brief On-disk header (native byte order)
+     */
+    struct Header {
+        char magic[8];            ///< "OBSNAPC" + NUL
+        uint32_t version;         ///< kVersion
+        uint32_t levels;          ///< kBookLevels
+        uint64_t source_size;     ///< Source file size in bytes
+        int64_t source_mtime;     ///< Source modification time (file clock ticks)
+        uint64_t rows;            ///< Number of snapshots
+        char date[16];            ///< Trading date, NUL padded
+    };
+    
+    /**
+     * @brief Bytes of column data per snapshot
+     */
+    static constexpr size_t rowBytes() {
+        return sizeof(int64_t) + kBookLevels * (2 * sizeof(int64_t) + 2 * sizeof(int32_t));
+    }
+    
+    /**
+     * @brief Header plus column bytes of a cache holding `rows` snapshots
+     */
+    static constexpr size_t fileBytes(size_t rows) {
+        return sizeof(Header) + rows * rowBytes();
+    }
+    
+    /**
+     * @brief Load a cache into an empty store if it matches its source
+     * @param cache Cache file
+     * @param source CSV the cache was built from
+     * @param store Empty store to fill
+     * @param max_rows Maximum number of rows to load
+     * @return true on a valid cache hit
+     */
+    static bool read(const fs::path& cache, const fs::path& source, SnapshotStore& store, size_t max_rows) {
+        Header expected;
+        if (!describeSource(source, expected)) return false;
+        
+        MappedFile file;
+        std::error_code ec;
+        if (!fs::exists(cache, ec) || !file.open(cache) || file.size() < sizeof(Header)) return false;
+        Header header;
+        std::memcpy(&header, file.data(), sizeof(Header));
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+            header.version != kVersion || header.levels != kBookLevels ||
+            header.source_size != expected.source_size || header.source_mtime != expected.source_mtime ||
+            file.size() != sizeof(Header) + header.rows * rowBytes()) {
+            return false;
+        }
+        
+        const size_t total = static_cast<size_t>(header.rows);
+        const size_t rows = std::min(total, max_rows);
+        header.date[sizeof(header.date) - 1] = '\0';
+        store.addDay(header.date);
+        
+        const char* column = file.data() + sizeof(Header);
+        store.ts_ns.resize(rows);
+        std::memcpy(store.ts_ns.data(), column, rows * sizeof(int64_t));
+        store.day.assign(rows, 0);
+        column += total * sizeof(int64_t);
+        
+        auto readPrices = [&](std::vector<double>& out) {
+            out.resize(rows * kBookLevels);
+            for (size_t i = 0; i < out.size(); ++i) {
+                int64_t ticks;
+                std::memcpy(&ticks, column + i * sizeof(int64_t), sizeof(int64_t));
+                out[i] = static_cast<double>(ticks) / kPriceScale;
+            }
+            column += total * kBookLevels * sizeof(int64_t);
+        };
+        auto readSizes = [&](std::vector<int>& out) {
+            out.resize(rows * kBookLevels);
+            std::memcpy(out.data(), column, out.size() * sizeof(int32_t));
+            column += total * kBookLevels * sizeof(int32_t);
+        };
+        readPrices(store.bid_px);
+        readPrices(store.ask_px);
+        readSizes(store.bid_sz);
+        readSizes(store.ask_sz);
+        return true;
+    }
+    
+    /**
+     * @brief Write a single-file store as a cache (best effort)
+     * @param cache Cache file to create or replace
+     * @param source CSV the store was parsed from
+     * @param store Every valid row of that file
+     * @return true if the cache was written
+     */
+    static bool write(const fs::path& cache, const fs::path& source, const SnapshotStore& store) {
+        Header header;
+        if (!describeSource(source, header) || store.days.size() > 1) return false;
+        header.rows = store.size();
+        if (!store.days.empty()) {
+            std::strncpy(header.date, store.days[0].c_str(), sizeof(header.date) - 1);
+        }
+        
+        std::vector<int64_t> bid_ticks, ask_ticks;
+        if (!toTicks(store.bid_px, bid_ticks) || !toTicks(store.ask_px, ask_ticks)) return false;
+        
+        std::error_code ec;
+        fs::create_directories(cache.parent_path(), ec);
+        fs::path temp = cache;
+        temp += "." + uniqueToken() + ".tmp";  // writers sharing the cache never write the same temp file
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return false;
+            auto put = [&out](const void* bytes, size_t length) {
+                out.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(length));
+            };
+            put(&header, sizeof(header));
+            put(store.ts_ns.data(), store.ts_ns.size() * sizeof(int64_t));
+            put(bid_ticks.data(), bid_ticks.size() * sizeof(int64_t));
+            put(ask_ticks.data(), ask_ticks.size() * sizeof(int64_t));
+            put(store.bid_sz.data(), store.bid_sz.size() * sizeof(int32_t));
+            put(store.ask_sz.data(), store.ask_sz.size() * sizeof(int32_t));
+            if (!out.good()) {
+                out.close();
+                fs::remove(temp, ec);
+                return false;
+            }
+        }
+        fs::rename(temp, cache, ec);
+        if (ec) fs::remove(temp, ec);
+        return !ec;
+    }
+    
+private:
+    /**
+     * @brief Fill the identity fields of a header from the source file
+     * @return false if the source cannot be stat'ed
+     */
+    static bool describeSource(const fs::path& source, Header& header) {
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "OBSNAPC", 8);
+        header.version = kVersion;
+        header.levels = static_cast<uint32_t>(kBookLevels);
+        std::error_code ec;
+        header.source_size = static_cast<uint64_t>(fs::file_size(source, ec));
+        if (ec) return false;
+        auto mtime = fs::last_write_time(source, ec);
+        if (ec) return false;
+        header.source_mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+        return true;
+    }
+    
+    /**
+     * @brief Convert prices to exact 1e-9 ticks
+     * @return false if any price would not round-trip through ticks
+     */
+    static bool toTicks(const std::vector<double>& prices, std::vector<int64_t>& ticks) {
+        ticks.resize(prices.size());
+        for (size_t i = 0; i < prices.size(); ++i) {
+            double scaled = prices[i] * kPriceScale;
+            if (!(std::fabs(scaled) < 9.0e15)) return false;  // Also rejects NaN
+            ticks[i] = std::llround(scaled);
+            if (static_cast<double>(ticks[i]) / kPriceScale != prices[i]) return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * @struct ImpactResult
+ * @brief Stores the results of temporary impact analysis for a specific order size
+ */
+struct ImpactResult {
+    int order_size;      ///< Order size in shares
+    double avg_impact;   ///< Average impact as decimal (e.g., 0.001 = 0.1%)
+    double impact_bps;   ///< Average impact in basis points (e.g., 10.0 = 10 bps)
+    double std_bps = 0;  ///< Standard deviation of per-snapshot impact (bps; --distribution)
+    double p50_bps = 0;  ///< Median impact (bps; --distribution)
+    double p95_bps = 0;  ///< 95th percentile impact (bps; --distribution)
+    double p99_bps = 0;  ///< 99th percentile impact (bps; --distribution)
+};
+
+/**
+ * @brief Write a trivially copyable value in native byte order
+ */
+template <typename T>
+inline void writePod(std::ostream& out, const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "writePod needs a trivially copyable type");
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/**
+ * @brief Read a value written by writePod()
+ * @return false on a short read
+ */
+template <typename T>
+inline bool readPod(std::istream& in, T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "readPod needs a trivially copyable type");
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+/**
+ * @brief Write a vector as a uint64 element count followed by its elements
+ */
+template <typename T>
+inline void writeVector(std::ostream& out, const std::vector<T>& values) {
+    writePod(out, static_cast<uint64_t>(values.size()));
+    out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+/**
+ * @brief Read a vector written by writeVector()
+ * @param max_size Largest element count accepted (guards against corrupt lengths)
+ * @return false on a short read or an oversized count
+ */
+template <typename T>
+inline bool readVector(std::istream& in, std::vector<T>& values, uint64_t max_size) {
+    uint64_t size = 0;
+    if (!readPod(in, size) || size > max_size) return false;
+    values.resize(static_cast<size_t>(size));
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(values.data()),
+                                     static_cast<std::streamsize>(values.size() * sizeof(T))));
+}
+
+/**
+ * @struct WeightedMoments
+ * @brief Weighted Welford mean/variance with Chan's pairwise merge
+ */
+struct WeightedMoments {
+    double weight = 0;  ///< Total weight
+    double mean = 0;    ///< Weighted mean
+    double m2 = 0;      ///< Weighted sum of squared deviations
+    
+    void add(double x, double w) {
+        if (w <= 0) return;
+        weight += w;
+        double delta = x - mean;
+        mean += delta * w / weight;
+        m2 += w * delta * (x - mean);
+    }
+    
+    void merge(const WeightedMoments& other) {
+        if (other.weight <= 0) return;
+        if (weight <= 0) { *this = other; return; }
+        double total = weight + other.weight;
+        double delta = other.mean - mean;
+        mean += delta * other.weight / total;
+        m2 += other.m2 + delta * delta * weight * other.weight / total;
+        weight = total;
+    }
+    
+    /// Population variance (weights are durations or unit counts, not frequencies of a sample)
+    double variance() const { return weight > 0 ? m2 / weight : 0.0; }
+};
+
+/**
+ * @class QuantileSketch
+ * @brief Mergeable relative-error quantile sketch (DDSketch-style log buckets)
+ * 
+ * Values are counted in logarithmic buckets of ratio gamma = (1 + a) / (1 - a),
+ * separately for positive and negative values, so every quantile is
+ * returned within relative error a = kRelativeAccuracy. Bucket counts are
+ * plain (weighted) sums, which makes merging exact and independent of the
+ * order in which rows, chunks, threads or files are combined: unlike a
+ * KLL or t-digest compaction, the result does not depend on the thread
+ * count. Memory is a few hundred buckets for impacts spanning 1e-6 to 1e-1.
+ */
+class QuantileSketch {
+public:
+    static constexpr double kRelativeAccuracy = 0.01;  ///< Quantile relative error bound
+    static constexpr double kMinMagnitude = 1e-12;     ///< |x| below this counts as zero
+    
+    void add(double x, double w) {
+        if (!(w > 0)) return;
+        total += w;
+        double magnitude = std::fabs(x);
+        if (magnitude < kMinMagnitude) {
+            zero += w;
+            return;
+        }
+        (x > 0 ? positive : negative).add(bucketOf(magnitude), w);
+    }
+    
+    void merge(const QuantileSketch& other) {
+        total += other.total;
+        zero += other.zero;
+        positive.merge(other.positive);
+        negative.merge(other.negative);
+    }
+    
+    /**
+     * @brief Serialize the bucket counts (native byte order)
+     */
+    void write(std::ostream& out) const {
+        writePod(out, total);
+        writePod(out, zero);
+        positive.write(out);
+        negative.write(out);
+    }
+    
+    /**
+     * @brief Replace this sketch by one written with write()
+     * @return false on malformed input
+     */
+    bool read(std::istream& in) {
+        return readPod(in, total) && readPod(in, zero) && positive.read(in) && negative.read(in);
+    }
+    
+    /**
+     * @brief Value at quantile q in [0, 1] (0 when empty)
+     */
+    double quantile(double q) const {
+        if (total <= 0) return 0.0;
+        const double rank = q * total;
+        double seen = 0;
+        for (size_t i = negative.counts.size(); i-- > 0;) {  // most negative first
+            seen += negative.counts[i];
+            if (seen > rank) return -valueOf(negative.first + static_cast<int>(i));
+        }
+        seen += zero;
+        if (seen > rank) return 0.0;
+        for (size_t i = 0; i < positive.counts.size(); ++i) {
+            seen += positive.counts[i];
+            if (seen > rank) return valueOf(positive.first + static_cast<int>(i));
+        }
+        return positive.counts.empty() ? 0.0 : valueOf(positive.first + static_cast<int>(positive.counts.size()) - 1);
+    }
+    
+private:
+    /**
+     * @struct Buckets
+     * @brief Dense bucket counts for indices [first, first + counts.size())
+     */
+    struct Buckets {
+        int first = 0;
+        std::vector<double> counts;
+        
+        void add(int index, double w) {
+            if (counts.empty()) {
+                first = index;
+                counts.assign(1, 0.0);
+            } else if (index < first) {
+                counts.insert(counts.begin(), static_cast<size_t>(first - index), 0.0);
+                first = index;
+            } else if (index >= first + static_cast<int>(counts.size())) {
+                counts.resize(static_cast<size_t>(index - first + 1), 0.0);
+            }
+            counts[static_cast<size_t>(index - first)] += w;
+        }
+        
+        void merge(const Buckets& other) {
+            for (size_t i = 0; i < other.counts.size(); ++i) {
+                if (other.counts[i] != 0) add(other.first + static_cast<int>(i), other.counts[i]);
+            }
+        }
+        
+        void write(std::ostream& out) const {
+            writePod(out, static_cast<int32_t>(first));
+            writeVector(out, counts);
+        }
+        
+        bool read(std::istream& in) {
+            int32_t stored_first = 0;
+            if (!readPod(in, stored_first) || !readVector(in, counts, kMaxBuckets)) return false;
+            first = stored_first;
+            return true;
+        }
+    };
+    
+    static constexpr uint64_t kMaxBuckets = 1u << 20;  ///< Sanity bound when reading buckets
+    
+    static double logGamma() {
+        static const double value = std::log((1 + kRelativeAccuracy) / (1 - kRelativeAccuracy));
+        return value;
+    }
+    static int bucketOf(double magnitude) { return static_cast<int>(std::ceil(std::log(magnitude) / logGamma())); }
+    static double valueOf(int index) {
+        // Midpoint (in relative terms) of (gamma^(i-1), gamma^i]
+        return 2.0 * std::exp(logGamma() * index) / (1.0 + std::exp(logGamma()));
+    }
+    
+    double total = 0;   ///< Total weight
+    double zero = 0;    ///< Weight of |x| < kMinMagnitude
+    Buckets positive;   ///< Buckets of x > 0
+    Buckets negative;   ///< Buckets of -x for x < 0
+};
+
+/**
+ * @enum Side
+ * @brief Order side; buys consume the ask book, sells consume the bid book
+ */
+enum class Side { Buy, Sell };
+
+/**
+ * @brief Lower-case label for a side ("buy" / "sell")
+ */
+inline const char* sideName(Side side) {
+    return side == Side::Buy ? "buy" : "sell";
+}
+
+/**
+ * @struct OrderSizeGrid
+ * @brief Evaluated order sizes: step, 2*step, ... up to max_shares
+ */
+struct OrderSizeGrid {
+    int step = 10;         ///< Spacing between order sizes (and first size)
+    int max_shares = 500;  ///< Largest order size evaluated
+    
+    size_t points() const {
+        return (step > 0 && max_shares >= step) ? static_cast<size_t>(max_shares / step) : 0;
+    }
+    int orderSize(size_t k) const { return step * static_cast<int>(k + 1); }
+};
+
+/**
+ * @struct ImpactAccumulator
+ * @brief Running per-order-size weighted impact sums over any number of snapshots
+ * 
+ * Accumulators over disjoint row ranges can be merged; the averaged curve
+ * is produced by results(). Unweighted rows carry weight 1.0, for which
+ * weight x impact and the weight sum are exact, so the average equals the
+ * plain per-snapshot mean bit for bit.
+ */
+struct ImpactAccumulator {
+    OrderSizeGrid grid;                ///< Order sizes the sums refer to
+    std::vector<double> impact_sum;    ///< Sum of weight x per-snapshot impact per size
+    std::vector<double> weight_sum;    ///< Sum of weights per size
+    std::vector<uint64_t> count;       ///< Snapshots contributing per size
+    std::vector<WeightedMoments> moments;    ///< Per-size variance (distribution mode only)
+    std::vector<QuantileSketch> sketches;    ///< Per-size quantiles (distribution mode only)
+    
+    /**
+     * @param g Order size grid
+     * @param distribution Also track per-size variance and quantiles
+     */
+    explicit ImpactAccumulator(const OrderSizeGrid& g = OrderSizeGrid(), bool distribution = false)
+        : grid(g), impact_sum(g.points(), 0.0), weight_sum(g.points(), 0.0), count(g.points(), 0),
+          moments(distribution ? g.points() : 0), sketches(distribution ? g.points() : 0) {}
+    
+    bool tracksDistribution() const { return !moments.empty(); }
+    
+    /**
+     * @brief Add one snapshot's impact at grid index k
+     */
+    void add(size_t k, double impact, double weight) {
+        impact_sum[k] += weight * impact;
+        weight_sum[k] += weight;
+        count[k]++;
+        if (!moments.empty()) {
+            moments[k].add(impact, weight);
+            sketches[k].add(impact, weight);
+        }
+    }
+    
+    /**
+     * @brief Clear all sums and counts, keeping the grid
+     */
+    void reset() {
+        std::fill(impact_sum.begin(), impact_sum.end(), 0.0);
+        std::fill(weight_sum.begin(), weight_sum.end(), 0.0);
+        std::fill(count.begin(), count.end(), 0);
+        std::fill(moments.begin(), moments.end(), WeightedMoments());
+        std::fill(sketches.begin(), sketches.end(), QuantileSketch());
+    }
+    
+    /**
+     * @brief Add another accumulator over the same grid
+     */
+    void merge(const ImpactAccumulator& other) {
+        for (size_t k = 0; k < impact_sum.size(); ++k) {
+            impact_sum[k] += other.impact_sum[k];
+            weight_sum[k] += other.weight_sum[k];
+            count[k] += other.count[k];
+        }
+        for (size_t k = 0; k < moments.size() && k < other.moments.size(); ++k) {
+            moments[k].merge(other.moments[k]);
+            sketches[k].merge(other.sketches[k]);
+        }
+    }
+    
+    /**
+     * @brief Serialize the sums (and distribution state) in native byte order
+     * 
+     * The grid and distribution flag are not written; read() expects an
+     * accumulator constructed with the same ones.
+     */
+    void write(std::ostream& out) const {
+        writeVector(out, impact_sum);
+        writeVector(out, weight_sum);
+        writeVector(out, count);
+        for (size_t k = 0; k < moments.size(); ++k) {
+            writePod(out, moments[k]);
+            sketches[k].write(out);
+        }
+    }
+    
+    /**
+     * @brief Replace the sums by ones written with write()
+     * @return false on malformed input or a different grid size
+     */
+    bool read(std::istream& in) {
+        const uint64_t points = grid.points();
+        if (!readVector(in, impact_sum, points) || !readVector(in, weight_sum, points) ||
+            !readVector(in, count, points) || impact_sum.size() != points ||
+            weight_sum.size() != points || count.size() != points) {
+            return false;
+        }
+        for (size_t k = 0; k < moments.size(); ++k) {
+            if (!readPod(in, moments[k]) || !sketches[k].read(in)) return false;
+        }
+        return true;
+    }
+    
+    /**
+     * @brief Average impact per order size (sizes with no weight are omitted)
+     * 
+     * In distribution mode the results also carry the standard deviation
+     * and the 50th/95th/99th percentiles of the per-snapshot impact.
+     */
+    std::vector<ImpactResult> results() const {
+        std::vector<ImpactResult> out;
+        for (size_t k = 0; k < impact_sum.size(); ++k) {
+            if (count[k] == 0 || weight_sum[k] <= 0) continue;
+            double avg_impact = impact_sum[k] / weight_sum[k];
+            ImpactResult result{grid.orderSize(k), avg_impact, avg_impact * 10000.0};
+            if (!moments.empty()) {
+                result.std_bps = std::sqrt(moments[k].variance()) * 10000.0;
+                result.p50_bps = sketches[k].quantile(0.50) * 10000.0;
+                result.p95_bps = sketches[k].quantile(0.95) * 10000.0;
+                result.p99_bps = sketches[k].quantile(0.99) * 10000.0;
+            }
+            out.push_back(result);
+        }
+        return out;
+    }
+};
+
+/**
+ * @class StateCollapser
+ * @brief Collapses runs of identical books into time-weighted states
+ * 
+ * Rows are fed in time order, possibly in several batches. Consecutive rows
+ * of the same day whose 10-level prices and sizes are identical form one
+ * state; a state is emitted, with weight = seconds (by ts_event) until the
+ * next distinct state, once that next state is seen. The last state of
+ * each day has no observed end and states lasting 0 ns carry no time, so
+ * both are dropped. Emitted rows keep the timestamp of the state's first row.
+ */
+class StateCollapser {
+private:
+    SnapshotStore pending;      ///< Current state (one row) while its run lasts
+    std::string pending_date;   ///< Day of the current state
+    bool has_pending = false;
+    
+    void emit(int64_t end_ns, SnapshotStore& out) {
+        const int64_t duration = end_ns - pending.ts_ns[0];
+        if (duration <= 0) return;
+        out.copyRow(pending, 0, out.addDay(pending_date));
+        out.weight.resize(out.size() - 1, 1.0);
+        out.weight.push_back(static_cast<double>(duration) * 1e-9);
+    }
+    
+public:
+    /**
+     * @brief Feed one row; a completed state is appended to out
+     * @return true if a state was appended
+     */
+    bool feed(const SnapshotStore& in, size_t row, SnapshotStore& out) {
+        const std::string& date = in.days[in.day[row]];
+        if (has_pending && date == pending_date && SnapshotStore::sameBook(pending, 0, in, row)) {
+            return false;  // same state continues
+        }
+        const size_t before = out.size();
+        if (has_pending && date == pending_date) emit(in.ts_ns[row], out);
+        pending.clearRows();
+        pending.copyRow(in, row, pending.addDay(date));
+        pending_date = date;
+        has_pending = true;
+        return out.size() != before;
+    }
+    
+    /**
+     * @brief Drop the open state at the end of the input (its end is unknown)
+     */
+    void finish() { has_pending = false; }
+    
+    /**
+     * @brief Collapse a whole store
+     */
+    static SnapshotStore collapse(const SnapshotStore& in) {
+        SnapshotStore out;
+        StateCollapser collapser;
+        for (size_t row = 0; row < in.size(); ++row) collapser.feed(in, row, out);
+        collapser.finish();
+        return out;
+    }
+};
+
+/**
+ * @struct MarketStats
+ * @brief Running sums behind the per-symbol market statistics
+ */
+struct MarketStats {
+    double total_mid = 0;            ///< Sum of mid prices
+    double total_spread = 0;         ///< Sum of spreads (dollars)
+    int64_t total_bid_depth = 0;     ///< Sum of total bid depth (shares)
+    int64_t total_ask_depth = 0;     ///< Sum of total ask depth (shares)
+    int64_t valid_snapshots = 0;     ///< Snapshots with a valid mid price
+    
+    /**
+     * @brief Add rows [begin, end) of a store, in row order
+     */
+    void add(const SnapshotStore& store, size_t begin, size_t end) {
+        for (size_t row = begin; row < end; ++row) {
+            double mid = store.midPrice(row);
+            if (mid > 0) addRow(store, row, mid);
+        }
+    }
+    
+    /**
+     * @brief Add one row whose mid price is known to be positive
+     */
+    void addRow(const SnapshotStore& store, size_t row, double mid) {
+        total_mid += mid;
+        total_spread += store.spread(row);
+        total_bid_depth += store.totalBidDepth(row);
+        total_ask_depth += store.totalAskDepth(row);
+        valid_snapshots++;
+    }
+    
+    /**
+     * @brief Add the sums of another (later) row range
+     */
+    void merge(const MarketStats& other) {
+        total_mid += other.total_mid;
+        total_spread += other.total_spread;
+        total_bid_depth += other.total_bid_depth;
+        total_ask_depth += other.total_ask_depth;
+        valid_snapshots += other.valid_snapshots;
+    }
+    
+    /**
+     * @brief Add fixed-depth snapshots, in order
+     * 
+     * Mid and spread are formed in the snapshot's price type (exact for
+     * ticks) and converted to dollars once per snapshot.
+     */
+    template <size_t Levels, typename PriceT>
+    void add(const FixedDepthSnapshot<Levels, PriceT>* rows, size_t count) {
+        using Traits = PriceTraits<PriceT>;
+        for (size_t r = 0; r < count; ++r) {
+            const auto& snapshot = rows[r];
+            if (!snapshot.hasMid()) continue;
+            total_mid += Traits::toDollars(snapshot.mid2()) / 2.0;
+            total_spread += Traits::toDollars(snapshot.ask_px[0] - snapshot.bid_px[0]);
+            for (size_t i = 0; i < Levels; ++i) {
+                total_bid_depth += snapshot.bid_sz[i];
+                total_ask_depth += snapshot.ask_sz[i];
+            }
+            valid_snapshots++;
+        }
+    }
+};
+
+/**
+ * @brief Notional of the shares beyond a side's visible depth, on an extrapolated ladder
+ * @tparam S Book side consumed
+ * @param prices Visible level prices, best first
+ * @param visible Visible levels (at least one)
+ * @param depth Shares on the visible levels
+ * @param remainder Shares still to fill
+ * 
+ * The book is continued past its last visible level with levels of the
+ * mean visible size (depth / visible), spaced by the mean visible price
+ * step (|p_last - p_first| / (visible - 1); zero for a one-level book,
+ * which fills the remainder at that level). Ask prices rise, bid prices
+ * fall; bid levels that would be priced below zero fill at zero.
+ */
+template <Side S>
+inline double extrapolatedCost(const double* prices, size_t visible, int64_t depth, int64_t remainder) {
+    const double last = prices[visible - 1];
+    const double step = visible > 1 ? std::abs(last - prices[0]) / static_cast<double>(visible - 1) : 0.0;
+    const double level_size = static_cast<double>(depth) / static_cast<double>(visible);
+    double full = std::floor(static_cast<double>(remainder) / level_size);
+    double rest = static_cast<double>(remainder) - full * level_size;
+    if (S == Side::Sell && step > 0) {
+        const double positive = std::floor(last / step);  // Virtual bid levels priced above zero
+        if (full >= positive) {
+            full = positive;
+            rest = 0.0;
+        }
+    }
+    const double signed_step = S == Side::Buy ? step : -step;
+    // Levels j = 1..full at last + j * step, then the rest at level full + 1
+    return level_size * (full * last + signed_step * full * (full + 1.0) / 2.0) +
+           rest * (last + signed_step * (full + 1.0));
+}
+
+/**
+ * @brief Cumulative-depth walk of one side of one snapshot over the whole grid
+ * @tparam S Book side to consume, fixed at compile time
+ * @tparam P Pricing of sizes beyond the visible depth
+ * @param store Snapshots to evaluate
+ * @param row Row to walk (must have a positive mid price)
+ * @param mid_price Mid price of the row
+ * @param acc Accumulator receiving per-size impact sums
+ * 
+ * The grid is ascending, so the fill walk only ever moves forward: the
+ * running size/notional of fully consumed levels is carried from one order
+ * size to the next and the partial level is priced on top. Cost is
+ * O(levels + grid points) instead of O(levels x grid points). Each
+ * per-size sum sees the same floating point operations in the same order
+ * as calculateTemporaryImpact(), so results are bit-identical to the
+ * reference walk under every policy P.
+ */
+template <Side S, PartialFillPolicy P = PartialFillPolicy::Average>
+inline void walkSide(const SnapshotStore& store, size_t row, double mid_price, ImpactAccumulator& acc) {
+    const size_t points = acc.grid.points();
+    const double weight = store.rowWeight(row);
+    const double* prices = S == Side::Buy ? store.askPrices(row) : store.bidPrices(row);
+    const int* sizes = S == Side::Buy ? store.askSizes(row) : store.bidSizes(row);
+    
+    // Levels up to the first empty one are usable, as counted by the store's scan when it has one
+    size_t visible = 0;
+    if (const BookQuality* quality = store.quality.get()) {
+        visible = S == Side::Buy ? quality->ask_levels[row] : quality->bid_levels[row];
+    } else {
+        while (visible < kBookLevels && prices[visible] > 0 && sizes[visible] > 0) ++visible;
+    }
+    
+    size_t level = 0;          // First level not fully consumed
+    double filled_cost = 0.0;  // Notional of fully consumed levels
+    int64_t filled_shares = 0; // Shares of fully consumed levels (64-bit: sizes reach INT_MAX)
+    
+    for (size_t k = 0; k < points; ++k) {
+        int order_size = acc.grid.orderSize(k);
+        while (level < visible && filled_shares + sizes[level] < order_size) {
+            filled_cost += static_cast<double>(sizes[level]) * prices[level];
+            filled_shares += sizes[level];
+            ++level;
+        }
+        
+        double total_cost = filled_cost;
+        int64_t total_shares = filled_shares;
+        if (level < visible) {
+            int64_t take = order_size - filled_shares;
+            total_cost += static_cast<double>(take) * prices[level];
+            total_shares += take;
+        } else if (P != PartialFillPolicy::Average && visible > 0) {
+            if (P == PartialFillPolicy::Skip) break;  // This and every larger size exceed the depth
+            total_cost += extrapolatedCost<S>(prices, visible, filled_shares, order_size - filled_shares);
+            total_shares = order_size;
+        }
+        if (total_shares <= 0) break;  // Empty book side: no size can fill
+        
+        double avg_price = total_cost / static_cast<double>(total_shares);
+        double impact = S == Side::Buy ? (avg_price - mid_price) / mid_price
+                                       : (mid_price - avg_price) / mid_price;
+        acc.add(k, impact, weight);
+    }
+}
+
+/**
+ * @brief Accumulate g(X) for every grid size in one pass per snapshot
+ * @tparam P Pricing of sizes beyond the visible depth
+ * @param store Snapshots to evaluate
+ * @param begin First row (inclusive)
+ * @param end Last row (exclusive)
+ * @param side Book side to consume
+ * @param acc Accumulator receiving per-size impact sums
+ * 
+ * Runtime-side wrapper around walkSide(); the side is dispatched once per
+ * call, not per row.
+ */
+template <PartialFillPolicy P>
+inline void accumulateCumulativeDepthPolicy(const SnapshotStore& store, size_t begin, size_t end,
+                                            Side side, ImpactAccumulator& acc) {
+    auto walk = [&](auto side_tag) {
+        for (size_t row = begin; row < end; ++row) {
+            double mid_price = store.midPrice(row);
+            if (mid_price <= 0) continue;  // Skip invalid snapshots
+            walkSide<decltype(side_tag)::value, P>(store, row, mid_price, acc);
+        }
+    };
+    if (side == Side::Buy) {
+        walk(std::integral_constant<Side, Side::Buy>());
+    } else {
+        walk(std::integral_constant<Side, Side::Sell>());
+    }
+}
+
+/**
+ * @brief accumulateCumulativeDepthPolicy() with the default (Average) policy
+ */
+inline void accumulateCumulativeDepthImpact(const SnapshotStore& store, size_t begin, size_t end,
+                                            Side side, ImpactAccumulator& acc) {
+    accumulateCumulativeDepthPolicy<PartialFillPolicy::Average>(store, begin, end, side, acc);
+}
+
+/**
+ * @brief Statistics and both impact grids of rows [begin, end) in one traversal
+ * @param store Snapshots to evaluate
+ * @param begin First row (inclusive)
+ * @param end Last row (exclusive)
+ * @param stats Receives market statistics (nullptr = skip)
+ * @param buy Receives buy-side impact sums
+ * @param sell Receives sell-side impact sums
+ * 
+ * Each row is loaded once for the mid/spread/depth sums and both level
+ * walks, instead of once per pass. Per-row arithmetic is that of
+ * MarketStats::add() and accumulateCumulativeDepthPolicy<P>().
+ */
+template <PartialFillPolicy P = PartialFillPolicy::Average>
+inline void accumulateFusedPass(const SnapshotStore& store, size_t begin, size_t end,
+                                MarketStats* stats, ImpactAccumulator& buy, ImpactAccumulator& sell) {
+    for (size_t row = begin; row < end; ++row) {
+        double mid_price = store.midPrice(row);
+        if (mid_price <= 0) continue;  // Skip invalid snapshots
+        if (stats) stats->addRow(store, row, mid_price);
+        walkSide<Side::Buy, P>(store, row, mid_price, buy);
+        walkSide<Side::Sell, P>(store, row, mid_price, sell);
+    }
+}
+
+/**
+ * @brief Cumulative-depth g(X) over fixed-depth snapshots
+ * @tparam Levels Levels per side (compile time, so the level scan unrolls)
+ * @tparam PriceT double or int64_t ticks
+ * @param rows Snapshots to evaluate, in order
+ * @param count Number of snapshots
+ * @param side Book side to consume
+ * @param acc Accumulator receiving per-size impact sums
+ * @param weights Per-snapshot weights (nullptr = 1.0 each)
+ * 
+ * Same walk as accumulateCumulativeDepthImpact(). With tick prices the
+ * filled notional and 2 x shares x mid are exact integers, so the only
+ * rounding is the final division: g = (2 cost - shares mid2) / (shares mid2)
+ * for buys. Results are then identical on every IEEE platform and compiler,
+ * whatever its FMA contraction or summation choices. Notional stays exact
+ * while shares x price is below 2^62 ticks (about $4.6bn per fill).
+ */
+template <size_t Levels, typename PriceT>
+void accumulateFixedDepthImpact(const FixedDepthSnapshot<Levels, PriceT>* rows, size_t count,
+                                Side side, ImpactAccumulator& acc, const double* weights = nullptr) {
+    using Notional = typename PriceTraits<PriceT>::Notional;
+    const size_t points = acc.grid.points();
+    for (size_t r = 0; r < count; ++r) {
+        const auto& snapshot = rows[r];
+        if (!snapshot.hasMid()) continue;  // Skip invalid snapshots
+        const Notional mid2 = snapshot.mid2();
+        const double weight = weights ? weights[r] : 1.0;
+        
+        const auto& prices = side == Side::Buy ? snapshot.ask_px : snapshot.bid_px;
+        const auto& sizes = side == Side::Buy ? snapshot.ask_sz : snapshot.bid_sz;
+        
+        size_t visible = 0;
+        while (visible < Levels && prices[visible] > 0 && sizes[visible] > 0) ++visible;
+        
+        size_t level = 0;
+        Notional filled_cost = 0;
+        int64_t filled_shares = 0;
+        for (size_t k = 0; k < points; ++k) {
+            const int64_t order_size = acc.grid.orderSize(k);
+            while (level < visible && filled_shares + sizes[level] < order_size) {
+                filled_cost += static_cast<Notional>(sizes[level]) * prices[level];
+                filled_shares += sizes[level];
+                ++level;
+            }
+            
+            Notional total_cost = filled_cost;
+            int64_t total_shares = filled_shares;
+            if (level < visible) {
+                total_cost += static_cast<Notional>(order_size - filled_shares) * prices[level];
+                total_shares = order_size;
+            }
+            if (total_shares <= 0) break;  // Empty book side: no size can fill
+            
+            double impact;
+            if constexpr (std::is_integral_v<PriceT>) {
+                const Notional mid_notional = static_cast<Notional>(total_shares) * mid2;
+                const Notional excess = 2 * total_cost - mid_notional;
+                impact = static_cast<double>(side == Side::Buy ? excess : -excess) / static_cast<double>(mid_notional);
+            } else {
+                const double mid_price = mid2 / 2.0;
+                const double avg_price = total_cost / static_cast<double>(total_shares);
+                impact = side == Side::Buy ? (avg_price - mid_price) / mid_price : (mid_price - avg_price) / mid_price;
+            }
+            acc.add(k, impact, weight);
+        }
+    }
+}
+
+/**
+ * @brief Snapshots converted per block by the fixed-point store adapters
+ */
+constexpr size_t kFixedPointBlockRows = 256;
+using TickSnapshot = FixedDepthSnapshot<kBookLevels, int64_t>;
+
+/**
+ * @brief Fixed-point engine over store rows [begin, end)
+ * 
+ * Rows are converted to tick snapshots in blocks of kFixedPointBlockRows
+ * and evaluated with accumulateFixedDepthImpact().
+ */
+inline void accumulateFixedPointImpact(const SnapshotStore& store, size_t begin, size_t end,
+                                       Side side, ImpactAccumulator& acc) {
+    std::vector<TickSnapshot> block(std::min(kFixedPointBlockRows, end - begin));
+    for (size_t row = begin; row < end; row += block.size()) {
+        const size_t count = std::min(block.size(), end - row);
+        for (size_t i = 0; i < count; ++i) block[i] = TickSnapshot::fromStore(store, row + i);
+        accumulateFixedDepthImpact(block.data(), count, side, acc, store.weight.empty() ? nullptr : store.weight.data() + row);
+    }
+}
+
+/**
+ * @brief Market statistics of store rows [begin, end) in tick arithmetic
+ */
+inline void addFixedPointStats(MarketStats& stats, const SnapshotStore& store, size_t begin, size_t end) {
+    std::vector<TickSnapshot> block(std::min(kFixedPointBlockRows, end - begin));
+    for (size_t row = begin; row < end; row += block.size()) {
+        const size_t count = std::min(block.size(), end - row);
+        for (size_t i = 0; i < count; ++i) block[i] = TickSnapshot::fromStore(store, row + i);
+        stats.add(block.data(), count);
+    }
+}
+
+#ifdef ORDER_BOOK_X86_KERNELS
+/**
+ * @brief Add one vector of per-lane impacts to the per-size sums in row order
+ * @param impacts Impact per lane (lane 0 = lowest row)
+ * @param lanes Number of lanes in the vector
+ * @param weights Row weight per lane
+ * @param mask Bit per lane that produced a fill
+ * @param acc Accumulator to update
+ * @param k Grid index
+ */
+inline void accumulateLanes(const double* impacts, const double* weights, int lanes, unsigned mask,
+                            ImpactAccumulator& acc, size_t k) {
+    for (int lane = 0; lane < lanes; ++lane) {
+        if (mask & (1u << lane)) acc.add(k, impacts[lane], weights[lane]);
+    }
+}
+
+/**
+ * @brief AVX2 impact kernel: the ten-level walk for 4 snapshots per vector
+ * @param store Snapshots to evaluate
+ * @param begin First row (inclusive)
+ * @param end Last row (exclusive)
+ * @param side Book side to consume
+ * @param acc Accumulator receiving per-size impact sums
+ * 
+ * Levels behind the first empty one are masked to zero size up front, so
+ * the walk is a fixed sequence of min/multiply/add per level with no
+ * per-lane branches; a filled (zero-size) step adds exactly 0.0. Once every
+ * lane's order exceeds its visible depth the remaining grid sizes repeat
+ * the same fill and are added without re-walking. Lane results are added
+ * in row order and no FMA is used, so sums match the scalar engines bit for
+ * bit. A trailing group of fewer than 4 rows goes through the scalar kernel.
+ */
+__attribute__((target("avx2")))
+inline void accumulateAvx2Impact(const SnapshotStore& store, size_t begin, size_t end,
+                                 Side side, ImpactAccumulator& acc) {
+    constexpr int kLanes = 4;
+    const size_t points = acc.grid.points();
+    constexpr size_t S = kBookLevels;  // Row stride in the level columns
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d two = _mm256_set1_pd(2.0);
+    const double* side_px = side == Side::Buy ? store.ask_px.data() : store.bid_px.data();
+    const int* side_sz = side == Side::Buy ? store.ask_sz.data() : store.bid_sz.data();
+    alignas(32) double impacts[kLanes];
+    double weights[kLanes];
+    
+    size_t row = begin;
+    for (; row + kLanes <= end; row += kLanes) {
+        const size_t base = row * kBookLevels;
+        for (int lane = 0; lane < kLanes; ++lane) weights[lane] = store.rowWeight(row + static_cast<size_t>(lane));
+        const double* bid = store.bid_px.data() + base;
+        const double* ask = store.ask_px.data() + base;
+        __m256d best_bid = _mm256_setr_pd(bid[0], bid[S], bid[2 * S], bid[3 * S]);
+        __m256d best_ask = _mm256_setr_pd(ask[0], ask[S], ask[2 * S], ask[3 * S]);
+        __m256d valid = _mm256_and_pd(_mm256_cmp_pd(best_bid, zero, _CMP_GT_OQ),
+                                      _mm256_cmp_pd(best_ask, zero, _CMP_GT_OQ));
+        __m256d mid = _mm256_div_pd(_mm256_add_pd(best_bid, best_ask), two);
+        
+        __m256d px[kBookLevels];
+        __m256d sz[kBookLevels];
+        __m256d alive = valid;
+        for (size_t i = 0; i < kBookLevels; ++i) {
+            const double* lp = side_px + base + i;
+            const int* lq = side_sz + base + i;
+            __m256d p = _mm256_setr_pd(lp[0], lp[S], lp[2 * S], lp[3 * S]);
+            __m256d q = _mm256_cvtepi32_pd(_mm_setr_epi32(lq[0], lq[S], lq[2 * S], lq[3 * S]));
+            alive = _mm256_and_pd(alive, _mm256_and_pd(_mm256_cmp_pd(p, zero, _CMP_GT_OQ),
+                                                       _mm256_cmp_pd(q, zero, _CMP_GT_OQ)));
+            px[i] = _mm256_and_pd(p, alive);
+            sz[i] = _mm256_and_pd(q, alive);
+        }
+        
+        for (size_t k = 0; k < points; ++k) {
+            __m256d remaining = _mm256_set1_pd(static_cast<double>(acc.grid.orderSize(k)));
+            __m256d cost = zero;
+            __m256d shares = zero;
+            for (size_t i = 0; i < kBookLevels; ++i) {
+                __m256d take = _mm256_min_pd(remaining, sz[i]);
+                cost = _mm256_add_pd(cost, _mm256_mul_pd(take, px[i]));
+                shares = _mm256_add_pd(shares, take);
+                remaining = _mm256_sub_pd(remaining, take);
+                if (_mm256_movemask_pd(_mm256_cmp_pd(remaining, zero, _CMP_GT_OQ)) == 0) break;
+            }
+            
+            __m256d filled = _mm256_cmp_pd(shares, zero, _CMP_GT_OQ);
+            __m256d avg = _mm256_div_pd(cost, shares);
+            __m256d impact = side == Side::Buy ? _mm256_div_pd(_mm256_sub_pd(avg, mid), mid)
+                                               : _mm256_div_pd(_mm256_sub_pd(mid, avg), mid);
+            _mm256_store_pd(impacts, impact);
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_pd(filled));
+            accumulateLanes(impacts, weights, kLanes, mask, acc, k);
+            
+            // Every lane past its visible depth: larger sizes fill identically
+            __m256d short_fill = _mm256_or_pd(_mm256_cmp_pd(remaining, zero, _CMP_GT_OQ),
+                                              _mm256_cmp_pd(shares, zero, _CMP_EQ_OQ));
+            if (_mm256_movemask_pd(short_fill) == 0xF) {
+                for (size_t rest = k + 1; rest < points; ++rest) accumulateLanes(impacts, weights, kLanes, mask, acc, rest);
+                break;
+            }
+        }
+    }
+    accumulateCumulativeDepthImpact(store, row, end, side, acc);
+}
+
+// GCC 12's AVX-512 headers seed some intrinsics with _mm512_undefined_pd(),
+// which trips a false -Wmaybe-uninitialized once they are inlined here.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+/**
+ * @brief AVX-512 variant of accumulateAvx2Impact() over 8 snapshots per vector
+ * 
+ * Same algorithm and the same row-ordered, FMA-free arithmetic; validity is
+ * tracked in mask registers instead of all-ones lanes.
+ */
+__attribute__((target("avx512f")))
+inline void accumulateAvx512Impact(const SnapshotStore& store, size_t begin, size_t end,
+                                   Side side, ImpactAccumulator& acc) {
+    constexpr int kLanes = 8;
+    const size_t points = acc.grid.points();
+    constexpr size_t S = kBookLevels;  // Row stride in the level columns
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d two = _mm512_set1_pd(2.0);
+    const double* side_px = side == Side::Buy ? store.ask_px.data() : store.bid_px.data();
+    const int* side_sz = side == Side::Buy ? store.ask_sz.data() : store.bid_sz.data();
+    alignas(64) double impacts[kLanes];
+    double weights[kLanes];
+    
+    size_t row = begin;
+    for (; row + kLanes <= end; row += kLanes) {
+        const size_t base = row * kBookLevels;
+        for (int lane = 0; lane < kLanes; ++lane) weights[lane] = store.rowWeight(row + static_cast<size_t>(lane));
+        const double* bid = store.bid_px.data() + base;
+        const double* ask = store.ask_px.data() + base;
+        __m512d best_bid = _mm512_setr_pd(bid[0], bid[S], bid[2 * S], bid[3 * S],
+                                          bid[4 * S], bid[5 * S], bid[6 * S], bid[7 * S]);
+        __m512d best_ask = _mm512_setr_pd(ask[0], ask[S], ask[2 * S], ask[3 * S],
+                                          ask[4 * S], ask[5 * S], ask[6 * S], ask[7 * S]);
+        __mmask8 alive = _mm512_cmp_pd_mask(best_bid, zero, _CMP_GT_OQ) &
+                         _mm512_cmp_pd_mask(best_ask, zero, _CMP_GT_OQ);
+        __m512d mid = _mm512_div_pd(_mm512_add_pd(best_bid, best_ask), two);
+        
+        __m512d px[kBookLevels];
+        __m512d sz[kBookLevels];
+        for (size_t i = 0; i < kBookLevels; ++i) {
+            const double* lp = side_px + base + i;
+            const int* lq = side_sz + base + i;
+            __m512d p = _mm512_setr_pd(lp[0], lp[S], lp[2 * S], lp[3 * S],
+                                       lp[4 * S], lp[5 * S], lp[6 * S], lp[7 * S]);
+            __m512d q = _mm512_setr_pd(lq[0], lq[S], lq[2 * S], lq[3 * S],
+                                       lq[4 * S], lq[5 * S], lq[6 * S], lq[7 * S]);
+            alive &= _mm512_cmp_pd_mask(p, zero, _CMP_GT_OQ) & _mm512_cmp_pd_mask(q, zero, _CMP_GT_OQ);
+            px[i] = _mm512_maskz_mov_pd(alive, p);
+            sz[i] = _mm512_maskz_mov_pd(alive, q);
+        }
+        
+        for (size_t k = 0; k < points; ++k) {
+            __m512d remaining = _mm512_set1_pd(static_cast<double>(acc.grid.orderSize(k)));
+            __m512d cost = zero;
+            __m512d shares = zero;
+            for (size_t i = 0; i < kBookLevels; ++i) {
+                __m512d take = _mm512_min_pd(remaining, sz[i]);
+                cost = _mm512_add_pd(cost, _mm512_mul_pd(take, px[i]));
+                shares = _mm512_add_pd(shares, take);
+                remaining = _mm512_sub_pd(remaining, take);
+                if (_mm512_cmp_pd_mask(remaining, zero, _CMP_GT_OQ) == 0) break;
+            }
+            
+            __mmask8 filled = _mm512_cmp_pd_mask(shares, zero, _CMP_GT_OQ);
+            __m512d avg = _mm512_div_pd(cost, shares);
+            __m512d impact = side == Side::Buy ? _mm512_div_pd(_mm512_sub_pd(avg, mid), mid)
+                                               : _mm512_div_pd(_mm512_sub_pd(mid, avg), mid);
+            _mm512_store_pd(impacts, impact);
+            accumulateLanes(impacts, weights, kLanes, filled, acc, k);
+            
+            // Every lane past its visible depth: larger sizes fill identically
+            __mmask8 short_fill = _mm512_cmp_pd_mask(remaining, zero, _CMP_GT_OQ) | static_cast<__mmask8>(~filled);
+            if (short_fill == 0xFF) {
+                for (size_t rest = k + 1; rest < points; ++rest) accumulateLanes(impacts, weights, kLanes, filled, acc, rest);
+                break;
+            }
+        }
+    }
+    accumulateCumulativeDepthImpact(store, row, end, side, acc);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+/**
+ * @enum SimdLevel
+ * @brief Instruction set used by accumulateSimdImpact()
+ */
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+/**
+ * @brief Widest SIMD impact kernel supported by the running CPU (detected once)
+ */
+inline SimdLevel detectSimdLevel() {
+#ifdef ORDER_BOOK_X86_KERNELS
+    static const SimdLevel level = __builtin_cpu_supports("avx512f") ? SimdLevel::Avx512
+                                 : __builtin_cpu_supports("avx2")    ? SimdLevel::Avx2
+                                                                     : SimdLevel::Scalar;
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+/**
+ * @brief Label for a SIMD level ("avx512", "avx2", "scalar")
+ */
+inline const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Avx512: return "avx512";
+        case SimdLevel::Avx2:   return "avx2";
+        default:                return "scalar";
+    }
+}
+
+/**
+ * @brief Vectorized impact accumulation with runtime dispatch
+ * 
+ * Uses the AVX-512 or AVX2 kernel when the CPU supports it and falls back
+ * to the scalar accumulateCumulativeDepthImpact() otherwise. All variants
+ * produce identical sums.
+ */
+inline void accumulateSimdImpact(const SnapshotStore& store, size_t begin, size_t end,
+                                 Side side, ImpactAccumulator& acc) {
+    switch (detectSimdLevel()) {
+#ifdef ORDER_BOOK_X86_KERNELS
+        case SimdLevel::Avx512: accumulateAvx512Impact(store, begin, end, side, acc); return;
+        case SimdLevel::Avx2:   accumulateAvx2Impact(store, begin, end, side, acc); return;
+#endif
+        default:                accumulateCumulativeDepthImpact(store, begin, end, side, acc); return;
+    }
+}
+
+/// Signature shared by the row-range impact kernels
+using ImpactKernel = void (*)(const SnapshotStore&, size_t, size_t, Side, ImpactAccumulator&);
+
+/**
+ * @brief Row-range kernel of an engine (the reference engine has none; it maps to the default)
+ * @param engine Configured engine
+ * @param policy Partial fill policy; only the cumulative kernel implements
+ *        other than Average, the option validation rejects the rest
+ */
+inline ImpactKernel impactKernelFor(ImpactEngine engine, PartialFillPolicy policy = PartialFillPolicy::Average) {
+    switch (engine) {
+        case ImpactEngine::Simd:       return accumulateSimdImpact;
+        case ImpactEngine::FixedPoint: return accumulateFixedPointImpact;
+        default: break;
+    }
+    switch (policy) {
+        case PartialFillPolicy::Skip:        return accumulateCumulativeDepthPolicy<PartialFillPolicy::Skip>;
+        case PartialFillPolicy::Extrapolate: return accumulateCumulativeDepthPolicy<PartialFillPolicy::Extrapolate>;
+        default:                             return accumulateCumulativeDepthImpact;
+    }
+}
+
+/**
+ * @class PiecewiseImpactCurve
+ * @brief Exact g(X) for every order size, as a merged breakpoint structure
+ * 
+ * For one snapshot side with visible levels (p_j, s_j) and cumulative
+ * depth Q_j, an order of X in (Q_{j-1}, Q_j] shares pays
+ * C_{j-1} + (X - Q_{j-1}) p_j, so its impact is exactly a_j + b_j / X with
+ * a_j = +-(p_j - mid) / mid and b_j = +-(C_{j-1} - Q_{j-1} p_j) / mid (sign
+ * of the side). Beyond the visible depth D the walk of the grid engines
+ * uses the VWAP of what is visible, the constant g(D).
+ * 
+ * add() records, per snapshot, weighted changes of (sum a, sum b, fill
+ * weight, beyond-depth sum) at the integer sizes X = Q_j + 1 where they
+ * happen; finalize() sorts the k distinct breakpoints of all snapshots and
+ * prefix-sums them into segments. evaluate() then answers any X with one
+ * binary search: the exact mean over the snapshots deep enough to fill X,
+ * the share of weight they carry, and the grid engines' value (partial
+ * fills averaged in), which equals the cumulative engine up to rounding.
+ * Curves of disjoint row sets merge() by adding their changes.
+ */
+class PiecewiseImpactCurve {
+public:
+    /**
+     * @struct Point
+     * @brief g at one order size
+     */
+    struct Point {
+        double impact = 0;               ///< Mean over snapshots that fill X completely (NaN if none)
+        double fill_fraction = 0;        ///< Weight share of those snapshots
+        double impact_with_partial = 0;  ///< Mean over all snapshots, short books at their full-depth VWAP
+    };
+    
+    /**
+     * @struct Segment
+     * @brief Sizes [from, next segment's from) share g(X) = alpha + beta / X
+     */
+    struct Segment {
+        int64_t from = 0;            ///< First order size of the segment
+        double alpha = 0;            ///< Exact mean: constant term
+        double beta = 0;             ///< Exact mean: coefficient of 1 / X
+        double fill_fraction = 0;    ///< Weight share of snapshots filling the segment
+        double partial_term = 0;     ///< Short books' contribution to impact_with_partial
+    };
+    
+    /**
+     * @brief Add rows [begin, end) of a store for one side (rows with mid <= 0 are skipped)
+     */
+    void add(const SnapshotStore& store, size_t begin, size_t end, Side side) {
+        for (size_t row = begin; row < end; ++row) {
+            const double mid_price = store.midPrice(row);
+            if (mid_price <= 0) continue;
+            addRow(store, row, mid_price, side);
+        }
+    }
+    
+    /**
+     * @brief Add the changes of another curve (before finalize())
+     */
+    void merge(const PiecewiseImpactCurve& other) {
+        for (const auto& entry : other.deltas) deltas[entry.first] += entry.second;
+        total_weight += other.total_weight;
+    }
+    
+    /**
+     * @brief Turn the recorded changes into segments (call once, after the last add/merge)
+     */
+    void finalize() {
+        std::vector<std::pair<int64_t, Coeffs>> sorted(deltas.begin(), deltas.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        deltas.clear();
+        segments.clear();
+        segments.reserve(sorted.size());
+        long double a = 0, b = 0, fill = 0, partial = 0;
+        int64_t fills = 0;
+        for (const auto& entry : sorted) {
+            a += entry.second.a;
+            b += entry.second.b;
+            fill += entry.second.fill;
+            partial += entry.second.partial;
+            fills += entry.second.fills;
+            Segment segment;
+            segment.from = entry.first;
+            // The weighted sums of +w/-w changes keep a rounding residue once every
+            // book has dropped out, so emptiness is decided on the exact count
+            if (fills > 0 && fill > 0) {
+                segment.alpha = static_cast<double>(a / fill);
+                segment.beta = static_cast<double>(b / fill);
+                if (total_weight > 0) segment.fill_fraction = static_cast<double>(fill / total_weight);
+            }
+            if (total_weight > 0) segment.partial_term = static_cast<double>(partial / total_weight);
+            segments.push_back(segment);
+        }
+    }
+    
+    /**
+     * @brief g at order size x >= 1 in O(log k)
+     * @return false before finalize(), for x < 1, or without any snapshot
+     */
+    bool evaluate(int64_t x, Point& point) const {
+        if (x < 1 || segments.empty() || x < segments.front().from) return false;
+        auto it = std::upper_bound(segments.begin(), segments.end(), x,
+                                   [](int64_t v, const Segment& segment) { return v < segment.from; });
+        const Segment& segment = *(it - 1);
+        const double exact = segment.alpha + segment.beta / static_cast<double>(x);
+        point.fill_fraction = segment.fill_fraction;
+        point.impact = segment.fill_fraction > 0 ? exact : std::numeric_limits<double>::quiet_NaN();
+        point.impact_with_partial = (segment.fill_fraction > 0 ? segment.fill_fraction * exact : 0.0) + segment.partial_term;
+        return true;
+    }
+    
+    size_t breakpoints() const { return segments.size(); }
+    const std::vector<Segment>& pieces() const { return segments; }
+    
+    /**
+     * @brief Write the segments as CSV: from_shares,to_shares,alpha,beta,fill_fraction,partial_term
+     * @return false if the file could not be written
+     * 
+     * On [from_shares, to_shares], g(X) = alpha + beta / X over the
+     * snapshots that fill X; the grid engines' value is
+     * fill_fraction * g(X) + partial_term. The last segment is open-ended.
+     */
+    bool save(const std::string& filename) const {
+        std::ofstream file(filename);
+        if (!file.is_open()) return false;
+        file << "from_shares,to_shares,alpha,beta,fill_fraction,partial_term\n";
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const Segment& segment = segments[i];
+            file << segment.from << ",";
+            if (i + 1 < segments.size()) file << segments[i + 1].from - 1;
+            file << std::setprecision(17) << "," << segment.alpha << "," << segment.beta << ","
+                 << segment.fill_fraction << "," << segment.partial_term << "\n";
+        }
+        return true;
+    }
+    
+private:
+    struct Coeffs {
+        double a = 0;        ///< Weighted constant terms of snapshots that fill
+        double b = 0;        ///< Weighted 1 / X coefficients of snapshots that fill
+        double fill = 0;     ///< Weight of snapshots that fill
+        double partial = 0;  ///< Weighted g(D) of snapshots shorter than X
+        int64_t fills = 0;   ///< Number of snapshots that fill (exact, unlike fill)
+        
+        Coeffs& operator+=(const Coeffs& other) {
+            a += other.a;
+            b += other.b;
+            fill += other.fill;
+            partial += other.partial;
+            fills += other.fills;
+            return *this;
+        }
+    };
+    
+    std::unordered_map<int64_t, Coeffs> deltas;  ///< Change of the sums at each breakpoint size
+    double total_weight = 0;                     ///< Weight of snapshots with a non-empty side
+    std::vector<Segment> segments;               ///< Built by finalize(), ascending from
+    
+    void addRow(const SnapshotStore& store, size_t row, double mid_price, Side side) {
+        const bool buy = side == Side::Buy;
+        const double sign = buy ? 1.0 : -1.0;
+        const double* prices = buy ? store.askPrices(row) : store.bidPrices(row);
+        const int* sizes = buy ? store.askSizes(row) : store.bidSizes(row);
+        size_t visible = 0;
+        while (visible < kBookLevels && prices[visible] > 0 && sizes[visible] > 0) ++visible;
+        if (visible == 0) return;
+        
+        const double w = store.rowWeight(row);
+        total_weight += w;
+        double a = sign * (prices[0] - mid_price) / mid_price;
+        double b = 0.0;          // sign * (C_{j-1} - Q_{j-1} p_j) / mid
+        int64_t depth = 0;       // Q_j
+        deltas[1] += Coeffs{w * a, 0.0, w, 0.0, 1};
+        for (size_t j = 0; j + 1 < visible; ++j) {
+            depth += sizes[j];
+            const double next_b = b + sign * static_cast<double>(depth) * (prices[j] - prices[j + 1]) / mid_price;
+            const double next_a = sign * (prices[j + 1] - mid_price) / mid_price;
+            deltas[depth + 1] += Coeffs{w * (next_a - a), w * (next_b - b), 0.0, 0.0, 0};
+            a = next_a;
+            b = next_b;
+        }
+        depth += sizes[visible - 1];
+        const double full_depth = a + b / static_cast<double>(depth);
+        deltas[depth + 1] += Coeffs{-w * a, -w * b, -w, w * full_depth, -1};
+    }
+};
+
+/**
+ * @class ColumnarWriter
+ * @brief Batched writer of .obcol columnar result files
+ * 
+ * Rows are buffered per column and written every batch_rows rows as a row
+ * group, so memory stays bounded however many rows are emitted. Float64
+ * columns are stored plain, each chunk starting on a 64-byte boundary, so
+ * a reader can map a single-group column without copying. Int64 columns
+ * are delta encoded within the group, zigzagged and written as LEB128
+ * varints, which shrinks sorted or repetitive keys (timestamps, order
+ * sizes, counts) to a byte or two per row.
+ * 
+ * File layout (native byte order; create_cpp_charts.py reads it as
+ * little-endian): 8-byte magic "OBCOL\0\0\0" padded to 64 bytes, the
+ * column chunks, then a footer - uint32 version, column count, uint64
+ * rows, uint32 row groups, metadata entries; per column uint8 encoding,
+ * uint8 reserved, uint16 name length and name; per metadata entry uint16
+ * key length, key, uint32 value length, value; per row group uint64 rows
+ * and per column uint64 offset and byte length - and finally the uint64
+ * footer offset and the magic "OBCOLEND". The file is written to a
+ * temporary name unique to the writer and renamed by finish(), so runs
+ * or shards writing the same path never share a temporary file.
+ */
+class ColumnarWriter {
+public:
+    static constexpr uint32_t kVersion = 1;          ///< Bump when the layout changes
+    static constexpr size_t kBatchRows = 65536;      ///< Default rows per row group
+    
+    enum class Encoding : uint8_t {
+        Float64 = 0,     ///< Plain IEEE doubles
+        DeltaInt64 = 1   ///< Zigzag varint deltas of int64 values
+    };
+    
+    explicit ColumnarWriter(std::string file_path, size_t batch = kBatchRows)
+        : path(std::move(file_path)), temp(path + "." + uniqueToken() + ".tmp"), batch_rows(std::max<size_t>(batch, 1)),
+          out(temp, std::ios::binary | std::ios::trunc) {
+        out.write("OBCOL\0\0\0", 8);
+        pad();
+    }
+    
+    ~ColumnarWriter() {
+        if (!finished) {
+            out.close();
+            std::error_code ec;
+            fs::remove(temp, ec);
+        }
+    }
+    
+    ColumnarWriter(const ColumnarWriter&) = delete;
+    ColumnarWriter& operator=(const ColumnarWriter&) = delete;
+    
+    /**
+     * @brief Declare a column (before the first row)
+     * @return Column index for append()
+     */
+    size_t addColumn(const std::string& name, Encoding encoding) {
+        columns.push_back(Column{name, encoding, {}, {}});
+        return columns.size() - 1;
+    }
+    
+    /**
+     * @brief Attach a key/value string to the file (symbol, side, grid, ...)
+     */
+    void setMetadata(const std::string& key, const std::string& value) { metadata.emplace_back(key, value); }
+    
+    void append(size_t column, double value) { columns[column].floats.push_back(value); }
+    void append(size_t column, int64_t value) { columns[column].ints.push_back(value); }
+    
+    /**
+     * @brief Close the current row; every column must have received one value
+     */
+    void endRow() {
+        if (++buffered == batch_rows) flush();
+    }
+    
+    bool isOpen() const { return out.is_open(); }
+    
+    /**
+     * @brief Write the last row group and the footer, then move the file into place
+     * @return false if any write failed (the partial file is removed)
+     */
+    bool finish() {
+        if (!out.is_open()) return false;
+        flush();
+        const uint64_t footer_offset = static_cast<uint64_t>(out.tellp());
+        writePod(out, kVersion);
+        writePod(out, static_cast<uint32_t>(columns.size()));
+        writePod(out, rows);
+        writePod(out, static_cast<uint32_t>(groups.size()));
+        writePod(out, static_cast<uint32_t>(metadata.size()));
+        for (const Column& column : columns) {
+            writePod(out, static_cast<uint8_t>(column.encoding));
+            writePod(out, static_cast<uint8_t>(0));
+            writePod(out, static_cast<uint16_t>(column.name.size()));
+            out.write(column.name.data(), static_cast<std::streamsize>(column.name.size()));
+        }
+        for (const auto& entry : metadata) {
+            writePod(out, static_cast<uint16_t>(entry.first.size()));
+            out.write(entry.first.data(), static_cast<std::streamsize>(entry.first.size()));
+            writePod(out, static_cast<uint32_t>(entry.second.size()));
+            out.write(entry.second.data(), static_cast<std::streamsize>(entry.second.size()));
+        }
+        for (const Group& group : groups) {
+            writePod(out, group.rows);
+            for (const auto& chunk : group.chunks) {
+                writePod(out, chunk.first);
+                writePod(out, chunk.second);
+            }
+        }
+        writePod(out, footer_offset);
+        out.write("OBCOLEND", 8);
+        const bool ok = out.good();
+        out.close();
+        
+        std::error_code ec;
+        if (ok) fs::rename(temp, path, ec);
+        if (!ok || ec) {
+            fs::remove(temp, ec);
+            return false;
+        }
+        finished = true;
+        return true;
+    }
+    
+    uint64_t rowCount() const { return rows + buffered; }
+    
+private:
+    struct Column {
+        std::string name;
+        Encoding encoding;
+        std::vector<double> floats;   ///< Buffered Float64 values
+        std::vector<int64_t> ints;    ///< Buffered DeltaInt64 values
+    };
+    struct Group {
+        uint64_t rows = 0;
+        std::vector<std::pair<uint64_t, uint64_t>> chunks;  ///< (offset, bytes) per column
+    };
+    
+    std::string path;
+    std::string temp;
+    size_t batch_rows;
+    std::ofstream out;
+    std::vector<Column> columns;
+    std::vector<std::pair<std::string, std::string>> metadata;
+    std::vector<Group> groups;
+    std::vector<uint8_t> scratch;   ///< Encoded chunk, reused across groups
+    uint64_t rows = 0;              ///< Rows in written groups
+    size_t buffered = 0;            ///< Rows in the current group
+    bool finished = false;
+    
+    void pad() {
+        static const char zeros[64] = {};
+        const auto position = static_cast<uint64_t>(out.tellp());
+        if (position % 64) out.write(zeros, static_cast<std::streamsize>(64 - position % 64));
+    }
+    
+    void flush() {
+        if (buffered == 0) return;
+        Group group;
+        group.rows = buffered;
+        for (Column& column : columns) {
+            pad();
+            const auto offset = static_cast<uint64_t>(out.tellp());
+            uint64_t bytes = 0;
+            if (column.encoding == Encoding::Float64) {
+                bytes = column.floats.size() * sizeof(double);
+                out.write(reinterpret_cast<const char*>(column.floats.data()), static_cast<std::streamsize>(bytes));
+                column.floats.clear();
+            } else {
+                scratch.clear();
+                int64_t previous = 0;
+                for (int64_t value : column.ints) {
+                    const uint64_t delta = static_cast<uint64_t>(value) - static_cast<uint64_t>(previous);
+                    uint64_t zigzag = (delta << 1) ^ (static_cast<int64_t>(delta) < 0 ? ~uint64_t{0} : uint64_t{0});
+                    previous = value;
+                    while (zigzag >= 0x80) {
+                        scratch.push_back(static_cast<uint8_t>(zigzag | 0x80));
+                        zigzag >>= 7;
+                    }
+                    scratch.push_back(static_cast<uint8_t>(zigzag));
+                }
+                bytes = scratch.size();
+                out.write(reinterpret_cast<const char*>(scratch.data()), static_cast<std::streamsize>(bytes));
+                column.ints.clear();
+            }
+            group.chunks.emplace_back(offset, bytes);
+        }
+        groups.push_back(std::move(group));
+        rows += buffered;
+        buffered = 0;
+    }
+};
+
+/**
+ * @class ImpactSurface
+ * @brief Buy and sell g(X) per time-of-day bucket, i.e. [bucket x order size] surfaces
+ * 
+ * Buckets are fixed-width slices of the UTC day taken from the integer
+ * ts_event column. The analyzer fills a surface inside its chunked curve
+ * pass (OrderBookAnalyzer::reduceChunks()): each run of consecutive rows
+ * in one bucket is evaluated once and its sums go to both the curve and
+ * the bucket's cell, with per-chunk surfaces merge()d in chunk order.
+ * add() evaluates rows on their own instead: it groups them into bucket
+ * runs with one linear scan and evaluates each bucket's runs with the
+ * regular row-range kernel, one bucket per task. Either way the surface
+ * is independent of thread count.
+ */
+class ImpactSurface {
+public:
+    /**
+     * @struct Cell
+     * @brief Accumulators of one time bucket
+     */
+    struct Cell {
+        ImpactAccumulator buy;
+        ImpactAccumulator sell;
+        double books = 0;  ///< Weight of the bucket's rows with a positive mid price
+    };
+    
+    ImpactSurface(const OrderSizeGrid& g, int bucket_minutes)
+        : grid(g), bucket_ns(static_cast<int64_t>(bucket_minutes) * 60 * 1000000000LL) {}
+    
+    /**
+     * @brief Empty surface with the same grid and bucket width
+     */
+    ImpactSurface emptyCopy() const {
+        ImpactSurface out(grid, 1);
+        out.bucket_ns = bucket_ns;
+        return out;
+    }
+    
+    /**
+     * @brief Bucket index (within the day) of a timestamp
+     */
+    int64_t bucketOf(int64_t ts_ns) const {
+        constexpr int64_t kDayNs = 86400LL * 1000000000LL;
+        return ((ts_ns % kDayNs + kDayNs) % kDayNs) / bucket_ns;
+    }
+    
+    /**
+     * @brief Cell of a bucket, created empty on first use
+     */
+    Cell& cell(int64_t bucket) {
+        auto it = cells.find(bucket);
+        if (it == cells.end()) it = cells.emplace(bucket, Cell{ImpactAccumulator(grid), ImpactAccumulator(grid)}).first;
+        return it->second;
+    }
+    
+    /**
+     * @brief Weight of the rows in [begin, end) with a positive mid price (Cell::books)
+     */
+    static double bookWeight(const SnapshotStore& store, size_t begin, size_t end) {
+        double books = 0;
+        for (size_t row = begin; row < end; ++row) {
+            if (store.midPrice(row) > 0) books += store.rowWeight(row);
+        }
+        return books;
+    }
+    
+    /**
+     * @brief Add the cells of a surface over later rows
+     */
+    void merge(const ImpactSurface& other) {
+        for (const auto& entry : other.cells) {
+            Cell& target = cell(entry.first);
+            target.buy.merge(entry.second.buy);
+            target.sell.merge(entry.second.sell);
+            target.books += entry.second.books;
+        }
+    }
+    
+    void clear() { cells.clear(); }
+    
+    /**
+     * @brief Add rows [begin, end) of a store to both sides' surfaces
+     * @param parallel Callable (count, fn) running fn(0) ... fn(count - 1)
+     */
+    template <typename Parallel>
+    void add(const SnapshotStore& store, size_t begin, size_t end, ImpactKernel kernel, Parallel&& parallel) {
+        std::map<int64_t, std::vector<std::pair<size_t, size_t>>> runs;
+        for (size_t row = begin; row < end;) {
+            const int64_t bucket = bucketOf(store.ts_ns[row]);
+            size_t run_end = row + 1;
+            while (run_end < end && bucketOf(store.ts_ns[run_end]) == bucket) ++run_end;
+            runs[bucket].emplace_back(row, run_end);
+            row = run_end;
+        }
+        
+        std::vector<std::pair<Cell*, const std::vector<std::pair<size_t, size_t>>*>> work;
+        for (const auto& entry : runs) work.emplace_back(&cell(entry.first), &entry.second);
+        parallel(work.size(), [&](size_t i) {
+            for (const auto& run : *work[i].second) {
+                kernel(store, run.first, run.second, Side::Buy, work[i].first->buy);
+                kernel(store, run.first, run.second, Side::Sell, work[i].first->sell);
+                work[i].first->books += bookWeight(store, run.first, run.second);
+            }
+        });
+    }
+    
+    /**
+     * @brief Write one side as CSV: bucket_start,order_size,avg_impact,impact_bps,snapshots
+     * @return false if the file could not be written
+     */
+    bool save(const std::string& filename, Side side) const {
+        std::ofstream file(filename);
+        if (!file.is_open()) return false;
+        file << "bucket_start,order_size,avg_impact,impact_bps,snapshots\n";
+        for (const auto& entry : cells) {
+            const ImpactAccumulator& acc = side == Side::Buy ? entry.second.buy : entry.second.sell;
+            const std::string label = bucketLabel(entry.first);
+            for (size_t k = 0; k < acc.impact_sum.size(); ++k) {
+                if (acc.count[k] == 0 || acc.weight_sum[k] <= 0) continue;
+                double avg_impact = acc.impact_sum[k] / acc.weight_sum[k];
+                file << label << "," << acc.grid.orderSize(k) << ","
+                     << std::fixed << std::setprecision(6) << avg_impact << ","
+                     << std::fixed << std::setprecision(6) << avg_impact * 10000.0 << ","
+                     << acc.count[k] << "\n";
+            }
+        }
+        return true;
+    }
+    
+    /**
+     * @brief Write one side as .obcol: bucket_start_min,order_size,avg_impact,impact_bps,snapshots
+     * @param writer Fresh writer (columns are added here)
+     * @return false if the file could not be written
+     * 
+     * Same rows as save(); bucket_start_min is the bucket start in minutes
+     * after midnight UTC.
+     */
+    bool saveColumnar(ColumnarWriter& writer, Side side) const {
+        using Encoding = ColumnarWriter::Encoding;
+        const size_t start_col = writer.addColumn("bucket_start_min", Encoding::DeltaInt64);
+        const size_t size_col = writer.addColumn("order_size", Encoding::DeltaInt64);
+        const size_t avg_col = writer.addColumn("avg_impact", Encoding::Float64);
+        const size_t bps_col = writer.addColumn("impact_bps", Encoding::Float64);
+        const size_t count_col = writer.addColumn("snapshots", Encoding::DeltaInt64);
+        for (const auto& entry : cells) {
+            const ImpactAccumulator& acc = side == Side::Buy ? entry.second.buy : entry.second.sell;
+            const int64_t minutes = entry.first * bucket_ns / 60000000000LL;
+            for (size_t k = 0; k < acc.impact_sum.size(); ++k) {
+                if (acc.count[k] == 0 || acc.weight_sum[k] <= 0) continue;
+                double avg_impact = acc.impact_sum[k] / acc.weight_sum[k];
+                writer.append(start_col, minutes);
+                writer.append(size_col, static_cast<int64_t>(acc.grid.orderSize(k)));
+                writer.append(avg_col, avg_impact);
+                writer.append(bps_col, avg_impact * 10000.0);
+                writer.append(count_col, static_cast<int64_t>(acc.count[k]));
+                writer.endRow();
+            }
+        }
+        return writer.finish();
+    }
+    
+    size_t buckets() const { return cells.size(); }
+    const OrderSizeGrid& orderSizes() const { return grid; }
+    
+    /**
+     * @brief Indices (within the day) of the buckets holding data, ascending
+     */
+    std::vector<int64_t> bucketIndices() const {
+        std::vector<int64_t> indices;
+        for (const auto& entry : cells) indices.push_back(entry.first);
+        return indices;
+    }
+    
+    /**
+     * @brief Average impact per grid point of one bucket
+     * @param min_share Smallest share of the bucket's book weight that must
+     *        contribute to a size for it to count (0 = any snapshot)
+     * @return One value per order size; infinity where fewer snapshots of the
+     *         bucket contributed to that size
+     * 
+     * Which snapshots contribute is the kernel's partial fill policy: under
+     * Average every non-empty book counts at every size, so only a surface
+     * built with the Skip kernel is infinite where too few snapshots of the
+     * bucket had the depth to fill the size. The mean over the books that
+     * did fill is conditioned on their depth, so without a minimum share one
+     * rare deep book makes a large size look cheap.
+     */
+    std::vector<double> bucketCurve(int64_t bucket, Side side, double min_share = 0.0) const {
+        std::vector<double> curve(grid.points(), std::numeric_limits<double>::infinity());
+        auto it = cells.find(bucket);
+        if (it == cells.end()) return curve;
+        const ImpactAccumulator& acc = side == Side::Buy ? it->second.buy : it->second.sell;
+        const double required = min_share * it->second.books;
+        for (size_t k = 0; k < curve.size(); ++k) {
+            if (acc.count[k] > 0 && acc.weight_sum[k] > 0 && acc.weight_sum[k] >= required) {
+                curve[k] = acc.impact_sum[k] / acc.weight_sum[k];
+            }
+        }
+        return curve;
+    }
+    
+    /**
+     * @brief Bucket start as "HH:MM" (UTC)
+     */
+    std::string bucketLabel(int64_t bucket) const {
+        const int64_t minutes = bucket * bucket_ns / 60000000000LL;
+        char label[32];
+        std::snprintf(label, sizeof(label), "%02d:%02d", static_cast<int>(minutes / 60), static_cast<int>(minutes % 60));
+        return label;
+    }
+    
+private:
+    OrderSizeGrid grid;
+    int64_t bucket_ns;                 ///< Bucket width
+    std::map<int64_t, Cell> cells;     ///< Non-empty buckets by index within the day
+};
+
+/**
+ * @class ExecutionSolver
+ * @brief Optimal split of a parent order over intervals with measured impact curves
+ * 
+ * Minimizes the total temporary impact cost sum_i x_i * g_i(x_i) subject
+ * to sum_i x_i = S, where x_i is a multiple of the grid step no larger
+ * than the grid maximum and g_i is interval i's impact curve (typically a
+ * time-of-day bucket of an ImpactSurface). The curves are measured, not
+ * fitted, so they need not be convex and a marginal-cost greedy could
+ * stop in a local optimum; solve() therefore runs an exact min-plus
+ * dynamic program over the intervals in O(intervals x sizes x S/step).
+ * The inner loop runs over all partial totals at once for a fixed child
+ * size, a branch-free min/select that the compiler vectorizes. Cost
+ * tables are built once, so one solver serves many solve() calls.
+ */
+class ExecutionSolver {
+public:
+    /**
+     * @struct Schedule
+     * @brief Result of solve()
+     */
+    struct Schedule {
+        bool feasible = false;      ///< false if S cannot be split within the curves
+        std::vector<int> shares;    ///< Shares per interval
+        double cost = 0;            ///< sum_i x_i * g_i(x_i) (in shares x fraction of mid)
+        
+        /// Share-weighted average impact of the whole order, in basis points
+        double impactBps(int total_shares) const {
+            return total_shares > 0 ? cost / total_shares * 10000.0 : 0.0;
+        }
+    };
+    
+    /**
+     * @param step Grid step in shares (child orders are multiples of it)
+     * @param curves Per interval, g at step, 2*step, ... (infinity = size not available)
+     */
+    ExecutionSolver(int step, const std::vector<std::vector<double>>& curves)
+        : grid_step(step), sizes(0) {
+        for (const auto& curve : curves) sizes = std::max(sizes, curve.size());
+        cost.assign(curves.size() * (sizes + 1), std::numeric_limits<double>::infinity());
+        for (size_t i = 0; i < curves.size(); ++i) {
+            double* row = cost.data() + i * (sizes + 1);
+            row[0] = 0.0;  // trading nothing is always possible and free
+            for (size_t k = 0; k < curves[i].size(); ++k) {
+                row[k + 1] = static_cast<double>(grid_step) * static_cast<double>(k + 1) * curves[i][k];
+            }
+        }
+    }
+    
+    /**
+     * @brief Solver over one side of a surface, one interval per bucket (ascending time)
+     * @param min_share Share of a bucket's books that must fill a child size
+     *        (see ImpactSurface::bucketCurve())
+     * 
+     * For schedules that respect the visible depth, pass a surface built
+     * with the Skip kernel and a minimum share.
+     */
+    static ExecutionSolver fromSurface(const ImpactSurface& surface, Side side, double min_share = 0.0) {
+        std::vector<std::vector<double>> curves;
+        for (int64_t bucket : surface.bucketIndices()) curves.push_back(surface.bucketCurve(bucket, side, min_share));
+        return ExecutionSolver(surface.orderSizes().step, curves);
+    }
+    
+    size_t intervals() const { return cost.size() / (sizes + 1); }
+    
+    /**
+     * @brief Cheapest allocation of total_shares over the intervals
+     * @param total_shares Parent order size; must be a positive multiple of the step
+     * 
+     * Ties go to the allocation that puts fewer shares into later intervals.
+     */
+    Schedule solve(int total_shares) const {
+        Schedule schedule;
+        const size_t n = intervals();
+        if (total_shares <= 0 || grid_step <= 0 || total_shares % grid_step != 0 || n == 0) return schedule;
+        const size_t target = static_cast<size_t>(total_shares / grid_step);
+        if (target > n * sizes) return schedule;
+        
+        const double inf = std::numeric_limits<double>::infinity();
+        std::vector<double> best(target + 1, inf), next(target + 1);
+        std::vector<uint32_t> choice(n * (target + 1), 0);
+        best[0] = 0.0;  // no interval used yet
+        for (size_t i = 0; i < n; ++i) {
+            const double* row = cost.data() + i * (sizes + 1);
+            uint32_t* pick = choice.data() + i * (target + 1);
+            std::fill(next.begin(), next.end(), inf);
+            for (size_t k = 0; k <= std::min(sizes, target); ++k) {
+                const double c = row[k];
+                if (c == inf) continue;
+                const double* prev = best.data();
+                double* out = next.data() + k;
+                uint32_t* arg = pick + k;
+                const size_t count = target + 1 - k;
+                for (size_t m = 0; m < count; ++m) {
+                    const double candidate = c + prev[m];
+                    const bool better = candidate < out[m];
+                    out[m] = better ? candidate : out[m];
+                    arg[m] = better ? static_cast<uint32_t>(k) : arg[m];
+                }
+            }
+            best.swap(next);
+        }
+        if (best[target] == inf) return schedule;
+        
+        schedule.feasible = true;
+        schedule.cost = best[target];
+        schedule.shares.assign(n, 0);
+        size_t remaining = target;
+        for (size_t i = n; i-- > 0;) {
+            const uint32_t k = choice[i * (target + 1) + remaining];
+            schedule.shares[i] = static_cast<int>(k) * grid_step;
+            remaining -= k;
+        }
+        return schedule;
+    }
+    
+private:
+    int grid_step;              ///< Shares per grid point
+    size_t sizes;               ///< Grid points per interval
+    std::vector<double> cost;   ///< intervals x (sizes + 1): cost of k steps, k = 0 .. sizes
+};
+
+/**
+ * @class PartialResults
+ * @brief Mergeable per-day sums of one symbol, the unit exchanged by sharded runs
+ * 
+ * A shard worker (--partials-out) writes, for each day file it processed,
+ * the market statistics sums and the buy/sell accumulators (with sketches
+ * under --distribution) instead of averaged curves. Averages do not
+ * combine, but these sums do: --reduce merges any set of partial files
+ * day by day in date order and only then forms the averages, so the
+ * result does not depend on how days were assigned to workers. Every
+ * worker writes a file for every symbol, without days if it was given
+ * none, recording its shard index and count, so the reduce step can tell
+ * a shard that had nothing to do from one whose output is missing.
+ * 
+ * File layout (native byte order): Header, then per day a DayHeader
+ * followed by the buy and the sell accumulator (ImpactAccumulator::write).
+ */
+class PartialResults {
+public:
+    static constexpr uint32_t kVersion = 2;  ///< Bump when the layout changes (2: shard index and count)
+    
+    /**
+     * @struct Day
+     * @brief Sums of one trading day
+     */
+    struct Day {
+        std::string date;            ///< "YYYY-MM-DD"
+        uint64_t snapshots = 0;      ///< Rows loaded (before any time-weighted collapsing)
+        MarketStats stats;           ///< Statistics sums over the loaded rows
+        ImpactAccumulator buy;       ///< Buy-side impact sums
+        ImpactAccumulator sell;      ///< Sell-side impact sums
+    };
+    
+    std::string symbol;                             ///< Symbol the days belong to
+    OrderSizeGrid grid;                             ///< Grid of every accumulator
+    Averaging averaging = Averaging::PerSnapshot;   ///< Weighting the sums were built with
+    bool distribution = false;                      ///< Accumulators carry sketches
+    int shard_index = 0;                            ///< Shard that wrote the file
+    int shard_count = 1;                            ///< Shards the run was split into
+    std::vector<Day> days;                          ///< Processed days, in date order
+    
+    /**
+     * @brief Empty day with accumulators matching this file's configuration
+     */
+    Day makeDay(const std::string& date) const {
+        return Day{date, 0, MarketStats(), ImpactAccumulator(grid, distribution), ImpactAccumulator(grid, distribution)};
+    }
+    
+    /**
+     * @brief Write the file atomically (temporary file + rename)
+     * @return false if the file could not be written or the symbol is too long
+     */
+    bool save(const fs::path& path) const {
+        Header header = makeHeader();
+        if (symbol.size() >= sizeof(header.symbol)) return false;
+        std::strncpy(header.symbol, symbol.c_str(), sizeof(header.symbol) - 1);
+        header.days = days.size();
+        
+        std::error_code ec;
+        fs::path temp = path;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return false;
+            writePod(out, header);
+            for (const Day& day : days) {
+                DayHeader day_header{};
+                std::strncpy(day_header.date, day.date.c_str(), sizeof(day_header.date) - 1);
+                day_header.snapshots = day.snapshots;
+                day_header.stats = day.stats;
+                writePod(out, day_header);
+                day.buy.write(out);
+                day.sell.write(out);
+            }
+            if (!out.good()) {
+                out.close();
+                fs::remove(temp, ec);
+                return false;
+            }
+        }
+        fs::rename(temp, path, ec);
+        if (ec) fs::remove(temp, ec);
+        return !ec;
+    }
+    
+    /**
+     * @brief Read a file written by save()
+     * @return false if the file is missing, truncated or of another version
+     */
+    static bool load(const fs::path& path, PartialResults& out) {
+        std::ifstream in(path, std::ios::binary);
+        Header header;
+        if (!in.is_open() || !readPod(in, header) || std::memcmp(header.magic, "OBPART\0", 8) != 0 ||
+            header.version != kVersion || header.averaging > static_cast<uint32_t>(Averaging::TimeWeighted)) {
+            return false;
+        }
+        header.symbol[sizeof(header.symbol) - 1] = '\0';
+        out.symbol = header.symbol;
+        out.grid = OrderSizeGrid{header.grid_step, header.max_shares};
+        out.averaging = static_cast<Averaging>(header.averaging);
+        out.distribution = header.distribution != 0;
+        out.shard_index = header.shard_index;
+        out.shard_count = header.shard_count;
+        if (out.shard_count < 1 || out.shard_index < 0 || out.shard_index >= out.shard_count) return false;
+        out.days.clear();
+        for (uint64_t d = 0; d < header.days; ++d) {
+            DayHeader day_header;
+            if (!readPod(in, day_header)) return false;
+            day_header.date[sizeof(day_header.date) - 1] = '\0';
+            Day day = out.makeDay(day_header.date);
+            day.snapshots = day_header.snapshots;
+            day.stats = day_header.stats;
+            if (!day.buy.read(in) || !day.sell.read(in)) return false;
+            out.days.push_back(std::move(day));
+        }
+        return true;
+    }
+    
+    /**
+     * @brief Take over the days of another partial of the same symbol
+     * @return false if the configurations or shard counts differ or a day is present twice
+     */
+    bool absorb(PartialResults&& other) {
+        if (other.symbol != symbol || other.grid.step != grid.step || other.grid.max_shares != grid.max_shares ||
+            other.averaging != averaging || other.distribution != distribution || other.shard_count != shard_count) {
+            return false;
+        }
+        for (Day& day : other.days) {
+            auto at = std::lower_bound(days.begin(), days.end(), day.date,
+                                       [](const Day& d, const std::string& date) { return d.date < date; });
+            if (at != days.end() && at->date == day.date) return false;
+            days.insert(at, std::move(day));
+        }
+        return true;
+    }
+    
+    /**
+     * @brief Merge all days, in date order
+     * @return Total snapshots loaded over those days
+     */
+    uint64_t reduce(MarketStats& stats, ImpactAccumulator& buy, ImpactAccumulator& sell) const {
+        uint64_t snapshots = 0;
+        for (const Day& day : days) {
+            stats.merge(day.stats);
+            buy.merge(day.buy);
+            sell.merge(day.sell);
+            snapshots += day.snapshots;
+        }
+        return snapshots;
+    }
+    
+private:
+    /**
+     * @struct Header
+     * @brief On-disk file header
+     */
+    struct Header {
+        char magic[8];         ///< "OBPART" + NULs
+        uint32_t version;      ///< kVersion
+        uint32_t averaging;    ///< Averaging enumerator
+        int32_t grid_step;     ///< OrderSizeGrid::step
+        int32_t max_shares;    ///< OrderSizeGrid::max_shares
+        uint32_t distribution; ///< 1 if accumulators carry sketches
+        int32_t shard_index;   ///< PartialResults::shard_index
+        int32_t shard_count;   ///< PartialResults::shard_count
+        uint32_t reserved;     ///< Zero
+        uint64_t days;         ///< Number of day records
+        char symbol[16];       ///< Symbol, NUL padded
+    };
+    
+    /**
+     * @struct DayHeader
+     * @brief On-disk prefix of a day record
+     */
+    struct DayHeader {
+        char date[16];         ///< Trading date, NUL padded
+        uint64_t snapshots;    ///< Day::snapshots
+        MarketStats stats;     ///< Day::stats
+    };
+    
+    Header makeHeader() const {
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "OBPART\0", 8);
+        header.version = kVersion;
+        header.averaging = static_cast<uint32_t>(averaging);
+        header.grid_step = grid.step;
+        header.max_shares = grid.max_shares;
+        header.distribution = distribution ? 1 : 0;
+        header.shard_index = shard_index;
+        header.shard_count = shard_count;
+        return header;
+    }
+};
+
+/**
+ * @struct RowSink
+ * @brief Consumer of bounded row batches, used by the loaders in streaming mode
+ * 
+ * When set, a loader hands its store to consume() each time it holds
+ * batch_rows rows and then clears it, so memory stays bounded by the batch.
+ * The batch store is carried across files; the caller flushes the remainder.
+ */
+struct RowSink {
+    size_t batch_rows = kImpactChunkRows;               ///< Rows per consumed batch
+    std::function<void(const SnapshotStore&)> consume;  ///< Batch consumer
+};
+
+/**
+ * @struct IngestCounters
+ * @brief Row accounting and timing of one or more day files
+ * 
+ * Every data row read ends up in exactly one of the rows_* buckets.
+ * Loaders fill a per-file instance without synchronisation; files are
+ * merged into the symbol totals in file order.
+ */
+struct IngestCounters {
+    uint64_t files = 0;               ///< Day files opened
+    uint64_t bytes_read = 0;          ///< CSV or cache bytes consumed
+    uint64_t rows_parsed = 0;         ///< Data rows read (header excluded)
+    uint64_t rows_short = 0;          ///< Rejected: fewer than kMinRowColumns fields
+    uint64_t rows_unparsable = 0;     ///< Rejected: a price or size failed to convert
+    uint64_t rows_empty_book = 0;     ///< Rejected: no positive best bid and ask
+    uint64_t rows_sampled_out = 0;    ///< Valid rows dropped by the sampling spec
+    uint64_t rows_excluded = 0;       ///< Valid rows dropped by --exclude-books
+    uint64_t rows_book_updates = 0;   ///< MBO events applied without ending an event batch
+    uint64_t rows_kept = 0;           ///< Snapshots handed to the analysis
+    uint64_t cache_hits = 0;          ///< Files served from the snapshot cache
+    uint64_t cache_misses = 0;        ///< Files parsed because no valid cache existed
+    uint64_t parse_ns = 0;            ///< Time in the CSV loaders
+    uint64_t cache_read_ns = 0;       ///< Time decoding caches
+    uint64_t cache_write_ns = 0;      ///< Time writing caches
+    
+    void merge(const IngestCounters& other) {
+        files += other.files;
+        bytes_read += other.bytes_read;
+        rows_parsed += other.rows_parsed;
+        rows_short += other.rows_short;
+        rows_unparsable += other.rows_unparsable;
+        rows_empty_book += other.rows_empty_book;
+        rows_sampled_out += other.rows_sampled_out;
+        rows_excluded += other.rows_excluded;
+        rows_book_updates += other.rows_book_updates;
+        rows_kept += other.rows_kept;
+        cache_hits += other.cache_hits;
+        cache_misses += other.cache_misses;
+        parse_ns += other.parse_ns;
+        cache_read_ns += other.cache_read_ns;
+        cache_write_ns += other.cache_write_ns;
+    }
+};
+
+/**
+ * @class ScopedTimer
+ * @brief Adds the lifetime of the object to a nanosecond counter
+ * 
+ * A null target disables the timer: no clock is read, so instrumentation
+ * that is switched off costs one branch per scope.
+ */
+class ScopedTimer {
+private:
+    uint64_t* target;
+    std::chrono::steady_clock::time_point start;
+    
+public:
+    explicit ScopedTimer(uint64_t* ns) : target(ns) {
+        if (target) start = std::chrono::steady_clock::now();
+    }
+    ~ScopedTimer() {
+        if (target) {
+            *target += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+/**
+ * @enum Phase
+ * @brief Timed stages of a symbol's analysis
+ */
+enum class Phase {
+    Load,    ///< File listing, parsing / cache reads and sampling (and, when streaming, the folded stats and impact)
+    Stats,   ///< Separate market statistics pass (fused into Impact when possible)
+    Impact,  ///< Buy and sell impact curves
+    Report,  ///< Console report and CSV output
+    Count
+};
+
+inline const char* phaseName(Phase phase) {
+    static const char* const names[] = {"load", "stats", "impact", "report"};
+    return names[static_cast<size_t>(phase)];
+}
+
+/**
+ * @struct SymbolMetrics
+ * @brief Instrumentation of one symbol
+ */
+struct SymbolMetrics {
+    IngestCounters ingest;                                           ///< Row accounting
+    std::array<uint64_t, static_cast<size_t>(Phase::Count)> phase_ns{};  ///< Wall time per phase
+    
+    uint64_t* phase(Phase p) { return &phase_ns[static_cast<size_t>(p)]; }
+};
+
+/**
+ * @struct PrefetchCounters
+ * @brief What the prefetch stage did during a run (reported with --metrics)
+ */
+struct PrefetchCounters {
+    uint64_t files_read = 0;       ///< Files read ahead by the I/O thread
+    uint64_t bytes_read = 0;       ///< Bytes those reads covered
+    uint64_t files_resident = 0;   ///< Files skipped because they were already in the page cache
+    uint64_t files_claimed = 0;    ///< Files a parser reached before the I/O thread did
+    uint64_t wait_ns = 0;          ///< Time parsers waited for an in-progress read
+    
+    void merge(const PrefetchCounters& other) {
+        files_read += other.files_read;
+        bytes_read += other.bytes_read;
+        files_resident += other.files_resident;
+        files_claimed += other.files_claimed;
+        wait_ns += other.wait_ns;
+    }
+};
+
+/**
+ * @class Prefetcher
+ * @brief I/O stage of the loader: reads the run's upcoming day files ahead of the parsers
+ * 
+ * A dedicated thread walks the files in the order the run will load them
+ * and pulls each into the page cache with large sequential reads
+ * (kReadBytes, POSIX_FADV_SEQUENTIAL), skipping files that are already
+ * resident (mincore). Parsers then map or read the file as before, now
+ * from memory, so storage latency overlaps the parsing and analysis of
+ * the files before it - including those of the previous symbol.
+ * 
+ * Read-ahead is bounded: at most window_bytes of files that were read but
+ * not yet released by a parser, the queue between the I/O and the parse
+ * stage (one file is always allowed, however large). A parser takes a
+ * Lease for its file: if the read is in progress it waits for it; if the
+ * reader has not got there yet the parser claims the file and reads it
+ * itself. When a lease ends the file leaves the window.
+ */
+class Prefetcher {
+public:
+    static constexpr size_t kReadBytes = 4 << 20;  ///< Bytes per sequential read
+    
+    /**
+     * @class Lease
+     * @brief A parser's hold on one scheduled file; releases it on destruction
+     */
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Prefetcher* p, size_t i) : owner(p), index(i) {}
+        Lease(Lease&& other) noexcept : owner(other.owner), index(other.index) { other.owner = nullptr; }
+        Lease& operator=(Lease&&) = delete;
+        Lease(const Lease&) = delete;
+        ~Lease() { if (owner) owner->release(index); }
+        
+    private:
+        Prefetcher* owner = nullptr;
+        size_t index = 0;
+    };
+    
+    /**
+     * @param files (file the parser asks for, file actually read) in load order;
+     *              the two differ when a snapshot cache file will be read instead
+     * @param window_bytes Read-ahead bound
+     */
+    Prefetcher(const std::vector<std::pair<fs::path, fs::path>>& files, uint64_t window_bytes) : window(window_bytes) {
+        for (const auto& file : files) {
+            if (index_of.count(file.first)) continue;
+            std::error_code ec;
+            const uintmax_t bytes = fs::file_size(file.second, ec);
+            index_of[file.first] = entries.size();
+            entries.push_back(Entry{file.second, ec ? 0 : static_cast<uint64_t>(bytes), State::Pending});
+        }
+        reader = std::thread([this] { readLoop(); });
+    }
+    
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        reader.join();
+    }
+    
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+    
+    /**
+     * @brief Take the file for parsing (waits while the I/O thread is reading it)
+     * @return Lease to hold until the file has been parsed (empty for unscheduled files)
+     */
+    Lease acquire(const fs::path& file) {
+        auto it = index_of.find(file);
+        if (it == index_of.end()) return Lease();
+        std::unique_lock<std::mutex> lock(mutex);
+        Entry& entry = entries[it->second];
+        if (entry.state == State::Pending) {
+            entry.state = State::Claimed;
+            stats.files_claimed++;
+        } else if (entry.state == State::Reading) {
+            const auto start = std::chrono::steady_clock::now();
+            changed.wait(lock, [&] { return entry.state != State::Reading; });
+            stats.wait_ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        return Lease(this, it->second);
+    }
+    
+    /**
+     * @brief Drop scheduled files no parser took (a symbol that loaded fewer files, or failed)
+     * 
+     * Files not read yet are skipped; files read ahead leave the window, so
+     * the I/O thread is not held back by reads nobody will claim.
+     */
+    void discard(const std::vector<fs::path>& files) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& file : files) {
+                auto it = index_of.find(file);
+                if (it == index_of.end()) continue;
+                Entry& entry = entries[it->second];
+                if (entry.state == State::Ready) in_flight -= entry.bytes;
+                if (entry.state == State::Pending || entry.state == State::Ready) entry.state = State::Done;
+                if (entry.state == State::Reading) entry.discarded = true;
+            }
+        }
+        changed.notify_all();
+    }
+    
+    PrefetchCounters counters() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+    
+private:
+    enum class State : uint8_t {
+        Pending,  ///< Not read yet
+        Reading,  ///< I/O thread is reading it
+        Ready,    ///< Read ahead, counted in the window
+        Claimed,  ///< A parser got there first
+        Done      ///< Parsed and released
+    };
+    struct Entry {
+        fs::path path;           ///< File to read
+        uint64_t bytes;          ///< Its size
+        State state;
+        bool discarded = false;  ///< Dropped while Reading: Done once the read ends
+    };
+    
+    std::vector<Entry> entries;             ///< Files in load order
+    std::map<fs::path, size_t> index_of;    ///< Requested file -> entry (fixed after construction)
+    uint64_t window;
+    uint64_t in_flight = 0;                 ///< Bytes of Ready (and Reading) entries
+    PrefetchCounters stats;
+    bool stopping = false;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::thread reader;
+    
+    void release(size_t index) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Entry& entry = entries[index];
+            if (entry.state == State::Ready) in_flight -= entry.bytes;
+            entry.state = State::Done;
+        }
+        changed.notify_all();
+    }
+    
+    void readLoop() {
+        std::vector<char> buffer(kReadBytes);
+        std::unique_lock<std::mutex> lock(mutex);
+        for (size_t next = 0;; ++next) {
+            while (next < entries.size() && entries[next].state != State::Pending) ++next;
+            if (next == entries.size()) return;
+            Entry& entry = entries[next];
+            changed.wait(lock, [&] {
+                return stopping || entry.state != State::Pending || in_flight == 0 || in_flight + entry.bytes <= window;
+            });
+            if (stopping) return;
+            if (entry.state != State::Pending) continue;
+            
+            entry.state = State::Reading;
+            in_flight += entry.bytes;
+            const fs::path path = entry.path;
+            lock.unlock();
+            bool resident = false;
+            const uint64_t bytes = warm(path, buffer, resident);
+            lock.lock();
+            if (entry.discarded && entry.state == State::Reading) {
+                entry.state = State::Done;
+                in_flight -= entry.bytes;
+            } else {
+                entry.state = State::Ready;
+            }
+            if (resident) {
+                stats.files_resident++;
+            } else {
+                stats.files_read++;
+                stats.bytes_read += bytes;
+            }
+            changed.notify_all();
+        }
+    }
+    
+    /**
+     * @brief Pull a file into the page cache
+     * @param resident Set when the file was already fully cached (nothing read)
+     * @return Bytes read
+     */
+    static uint64_t warm(const fs::path& path, std::vector<char>& buffer, bool& resident) {
+        uint64_t total = 0;
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary);
+        while (in.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || in.gcount() > 0) {
+            total += static_cast<uint64_t>(in.gcount());
+        }
+        (void)resident;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return 0;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            const size_t length = static_cast<size_t>(st.st_size);
+            void* region = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            if (region != MAP_FAILED) {
+                const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                std::vector<unsigned char> pages((length + page - 1) / page);
+                resident = mincore(region, length, pages.data()) == 0 &&
+                           std::all_of(pages.begin(), pages.end(), [](unsigned char p) { return p & 1; });
+                munmap(region, length);
+            }
+            if (!resident) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                ssize_t got;
+                while ((got = ::read(fd, buffer.data(), buffer.size())) > 0) total += static_cast<uint64_t>(got);
+            }
+        }
+        ::close(fd);
+#endif
+        return total;
+    }
+};
+
+/**
+ * @class Metrics
+ * @brief Per-symbol counters and phase timers, written as a JSON summary
+ * 
+ * Disabled instances hand out null pointers, which turns every counter
+ * merge and ScopedTimer into a no-op.
+ */
+class Metrics {
+private:
+    bool enabled = false;
+    std::vector<std::pair<std::string, SymbolMetrics>> symbols;  ///< In analysis order
+    bool has_prefetch = false;
+    PrefetchCounters prefetch;                                   ///< Set when the run prefetched
+    
+public:
+    explicit Metrics(bool enable = false) : enabled(enable) {}
+    
+    bool isEnabled() const { return enabled; }
+    
+    void setPrefetch(const PrefetchCounters& counters) {
+        prefetch = counters;
+        has_prefetch = true;
+    }
+    
+    /**
+     * @brief Metrics of a symbol, created on first use
+     * @return nullptr when instrumentation is disabled
+     */
+    SymbolMetrics* symbol(const std::string& name) {
+        if (!enabled) return nullptr;
+        for (auto& entry : symbols) {
+            if (entry.first == name) return &entry.second;
+        }
+        symbols.emplace_back(name, SymbolMetrics());
+        return &symbols.back().second;
+    }
+    
+    /**
+     * @brief Write the per-symbol counters and phase times as JSON
+     * @param filename Output path
+     * @param total_ns Wall time of the whole run
+     * @return false if the file could not be written
+     */
+    bool writeJson(const std::string& filename, uint64_t total_ns) const {
+        std::ofstream out(filename);
+        if (!out.is_open()) return false;
+        out << "{\n  \"total_ns\": " << total_ns << ",\n  \"symbols\": {";
+        for (size_t i = 0; i < symbols.size(); ++i) {
+            const IngestCounters& c = symbols[i].second.ingest;
+            out << (i ? "," : "") << "\n    \"" << symbols[i].first << "\": {\n";
+            const std::pair<const char*, uint64_t> fields[] = {
+                {"files", c.files}, {"bytes_read", c.bytes_read}, {"rows_parsed", c.rows_parsed},
+                {"rows_short", c.rows_short}, {"rows_unparsable", c.rows_unparsable},
+                {"rows_empty_book", c.rows_empty_book}, {"rows_sampled_out", c.rows_sampled_out},
+                {"rows_excluded", c.rows_excluded}, {"rows_book_updates", c.rows_book_updates},
+                {"rows_kept", c.rows_kept}, {"cache_hits", c.cache_hits}, {"cache_misses", c.cache_misses},
+                {"parse_ns", c.parse_ns}, {"cache_read_ns", c.cache_read_ns}, {"cache_write_ns", c.cache_write_ns},
+            };
+            for (const auto& field : fields) {
+                out << "      \"" << field.first << "\": " << field.second << ",\n";
+            }
+            out << "      \"phases_ns\": {";
+            for (size_t p = 0; p < static_cast<size_t>(Phase::Count); ++p) {
+                out << (p ? ", " : "") << "\"" << phaseName(static_cast<Phase>(p)) << "\": "
+                    << symbols[i].second.phase_ns[p];
+            }
+            out << "}\n    }";
+        }
+        out << "\n  }";
+        if (has_prefetch) {
+            out << ",\n  \"prefetch\": {\"files_read\": " << prefetch.files_read << ", \"bytes_read\": "
+                << prefetch.bytes_read << ", \"files_resident\": " << prefetch.files_resident
+                << ", \"files_claimed\": " << prefetch.files_claimed << ", \"wait_ns\": " << prefetch.wait_ns << "}";
+        }
+        out << "\n}\n";
+        return out.good();
+    }
+};
+
+/**
+ * @struct ParseLimits
+ * @brief Row limits, streaming hook and counters applied by the CSV loaders
+ */
+struct ParseLimits {
+    int max_rows = std::numeric_limits<int>::max();  ///< Stop after this many kept rows
+    int keep_every = 1;                              ///< Keep every k-th valid row
+    const RowSink* sink = nullptr;                   ///< Batch consumer (streaming mode)
+    IngestCounters* counters = nullptr;              ///< Row accounting (instrumentation)
+};
+
+/**
+ * @brief Reserve store rows for a day file from its size
+ * @param store Store the file is parsed into
+ * @param payload_bytes File bytes after the header
+ * @param row_bytes Length of the first data row, newline included
+ * @param limits Row limit and stride of the parse
+ * @param min_row_bytes Shortest row that can hold a snapshot in this format
+ * 
+ * MBP-10 rows are nearly constant in width, so payload / row_bytes plus a
+ * 1/16 margin covers the file and addRow() never reallocates. A short or
+ * malformed first row is taken as min_row_bytes wide, so it cannot inflate
+ * the reservation beyond the rows the file could possibly hold. Streaming
+ * batches are reserved by their owner and are left alone.
+ */
+inline void reserveForFile(SnapshotStore& store, uint64_t payload_bytes, size_t row_bytes, const ParseLimits& limits,
+                           size_t min_row_bytes = kMinRowBytes) {
+    if (limits.sink || row_bytes == 0) return;
+    uint64_t rows = payload_bytes / std::max(row_bytes, min_row_bytes);
+    rows = (rows + rows / 16 + 1) / static_cast<uint64_t>(limits.keep_every) + 1;
+    rows = std::min<uint64_t>(rows, static_cast<uint64_t>(limits.max_rows));
+    store.reserve(store.size() + static_cast<size_t>(rows));
+}
+
+/**
+ * @class ThreadPool
+ * @brief Fixed-size work-stealing pool of worker threads
+ * 
+ * Each worker owns a deque. Tasks submitted from a worker go to the back
+ * of its own deque and are taken LIFO by that worker (the freshest, most
+ * cache-warm work); tasks submitted from outside are dealt round-robin.
+ * An idle worker steals from the front of the other deques, i.e. the
+ * oldest and typically largest pieces of work. A thread waiting for a
+ * task's result through wait() keeps running pending tasks meanwhile, so
+ * tasks may themselves submit and wait for subtasks (a file task fanning
+ * out into byte-range tasks) without deadlocking the pool.
+ * 
+ * Tasks are submitted as callables and return a std::future; exceptions
+ * thrown by a task are rethrown from future::get().
+ */
+class ThreadPool {
+private:
+    /**
+     * @struct TaskQueue
+     * @brief One worker's deque
+     */
+    struct TaskQueue {
+        std::mutex mutex;                          ///< Guards tasks
+        std::deque<std::function<void()>> tasks;   ///< Owner pops the back, thieves the front
+    };
+    
+    std::vector<std::unique_ptr<TaskQueue>> queues;  ///< One deque per worker
+    std::vector<std::thread> workers;                ///< Worker threads
+    std::mutex sleep_mutex;                          ///< Guards pending and stopping for sleepers
+    std::condition_variable ready;                   ///< Signalled on new task or stop
+    size_t pending = 0;                              ///< Queued, not yet started tasks
+    bool stopping = false;                           ///< Set by the destructor
+    std::atomic<size_t> next_queue{0};               ///< Round-robin target of external submits
+    
+    /**
+     * @brief Worker index of the calling thread in this pool, or size() if none
+     */
+    size_t currentWorker() const {
+        return current_pool() == this ? current_index() : queues.size();
+    }
+    
+    static const ThreadPool*& current_pool() {
+        thread_local const ThreadPool* pool = nullptr;
+        return pool;
+    }
+    static size_t& current_index() {
+        thread_local size_t index = 0;
+        return index;
+    }
+    
+    /**
+     * @brief Take a task: own deque back first, then steal from the others' fronts
+     * @param self Worker index of the caller (size() for outside threads)
+     */
+    bool take(size_t self, std::function<void()>& task) {
+        const size_t n = queues.size();
+        if (self < n) {
+            TaskQueue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return claimed();
+            }
+        }
+        for (size_t offset = 1; offset <= n; ++offset) {
+            const size_t victim = (self + offset) % n;
+            if (victim == self) continue;
+            TaskQueue& queue = *queues[victim];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                return claimed();
+            }
+        }
+        return false;
+    }
+    
+    bool claimed() {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        pending--;
+        return true;
+    }
+    
+public:
+    /**
+     * @brief Start the worker threads
+     * @param threads Number of workers (at least one is started)
+     */
+    explicit ThreadPool(size_t threads) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; ++i) queues.push_back(std::make_unique<TaskQueue>());
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back([this, i] {
+                current_pool() = this;
+                current_index() = i;
+                for (;;) {
+                    std::function<void()> task;
+                    if (take(i, task)) {
+                        task();
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock(sleep_mutex);
+                    ready.wait(lock, [this] { return stopping || pending > 0; });
+                    if (stopping && pending == 0) return;
+                }
+            });
+        }
+    }
+    
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    
+    /**
+     * @brief Drain remaining tasks and join the workers
+     */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+    
+    size_t size() const { return workers.size(); }
+    
+    /**
+     * @brief Queue a task for execution
+     * @param fn Callable taking no arguments
+     * @return Future holding the callable's result
+     */
+    template <typename F>
+    auto submit(F&& fn) -> std::future<decltype(fn())> {
+        using Result = decltype(fn());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(fn));
+        std::future<Result> result = task->get_future();
+        size_t target = currentWorker();
+        if (target == queues.size()) target = next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            pending++;  // counted before it is visible, so claimed() never underflows
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.emplace_back([task] { (*task)(); });
+        }
+        ready.notify_one();
+        return result;
+    }
+    
+    /**
+     * @brief Block until a future is ready, running pending tasks meanwhile
+     */
+    template <typename T>
+    void wait(std::future<T>& future) {
+        const size_t self = currentWorker();
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            std::function<void()> task;
+            if (take(self, task)) {
+                task();
+            } else {
+                future.wait_for(std::chrono::microseconds(100));
+            }
+        }
+    }
+};
+
+/**
+ * @struct NumaNode
+ * @brief One memory node of the host and the CPUs attached to it
+ */
+struct NumaNode {
+    int id = 0;             ///< Node number
+    std::vector<int> cpus;  ///< Logical CPUs (empty = unknown; threads are left unpinned)
+};
+
+/**
+ * @brief Parse a sysfs CPU list such as "0-3,8-11"
+ * @return CPU numbers in list order; malformed items are skipped
+ */
+inline std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        int first = 0, last = 0;
+        const char* begin = item.data();
+        const char* end = item.data() + item.size();
+        auto parsed = std::from_chars(begin, end, first);
+        if (parsed.ec != std::errc()) continue;
+        last = first;
+        if (parsed.ptr < end && *parsed.ptr == '-') {
+            auto range = std::from_chars(parsed.ptr + 1, end, last);
+            if (range.ec != std::errc() || range.ptr != end || last < first) continue;
+        } else if (parsed.ptr != end) {
+            continue;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+/**
+ * @brief NUMA nodes of the host, from /sys/devices/system/node
+ * @return Nodes with CPUs in node order; a single node without CPUs when
+ *         the topology is not available (other platforms, containers
+ *         without sysfs)
+ */
+inline std::vector<NumaNode> detectNumaNodes() {
+    std::vector<NumaNode> nodes;
+    std::error_code ec;
+    for (fs::directory_iterator it("/sys/devices/system/node", ec), end; !ec && it != end; it.increment(ec)) {
+        const std::string name = it->path().filename().string();
+        if (name.size() <= 4 || name.compare(0, 4, "node") != 0) continue;
+        NumaNode node;
+        auto parsed = std::from_chars(name.data() + 4, name.data() + name.size(), node.id);
+        if (parsed.ec != std::errc() || parsed.ptr != name.data() + name.size()) continue;
+        std::ifstream file(it->path() / "cpulist");
+        std::string text;
+        if (!std::getline(file, text)) continue;
+        node.cpus = parseCpuList(text);
+        if (!node.cpus.empty()) nodes.push_back(std::move(node));  // memory-only nodes run no workers
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+    if (nodes.empty()) nodes.push_back(NumaNode());
+    return nodes;
+}
+
+/**
+ * @brief Restrict the calling thread to a set of CPUs
+ * @param cpus Allowed CPUs (empty = leave the thread as it is)
+ * @return false if pinning is unsupported or was refused; the thread then
+ *         keeps its current affinity
+ * 
+ * Threads created afterwards by the caller inherit the affinity.
+ */
+inline bool pinCurrentThread(const std::vector<int>& cpus) {
+    if (cpus.empty()) return false;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @class OrderBookAnalyzer
+ * @brief Main class for analyzing temporary price impact using order book data
+ * 
+ * This class implements a comprehensive analysis framework for calculating
+ * temporary price impact functions g_s(X) using real market microstructure data.
+ * It processes MBP-10 format CSV files and simulates order execution to
+ * determine realistic market impact across different order sizes.
+ * 
+ * Features:
+ * - Loads and parses MBP-10 format order book data
+ * - Calculates VWAP-based temporary impact functions
+ * - Supports multiple symbols and large datasets
+ * - Generates detailed impact analysis results
+ * 
+ * Usage:
+ * @code
+ * OrderBookAnalyzer analyzer(".");
+ * analyzer.analyzeAllSymbols();
+ * @endcode
+ */
+class OrderBookAnalyzer {
+private:
+    std::string data_folder;                                        ///< Root folder containing symbol data
+    std::vector<std::string> symbols;                               ///< Symbols to analyze (discovered when empty)
+    std::map<std::string, SnapshotStore> data;                     ///< Loaded order book data (columnar)
+    AnalyzerOptions options;                                        ///< Runtime configuration
+    std::unique_ptr<ThreadPool> pool;                               ///< Workers (null when single-threaded)
+    std::unique_ptr<Prefetcher> prefetcher;                         ///< Read-ahead of the run's files (null = off)
+    std::map<std::string, std::vector<fs::path>> prefetch_schedule; ///< Files scheduled per symbol
+    fs::path cache_root;                                            ///< Snapshot cache folder (see cacheRootFor())
+    Metrics metrics;                                                ///< Counters and phase timers (--metrics)
+    std::map<fs::path, int> shard_plan;                             ///< Shard of every selected day file (--shard)
+    std::ostream* log_stream = &std::cout;                          ///< Progress and report output
+    
+    /**
+     * @brief Stream for progress and report output (std::cout unless redirected)
+     */
+    std::ostream& log() const { return *log_stream; }
+    
+    /**
+     * @brief Run fn(0) ... fn(count - 1), on the pool when one is available
+     * @param count Number of independent work items
+     * @param fn Work item; must only touch state owned by its index
+     */
+    template <typename F>
+    void runParallel(size_t count, F&& fn) {
+        if (!pool || count <= 1) {
+            for (size_t i = 0; i < count; ++i) fn(i);
+            return;
+        }
+        std::vector<std::future<void>> futures;
+        futures.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            futures.push_back(pool->submit([&fn, i] { fn(i); }));
+        }
+        for (auto& future : futures) pool->wait(future);
+        for (auto& future : futures) future.get();
+    }
+    
+    /**
+     * @brief runParallel() as a callable for helpers outside the analyzer
+     */
+    auto parallel() {
+        return [this](size_t count, const auto& fn) { runParallel(count, fn); };
+    }
+    
+public:
+    /**
+     * @brief Constructor
+     * @param folder Root folder containing symbol subdirectories with CSV files
+     * @param opts Runtime configuration (loader path, engine, threads, ...)
+     */
+    explicit OrderBookAnalyzer(const std::string& folder, const AnalyzerOptions& opts = AnalyzerOptions())
+        : data_folder(folder), symbols(opts.symbols), options(opts), metrics(!opts.metrics_path.empty()) {
+        if (options.grid_step <= 0 || options.max_shares < options.grid_step) {
+            throw std::invalid_argument("--grid-step must be positive and no larger than --max-shares");
+        }
+        size_t threads = options.threads > 0 ? static_cast<size_t>(options.threads)
+                                             : std::max(1u, std::thread::hardware_concurrency());
+        if (threads > 1) pool = std::make_unique<ThreadPool>(threads);
+        if (options.use_cache) cache_root = cacheRootFor(data_folder, options);
+        
+        const SamplingMode mode = options.ingest.mode;
+        if (options.streaming && mode == SamplingMode::TimeStratified) {
+            throw std::invalid_argument("stratified sampling needs whole files; not available with --streaming");
+        }
+        if (options.averaging == Averaging::TimeWeighted && options.engine == ImpactEngine::Reference) {
+            throw std::invalid_argument("--averaging=time is not supported by the reference engine");
+        }
+        if (options.distribution && options.engine == ImpactEngine::Reference) {
+            throw std::invalid_argument("--distribution is not supported by the reference engine");
+        }
+        if (options.schedule_shares > 0 && options.bucket_minutes <= 0) {
+            throw std::invalid_argument("--schedule-shares needs --bucket-minutes");
+        }
+        if (options.schedule_shares % options.grid_step != 0) {
+            throw std::invalid_argument("--schedule-shares must be a multiple of --grid-step");
+        }
+        if ((options.piecewise || !options.impact_at.empty()) && (options.streaming || !options.partials_dir.empty())) {
+            throw std::invalid_argument("--piecewise needs the loaded snapshots; not available with --streaming or --partials-out");
+        }
+        if (options.snapshot_detail && (options.streaming || !options.partials_dir.empty())) {
+            throw std::invalid_argument("--snapshot-detail needs the loaded snapshots; not available with --streaming or --partials-out");
+        }
+        if (options.partial_fills != PartialFillPolicy::Average &&
+            (options.engine == ImpactEngine::Simd || options.engine == ImpactEngine::FixedPoint)) {
+            throw std::invalid_argument("--partial-fills=skip|extrapolate is supported by the cumulative and reference engines");
+        }
+        if (options.batch && !options.partials_dir.empty()) {
+            throw std::invalid_argument("--batch runs the whole analysis; not available with --partials-out");
+        }
+        if (options.shard_count > 1 && options.partials_dir.empty()) {
+            throw std::invalid_argument("--shard needs --partials-out");
+        }
+        if (!options.partials_dir.empty()) {
+            if (options.engine == ImpactEngine::Reference) {
+                throw std::invalid_argument("--partials-out is not supported by the reference engine");
+            }
+            if (mode == SamplingMode::Reservoir || options.bucket_minutes > 0) {
+                throw std::invalid_argument("--partials-out works per day; reservoir sampling and surfaces are not available");
+            }
+        }
+    }
+    
+    /**
+     * @brief Snapshots loaded for a symbol by loadData()
+     * @return Store pointer, or nullptr if the symbol has not been loaded
+     */
+    const SnapshotStore* getSnapshots(const std::string& symbol) const {
+        auto it = data.find(symbol);
+        return it != data.end() ? &it->second : nullptr;
+    }
+    
+    /**
+     * @brief Utility function to split strings by delimiter
+     * @param str Input string to split
+     * @param delimiter Character to split on
+     * @return Vector of string tokens
+     */
+    std::vector<std::string> split(const std::string& str, char delimiter) {
+        std::vector<std::string> tokens;
+        std::stringstream ss(str);
+        std::string token;
+        while (std::getline(ss, token, delimiter)) {
+            tokens.push_back(token);
+        }
+        return tokens;
+    }
+    
+    /**
+     * @brief split() into caller-owned token buffers
+     * @param str Input string to split
+     * @param delimiter Character to split on
+     * @param tokens Reused buffers; only the first `count` entries are meaningful
+     * @return Token count, as tokens.size() of split() would be
+     * 
+     * Strings are overwritten in place, so once the buffers have grown to
+     * the widest row no further allocation takes place.
+     */
+    static size_t split(const std::string& str, char delimiter, std::vector<std::string>& tokens) {
+        size_t count = 0;
+        size_t start = 0;
+        while (start < str.size()) {  // like getline, a trailing empty token is not produced
+            size_t pos = str.find(delimiter, start);
+            if (pos == std::string::npos) pos = str.size();
+            if (count == tokens.size()) tokens.emplace_back();
+            tokens[count++].assign(str, start, pos - start);
+            start = pos + 1;
+        }
+        return count;
+    }
+    
+    /**
+     * @brief Load order book data for a specific symbol
+     * @param symbol Stock symbol (e.g., "CRWV", "FROG", "SOUN")
+     * @return true if data was successfully loaded, false otherwise
+     * 
+     * This function loads MBP-10 format CSV files from the symbol's subdirectory.
+     * Each file contains order book snapshots with 10 levels of bid/ask data.
+     * The function parses the CSV according to Databento MBP-10 schema, using
+     * the ingestion path selected by AnalyzerOptions::loader. Files are taken
+     * in date order up to IngestSpec::max_files and sampled per IngestSpec.
+     * 
+     * With a thread pool, the files still needed to reach max_files are parsed
+     * concurrently into per-file stores which are then appended in directory
+     * order, so the resulting store and log are the same as a serial load.
+     * Files that fail to open do not count towards max_files; the next
+     * candidates are parsed in a further wave. A reservoir sample is drawn
+     * while the files are appended (ReservoirSampler), so only the sample
+     * and one wave of files are held at a time.
+     */
+    bool loadData(const std::string& symbol) {
+        log() << "Loading data for " << symbol << "..." << std::endl;
+        
+        SymbolMetrics* symbol_metrics = metrics.symbol(symbol);
+        ScopedTimer timer(symbol_metrics ? symbol_metrics->phase(Phase::Load) : nullptr);
+        SnapshotStore snapshots;
+        BookQuality::Counts excluded;
+        auto quality = std::make_shared<BookQuality>();  // the files' scans, in append order
+        std::vector<fs::path> candidates = listDayFiles(symbol);
+        
+        // A reservoir takes each file's rows as it is appended and loads one
+        // file per worker at a time, so memory stays O(sample + wave)
+        std::unique_ptr<ReservoirSampler> reservoir;
+        if (options.ingest.mode == SamplingMode::Reservoir) {
+            reservoir = std::make_unique<ReservoirSampler>(options.ingest.count, options.ingest.seed);
+        }
+        
+        const int max_files = maxFiles();
+        int files_loaded = 0;
+        size_t next = 0;
+        while (files_loaded < max_files && next < candidates.size()) {
+            size_t wave = std::min(candidates.size() - next, static_cast<size_t>(max_files - files_loaded));
+            if (reservoir) wave = std::min(wave, pool ? pool->size() : size_t{1});
+            std::vector<SnapshotStore> parsed(wave);
+            std::vector<int> rows_loaded(wave, 0);
+            std::vector<char> opened(wave, 0);
+            std::vector<IngestCounters> counters(wave);
+            std::vector<BookQuality::Counts> screened(wave);
+            
+            runParallel(wave, [&](size_t i) {
+                opened[i] = loadFile(candidates[next + i], parsed[i], rows_loaded[i],
+                                     symbol_metrics ? &counters[i] : nullptr, &screened[i]);
+            });
+            
+            // Size the symbol store once per wave; a lone file is moved, not copied
+            size_t wave_rows = 0;
+            size_t wave_files = 0;
+            for (size_t i = 0; i < wave; ++i) {
+                if (opened[i]) { wave_rows += parsed[i].size(); wave_files++; }
+            }
+            if (!reservoir && !(snapshots.days.empty() && wave_files == 1)) {
+                snapshots.reserve(snapshots.size() + wave_rows);
+            }
+            
+            for (size_t i = 0; i < wave; ++i) {
+                log() << "  Loading file: " << candidates[next + i].filename() << std::endl;
+                if (!opened[i]) continue;
+                if (symbol_metrics) symbol_metrics->ingest.merge(counters[i]);
+                excluded.merge(screened[i]);
+                
+                if (reservoir) {
+                    reservoir->add(parsed[i]);
+                    parsed[i] = SnapshotStore();
+                } else {
+                    quality->append(*parsed[i].quality);
+                    if (snapshots.days.empty() && wave_files == 1) {
+                        snapshots = std::move(parsed[i]);
+                    } else {
+                        snapshots.appendStore(parsed[i]);
+                        parsed[i] = SnapshotStore();  // release the file's rows once copied
+                    }
+                }
+                files_loaded++;
+                log() << "    Loaded " << rows_loaded[i] << " valid snapshots" << std::endl;
+            }
+            next += wave;
+        }
+        if (options.exclude_books) printExcluded(symbol, excluded);
+        
+        if (reservoir) {
+            snapshots = reservoir->take();
+            qualityOf(snapshots);
+            logReservoir(reservoir->rowsSeen(), snapshots.size(), symbol_metrics);
+        } else {
+            snapshots.quality = std::move(quality);
+        }
+        
+        if (!snapshots.empty()) {
+            data[symbol] = std::move(snapshots);
+            log() << "Total snapshots for " << symbol << ": " << data[symbol].size() << std::endl;
+            return true;
+        }
+        
+        return false;
+    }
+    
+    /**
+     * @brief CSV day files of a symbol within the date range, sorted by name (and so by date)
+     * @param symbol Symbol subdirectory of the data folder
+     * 
+     * With --start-date/--end-date, files whose name carries no date in
+     * the range are skipped.
+     */
+    std::vector<fs::path> listDayFiles(const std::string& symbol) const {
+        std::string symbol_folder = data_folder + "/" + symbol;
+        std::vector<fs::path> files;
+        for (const auto& entry : fs::directory_iterator(symbol_folder)) {
+            if (!isDayFile(entry.path())) continue;
+            const std::string date = dateFromFilename(entry.path());
+            if (!options.start_date.empty() && !(date >= options.start_date)) continue;
+            if (!options.end_date.empty() && !(!date.empty() && date <= options.end_date)) continue;
+            files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+    
+    /**
+     * @brief Check that every requested symbol has a folder, before any symbol is analyzed
+     * @throws std::runtime_error naming the symbols without one
+     * 
+     * A mistyped --symbols entry would otherwise fail the run only when
+     * its turn comes, after the earlier symbols were written.
+     */
+    void requireSymbolFolders() const {
+        std::string missing;
+        for (const auto& symbol : symbols) {
+            std::error_code ec;
+            if (fs::is_directory(fs::path(data_folder) / symbol, ec)) continue;
+            missing += (missing.empty() ? "" : ", ") + symbol;
+        }
+        if (!missing.empty()) throw std::runtime_error("no folder for symbol(s) " + missing + " in " + data_folder);
+    }
+    
+    /**
+     * @brief Whether a file is a day file named for its symbol folder, "<DIR>_YYYY-MM-DD..."
+     */
+    static bool isSymbolDayFile(const std::string& symbol, const fs::path& path) {
+        const std::string name = path.filename().string();
+        if (!isDayFile(path) || name.size() < symbol.size() + 11 || name.compare(0, symbol.size(), symbol) != 0 ||
+            name[symbol.size()] != '_') {
+            return false;
+        }
+        const std::string date = name.substr(symbol.size() + 1, 10);
+        for (size_t i = 0; i < date.size(); ++i) {
+            const bool dash = i == 4 || i == 7;
+            if (dash ? date[i] != '-' : !std::isdigit(static_cast<unsigned char>(date[i]))) return false;
+        }
+        return true;
+    }
+    
+    /**
+     * @brief Subdirectories of the data folder that hold day files, sorted by name
+     * 
+     * A symbol folder must hold at least one day file named for it
+     * ("CRWV/CRWV_2025-04-03 ...csv"). Hidden directories and the run's own
+     * output, partials and cache folders are skipped, so results written
+     * under the data folder are never taken for a symbol.
+     */
+    std::vector<std::string> discoverSymbols() const {
+        std::vector<fs::path> own_dirs;
+        for (const std::string& dir : {options.output_dir, options.partials_dir, options.cache_dir}) {
+            if (!dir.empty()) own_dirs.emplace_back(dir);
+        }
+        std::vector<std::string> found;
+        for (const auto& entry : fs::directory_iterator(data_folder)) {
+            const std::string name = entry.path().filename().string();
+            if (!entry.is_directory() || name.empty() || name[0] == '.') continue;
+            const bool own = std::any_of(own_dirs.begin(), own_dirs.end(), [&](const fs::path& dir) {
+                std::error_code ec;
+                return fs::equivalent(entry.path(), dir, ec);
+            });
+            if (own) continue;
+            for (const auto& file : fs::directory_iterator(entry.path())) {
+                if (isSymbolDayFile(name, file.path())) {
+                    found.push_back(name);
+                    break;
+                }
+            }
+        }
+        std::sort(found.begin(), found.end());
+        return found;
+    }
+    
+    /**
+     * @brief Size-balanced assignment of every symbol's day files to the shards
+     * @return Shard index per file (files after --max-files are left out)
+     * 
+     * Files of all symbols are placed largest first, each on the shard with
+     * the fewest bytes so far (ties: path, then lowest shard), i.e. the LPT
+     * heuristic, which stays within 4/3 of the best possible makespan even
+     * when symbol sizes differ by orders of magnitude. Every worker derives
+     * the same plan from the shared data folder, so no coordinator is needed.
+     */
+    std::map<fs::path, int> planShards() const {
+        std::vector<std::pair<uintmax_t, fs::path>> files;
+        for (const auto& symbol : symbols) {
+            std::vector<fs::path> day_files = listDayFiles(symbol);
+            day_files.resize(std::min(day_files.size(), static_cast<size_t>(maxFiles())));
+            for (auto& path : day_files) {
+                std::error_code ec;
+                uintmax_t bytes = fs::file_size(path, ec);
+                files.emplace_back(ec ? 0 : bytes, std::move(path));
+            }
+        }
+        std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+        
+        std::vector<uintmax_t> load(static_cast<size_t>(options.shard_count), 0);
+        std::map<fs::path, int> plan;
+        for (const auto& file : files) {
+            size_t shard = static_cast<size_t>(std::min_element(load.begin(), load.end()) - load.begin());
+            load[shard] += file.first;
+            plan[file.second] = static_cast<int>(shard);
+        }
+        return plan;
+    }
+    
+    /**
+     * @brief Start reading every day file the run will load, in load order
+     * 
+     * The schedule is the symbols in analysis order, each with its first
+     * --max-files day files (this shard's files with --shard). A file with
+     * a snapshot cache entry is scheduled as the cache file, which is what
+     * loadFile() will read; symbols whose folder cannot be listed are left
+     * to fail where they always did, in analyzeSymbol().
+     * 
+     * Only files that will be read whole are scheduled: under a Head limit
+     * (--sample=head:N) the parsers stop after N rows, so a source file is
+     * scheduled only when a missing cache entry makes loadFile() parse all
+     * of it. Every-k sampling still reads whole files and is unaffected.
+     */
+    void startPrefetch() {
+        if (options.prefetch_mb <= 0) return;
+        const bool head_limited = parseLimits().max_rows != std::numeric_limits<int>::max();
+        std::vector<std::pair<fs::path, fs::path>> files;
+        for (const auto& symbol : symbols) {
+            std::vector<fs::path> day_files;
+            try {
+                day_files = listDayFiles(symbol);
+            } catch (const fs::filesystem_error&) {
+                continue;
+            }
+            int taken = 0;
+            for (const auto& path : day_files) {
+                if (options.partials_dir.empty()) {
+                    if (taken++ >= maxFiles()) break;
+                } else {
+                    auto assigned = shard_plan.find(path);
+                    if (assigned == shard_plan.end() || assigned->second != options.shard_index) continue;
+                }
+                std::error_code ec;
+                const fs::path cache = cachePathFor(path);
+                const bool cached = options.use_cache && !options.streaming && fs::exists(cache, ec);
+                if (head_limited && (cached || !options.use_cache || options.streaming)) continue;
+                files.emplace_back(path, cached ? cache : path);
+                prefetch_schedule[symbol].push_back(path);
+            }
+        }
+        if (!files.empty()) {
+            prefetcher = std::make_unique<Prefetcher>(files, static_cast<uint64_t>(options.prefetch_mb) << 20);
+        }
+    }
+    
+    /**
+     * @brief Analyze one symbol, then drop whatever of its schedule was not loaded
+     */
+    void analyzeScheduled(const std::string& symbol) {
+        analyzeSymbol(symbol);
+        if (prefetcher) prefetcher->discard(prefetch_schedule[symbol]);
+    }
+    
+    /**
+     * @brief Path of a result file inside the output directory (created on demand)
+     */
+    std::string outputPath(const std::string& filename) const {
+        if (options.output_dir.empty()) return filename;
+        std::error_code ec;
+        fs::create_directories(options.output_dir, ec);
+        return (fs::path(options.output_dir) / filename).string();
+    }
+    
+    /**
+     * @brief Day file limit of the ingest spec (0 = unlimited)
+     */
+    int maxFiles() const {
+        return options.ingest.max_files > 0 ? options.ingest.max_files : std::numeric_limits<int>::max();
+    }
+    
+    /**
+     * @brief Parse a symbol's day files straight into running accumulators
+     * @param symbol Stock symbol
+     * @param stats Receives the market statistics
+     * @param buy Receives buy-side impact sums
+     * @param sell Receives sell-side impact sums
+     * @param surface Receives the intraday surfaces (nullptr = not computed)
+     * @param schedule_surface Receives the schedule surface with scheduleKernel() (nullptr = not computed)
+     * @return true if any snapshot was processed
+     * 
+     * Streaming counterpart of loadData(): same file selection, sampling
+     * and log, but rows only live in one RowSink batch of kImpactChunkRows
+     * rows. Each batch is folded into the statistics and into fresh per-side
+     * partial sums that are merged in order, so results equal an in-memory
+     * run at any thread count while memory stays O(batch + grid). A
+     * reservoir sample is drawn from the batches and processed after the
+     * last file, adding O(sample). The snapshot cache is bypassed since it
+     * would materialise whole files.
+     */
+    bool streamData(const std::string& symbol, MarketStats& stats, ImpactAccumulator& buy, ImpactAccumulator& sell,
+                    ImpactSurface* surface = nullptr, ImpactSurface* schedule_surface = nullptr) {
+        log() << "Loading data for " << symbol << "..." << std::endl;
+        
+        SymbolMetrics* symbol_metrics = metrics.symbol(symbol);
+        ScopedTimer timer(symbol_metrics ? symbol_metrics->phase(Phase::Load) : nullptr);
+        size_t total_rows = 0;
+        
+        auto fold = [&](const SnapshotStore& rows, MarketStats* row_stats) {
+            ScopedTimer impact_timer(symbol_metrics ? symbol_metrics->phase(Phase::Impact) : nullptr);
+            reduceChunks(rows, row_stats, &buy, &sell, surface, schedule_surface);
+        };
+        
+        // Time weighting folds collapsed states in kImpactChunkRows batches,
+        // matching the chunks an in-memory run reduces over
+        const bool time_weighted = options.averaging == Averaging::TimeWeighted;
+        StateCollapser collapser;
+        SnapshotStore states;
+        size_t total_states = 0;
+        
+        auto process = [&](const SnapshotStore& batch) {
+            total_rows += batch.size();
+            if (!time_weighted) {
+                fold(batch, &stats);  // statistics fused into the impact pass
+                return;
+            }
+            {
+                ScopedTimer stats_timer(symbol_metrics ? symbol_metrics->phase(Phase::Stats) : nullptr);
+                reduceChunks(batch, &stats, nullptr, nullptr);
+            }
+            for (size_t row = 0; row < batch.size(); ++row) {
+                if (collapser.feed(batch, row, states) && states.size() == kImpactChunkRows) {
+                    fold(states, nullptr);
+                    total_states += states.size();
+                    states.clearRows();
+                }
+            }
+        };
+        
+        // A reservoir sample takes the screened rows and is processed once
+        // the last file is read, as an in-memory run samples after loading
+        std::unique_ptr<ReservoirSampler> reservoir;
+        if (options.ingest.mode == SamplingMode::Reservoir) {
+            reservoir = std::make_unique<ReservoirSampler>(options.ingest.count, options.ingest.seed);
+        }
+        auto admit = [&](const SnapshotStore& rows) {
+            if (reservoir) {
+                reservoir->add(rows);
+            } else {
+                process(rows);
+            }
+        };
+        
+        // --exclude-books screens each parsed batch and refills whole
+        // kImpactChunkRows batches from the remaining rows, so the chunks
+        // still match those of an in-memory run
+        BookQuality::Counts excluded;
+        BookQuality::Clock clock;
+        SnapshotStore kept;
+        RowSink sink;
+        sink.consume = [&](const SnapshotStore& batch) {
+            if (!options.exclude_books) {
+                admit(batch);
+                return;
+            }
+            BookQuality quality;
+            quality.scan(batch, clock);
+            BookQuality::Counts counts = quality.counts();
+            const std::vector<size_t> rows = quality.rowsWithout(options.exclude_books, batch.size());
+            counts.excluded = batch.size() - rows.size();
+            excluded.merge(counts);
+            if (symbol_metrics) {
+                symbol_metrics->ingest.rows_excluded += counts.excluded;
+                symbol_metrics->ingest.rows_kept -= counts.excluded;  // this file's rows are merged after parsing
+            }
+            for (size_t row : rows) {
+                kept.copyRow(batch, row, kept.addDay(batch.days[batch.day[row]]));
+                if (kept.size() == kImpactChunkRows) {
+                    admit(kept);
+                    kept.clearRows();
+                }
+            }
+        };
+        
+        SnapshotStore batch;
+        batch.reserve(sink.batch_rows);
+        int files_loaded = 0;
+        ParseLimits limits = parseLimits();
+        limits.sink = &sink;
+        for (const auto& path : listDayFiles(symbol)) {
+            if (files_loaded >= maxFiles()) break;
+            log() << "  Loading file: " << path.filename() << std::endl;
+            
+            int rows_loaded = 0;
+            IngestCounters counters;
+            limits.counters = symbol_metrics ? &counters : nullptr;
+            {
+                Prefetcher::Lease lease = prefetcher ? prefetcher->acquire(path) : Prefetcher::Lease();
+                ScopedTimer parse_timer(limits.counters ? &counters.parse_ns : nullptr);
+                if (!parseFile(path, batch, rows_loaded, limits)) continue;
+            }
+            if (symbol_metrics) symbol_metrics->ingest.merge(counters);
+            files_loaded++;
+            log() << "    Loaded " << rows_loaded << " valid snapshots" << std::endl;
+        }
+        if (!batch.empty()) sink.consume(batch);
+        if (!kept.empty()) admit(kept);
+        if (options.exclude_books) printExcluded(symbol, excluded);
+        if (reservoir) {
+            const SnapshotStore sample = reservoir->take();
+            logReservoir(reservoir->rowsSeen(), sample.size(), symbol_metrics);
+            if (!sample.empty()) process(sample);
+        }
+        collapser.finish();
+        if (!states.empty()) {
+            fold(states, nullptr);
+            total_states += states.size();
+        }
+        
+        if (total_rows == 0) return false;
+        log() << "Total snapshots for " << symbol << ": " << total_rows << std::endl;
+        if (time_weighted) printCollapse(total_rows, total_states);
+        return true;
+    }
+    
+    /**
+     * @brief Load and sample one day file, through the snapshot cache when enabled
+     * @param path CSV file
+     * @param snapshots Empty store receiving the file's snapshots
+     * @param rows_loaded Receives the number of snapshots kept
+     * @param counters Receives row accounting and timings (nullptr = not instrumented)
+     * @param screened Receives the --exclude-books counts (nullptr = not needed)
+     * @return false if the file could not be read
+     * 
+     * On a cache miss the whole file is parsed so the cache can serve any
+     * later sampling spec, then the spec is applied to the parsed rows.
+     * A cache hit only accounts for the rows it returns; rows beyond a Head
+     * limit are neither parsed nor counted, as with the CSV loaders. The
+     * cache always holds the unscreened rows; --exclude-books is applied
+     * after sampling.
+     */
+    bool loadFile(const fs::path& path, SnapshotStore& snapshots, int& rows_loaded,
+                  IngestCounters* counters = nullptr, BookQuality::Counts* screened = nullptr) {
+        Prefetcher::Lease lease = prefetcher ? prefetcher->acquire(path) : Prefetcher::Lease();
+        ParseLimits limits = parseLimits();
+        limits.counters = counters;
+        if (!options.use_cache) {
+            ScopedTimer timer(counters ? &counters->parse_ns : nullptr);
+            if (!parseFile(path, snapshots, rows_loaded, limits)) return false;
+        } else {
+            fs::path cache = cachePathFor(path);
+            bool hit;
+            {
+                ScopedTimer timer(counters ? &counters->cache_read_ns : nullptr);
+                hit = SnapshotCache::read(cache, path, snapshots, static_cast<size_t>(limits.max_rows));
+            }
+            if (hit) {
+                if (counters) {
+                    counters->files++;
+                    counters->cache_hits++;
+                    counters->bytes_read += SnapshotCache::fileBytes(snapshots.size());
+                    counters->rows_parsed += snapshots.size();
+                    counters->rows_kept += snapshots.size();
+                }
+            } else {
+                ParseLimits full;
+                full.counters = counters;
+                {
+                    ScopedTimer timer(counters ? &counters->parse_ns : nullptr);
+                    if (!parseFile(path, snapshots, rows_loaded, full)) return false;
+                }
+                {
+                    ScopedTimer timer(counters ? &counters->cache_write_ns : nullptr);
+                    SnapshotCache::write(cache, path, snapshots);
+                }
+                if (counters) counters->cache_misses++;
+                const size_t before = snapshots.size();
+                snapshots.truncate(static_cast<size_t>(limits.max_rows));
+                if (counters) countSampledOut(*counters, before, snapshots.size());
+            }
+            if (limits.keep_every > 1) {
+                const size_t before = snapshots.size();
+                snapshots.keepRows(sampleEveryKth(snapshots.size(), static_cast<size_t>(limits.keep_every)));
+                if (counters) countSampledOut(*counters, before, snapshots.size());
+            }
+        }
+        const size_t before = snapshots.size();
+        sampleFile(snapshots);
+        if (counters) countSampledOut(*counters, before, snapshots.size());
+        qualityOf(snapshots);  // one scan per day file, on the thread that loaded it
+        if (options.exclude_books) {
+            const BookQuality::Counts counts = excludeBooks(snapshots);
+            if (counters) {
+                counters->rows_excluded += counts.excluded;
+                counters->rows_kept -= counts.excluded;
+            }
+            if (screened) *screened = counts;
+        }
+        rows_loaded = static_cast<int>(snapshots.size());
+        return true;
+    }
+    
+    /**
+     * @brief Drop the rows flagged with any of the --exclude-books conditions
+     * @param snapshots Rows to screen, compacted in place (their scan with them)
+     * @return Flagged rows per condition and the number dropped
+     */
+    BookQuality::Counts excludeBooks(SnapshotStore& snapshots) const {
+        const BookQuality& quality = qualityOf(snapshots);
+        BookQuality::Counts counts = quality.counts();
+        const std::vector<size_t> keep = quality.rowsWithout(options.exclude_books, snapshots.size());
+        counts.excluded = snapshots.size() - keep.size();
+        if (counts.excluded > 0) keepScannedRows(snapshots, keep);
+        return counts;
+    }
+    
+    /**
+     * @brief Log the --exclude-books screen of one symbol
+     */
+    void printExcluded(const std::string& symbol, const BookQuality::Counts& counts) const {
+        log() << "Excluded " << counts.excluded << " snapshots of " << symbol << " (flagged: "
+                  << counts.crossed << " crossed, " << counts.locked << " locked, "
+                  << counts.stale << " stale)" << std::endl;
+    }
+    
+    /**
+     * @brief Log a symbol's reservoir sample and count the rows it left out as sampled out
+     */
+    void logReservoir(size_t seen, size_t kept, SymbolMetrics* symbol_metrics) const {
+        log() << "  Reservoir sample: " << kept << " snapshots" << std::endl;
+        if (symbol_metrics) {
+            symbol_metrics->ingest.rows_sampled_out += seen - kept;
+            symbol_metrics->ingest.rows_kept -= seen - kept;
+        }
+    }
+    
+    /**
+     * @brief Move rows dropped by a post-parse sampling step from kept to sampled out
+     */
+    static void countSampledOut(IngestCounters& counters, size_t before, size_t after) {
+        counters.rows_sampled_out += before - after;
+        counters.rows_kept -= before - after;
+    }
+    
+    /**
+     * @brief Parse one day file with the loader for its format and schema
+     * 
+     * zstd-compressed files (.zst) go through loadFileZstd() and DBN files
+     * (recognised by their "DBN" magic) through loadFileDbn(). For CSV,
+     * MBP-10 files (and files without a recognised header) go through the
+     * configured --loader; MBP-1 and MBO files through loadFileEvents().
+     */
+    bool parseFile(const fs::path& path, SnapshotStore& snapshots, int& rows_loaded,
+                   const ParseLimits& limits = ParseLimits()) {
+        if (path.extension() == ".zst") return loadFileZstd(path, snapshots, rows_loaded, limits);
+        
+        std::ifstream probe(path);
+        if (!probe.is_open()) return false;
+        std::string header;
+        std::getline(probe, header);
+        probe.close();
+        if (header.compare(0, 3, "DBN") == 0) return loadFileDbn(path, snapshots, rows_loaded, limits);
+        
+        const FeedColumns columns = FeedColumns::fromHeader(header);
+        if (columns.schema == FeedSchema::Mbo || columns.schema == FeedSchema::Mbp1) {
+            return loadFileEvents(path, columns, snapshots, rows_loaded, limits);
+        }
+        return (options.loader == LoaderMode::Mapped)
+            ? loadFileMapped(path, snapshots, rows_loaded, limits)
+            : loadFileStream(path, snapshots, rows_loaded, limits);
+    }
+    
+    /**
+     * @brief Row limits that can be applied while parsing (Head, EveryKth)
+     */
+    ParseLimits parseLimits() const {
+        ParseLimits limits;
+        const IngestSpec& spec = options.ingest;
+        if (spec.mode == SamplingMode::Head) {
+            limits.max_rows = static_cast<int>(std::min<size_t>(spec.count, std::numeric_limits<int>::max()));
+        } else if (spec.mode == SamplingMode::EveryKth) {
+            limits.keep_every = static_cast<int>(std::min<size_t>(std::max<size_t>(spec.count, 1),
+                                                                  std::numeric_limits<int>::max()));
+        }
+        return limits;
+    }
+    
+    /**
+     * @brief Apply the per-file sampling that needs the whole file (TimeStratified)
+     */
+    void sampleFile(SnapshotStore& snapshots) const {
+        if (options.ingest.mode == SamplingMode::TimeStratified) {
+            snapshots.keepRows(sampleTimeStratified(snapshots, options.ingest.count));
+        }
+    }
+    
+    /**
+     * @brief Snapshot cache folder of a run
+     * 
+     * --cache-dir when given. Otherwise the cache stays out of the data
+     * folder, which may be read-only or shared: it goes to
+     * <output-dir>/.snapshot_cache, or without --output-dir to the user's
+     * cache folder ($XDG_CACHE_HOME, ~/.cache or %LOCALAPPDATA%, else the
+     * temp folder) under order_book_analysis/. Both defaults add a
+     * <data folder name>-<hash of its absolute path> level, so runs over
+     * different data folders do not evict each other's entries.
+     */
+    static fs::path cacheRootFor(const std::string& folder, const AnalyzerOptions& options) {
+        if (!options.cache_dir.empty()) return fs::path(options.cache_dir);
+        std::error_code ec;
+        fs::path data = fs::weakly_canonical(fs::absolute(folder, ec), ec);
+        if (data.empty()) data = fs::path(folder);
+        uint64_t hash = 0xCBF29CE484222325ULL;  // FNV-1a: stable across builds, unlike std::hash
+        for (unsigned char c : data.string()) hash = (hash ^ c) * 0x100000001B3ULL;
+        std::ostringstream key;
+        key << (data.filename().empty() ? std::string("data") : data.filename().string()) << "-" << std::hex << hash;
+        if (!options.output_dir.empty()) return fs::path(options.output_dir) / ".snapshot_cache" / key.str();
+        
+        fs::path user;
+        for (const char* variable : {"XDG_CACHE_HOME", "LOCALAPPDATA"}) {
+            const char* value = std::getenv(variable);
+            if (user.empty() && value && *value) user = fs::path(value);
+        }
+        const char* home = std::getenv("HOME");
+        if (user.empty() && home && *home) user = fs::path(home) / ".cache";
+        if (user.empty()) user = fs::temp_directory_path(ec);
+        return user / "order_book_analysis" / key.str();
+    }
+    
+    /**
+     * @brief Cache file for a day file: <cache root>/<symbol>/<file name>.obsc
+     */
+    fs::path cachePathFor(const fs::path& path) const {
+        fs::path cache = cache_root / path.parent_path().filename() / path.filename();
+        cache += ".obsc";
+        return cache;
+    }
+    
+    /**
+     * @brief Extract the trading date from a Databento file name
+     * @param path File such as "CRWV/CRWV_2025-04-03 00_00_00+00_00.csv"
+     * @return "YYYY-MM-DD", or an empty string if the name has no '_'
+     */
+    static std::string dateFromFilename(const fs::path& path) {
+        std::string filename = path.filename().string();
+        size_t pos = filename.find('_');
+        return pos != std::string::npos ? filename.substr(pos + 1, 10) : std::string();
+    }
+    
+    /**
+     * @brief Parse one CSV file with std::getline and split()
+     * @param path CSV file to read
+     * @param snapshots Destination for valid snapshots
+     * @param rows_loaded Receives the number of snapshots appended
+     * @param limits Row limit, stride and optional batch consumer
+     * @return false if the file could not be opened
+     */
+    bool loadFileStream(const fs::path& path, SnapshotStore& snapshots, int& rows_loaded,
+                        const ParseLimits& limits = ParseLimits()) {
+        std::ifstream file(path);
+        if (!file.is_open()) return false;
+        uint16_t day_index = snapshots.addDay(dateFromFilename(path));
+        
+        IngestCounters counters;
+        counters.files = 1;
+        std::string line;
+        std::getline(file, line); // Skip header
+        counters.bytes_read += line.size() + 1;
+        
+        // Row buffers live across iterations so steady-state rows do not allocate
+        std::vector<std::string> tokens;
+        OrderBookSnapshot snapshot;
+        snapshot.bids.resize(kBookLevels);
+        snapshot.asks.resize(kBookLevels);
+        
+        int valid_rows = 0;
+        while (rows_loaded < limits.max_rows && std::getline(file, line)) { // Limit rows per file
+            if (counters.rows_parsed++ == 0) {
+                std::error_code ec;
+                uint64_t file_bytes = fs::file_size(path, ec);
+                if (!ec && file_bytes > counters.bytes_read) {
+                    reserveForFile(snapshots, file_bytes - counters.bytes_read, line.size() + 1, limits);
+                }
+            }
+            counters.bytes_read += line.size() + 1;
+            size_t token_count = split(line, ',', tokens);
+            if (token_count < kMinRowColumns) { // Need at least 71 columns for bid_sz_09/ask_sz_09
+                counters.rows_short++;
+                continue;
+            }
+            
+            snapshot.timestamp.assign(tokens[1]);  // ts_event
+            std::fill(snapshot.bids.begin(), snapshot.bids.end(), OrderBookLevel());
+            std::fill(snapshot.asks.begin(), snapshot.asks.end(), OrderBookLevel());
+            
+            try {
+                // Parse bid and ask levels based on actual CSV structure
+                // MBP-10 Pattern: bid_px_XX at 13+6*i, ask_px_XX at 14+6*i, bid_sz_XX at 15+6*i, ask_sz_XX at 16+6*i
+                for (int i = 0; i < 10; ++i) {
+                    // Calculate column indices for this level
+                    size_t bid_px_col = static_cast<size_t>(13 + (6 * i));  // bid_px_00 at 13, bid_px_01 at 19, etc.
+                    size_t ask_px_col = static_cast<size_t>(14 + (6 * i));  // ask_px_00 at 14, ask_px_01 at 20, etc.
+                    size_t bid_sz_col = static_cast<size_t>(15 + (6 * i));  // bid_sz_00 at 15, bid_sz_01 at 21, etc.
+                    size_t ask_sz_col = static_cast<size_t>(16 + (6 * i));  // ask_sz_00 at 16, ask_sz_01 at 22, etc.
+                    
+                    // Parse bid price and size (with bounds checking)
+                    if (bid_px_col < token_count && !tokens[bid_px_col].empty()) {
+                        snapshot.bids[static_cast<size_t>(i)].price = std::stod(tokens[bid_px_col]);
+                    }
+                    if (bid_sz_col < token_count && !tokens[bid_sz_col].empty()) {
+                        snapshot.bids[static_cast<size_t>(i)].size = std::stoi(tokens[bid_sz_col]);
+                    }
+                    
+                    // Parse ask price and size (with bounds checking)
+                    if (ask_px_col < token_count && !tokens[ask_px_col].empty()) {
+                        snapshot.asks[static_cast<size_t>(i)].price = std::stod(tokens[ask_px_col]);
+                    }
+                    if (ask_sz_col < token_count && !tokens[ask_sz_col].empty()) {
+                        snapshot.asks[static_cast<size_t>(i)].size = std::stoi(tokens[ask_sz_col]);
+                    }
+                }
+                
+                // Only add if we have valid best bid and ask
+                if (snapshot.bids[0].price <= 0 || snapshot.asks[0].price <= 0) {
+                    counters.rows_empty_book++;
+                } else if (valid_rows++ % limits.keep_every != 0) {
+                    counters.rows_sampled_out++;
+                } else {
+                    snapshots.append(snapshot, day_index);
+                    rows_loaded++;
+                    counters.rows_kept++;
+                    if (limits.sink && snapshots.size() >= limits.sink->batch_rows) {
+                        limits.sink->consume(snapshots);
+                        snapshots.clearRows();
+                    }
+                }
+            } catch (const std::exception& e) {
+                // Skip invalid rows
+                counters.rows_unparsable++;
+                continue;
+            }
+        }
+        
+        if (limits.counters) limits.counters->merge(counters);
+        return true;
+    }
+    
+    /**
+     * @brief Parse one CSV file in place from a read-only memory mapping
+     * @param path CSV file to map
+     * @param snapshots Destination for valid snapshots
+     * @param rows_loaded Receives the number of snapshots appended
+     * @param limits Row limit, stride and optional batch consumer
+     * @return false if the file could not be mapped
+     * 
+     * Rows are located with memchr and split into std::string_view fields
+     * over the mapped bytes; only the timestamp and the 40 price/size
+     * columns are converted (std::from_chars). Row acceptance matches
+     * loadFileStream(): short rows and rows with unparsable fields are
+     * skipped, as are rows without a positive best bid and ask.
+     * 
+     * A large file parsed in full is cut into newline-aligned byte ranges
+     * of about kParseRangeBytes that run as separate pool tasks; their
+     * stores are appended in file order, so the result is the same as a
+     * sequential parse and one big file no longer occupies a single worker.
+     */
+    bool loadFileMapped(const fs::path& path, SnapshotStore& snapshots, int& rows_loaded,
+                        const ParseLimits& limits = ParseLimits()) {
+        MappedFile file;
+        if (!file.open(path)) return false;
+        
+        // Date is a property of the file, not of each row
+        uint16_t day_index = snapshots.addDay(dateFromFilename(path));
+        
+        const char* begin = file.data();
+        const char* end = begin + file.size();
+        IngestCounters counters;
+        counters.files = 1;
+        
+        // Skip the header, size the store(s) from the first data row
+        const char* cursor = afterLine(begin, end);
+        const size_t row_bytes = static_cast<size_t>(afterLine(cursor, end) - cursor);
+        const uint64_t payload = static_cast<uint64_t>(end - cursor);
+        
+        const size_t ranges = parseRangeCount(payload, limits);
+        if (ranges <= 1) {
+            reserveForFile(snapshots, payload, row_bytes, limits);
+            int valid_rows = 0;
+            cursor = parseMappedRows(cursor, end, day_index, snapshots, rows_loaded, valid_rows, limits, counters);
+        } else {
+            std::vector<const char*> cuts(ranges + 1, cursor);
+            for (size_t i = 1; i < ranges; ++i) {
+                cuts[i] = std::max(cuts[i - 1], afterLine(cursor + payload * i / ranges, end));
+            }
+            cuts[ranges] = end;
+            
+            std::vector<SnapshotStore> parts(ranges);
+            std::vector<int> part_rows(ranges, 0);
+            std::vector<IngestCounters> part_counters(ranges);
+            runParallel(ranges, [&](size_t i) {
+                uint16_t part_day = parts[i].addDay(snapshots.days[day_index]);
+                reserveForFile(parts[i], static_cast<uint64_t>(cuts[i + 1] - cuts[i]), row_bytes, limits);
+                int valid_rows = 0;
+                parseMappedRows(cuts[i], cuts[i + 1], part_day, parts[i], part_rows[i], valid_rows, limits, part_counters[i]);
+            });
+            
+            size_t first = 0;
+            if (snapshots.empty() && snapshots.days.size() == 1) {
+                snapshots = std::move(parts[0]);  // same single day, nothing to copy
+                first = 1;
+            }
+            size_t total = snapshots.size();
+            for (size_t i = first; i < ranges; ++i) total += parts[i].size();
+            snapshots.reserve(total);
+            for (size_t i = 0; i < ranges; ++i) {
+                if (i >= first) snapshots.appendStore(parts[i]);
+                parts[i] = SnapshotStore();
+                rows_loaded += part_rows[i];
+                counters.merge(part_counters[i]);
+            }
+            cursor = end;
+        }
+        
+        counters.bytes_read = static_cast<uint64_t>(cursor - begin);
+        if (limits.counters) limits.counters->merge(counters);
+        return true;
+    }
+    
+    /**
+     * @brief Start of the line after the one containing p (end if none)
+     */
+    static const char* afterLine(const char* p, const char* end) {
+        if (p >= end) return end;
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        return newline ? newline + 1 : end;
+    }
+    
+    /**
+     * @brief Number of byte-range tasks for a mapped file (1 = parse sequentially)
+     * 
+     * Only a full parse can be split: Head and EveryKth limits count kept
+     * rows across the whole file, and streaming batches must stay in order.
+     */
+    size_t parseRangeCount(uint64_t payload, const ParseLimits& limits) const {
+        if (!pool || limits.sink || limits.keep_every != 1 || limits.max_rows != std::numeric_limits<int>::max()) {
+            return 1;
+        }
+        return static_cast<size_t>(std::min<uint64_t>(std::max<uint64_t>(payload / kParseRangeBytes, 1), kMaxParseRanges));
+    }
+    
+    /**
+     * @brief Parse the MBP-10 data rows in [cursor, end) into a store
+     * @param day_index Day of the rows in that store
+     * @param valid_rows Valid rows seen so far in the file (EveryKth stride state)
+     * @param counters Receives row accounting (bytes are left to the caller)
+     * @return Position after the last consumed row (stops early at the row limit)
+     */
+    const char* parseMappedRows(const char* cursor, const char* end, uint16_t day_index, SnapshotStore& snapshots,
+                                int& rows_loaded, int& valid_rows, const ParseLimits& limits,
+                                IngestCounters& counters) {
+        std::array<std::string_view, kMinRowColumns> fields;
+        while (cursor < end && rows_loaded < limits.max_rows) {
+            const char* newline = static_cast<const char*>(std::memchr(cursor, '\n', static_cast<size_t>(end - cursor)));
+            const char* line_end = newline ? newline : end;
+            std::string_view line(cursor, static_cast<size_t>(line_end - cursor));
+            cursor = newline ? newline + 1 : end;
+            
+            counters.rows_parsed++;
+            if (splitFields(line, fields) < kMinRowColumns) {
+                counters.rows_short++;
+                continue;
+            }
+            
+            int64_t timestamp = 0;
+            parseTimestamp(fields[1], timestamp);  // ts_event
+            
+            // Write the levels straight into the next store row
+            size_t row = snapshots.addRow(timestamp, day_index);
+            double* bid_px = snapshots.bid_px.data() + row * kBookLevels;
+            double* ask_px = snapshots.ask_px.data() + row * kBookLevels;
+            int* bid_sz = snapshots.bid_sz.data() + row * kBookLevels;
+            int* ask_sz = snapshots.ask_sz.data() + row * kBookLevels;
+            
+            bool row_ok = true;
+            for (size_t i = 0; i < kBookLevels && row_ok; ++i) {
+                size_t col = kFirstLevelColumn + kColumnsPerLevel * i;
+                if (!fields[col].empty()) row_ok = row_ok && parseField(fields[col], bid_px[i]);
+                if (!fields[col + 2].empty()) row_ok = row_ok && parseField(fields[col + 2], bid_sz[i]);
+                if (!fields[col + 1].empty()) row_ok = row_ok && parseField(fields[col + 1], ask_px[i]);
+                if (!fields[col + 3].empty()) row_ok = row_ok && parseField(fields[col + 3], ask_sz[i]);
+            }
+            
+            // Only keep parsable rows with valid best bid and ask
+            if (!row_ok) {
+                counters.rows_unparsable++;
+            } else if (bid_px[0] <= 0 || ask_px[0] <= 0) {
+                counters.rows_empty_book++;
+            } else if (valid_rows++ % limits.keep_every != 0) {
+                counters.rows_sampled_out++;
+            } else {
+                rows_loaded++;
+                counters.rows_kept++;
+                if (limits.sink && snapshots.size() >= limits.sink->batch_rows) {
+                    limits.sink->consume(snapshots);
+                    snapshots.clearRows();
+                }
+                continue;
+            }
+            snapshots.popRow();
+        }
+        return cursor;
+    }
+    
+    /**
+     * @brief Read one DBN MBP-10 file from a read-only memory mapping
+     * @param path DBN file (metadata header followed by records)
+     * @param snapshots Destination for valid snapshots
+     * @param rows_loaded Receives the number of snapshots appended
+     * @param limits Row limit, stride and optional batch consumer
+     * @return false if the file could not be mapped, is not DBN or holds a
+     *         corrupt record header
+     * 
+     * Records are fixed-size binary structs, so there is nothing to parse:
+     * each MBP-10 record is copied out of the mapping and its integer
+     * fields converted (see parseDbnRecords()). Row acceptance, sampling
+     * and batching are those of loadFileMapped().
+     */
+    bool loadFileDbn(const fs::path& path, SnapshotStore& snapshots, int& rows_loaded,
+                     const ParseLimits& limits = ParseLimits()) {
+        MappedFile file;
+        if (!file.open(path)) return false;
+        const size_t offset = dbnRecordsOffset(file.data(), file.size());
+        if (offset == 0) return false;
+        
+        uint16_t day_index = snapshots.addDay(dateFromFilename(path));
+        IngestCounters counters;
+        counters.files = 1;
+        const char* begin = file.data();
+        const char* end = begin + file.size();
+        reserveForFile(snapshots, static_cast<uint64_t>(file.size() - offset), sizeof(DbnMbp10Msg), limits);
+        int valid_rows = 0;
+        const char* cursor = parseDbnRecords(begin + offset, end, day_index, snapshots, rows_loaded, valid_rows,
+                                             limits, counters);
+        if (!cursor) {
+            std::cerr << "    " << path.filename() << ": corrupt DBN record header" << std::endl;
+            return false;
+        }
+        counters.bytes_read = static_cast<uint64_t>(cursor - begin);
+        if (limits.counters) limits.counters->merge(counters);
+        return true;
+    }
+    
+    /**
+     * @brief Convert the complete DBN records in [cursor, end) into store rows
+     * @param day_index Day of the rows in that store
+     * @param valid_rows Valid rows seen so far in the file (EveryKth stride state)
+     * @param counters Receives row accounting (bytes are left to the caller)
+     * @return Position after the last consumed record (a trailing partial
+     *         record is left for the caller), or nullptr at a corrupt record
+     *         header, after which no record boundary can be trusted
+     * 
+     * Records other than MBP-10 are counted as short and skipped by their
+     * header length; records with a level size above INT32_MAX are counted
+     * as unparsable and dropped, as such a size is in a CSV. Prices are
+     * converted as ticks / 1e9, the correctly rounded double of the decimal
+     * the CSV export prints, so a DBN file and its CSV export load identical
+     * stores. Empty levels (undefined price) become zero price and size, as
+     * blank CSV fields do.
+     */
+    const char* parseDbnRecords(const char* cursor, const char* end, uint16_t day_index, SnapshotStore& snapshots,
+                                int& rows_loaded, int& valid_rows, const ParseLimits& limits,
+                                IngestCounters& counters) {
+        DbnMbp10Msg record;
+        while (rows_loaded < limits.max_rows && end - cursor >= static_cast<ptrdiff_t>(kDbnRecordHeaderBytes)) {
+            const size_t record_bytes = static_cast<size_t>(static_cast<uint8_t>(cursor[0])) * 4;
+            if (record_bytes < kDbnRecordHeaderBytes) return nullptr;
+            if (static_cast<size_t>(end - cursor) < record_bytes) break;
+            const uint8_t rtype = static_cast<uint8_t>(cursor[1]);
+            counters.rows_parsed++;
+            if (rtype != kDbnMbp10RType || record_bytes < sizeof(DbnMbp10Msg)) {
+                counters.rows_short++;
+                cursor += record_bytes;
+                continue;
+            }
+            // The mapping gives no alignment guarantee for records, so copy out
+            std::memcpy(&record, cursor, sizeof(record));
+            cursor += record_bytes;
+            
+            size_t row = snapshots.addRow(static_cast<int64_t>(record.ts_event), day_index);
+            double* bid_px = snapshots.bid_px.data() + row * kBookLevels;
+            double* ask_px = snapshots.ask_px.data() + row * kBookLevels;
+            int* bid_sz = snapshots.bid_sz.data() + row * kBookLevels;
+            int* ask_sz = snapshots.ask_sz.data() + row * kBookLevels;
+            bool sizes_fit = true;
+            for (size_t i = 0; i < kBookLevels; ++i) {
+                const DbnBidAskPair& level = record.levels[i];
+                const bool bid_defined = level.bid_px != kDbnUndefPrice;
+                const bool ask_defined = level.ask_px != kDbnUndefPrice;
+                bid_px[i] = bid_defined ? static_cast<double>(level.bid_px) / 1e9 : 0.0;
+                ask_px[i] = ask_defined ? static_cast<double>(level.ask_px) / 1e9 : 0.0;
+                bid_sz[i] = bid_defined ? static_cast<int>(level.bid_sz) : 0;
+                ask_sz[i] = ask_defined ? static_cast<int>(level.ask_sz) : 0;
+                sizes_fit &= (!bid_defined || level.bid_sz <= INT32_MAX) && (!ask_defined || level.ask_sz <= INT32_MAX);
+            }
+            
+            if (!sizes_fit) {
+                counters.rows_unparsable++;  // as a CSV size that does not fit an int
+            } else if (bid_px[0] <= 0 || ask_px[0] <= 0) {
+                counters.rows_empty_book++;
+            } else if (valid_rows++ % limits.keep_every != 0) {
+                counters.rows_sampled_out++;
+            } else {
+                rows_loaded++;
+                counters.rows_kept++;
+                if (limits.sink && snapshots.size() >= limits.sink->batch_rows) {
+                    limits.sink->consume(snapshots);
+                    snapshots.clearRows();
+                }
+                continue;
+            }
+            snapshots.popRow();
+        }
+        return cursor;
+    }
+    
+    /**
+     * @brief Read a zstd-compressed MBP-10 CSV or DBN file (.csv.zst, .dbn.zst)
+     * @param path Compressed day file
+     * @param snapshots Destination for valid snapshots
+     * @param rows_loaded Receives the number of snapshots appended
+     * @param limits Row limit, stride and optional batch consumer
+     * @return false if the file could not be read or decompressed, ends
+     *         inside a zstd frame (truncated), holds a corrupt DBN record
+     *         header, or if the program was built without zstd
+     * 
+     * The file is decompressed in kDecompressChunkBytes steps into one
+     * window; the complete lines (CSV) or records (DBN) of each step go
+     * through parseMappedRows() / parseDbnRecords() and only the incomplete
+     * tail is carried over, so memory stays O(chunk) whatever the file size.
+     * Only the MBP-10 schema is read from compressed CSV. bytes_read counts
+     * compressed bytes. Available when built with ZSTD=1.
+     */
+    bool loadFileZstd(const fs::path& path, SnapshotStore& snapshots, int& rows_loaded,
+                      const ParseLimits& limits = ParseLimits()) {
+#ifndef ORDER_BOOK_ANALYSIS_ZSTD
+        (void)snapshots;
+        (void)rows_loaded;
+        (void)limits;
+        std::cerr << "    " << path.filename() << ": zstd input needs a build with ZSTD=1" << std::endl;
+        return false;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) return false;
+        std::unique_ptr<ZSTD_DStream, size_t (*)(ZSTD_DStream*)> stream(ZSTD_createDStream(), ZSTD_freeDStream);
+        if (!stream || ZSTD_isError(ZSTD_initDStream(stream.get()))) return false;
+        
+        uint16_t day_index = snapshots.addDay(dateFromFilename(path));
+        IngestCounters counters;
+        counters.files = 1;
+        std::vector<char> input(ZSTD_DStreamInSize());
+        std::vector<char> window;     // Decompressed bytes not consumed yet
+        size_t filled = 0;
+        enum class Format { Unknown, Csv, Dbn } format = Format::Unknown;
+        int valid_rows = 0;
+        bool failed = false;
+        bool corrupt = false;         // Failed on the content, already reported
+        size_t frame_pending = 1;     // Last ZSTD_decompressStream() result; 0 = frame complete
+        std::error_code size_error;
+        const uint64_t compressed_bytes = fs::file_size(path, size_error);  // Reservation hint only
+        
+        // Consume what the window holds; at_end also takes a final unterminated line
+        auto consume = [&](bool at_end) {
+            const char* begin = window.data();
+            const char* end = begin + filled;
+            const char* cursor = begin;
+            if (format == Format::Unknown) {
+                if (filled >= 3 && std::memcmp(begin, "DBN", 3) == 0) {
+                    const size_t offset = dbnRecordsOffset(begin, filled);
+                    if (offset == 0) {
+                        failed = at_end;
+                        return;
+                    }
+                    format = Format::Dbn;
+                    cursor += offset;
+                } else {
+                    const char* newline = static_cast<const char*>(std::memchr(begin, '\n', filled));
+                    if (!newline && !at_end) return;
+                    const char* header_end = newline ? newline : end;
+                    const FeedColumns columns = FeedColumns::fromHeader(std::string(begin, header_end));
+                    if (columns.schema == FeedSchema::Mbo || columns.schema == FeedSchema::Mbp1) {
+                        std::cerr << "    " << path.filename() << ": only MBP-10 is read from compressed CSV" << std::endl;
+                        failed = true;
+                        return;
+                    }
+                    format = Format::Csv;
+                    cursor = afterLine(begin, end);
+                    reserveForFile(snapshots, size_error ? 0 : compressed_bytes * 4,
+                                   static_cast<size_t>(afterLine(cursor, end) - cursor), limits);
+                }
+            }
+            if (format == Format::Dbn) {
+                cursor = parseDbnRecords(cursor, end, day_index, snapshots, rows_loaded, valid_rows, limits, counters);
+                if (!cursor) {
+                    std::cerr << "    " << path.filename() << ": corrupt DBN record header" << std::endl;
+                    failed = corrupt = true;
+                    return;
+                }
+            } else {
+                const char* complete = end;
+                if (!at_end) {
+                    while (complete > cursor && complete[-1] != '\n') --complete;
+                }
+                cursor = parseMappedRows(cursor, complete, day_index, snapshots, rows_loaded, valid_rows, limits,
+                                         counters);
+            }
+            filled = static_cast<size_t>(end - cursor);
+            std::memmove(window.data(), cursor, filled);
+        };
+        
+        while (!failed && rows_loaded < limits.max_rows && in) {
+            in.read(input.data(), static_cast<std::streamsize>(input.size()));
+            ZSTD_inBuffer in_buffer{input.data(), static_cast<size_t>(in.gcount()), 0};
+            counters.bytes_read += in_buffer.size;
+            while (!failed && in_buffer.pos < in_buffer.size && rows_loaded < limits.max_rows) {
+                if (window.size() < filled + kDecompressChunkBytes) window.resize(filled + kDecompressChunkBytes);
+                ZSTD_outBuffer out_buffer{window.data() + filled, kDecompressChunkBytes, 0};
+                frame_pending = ZSTD_decompressStream(stream.get(), &out_buffer, &in_buffer);
+                if (ZSTD_isError(frame_pending)) {
+                    failed = true;
+                    break;
+                }
+                filled += out_buffer.pos;
+                consume(false);
+            }
+        }
+        // Flush what the decoder still holds, then the unterminated tail
+        while (!failed && rows_loaded < limits.max_rows) {
+            if (window.size() < filled + kDecompressChunkBytes) window.resize(filled + kDecompressChunkBytes);
+            ZSTD_inBuffer no_input{nullptr, 0, 0};
+            ZSTD_outBuffer out_buffer{window.data() + filled, kDecompressChunkBytes, 0};
+            const size_t remaining = ZSTD_decompressStream(stream.get(), &out_buffer, &no_input);
+            if (ZSTD_isError(remaining)) {
+                failed = true;
+                break;
+            }
+            // A call without output after a finished frame reports the next frame's header size
+            if (out_buffer.pos == 0) break;
+            frame_pending = remaining;
+            filled += out_buffer.pos;
+            consume(false);
+        }
+        // Input ended inside a frame (or held none): a truncated file, not a short day
+        const bool truncated = !failed && rows_loaded < limits.max_rows && frame_pending != 0;
+        if (!failed && !truncated && rows_loaded < limits.max_rows && filled > 0) consume(true);
+        if (truncated) {
+            std::cerr << "    " << path.filename() << ": truncated zstd frame" << std::endl;
+            return false;
+        }
+        if (failed) {
+            if (!corrupt) std::cerr << "    " << path.filename() << ": could not decompress" << std::endl;
+            return false;
+        }
+        if (limits.counters) limits.counters->merge(counters);
+        return true;
+#endif
+    }
+    
+    /**
+     * @brief Parse an MBO or MBP-1 CSV file into snapshots
+     * @param path CSV file to map
+     * @param columns Schema and column positions from the header
+     * @param snapshots Destination for valid snapshots
+     * @param rows_loaded Receives the number of snapshots appended
+     * @param limits Row limit, stride and optional batch consumer
+     * @return false if the file could not be mapped
+     * 
+     * MBP-1 rows carry the top of book and become one snapshot each, with
+     * levels 1-9 empty. MBO rows are applied to an IncrementalBook that
+     * starts empty for each file; a snapshot of its top kBookLevels levels
+     * is taken after each event flagged F_LAST (0x80), i.e. once per
+     * exchange event batch, or after every event if there is no flags
+     * column. Only the handful of event fields are converted, so the cost
+     * scales with the number of events rather than with 40 level fields
+     * per row. Snapshots then go through the same checks, sampling and
+     * batching as loadFileMapped().
+     */
+    bool loadFileEvents(const fs::path& path, const FeedColumns& columns, SnapshotStore& snapshots,
+                        int& rows_loaded, const ParseLimits& limits = ParseLimits()) {
+        constexpr int kLastInBatch = 0x80;  // Databento F_LAST
+        
+        MappedFile file;
+        if (!file.open(path)) return false;
+        uint16_t day_index = snapshots.addDay(dateFromFilename(path));
+        
+        const bool mbo = columns.schema == FeedSchema::Mbo;
+        const char* cursor = file.data();
+        const char* end = cursor + file.size();
+        bool header = true;
+        std::array<std::string_view, FeedColumns::kMaxColumns> fields;
+        IngestCounters counters;
+        counters.files = 1;
+        IncrementalBook book;
+        
+        int valid_rows = 0;
+        while (cursor < end && rows_loaded < limits.max_rows) {
+            const char* newline = static_cast<const char*>(std::memchr(cursor, '\n', static_cast<size_t>(end - cursor)));
+            const char* line_end = newline ? newline : end;
+            std::string_view line(cursor, static_cast<size_t>(line_end - cursor));
+            cursor = newline ? newline + 1 : end;
+            
+            if (header) {
+                header = false;
+                if (!mbo) {
+                    const char* next = static_cast<const char*>(std::memchr(cursor, '\n', static_cast<size_t>(end - cursor)));
+                    reserveForFile(snapshots, static_cast<uint64_t>(end - cursor),
+                                   static_cast<size_t>((next ? next + 1 : end) - cursor), limits, columns.min_fields);
+                }
+                continue;
+            }
+            counters.rows_parsed++;
+            if (splitFields(line, fields) < columns.min_fields) {
+                counters.rows_short++;
+                continue;
+            }
+            
+            int flags = kLastInBatch;
+            if (columns.flags != FeedColumns::kMissing && !parseField(fields[columns.flags], flags)) {
+                counters.rows_unparsable++;
+                continue;
+            }
+            
+            int64_t timestamp = 0;
+            parseTimestamp(fields[columns.ts_event], timestamp);
+            
+            if (mbo) {
+                double price = 0.0;
+                int size = 0;
+                uint64_t order_id = 0;
+                std::string_view id = fields[columns.order_id];
+                std::string_view action = fields[columns.action];
+                std::string_view side = fields[columns.side];
+                if (action.empty() || side.empty() ||
+                    (!fields[columns.price].empty() && !parseField(fields[columns.price], price)) ||
+                    !parseField(fields[columns.size], size) ||
+                    std::from_chars(id.data(), id.data() + id.size(), order_id).ec != std::errc()) {
+                    counters.rows_unparsable++;
+                    continue;
+                }
+                book.apply(action[0], side[0], std::llround(price * 1e9), size, order_id);
+                if (!(flags & kLastInBatch)) {
+                    counters.rows_book_updates++;
+                    continue;
+                }
+                if (!book.hasBothSides()) {
+                    counters.rows_empty_book++;
+                    continue;
+                }
+            }
+            
+            size_t row = snapshots.addRow(timestamp, day_index);
+            double* bid_px = snapshots.bid_px.data() + row * kBookLevels;
+            double* ask_px = snapshots.ask_px.data() + row * kBookLevels;
+            int* bid_sz = snapshots.bid_sz.data() + row * kBookLevels;
+            int* ask_sz = snapshots.ask_sz.data() + row * kBookLevels;
+            
+            bool row_ok = true;
+            if (mbo) {
+                book.writeTop(bid_px, bid_sz, ask_px, ask_sz);
+            } else {
+                auto parse = [&](size_t column, auto& value) {
+                    if (!fields[column].empty()) row_ok = row_ok && parseField(fields[column], value);
+                };
+                parse(columns.bid_px, bid_px[0]);
+                parse(columns.bid_sz, bid_sz[0]);
+                parse(columns.ask_px, ask_px[0]);
+                parse(columns.ask_sz, ask_sz[0]);
+            }
+            
+            if (!row_ok) {
+                counters.rows_unparsable++;
+            } else if (bid_px[0] <= 0 || ask_px[0] <= 0) {
+                counters.rows_empty_book++;
+            } else if (valid_rows++ % limits.keep_every != 0) {
+                counters.rows_sampled_out++;
+            } else {
+                rows_loaded++;
+                counters.rows_kept++;
+                if (limits.sink && snapshots.size() >= limits.sink->batch_rows) {
+                    limits.sink->consume(snapshots);
+                    snapshots.clearRows();
+                }
+                continue;
+            }
+            snapshots.popRow();
+        }
+        
+        counters.bytes_read = static_cast<uint64_t>(cursor - file.data());
+        if (limits.counters) limits.counters->merge(counters);
+        return true;
+    }
+    /**
+     * @brief Calculate temporary price impact function g_s(X) for given order book data
+     * @param snapshots Columnar order book snapshots to analyze
+     * @param side Order side: "buy" for buy orders, "sell" for sell orders
+     * @param max_shares Maximum order size to analyze (in shares)
+     * @param step Order size increment (in shares)
+     * @param partial_fills Pricing of sizes beyond a snapshot's visible depth
+     * @return Vector of ImpactResult containing impact analysis for each order size
+     * 
+     * This function implements the core temporary impact calculation using VWAP simulation.
+     * For each order size from step to max_shares (in steps of step), it simulates order
+     * execution by walking through order book levels and calculating the volume-weighted
+     * average price (VWAP) achieved.
+     * 
+     * Mathematical Model:
+     * - Buy orders: g_buy(X) = (VWAP_execution - Mid_Price) / Mid_Price
+     * - Sell orders: g_sell(X) = (Mid_Price - VWAP_execution) / Mid_Price
+     * 
+     * The algorithm:
+     * 1. For each order size X
+     * 2. For each order book snapshot
+     * 3. Simulate order execution by consuming liquidity level by level
+     * 4. Calculate VWAP and compare to mid-price
+     * 5. Average impact across all snapshots
+     * 
+     * Visible levels and depth come from the store's BookQuality scan
+     * (made here if the store has none); an order larger than the visible
+     * depth is priced per partial_fills.
+     */
+    std::vector<ImpactResult> calculateTemporaryImpact(
+        const SnapshotStore& snapshots, 
+        const std::string& side, 
+        int max_shares = 500,
+        int step = 10,
+        PartialFillPolicy partial_fills = PartialFillPolicy::Average) {
+        
+        log() << "Calculating " << side << " side temporary impact..." << std::endl;
+        
+        std::vector<ImpactResult> results;
+        
+        // Visible levels and depth of every snapshot: the loader's scan, or one made here for both sides' sizes
+        BookQuality local;
+        if (!snapshots.quality) local.scan(snapshots);
+        const BookQuality& quality = snapshots.quality ? *snapshots.quality : local;
+        const bool buy = side == "buy";
+        const std::vector<uint8_t>& levels = buy ? quality.ask_levels : quality.bid_levels;
+        const std::vector<int64_t>& depth = buy ? quality.ask_depth : quality.bid_depth;
+        
+        // Analyze impact for order sizes from step to max_shares in steps of step
+        for (int order_size = step; order_size <= max_shares; order_size += step) {
+            std::vector<double> impacts;
+            
+            // Calculate impact for this order size across all snapshots
+            for (size_t row = 0; row < snapshots.size(); ++row) {
+                double mid_price = snapshots.midPrice(row);
+                if (mid_price <= 0) continue;  // Skip invalid snapshots
+                if (partial_fills == PartialFillPolicy::Skip && order_size > depth[row]) continue;
+                
+                double total_cost = 0.0;
+                int total_shares = 0;
+                int remaining = order_size;
+                
+                // Buy orders consume ask-side liquidity, sell orders bid-side liquidity
+                const double* prices = buy ? snapshots.askPrices(row) : snapshots.bidPrices(row);
+                const int* sizes = buy ? snapshots.askSizes(row) : snapshots.bidSizes(row);
+                const size_t visible = levels[row];
+                for (size_t level = 0; level < visible && remaining > 0; ++level) {
+                    int take = std::min(remaining, sizes[level]);
+                    total_cost += static_cast<double>(take) * prices[level];
+                    total_shares += take;
+                    remaining -= take;
+                }
+                if (partial_fills == PartialFillPolicy::Extrapolate && remaining > 0 && visible > 0) {
+                    total_cost += buy ? extrapolatedCost<Side::Buy>(prices, visible, total_shares, remaining)
+                                      : extrapolatedCost<Side::Sell>(prices, visible, total_shares, remaining);
+                    total_shares = order_size;
+                }
+                
+                // Calculate VWAP and impact if we executed any shares
+                if (total_shares > 0) {
+                    double avg_price = total_cost / static_cast<double>(total_shares);
+                    double impact;
+                    
+                    // Calculate impact based on order side
+                    if (side == "buy") {
+                        // Buy impact: how much more expensive than mid-price
+                        impact = (avg_price - mid_price) / mid_price;
+                    } else {
+                        // Sell impact: how much cheaper than mid-price  
+                        impact = (mid_price - avg_price) / mid_price;
+                    }
+                    
+                    impacts.push_back(impact);
+                }
+            }
+            
+            // Calculate average impact for this order size
+            if (!impacts.empty()) {
+                double avg_impact = std::accumulate(impacts.begin(), impacts.end(), 0.0) / static_cast<double>(impacts.size());
+                results.push_back({
+                    order_size,
+                    avg_impact,
+                    avg_impact * 10000.0  // Convert to basis points
+                });
+            }
+        }
+        
+        return results;
+    }
+    
+    /**
+     * @brief Row-range kernel for the configured engine
+     * 
+     * The reference engine has no row-range form; its per-snapshot results
+     * equal the cumulative-depth kernel, which is used in its place.
+     */
+    ImpactKernel impactKernel() const { return impactKernelFor(options.engine, options.partial_fills); }
+    
+    /**
+     * @brief Row-range kernel of the --schedule-shares surface
+     * 
+     * Skip policy regardless of --partial-fills: a size beyond a snapshot's
+     * visible depth is left out instead of priced at the visible VWAP.
+     * saveSchedules() then treats a size as unavailable in a bucket unless
+     * --schedule-min-fill of its books filled it, so the solver neither
+     * places more shares than the books held nor prices a size by the few
+     * deep books that happened to hold it.
+     */
+    static ImpactKernel scheduleKernel() { return impactKernelFor(ImpactEngine::CumulativeDepth, PartialFillPolicy::Skip); }
+    
+    /**
+     * @brief Surface for the schedules: the curve surface when its kernel
+     *        already is scheduleKernel(), otherwise a separate one
+     */
+    std::unique_ptr<ImpactSurface> makeScheduleSurface(const OrderSizeGrid& grid) const {
+        if (options.schedule_shares <= 0 || impactKernel() == scheduleKernel()) return nullptr;
+        return std::make_unique<ImpactSurface>(grid, options.bucket_minutes);
+    }
+    
+    /**
+     * @brief accumulateFusedPass() with the configured partial fill policy
+     */
+    void fusedPass(const SnapshotStore& store, size_t begin, size_t end,
+                   MarketStats* stats, ImpactAccumulator& buy, ImpactAccumulator& sell) const {
+        switch (options.partial_fills) {
+            case PartialFillPolicy::Skip:
+                accumulateFusedPass<PartialFillPolicy::Skip>(store, begin, end, stats, buy, sell);
+                return;
+            case PartialFillPolicy::Extrapolate:
+                accumulateFusedPass<PartialFillPolicy::Extrapolate>(store, begin, end, stats, buy, sell);
+                return;
+            default:
+                accumulateFusedPass(store, begin, end, stats, buy, sell);
+                return;
+        }
+    }
+    
+    /**
+     * @brief Add rows [begin, end) to the market statistics, in the price
+     *        arithmetic of the configured engine
+     */
+    void addMarketStats(MarketStats& stats, const SnapshotStore& store, size_t begin, size_t end) const {
+        if (options.engine == ImpactEngine::FixedPoint) {
+            addFixedPointStats(stats, store, begin, end);
+        } else {
+            stats.add(store, begin, end);
+        }
+    }
+    
+    /**
+     * @brief Evaluate the impact curve with the configured engine
+     * @param snapshots Columnar order book snapshots to analyze
+     * @param side Order side
+     * @return ImpactResult per grid order size (same layout as calculateTemporaryImpact)
+     */
+    std::vector<ImpactResult> calculateImpactCurve(const SnapshotStore& snapshots, Side side) {
+        if (options.engine == ImpactEngine::Reference) {
+            return calculateTemporaryImpact(snapshots, sideName(side), options.max_shares, options.grid_step,
+                                            options.partial_fills);
+        }
+        
+        log() << "Calculating " << sideName(side) << " side temporary impact..." << std::endl;
+        
+        // Fixed-size row chunks are reduced in chunk order, so the merged sums do
+        // not depend on the thread count. Chunks run in windows to bound the
+        // number of live partial accumulators on fine grids.
+        const ImpactKernel kernel = impactKernel();
+        const OrderSizeGrid grid{options.grid_step, options.max_shares};
+        const size_t rows = snapshots.size();
+        const size_t chunks = (rows + kImpactChunkRows - 1) / kImpactChunkRows;
+        const size_t window = std::min(chunks, pool ? pool->size() * 2 : size_t{1});
+        
+        ImpactAccumulator total(grid, options.distribution);
+        std::vector<ImpactAccumulator> partials(window, ImpactAccumulator(grid, options.distribution));
+        for (size_t first = 0; first < chunks; first += window) {
+            size_t batch = std::min(window, chunks - first);
+            runParallel(batch, [&](size_t i) {
+                size_t begin = (first + i) * kImpactChunkRows;
+                partials[i].reset();
+                kernel(snapshots, begin, std::min(rows, begin + kImpactChunkRows), side, partials[i]);
+            });
+            for (size_t i = 0; i < batch; ++i) total.merge(partials[i]);
+        }
+        return total.results();
+    }
+    
+    /**
+     * @brief Statistics and/or both impact grids of a store in one chunked traversal
+     * @param rows Snapshots to evaluate
+     * @param stats Receives market statistics (nullptr = skip)
+     * @param buy Receives buy-side sums (nullptr together with sell = statistics only)
+     * @param sell Receives sell-side sums
+     * @param surface Receives the intraday surface cells (nullptr = none; needs buy and sell)
+     * @param schedule_surface Receives scheduleKernel() cells (nullptr = none; needs surface)
+     * 
+     * Rows are reduced over fixed kImpactChunkRows chunks in chunk order,
+     * like calculateImpactCurve(), so results do not depend on the thread
+     * count and a streaming run (one chunk per batch) matches an in-memory
+     * one. Each chunk is traversed once for everything requested: the
+     * cumulative engine walks both sides of each row right after its
+     * statistics; the other engines run their kernels back to back on the
+     * chunk while it is cache resident. A single chunk with a pool splits
+     * the sides across two workers instead.
+     * 
+     * With a surface, each run of a chunk's rows in one time bucket is
+     * evaluated into run sums that are merged into both the chunk's curve
+     * and the bucket's cell (the schedule kernel walks the same run while it
+     * is resident), so the surfaces cost no extra pass; the curve is then
+     * the sum of run sums, equal to a run without surfaces up to
+     * floating-point summation order.
+     */
+    void reduceChunks(const SnapshotStore& rows, MarketStats* stats, ImpactAccumulator* buy, ImpactAccumulator* sell,
+                      ImpactSurface* surface = nullptr, ImpactSurface* schedule_surface = nullptr) {
+        const bool curves = buy && sell;
+        if (!curves) surface = nullptr;
+        if (!surface) schedule_surface = nullptr;
+        const ImpactKernel kernel = impactKernel();
+        const ImpactKernel schedule_kernel = scheduleKernel();
+        const OrderSizeGrid grid = curves ? buy->grid : OrderSizeGrid();
+        auto chunk = [&](size_t begin, size_t end, MarketStats& s, ImpactAccumulator& b, ImpactAccumulator& a) {
+            if (curves && options.engine == ImpactEngine::CumulativeDepth) {
+                fusedPass(rows, begin, end, stats ? &s : nullptr, b, a);
+                return;
+            }
+            if (stats) addMarketStats(s, rows, begin, end);
+            if (curves) {
+                kernel(rows, begin, end, Side::Buy, b);
+                kernel(rows, begin, end, Side::Sell, a);
+            }
+        };
+        struct Cells {
+            ImpactSurface surface;
+            ImpactSurface schedule;
+            ImpactAccumulator run_buy;
+            ImpactAccumulator run_sell;
+        };
+        auto bucketed = [&](size_t begin, size_t end, MarketStats& s, ImpactAccumulator& b, ImpactAccumulator& a,
+                            Cells& cells) {
+            for (size_t row = begin; row < end;) {
+                const int64_t bucket = cells.surface.bucketOf(rows.ts_ns[row]);
+                size_t run_end = row + 1;
+                while (run_end < end && cells.surface.bucketOf(rows.ts_ns[run_end]) == bucket) ++run_end;
+                cells.run_buy.reset();
+                cells.run_sell.reset();
+                chunk(row, run_end, s, cells.run_buy, cells.run_sell);
+                b.merge(cells.run_buy);
+                a.merge(cells.run_sell);
+                const double books = ImpactSurface::bookWeight(rows, row, run_end);
+                ImpactSurface::Cell& cell = cells.surface.cell(bucket);
+                cell.buy.merge(cells.run_buy);
+                cell.sell.merge(cells.run_sell);
+                cell.books += books;
+                if (schedule_surface) {
+                    ImpactSurface::Cell& schedule_cell = cells.schedule.cell(bucket);
+                    schedule_kernel(rows, row, run_end, Side::Buy, schedule_cell.buy);
+                    schedule_kernel(rows, row, run_end, Side::Sell, schedule_cell.sell);
+                    schedule_cell.books += books;
+                }
+                row = run_end;
+            }
+        };
+        
+        const size_t count = rows.size();
+        const size_t chunks = (count + kImpactChunkRows - 1) / kImpactChunkRows;
+        if (chunks == 1 && pool && curves && !surface) {
+            MarketStats partial_stats;
+            ImpactAccumulator partials[2] = {ImpactAccumulator(grid, options.distribution),
+                                             ImpactAccumulator(grid, options.distribution)};
+            runParallel(2, [&](size_t i) {
+                if (i == 0 && stats) addMarketStats(partial_stats, rows, 0, count);
+                kernel(rows, 0, count, i == 0 ? Side::Buy : Side::Sell, partials[i]);
+            });
+            if (stats) stats->merge(partial_stats);
+            buy->merge(partials[0]);
+            sell->merge(partials[1]);
+            return;
+        }
+        
+        const size_t window = std::min(chunks, pool ? pool->size() * 2 : size_t{1});
+        std::vector<MarketStats> partial_stats(window);
+        std::vector<ImpactAccumulator> partial_buy(curves ? window : 0, ImpactAccumulator(grid, options.distribution));
+        std::vector<ImpactAccumulator> partial_sell(curves ? window : 0, ImpactAccumulator(grid, options.distribution));
+        std::vector<Cells> partial_cells;
+        if (surface) {
+            for (size_t i = 0; i < window; ++i) {
+                partial_cells.push_back(Cells{surface->emptyCopy(), surface->emptyCopy(),
+                                              ImpactAccumulator(grid, options.distribution),
+                                              ImpactAccumulator(grid, options.distribution)});
+            }
+        }
+        ImpactAccumulator unused(OrderSizeGrid{1, 0});
+        for (size_t first = 0; first < chunks; first += window) {
+            size_t batch = std::min(window, chunks - first);
+            runParallel(batch, [&](size_t i) {
+                size_t begin = (first + i) * kImpactChunkRows;
+                size_t end = std::min(count, begin + kImpactChunkRows);
+                partial_stats[i] = MarketStats();
+                if (curves) {
+                    partial_buy[i].reset();
+                    partial_sell[i].reset();
+                }
+                if (surface) {
+                    bucketed(begin, end, partial_stats[i], partial_buy[i], partial_sell[i], partial_cells[i]);
+                } else {
+                    chunk(begin, end, partial_stats[i], curves ? partial_buy[i] : unused, curves ? partial_sell[i] : unused);
+                }
+            });
+            for (size_t i = 0; i < batch; ++i) {
+                if (stats) stats->merge(partial_stats[i]);
+                if (curves) {
+                    buy->merge(partial_buy[i]);
+                    sell->merge(partial_sell[i]);
+                }
+                if (surface) {
+                    surface->merge(partial_cells[i].surface);
+                    partial_cells[i].surface.clear();
+                }
+                if (schedule_surface) {
+                    schedule_surface->merge(partial_cells[i].schedule);
+                    partial_cells[i].schedule.clear();
+                }
+            }
+        }
+    }
+    
+    /**
+     * @brief Analyze a single symbol and generate complete impact analysis
+     * @param symbol Stock symbol to analyze (e.g., "CRWV", "FROG", "SOUN")
+     * 
+     * This function performs a complete analysis of temporary price impact for
+     * a single symbol. It loads the data, calculates impact functions for both
+     * buy and sell orders, generates statistics, and saves results to CSV files.
+     * 
+     * Output includes:
+     * - Basic market statistics (mid-price, spread, depth)
+     * - Buy-side impact analysis
+     * - Sell-side impact analysis
+     * - Sample results display
+     * - CSV files for detailed analysis
+     */
+    void analyzeSymbol(const std::string& symbol) {
+        log() << "\n=== Analyzing " << symbol << " ===" << std::endl;
+        if (!options.partials_dir.empty()) {
+            writePartials(symbol);
+            return;
+        }
+        
+        SymbolMetrics* symbol_metrics = metrics.symbol(symbol);
+        auto phase = [&](Phase p) { return symbol_metrics ? symbol_metrics->phase(p) : nullptr; };
+        // Both curves come out of one pass, so it is announced before that pass starts
+        auto announceImpact = [&] {
+            log() << "Calculating buy side temporary impact..." << std::endl;
+            log() << "Calculating sell side temporary impact..." << std::endl;
+        };
+        
+        const OrderSizeGrid grid{options.grid_step, options.max_shares};
+        std::unique_ptr<ImpactSurface> surface;
+        std::unique_ptr<ImpactSurface> schedule_surface;
+        if (options.bucket_minutes > 0) {
+            surface = std::make_unique<ImpactSurface>(grid, options.bucket_minutes);
+            schedule_surface = makeScheduleSurface(grid);
+        }
+        
+        if (options.streaming) {
+            MarketStats stats;
+            ImpactAccumulator buy(grid, options.distribution), sell(grid, options.distribution);
+            announceImpact();
+            if (!streamData(symbol, stats, buy, sell, surface.get(), schedule_surface.get())) {
+                log() << "Failed to load data for " << symbol << std::endl;
+                return;
+            }
+            ScopedTimer timer(phase(Phase::Report));
+            printMarketStats(stats);
+            reportImpactResults(symbol, buy.results(), sell.results());
+            if (surface) saveSurfaces(symbol, *surface);
+            if (surface && options.schedule_shares > 0) saveSchedules(symbol, schedule_surface ? *schedule_surface : *surface);
+            return;
+        }
+        
         if (!loadData(symbol)) {
-            std::cout << "Failed to load data for " << symbol << std::endl;
+            log() << "Failed to load data for " << symbol << std::endl;
             return;
         }
         
-        const auto& snapshots = data[symbol];
+        const auto& snapshots = data[symbol];
+        if (options.snapshot_detail) {
+            ScopedTimer timer(phase(Phase::Report));
+            writeSnapshotDetail(symbol, snapshots);
+        }
+        
+        // Statistics are fused into the impact pass unless the curves use
+        // other rows (collapsed states) or the reference engine
+        const bool time_weighted = options.averaging == Averaging::TimeWeighted;
+        const bool fused = !time_weighted && options.engine != ImpactEngine::Reference;
+        MarketStats stats;
+        ImpactAccumulator buy(grid, options.distribution), sell(grid, options.distribution);
+        if (fused) {
+            announceImpact();
+            ScopedTimer timer(phase(Phase::Impact));
+            reduceChunks(snapshots, &stats, &buy, &sell, surface.get(), schedule_surface.get());
+        } else {
+            ScopedTimer timer(phase(Phase::Stats));
+            reduceChunks(snapshots, &stats, nullptr, nullptr);
+        }
+        printMarketStats(stats);
+        
+        // Time weighting evaluates distinct states only; they replace the raw rows
+        if (time_weighted) {
+            ScopedTimer timer(phase(Phase::Impact));
+            SnapshotStore states = StateCollapser::collapse(snapshots);
+            printCollapse(snapshots.size(), states.size());
+            data[symbol] = std::move(states);
+        }
+        
+        // Calculate impact functions
+        std::vector<ImpactResult> buy_impact, sell_impact;
+        {
+            ScopedTimer timer(phase(Phase::Impact));
+            if (options.engine == ImpactEngine::Reference) {
+                buy_impact = calculateImpactCurve(data[symbol], Side::Buy);
+                sell_impact = calculateImpactCurve(data[symbol], Side::Sell);
+                // The reference walk has no row-range form, so its surfaces take their own passes
+                if (surface) surface->add(data[symbol], 0, data[symbol].size(), impactKernel(), parallel());
+                if (schedule_surface) {
+                    schedule_surface->add(data[symbol], 0, data[symbol].size(), scheduleKernel(), parallel());
+                }
+            } else {
+                if (!fused) {
+                    announceImpact();
+                    reduceChunks(data[symbol], nullptr, &buy, &sell, surface.get(), schedule_surface.get());
+                }
+                buy_impact = buy.results();
+                sell_impact = sell.results();
+            }
+        }
+        
+        if (options.piecewise || !options.impact_at.empty()) {
+            ScopedTimer timer(phase(Phase::Impact));
+            reportPiecewise(symbol, data[symbol]);
+        }
+        
+        ScopedTimer timer(phase(Phase::Report));
+        reportImpactResults(symbol, buy_impact, sell_impact);
+        if (surface) saveSurfaces(symbol, *surface);
+        if (surface && options.schedule_shares > 0) saveSchedules(symbol, schedule_surface ? *schedule_surface : *surface);
+    }
+    
+    /**
+     * @brief Exact breakpoint curve of one side over all rows of a store
+     * 
+     * kImpactChunkRows chunks are built concurrently and merged in order,
+     * so the curve is the same at any thread count.
+     */
+    PiecewiseImpactCurve buildPiecewise(const SnapshotStore& rows, Side side) {
+        PiecewiseImpactCurve curve;
+        const size_t chunks = (rows.size() + kImpactChunkRows - 1) / kImpactChunkRows;
+        const size_t window = std::max<size_t>(std::min(chunks, pool ? pool->size() * 2 : size_t{1}), 1);
+        std::vector<PiecewiseImpactCurve> parts(window);
+        for (size_t first = 0; first < chunks; first += window) {
+            const size_t batch = std::min(window, chunks - first);
+            runParallel(batch, [&](size_t i) {
+                parts[i] = PiecewiseImpactCurve();
+                const size_t begin = (first + i) * kImpactChunkRows;
+                parts[i].add(rows, begin, std::min(rows.size(), begin + kImpactChunkRows), side);
+            });
+            for (size_t i = 0; i < batch; ++i) curve.merge(parts[i]);
+        }
+        curve.finalize();
+        return curve;
+    }
+    
+    /**
+     * @brief Build, save (--piecewise) and query (--impact-at) both sides' exact curves
+     * 
+     * Writes <symbol>_<side>_piecewise.csv and prints g at the requested
+     * sizes: the exact mean over snapshots that fill the order, their
+     * share, and the grid engines' value with short books averaged in.
+     */
+    void reportPiecewise(const std::string& symbol, const SnapshotStore& rows) {
+        for (Side side : {Side::Buy, Side::Sell}) {
+            const PiecewiseImpactCurve curve = buildPiecewise(rows, side);
+            if (options.piecewise) {
+                const std::string filename = outputPath(symbol + "_" + sideName(side) + "_piecewise.csv");
+                if (curve.save(filename)) {
+                    log() << "Saved " << curve.breakpoints() << "-breakpoint exact " << sideName(side)
+                              << " curve to " << filename << std::endl;
+                }
+            }
+            if (options.impact_at.empty()) continue;
+            log() << "\nExact " << sideName(side) << " impact:" << std::endl;
+            log() << "Order Size\tImpact (bps)\tFilled\t\tWith partial fills (bps)" << std::endl;
+            for (int64_t x : options.impact_at) {
+                PiecewiseImpactCurve::Point point;
+                if (!curve.evaluate(x, point)) continue;
+                log() << x << "\t\t" << std::fixed << std::setprecision(4);
+                if (point.fill_fraction > 0) {
+                    log() << point.impact * 10000.0;
+                } else {
+                    log() << "n/a";
+                }
+                log() << "\t\t" << std::setprecision(1) << point.fill_fraction * 100.0 << "%\t\t"
+                          << std::setprecision(4) << point.impact_with_partial * 10000.0 << std::endl;
+            }
+        }
+    }
+    
+    /**
+     * @brief Map step of a sharded run: write this shard's per-day sums of a symbol
+     * @param symbol Stock symbol
+     * 
+     * The day files (after --max-files) are split over the shards by
+     * planShards(); this worker processes its own files one at a time,
+     * through the snapshot cache, and writes
+     * <partials_dir>/<symbol>.shard-<i>-of-<n>.obpart, without days if it
+     * was given none of the symbol's, so that --reduce can check every
+     * shard reported. Each day is reduced on its own, with time-weighted
+     * states collapsed within it.
+     */
+    void writePartials(const std::string& symbol) {
+        log() << "Loading data for " << symbol << " (shard " << options.shard_index << " of "
+                  << options.shard_count << ")..." << std::endl;
+        
+        SymbolMetrics* symbol_metrics = metrics.symbol(symbol);
+        auto phase = [&](Phase p) { return symbol_metrics ? symbol_metrics->phase(p) : nullptr; };
+        
+        PartialResults partial;
+        partial.symbol = symbol;
+        partial.grid = OrderSizeGrid{options.grid_step, options.max_shares};
+        partial.averaging = options.averaging;
+        partial.distribution = options.distribution;
+        partial.shard_index = options.shard_index;
+        partial.shard_count = options.shard_count;
+        
+        std::vector<fs::path> files = listDayFiles(symbol);
+        files.resize(std::min(files.size(), static_cast<size_t>(maxFiles())));
+        BookQuality::Counts excluded;
+        for (size_t i = 0; i < files.size(); ++i) {
+            auto assigned = shard_plan.find(files[i]);
+            if (assigned == shard_plan.end() || assigned->second != options.shard_index) continue;
+            log() << "  Loading file: " << files[i].filename() << std::endl;
+            SnapshotStore snapshots;
+            int rows_loaded = 0;
+            IngestCounters counters;
+            BookQuality::Counts screened;
+            bool opened;
+            {
+                ScopedTimer timer(phase(Phase::Load));
+                opened = loadFile(files[i], snapshots, rows_loaded, symbol_metrics ? &counters : nullptr, &screened);
+            }
+            if (!opened) continue;
+            if (symbol_metrics) symbol_metrics->ingest.merge(counters);
+            excluded.merge(screened);
+            log() << "    Loaded " << rows_loaded << " valid snapshots" << std::endl;
+            if (snapshots.empty()) continue;
+            
+            ScopedTimer timer(phase(Phase::Impact));
+            PartialResults::Day day = partial.makeDay(snapshots.days[0]);
+            day.snapshots = snapshots.size();
+            if (options.averaging == Averaging::TimeWeighted) {
+                reduceChunks(snapshots, &day.stats, nullptr, nullptr);
+                SnapshotStore states = StateCollapser::collapse(snapshots);
+                reduceChunks(states, nullptr, &day.buy, &day.sell);
+            } else {
+                reduceChunks(snapshots, &day.stats, &day.buy, &day.sell);
+            }
+            partial.days.push_back(std::move(day));
+        }
+        if (options.exclude_books) printExcluded(symbol, excluded);
+        
+        if (partial.days.empty()) log() << "No days of " << symbol << " in this shard" << std::endl;
+        ScopedTimer timer(phase(Phase::Report));
+        fs::path path = fs::path(options.partials_dir) / (symbol + ".shard-" + std::to_string(options.shard_index) +
+                                                          "-of-" + std::to_string(options.shard_count) + ".obpart");
+        std::error_code ec;
+        fs::create_directories(path.parent_path(), ec);
+        if (!partial.save(path)) {
+            throw std::runtime_error("could not write partial results to " + path.string());
+        }
+        log() << "Saved " << partial.days.size() << " day(s) of partial results to " << path.string() << std::endl;
+    }
+    
+    /**
+     * @brief Log the effect of time-weighted state collapsing
+     */
+    void printCollapse(size_t rows, size_t states) const {
+        log() << "Time-weighted states: " << states << " of " << rows << " snapshots ("
+                  << std::fixed << std::setprecision(1)
+                  << (rows ? 100.0 * static_cast<double>(states) / static_cast<double>(rows) : 0.0) << "%)" << std::endl;
+    }
+    
+    /**
+     * @brief Print average mid price, spread and depth
+     * @param stats Accumulated statistics of one symbol
+     */
+    void printMarketStats(const MarketStats& stats) {
+        const int64_t valid_snapshots = stats.valid_snapshots;
+        if (valid_snapshots > 0) {
+            log() << std::fixed << std::setprecision(4);
+            log() << "Average mid price: $" << stats.total_mid / valid_snapshots << std::endl;
+            log() << "Average spread: " << (stats.total_spread / stats.total_mid * 10000 / valid_snapshots) << " bps" << std::endl;
+            log() << "Average bid depth: " << stats.total_bid_depth / valid_snapshots << " shares" << std::endl;
+            log() << "Average ask depth: " << stats.total_ask_depth / valid_snapshots << " shares" << std::endl;
+        }
+    }
+    
+    /**
+     * @brief Save both impact curves to CSV and print the first rows
+     * @param symbol Stock symbol (used for the file names)
+     * @param buy_impact Buy-side curve
+     * @param sell_impact Sell-side curve
+     */
+    void reportImpactResults(const std::string& symbol, const std::vector<ImpactResult>& buy_impact,
+                             const std::vector<ImpactResult>& sell_impact) {
+        if (options.output_format != OutputFormat::Columnar) {
+            saveImpactResults(outputPath(symbol + "_buy_impact.csv"), buy_impact);
+            saveImpactResults(outputPath(symbol + "_sell_impact.csv"), sell_impact);
+        }
+        if (options.output_format != OutputFormat::Csv) {
+            saveImpactColumnar(outputPath(symbol + "_buy_impact.obcol"), symbol, Side::Buy, buy_impact);
+            saveImpactColumnar(outputPath(symbol + "_sell_impact.obcol"), symbol, Side::Sell, sell_impact);
+        }
+        
+        // Print sample results
+        log() << "\nSample Buy Impact Results:" << std::endl;
+        log() << "Order Size\tImpact (bps)" << std::endl;
+        for (size_t i = 0; i < std::min(static_cast<size_t>(10), buy_impact.size()); ++i) {
+            log() << buy_impact[i].order_size << "\t\t" 
+                      << std::setprecision(2) << buy_impact[i].impact_bps << std::endl;
+        }
+        
+        log() << "\nSample Sell Impact Results:" << std::endl;
+        log() << "Order Size\tImpact (bps)" << std::endl;
+        for (size_t i = 0; i < std::min(static_cast<size_t>(10), sell_impact.size()); ++i) {
+            log() << sell_impact[i].order_size << "\t\t" 
+                      << std::setprecision(2) << sell_impact[i].impact_bps << std::endl;
+        }
+    }
+    
+    /**
+     * @brief Write <symbol>_buy_surface.csv and <symbol>_sell_surface.csv
+     */
+    void saveSurfaces(const std::string& symbol, const ImpactSurface& surface) {
+        for (Side side : {Side::Buy, Side::Sell}) {
+            const std::string stem = outputPath(symbol + "_" + sideName(side) + "_surface");
+            if (options.output_format != OutputFormat::Columnar && surface.save(stem + ".csv", side)) {
+                log() << "Saved " << surface.buckets() << "-bucket surface to " << stem << ".csv" << std::endl;
+            }
+            if (options.output_format != OutputFormat::Csv) {
+                ColumnarWriter writer(stem + ".obcol");
+                describeColumnar(writer, symbol, side);
+                writer.setMetadata("bucket_minutes", std::to_string(options.bucket_minutes));
+                if (surface.saveColumnar(writer, side)) {
+                    log() << "Saved " << surface.buckets() << "-bucket surface to " << stem << ".obcol" << std::endl;
+                } else {
+                    log() << "Could not write " << stem << ".obcol" << std::endl;
+                }
+            }
+        }
+    }
+    
+    /**
+     * @brief Solve and write the optimal child-order schedule of each side
+     * 
+     * Splits --schedule-shares over the surface buckets of the day with
+     * ExecutionSolver and writes <symbol>_<side>_schedule.csv
+     * (bucket_start,shares,impact_bps; impact_bps is the bucket's g at its
+     * child size) for non-empty buckets. The surface must come from
+     * scheduleKernel(), so a bucket only takes child sizes that at least
+     * --schedule-min-fill of its books could fill completely.
+     */
+    void saveSchedules(const std::string& symbol, const ImpactSurface& surface) {
+        const int total = options.schedule_shares;
+        const double min_fill = options.schedule_min_fill;
+        const std::vector<int64_t> buckets = surface.bucketIndices();
+        for (Side side : {Side::Buy, Side::Sell}) {
+            ExecutionSolver solver = ExecutionSolver::fromSurface(surface, side, min_fill);
+            ExecutionSolver::Schedule schedule = solver.solve(total);
+            if (!schedule.feasible) {
+                log() << "No " << sideName(side) << " schedule for " << total << " shares within the "
+                          << buckets.size() << " buckets' measured depth" << std::endl;
+                continue;
+            }
+            
+            std::string filename = outputPath(symbol + "_" + sideName(side) + "_schedule.csv");
+            std::ofstream file(filename);
+            if (!file.is_open()) continue;
+            file << "bucket_start,shares,impact_bps\n";
+            size_t used = 0;
+            for (size_t i = 0; i < buckets.size(); ++i) {
+                const int shares = schedule.shares[i];
+                if (shares == 0) continue;
+                const double impact =
+                    surface.bucketCurve(buckets[i], side, min_fill)[static_cast<size_t>(shares / options.grid_step) - 1];
+                file << surface.bucketLabel(buckets[i]) << "," << shares << ","
+                     << std::fixed << std::setprecision(6) << impact * 10000.0 << "\n";
+                used++;
+            }
+            log() << "Optimal " << sideName(side) << " schedule for " << total << " shares: " << used << " of "
+                      << buckets.size() << " buckets, average impact " << std::fixed << std::setprecision(2)
+                      << schedule.impactBps(total) << " bps (saved to " << filename << ")" << std::endl;
+        }
+    }
+    
+    /**
+     * @brief Save impact analysis results to CSV file
+     * @param filename Output CSV filename
+     * @param results Vector of ImpactResult to save
+     * 
+     * Creates a CSV file with columns:
+     * - order_size: Order size in shares
+     * - avg_impact: Average impact as decimal
+     * - impact_bps: Average impact in basis points
+     * - std_bps, p50_bps, p95_bps, p99_bps: Dispersion and quantiles of the
+     *   per-snapshot impact (only with --distribution)
+     * 
+     * The CSV format is compatible with Python pandas for further analysis.
+     */
+    void saveImpactResults(const std::string& filename, const std::vector<ImpactResult>& results) {
+        std::ofstream file(filename);
+        if (file.is_open()) {
+            // Write CSV header
+            file << "order_size,avg_impact,impact_bps";
+            if (options.distribution) file << ",std_bps,p50_bps,p95_bps,p99_bps";
+            file << "\n";
+            
+            // Write data rows
+            for (const auto& result : results) {
+                file << result.order_size << "," 
+                     << std::fixed << std::setprecision(6) << result.avg_impact << "," 
+                     << std::fixed << std::setprecision(6) << result.impact_bps;
+                if (options.distribution) {
+                    file << "," << result.std_bps << "," << result.p50_bps << ","
+                         << result.p95_bps << "," << result.p99_bps;
+                }
+                file << "\n";
+            }
+            
+            log() << "Saved results to " << filename << std::endl;
+        }
+    }
+    
+    /**
+     * @brief Metadata common to every .obcol result file
+     */
+    void describeColumnar(ColumnarWriter& writer, const std::string& symbol, Side side) const {
+        writer.setMetadata("symbol", symbol);
+        writer.setMetadata("side", sideName(side));
+        writer.setMetadata("grid_step", std::to_string(options.grid_step));
+        writer.setMetadata("max_shares", std::to_string(options.max_shares));
+        writer.setMetadata("averaging", options.averaging == Averaging::TimeWeighted ? "time" : "snapshot");
+    }
+    
+    /**
+     * @brief Save one impact curve as .obcol (same columns as saveImpactResults())
+     */
+    void saveImpactColumnar(const std::string& filename, const std::string& symbol, Side side,
+                            const std::vector<ImpactResult>& results) {
+        using Encoding = ColumnarWriter::Encoding;
+        ColumnarWriter writer(filename);
+        describeColumnar(writer, symbol, side);
+        const size_t size_col = writer.addColumn("order_size", Encoding::DeltaInt64);
+        const size_t avg_col = writer.addColumn("avg_impact", Encoding::Float64);
+        const size_t bps_col = writer.addColumn("impact_bps", Encoding::Float64);
+        size_t std_col = 0;
+        if (options.distribution) {
+            std_col = writer.addColumn("std_bps", Encoding::Float64);
+            writer.addColumn("p50_bps", Encoding::Float64);
+            writer.addColumn("p95_bps", Encoding::Float64);
+            writer.addColumn("p99_bps", Encoding::Float64);
+        }
+        for (const auto& result : results) {
+            writer.append(size_col, static_cast<int64_t>(result.order_size));
+            writer.append(avg_col, result.avg_impact);
+            writer.append(bps_col, result.impact_bps);
+            if (options.distribution) {
+                writer.append(std_col, result.std_bps);
+                writer.append(std_col + 1, result.p50_bps);
+                writer.append(std_col + 2, result.p95_bps);
+                writer.append(std_col + 3, result.p99_bps);
+            }
+            writer.endRow();
+        }
+        if (writer.finish()) {
+            log() << "Saved results to " << filename << std::endl;
+        } else {
+            log() << "Could not write " << filename << std::endl;
+        }
+    }
+    
+    /**
+     * @brief Write the impact of every loaded snapshot at every grid size to <SYMBOL>_snapshots.obcol
+     * 
+     * One row per (valid snapshot, order size): ts_ns, order_size,
+     * buy_impact, sell_impact (decimal; a size beyond a side's visible depth
+     * is priced per --partial-fills, as in the curves; NaN if that side is
+     * empty or the size is skipped). Rows are the raw loaded ones, in
+     * load order, before any --averaging=time collapsing; the impacts are
+     * those the curves average.
+     */
+    void writeSnapshotDetail(const std::string& symbol, const SnapshotStore& store) {
+        using Encoding = ColumnarWriter::Encoding;
+        const OrderSizeGrid grid{options.grid_step, options.max_shares};
+        const std::string filename = outputPath(symbol + "_snapshots.obcol");
+        ColumnarWriter writer(filename);
+        writer.setMetadata("symbol", symbol);
+        writer.setMetadata("grid_step", std::to_string(options.grid_step));
+        writer.setMetadata("max_shares", std::to_string(options.max_shares));
+        const size_t ts_col = writer.addColumn("ts_ns", Encoding::DeltaInt64);
+        const size_t size_col = writer.addColumn("order_size", Encoding::DeltaInt64);
+        const size_t buy_col = writer.addColumn("buy_impact", Encoding::Float64);
+        const size_t sell_col = writer.addColumn("sell_impact", Encoding::Float64);
+        
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        ImpactAccumulator buy(grid), sell(grid);
+        for (size_t row = 0; row < store.size(); ++row) {
+            const double mid_price = store.midPrice(row);
+            if (mid_price <= 0) continue;
+            buy.reset();
+            sell.reset();
+            fusedPass(store, row, row + 1, nullptr, buy, sell);
+            for (size_t k = 0; k < grid.points(); ++k) {
+                if (buy.count[k] == 0 && sell.count[k] == 0) break;  // Neither side prices this or a larger size
+                writer.append(ts_col, store.ts_ns[row]);
+                writer.append(size_col, static_cast<int64_t>(grid.orderSize(k)));
+                writer.append(buy_col, buy.count[k] ? buy.impact_sum[k] / buy.weight_sum[k] : nan);
+                writer.append(sell_col, sell.count[k] ? sell.impact_sum[k] / sell.weight_sum[k] : nan);
+                writer.endRow();
+            }
+        }
+        const uint64_t rows = writer.rowCount();
+        if (writer.finish()) {
+            log() << "Saved " << rows << " per-snapshot impacts to " << filename << std::endl;
+        } else {
+            log() << "Could not write " << filename << std::endl;
+        }
+    }
+    
+    /**
+     * @brief Display answers to the main task questions
+     * 
+     * This function provides comprehensive answers to both questions in the task:
+     * 1. How to model the temporary impact function g_s(x)
+     * 2. Mathematical framework for optimal execution with constraint Σᵢ xᵢ = S
+     * 
+     * The answers reference the implemented VWAP-based approach and provide
+     * mathematical formulations for the optimization problem.
+     */
+    void answerTaskQuestions() {
+        log() << "\n" << std::string(60, '=') << std::endl;
+        log() << "ANSWERING TASK QUESTIONS" << std::endl;
+        log() << std::string(60, '=') << std::endl;
+        
+        log() << "\n1. How do you choose to model the temporary impact g_s(x)?" << std::endl;
+        log() << "   Answer: I model g_s(x) as the weighted average execution price impact" << std::endl;
+        log() << "   when consuming X shares from the order book. This is implemented by:" << std::endl;
+        log() << "   - Walking through order book levels sequentially" << std::endl;
+        log() << "   - Taking liquidity at each level until order is filled" << std::endl;
+        log() << "   - Computing volume-weighted average price (VWAP)" << std::endl;
+        log() << "   - Measuring impact as (VWAP - Mid_Price) / Mid_Price" << std::endl;
+        
+        log() << "\n2. Mathematical Framework:" << std::endl;
+        log() << R"(
+   Let O(t) = {(p_i, s_i)} be the order book state at time t
+   where p_i is price and s_i is size at level i
+   
+   For buy order of size X:
+   VWAP_buy(X) = Σ(min(remaining, s_i) × p_i) / Σ(min(remaining, s_i))
+   g_buy(X) = (VWAP_buy(X) - mid_price) / mid_price
+   
+   For sell order of size X:
+   VWAP_sell(X) = Σ(min(remaining, s_i) × p_i) / Σ(min(remaining, s_i))
+   g_sell(X) = (mid_price - VWAP_sell(X)) / mid_price
+   
+   The C++ implementation provides O(n×(m+k)) complexity where:
+   - n = number of snapshots
+   - m = number of order sizes tested  
+   - k = number of book levels (10)
+   (each snapshot's level walk is shared by the whole ascending size grid)
+   
+   This is significantly faster than Python for large datasets.
+        )" << std::endl;
+    }
+    
+    /**
+     * @brief Reduce step of a sharded run: merge partial results into final curves
+     * @param dir Directory holding the workers' *.obpart files
+     * @throws std::runtime_error if a file is unreadable, the partials of a
+     *         symbol disagree on grid, averaging, distribution or shard
+     *         count, a day occurs twice, or any shard 0 .. N-1 of a symbol
+     *         is missing or present twice
+     * 
+     * Symbols are reported in name order with the same statistics, sample
+     * rows and CSV files as an analysis run. The days of a symbol are merged
+     * in date order whatever the file order, so the result equals a
+     * single-process run up to floating-point summation order.
+     */
+    void reducePartials(const std::string& dir) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        log() << "Blockhouse Order Book Analysis (C++) - reduce" << std::endl;
+        log() << std::string(50, '=') << std::endl;
+        
+        std::vector<fs::path> files;
+        for (const auto& entry : fs::directory_iterator(dir)) {
+            if (entry.path().extension() == ".obpart") files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end());
+        
+        std::map<std::string, PartialResults> merged;
+        std::map<std::string, std::vector<bool>> shards_seen;
+        for (const auto& path : files) {
+            PartialResults partial;
+            if (!PartialResults::load(path, partial)) {
+                throw std::runtime_error("could not read partial results " + path.string());
+            }
+            std::vector<bool>& seen = shards_seen[partial.symbol];
+            if (seen.empty()) seen.assign(static_cast<size_t>(partial.shard_count), false);
+            if (seen.size() != static_cast<size_t>(partial.shard_count) || seen[static_cast<size_t>(partial.shard_index)]) {
+                throw std::runtime_error(path.string() + " repeats a shard or disagrees on the shard count of " +
+                                         partial.symbol);
+            }
+            seen[static_cast<size_t>(partial.shard_index)] = true;
+            auto it = merged.find(partial.symbol);
+            if (it == merged.end()) {
+                std::string symbol = partial.symbol;
+                merged.emplace(symbol, std::move(partial));
+            } else if (!it->second.absorb(std::move(partial))) {
+                throw std::runtime_error(path.string() + " conflicts with earlier partials of " + it->first +
+                                         " (grid, averaging, distribution or a repeated day)");
+            }
+        }
+        if (merged.empty()) throw std::runtime_error("no partial results (*.obpart) in " + dir);
+        for (const auto& entry : shards_seen) {
+            for (size_t shard = 0; shard < entry.second.size(); ++shard) {
+                if (entry.second[shard]) continue;
+                throw std::runtime_error("partial results of " + entry.first + " are incomplete: shard " +
+                                         std::to_string(shard) + " of " + std::to_string(entry.second.size()) +
+                                         " is missing from " + dir);
+            }
+        }
+        log() << "Read " << files.size() << " partial file(s)" << std::endl;
+        
+        for (const auto& entry : merged) {
+            const PartialResults& partial = entry.second;
+            log() << "\n=== Reducing " << entry.first << " (" << partial.days.size() << " days) ===" << std::endl;
+            if (partial.days.empty()) {
+                log() << "No days of " << entry.first << " in any shard" << std::endl;
+                continue;
+            }
+            MarketStats stats;
+            ImpactAccumulator buy(partial.grid, partial.distribution), sell(partial.grid, partial.distribution);
+            uint64_t snapshots = partial.reduce(stats, buy, sell);
+            log() << "Total snapshots for " << entry.first << ": " << snapshots << std::endl;
+            printMarketStats(stats);
+            options.distribution = partial.distribution;  // CSV columns follow the partials
+            reportImpactResults(entry.first, buy.results(), sell.results());
+        }
+        
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - start_time);
+        log() << "\nTotal execution time: " << duration.count() << " ms" << std::endl;
+    }
+    
+    /**
+     * @brief Analyze all symbols concurrently, one group of workers per NUMA node (--batch)
+     * 
+     * Symbols are placed largest first (by selected day-file bytes) on the
+     * group with the fewest bytes so far, like the files in planShards().
+     * Each group is a thread pinned to its node's CPUs driving its own
+     * analyzer over its symbols in analysis order. The group's pool workers
+     * and prefetch thread inherit the pinning, so parsing first-touches
+     * every store (and reading ahead every page cache page) on that node
+     * and the impact passes read local memory only; no store is shared
+     * across nodes. Each symbol's output is buffered and written in the
+     * usual symbol order once all groups are done, and the groups' metrics
+     * are merged into this analyzer's, so log, files and metrics equal a
+     * serial run's apart from a summary line and timings. Stores are released with their
+     * group, so snapshots() is empty afterwards.
+     */
+    void analyzeByNode() {
+        const std::vector<NumaNode> nodes = detectNumaNodes();
+        const size_t wanted = options.numa_nodes > 0 ? static_cast<size_t>(options.numa_nodes) : nodes.size();
+        const size_t groups = std::max<size_t>(1, std::min(wanted, symbols.size()));
+        
+        std::vector<std::pair<uintmax_t, size_t>> sized;  // (bytes, symbol index)
+        for (size_t i = 0; i < symbols.size(); ++i) {
+            uintmax_t bytes = 0;
+            std::vector<fs::path> day_files;
+            try {
+                day_files = listDayFiles(symbols[i]);
+            } catch (const fs::filesystem_error&) {
+                // Fails again, and is reported, in analyzeSymbol()
+            }
+            day_files.resize(std::min(day_files.size(), static_cast<size_t>(maxFiles())));
+            for (const auto& path : day_files) {
+                std::error_code ec;
+                uintmax_t size = fs::file_size(path, ec);
+                if (!ec) bytes += size;
+            }
+            sized.emplace_back(bytes, i);
+        }
+        std::sort(sized.begin(), sized.end(), [](const auto& a, const auto& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+        std::vector<uintmax_t> load(groups, 0);
+        std::vector<std::vector<size_t>> members(groups);
+        std::vector<size_t> group_of(symbols.size(), 0);
+        for (const auto& symbol : sized) {
+            size_t group = static_cast<size_t>(std::min_element(load.begin(), load.end()) - load.begin());
+            load[group] += symbol.first;
+            members[group].push_back(symbol.second);
+            group_of[symbol.second] = group;
+        }
+        
+        std::vector<std::ostringstream> logs(symbols.size());
+        std::vector<Metrics> group_metrics(groups);
+        std::vector<PrefetchCounters> group_prefetch(groups);
+        std::vector<char> prefetched(groups, 0);
+        std::vector<std::exception_ptr> errors(groups);
+        std::vector<std::thread> threads;
+        for (size_t g = 0; g < groups; ++g) {
+            std::sort(members[g].begin(), members[g].end());
+            const NumaNode& node = nodes[g % nodes.size()];
+            const size_t sharing = (groups + nodes.size() - 1 - g % nodes.size()) / nodes.size();  // groups on this node
+            size_t workers = options.threads > 0 ? static_cast<size_t>(options.threads) / groups
+                                                 : (node.cpus.empty() ? std::thread::hardware_concurrency() / groups
+                                                                      : node.cpus.size() / sharing);
+            
+            AnalyzerOptions group_options = options;
+            group_options.batch = false;
+            group_options.threads = static_cast<int>(std::max<size_t>(1, workers));
+            group_options.symbols.clear();
+            for (size_t index : members[g]) group_options.symbols.push_back(symbols[index]);
+            
+            threads.emplace_back([&, g, group_options] {
+                try {
+                    pinCurrentThread(nodes[g % nodes.size()].cpus);
+                    OrderBookAnalyzer group(data_folder, group_options);
+                    group.startPrefetch();
+                    for (size_t index : members[g]) {
+                        group.log_stream = &logs[index];
+                        group.analyzeScheduled(symbols[index]);
+                    }
+                    if (group.prefetcher) {
+                        group_prefetch[g] = group.prefetcher->counters();
+                        prefetched[g] = 1;
+                    }
+                    group.prefetcher.reset();
+                    group_metrics[g] = std::move(group.metrics);
+                } catch (...) {
+                    errors[g] = std::current_exception();
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        for (const auto& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+        
+        for (size_t i = 0; i < symbols.size(); ++i) {
+            SymbolMetrics* merged = metrics.symbol(symbols[i]);
+            if (merged) *merged = *group_metrics[group_of[i]].symbol(symbols[i]);
+        }
+        PrefetchCounters prefetch;
+        bool any_prefetch = false;
+        for (size_t g = 0; g < groups; ++g) {
+            if (prefetched[g]) {
+                prefetch.merge(group_prefetch[g]);
+                any_prefetch = true;
+            }
+        }
+        if (any_prefetch && metrics.isEnabled()) metrics.setPrefetch(prefetch);
+        
+        log() << "Batch: " << symbols.size() << " symbols on " << groups << " node group(s)" << std::endl;
+        for (const auto& symbol_log : logs) log() << symbol_log.str();
+    }
+    
+    /**
+     * @brief Run complete analysis for all symbols
+     * 
+     * This is the main entry point for the analysis. It:
+     * 1. Analyzes each symbol (--symbols, or every symbol directory found) individually
+     * 2. Generates comprehensive statistics and impact functions
+     * 3. Saves results to CSV files for each symbol
+     * 4. Displays answers to the task questions
+     * 5. Reports total execution time
+     * 
+     * Every snapshot of the selected days is used unless --sample or
+     * --max-files bounds it (--streaming keeps none of them in memory), and
+     * both buy-side and sell-side impact functions are generated.
+     */
+    void run() {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        
+        log() << "Blockhouse Order Book Analysis (C++)" << std::endl;
+        log() << std::string(50, '=') << std::endl;
+        
+        if (symbols.empty()) {
+            symbols = discoverSymbols();
+            if (symbols.empty()) throw std::runtime_error("no symbol directories with CSV files in " + data_folder);
+        } else {
+            requireSymbolFolders();
+        }
+        if (!options.partials_dir.empty()) shard_plan = planShards();
+        
+        if (options.batch) {
+            analyzeByNode();
+        } else {
+            // Analyze each symbol individually
+            startPrefetch();
+            for (const auto& symbol : symbols) {
+                analyzeScheduled(symbol);
+            }
+        }
+        if (prefetcher) {
+            if (metrics.isEnabled()) metrics.setPrefetch(prefetcher->counters());
+            prefetcher.reset();
+        }
+        
+        // Display comprehensive answers to task questions
+        answerTaskQuestions();
+        
+        // Report performance metrics
+        auto end_time = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        
+        log() << "\nTotal execution time: " << duration.count() << " ms" << std::endl;
+        
+        if (metrics.isEnabled()) {
+            auto total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count();
+            if (metrics.writeJson(options.metrics_path, static_cast<uint64_t>(total_ns))) {
+                log() << "Metrics written to " << options.metrics_path << std::endl;
+            } else {
+                std::cerr << "Could not write metrics to " << options.metrics_path << std::endl;
+            }
+        }
+    }
+};
+
+/**
+ * @class ImpactService
+ * @brief Resident g(X) store with incremental appends and prefix-sum range queries
+ * 
+ * The library face of the analyzer for long-lived processes (--serve).
+ * Per symbol it keeps the buy and sell impact sums of every non-empty
+ * time bucket (absolute UTC buckets, so days stay apart) in time order as
+ * running prefix sums: row b holds the sums over buckets [0, b). g(X) over
+ * a time range is then two binary searches and one subtraction per
+ * order size, independent of how many snapshots the range covers.
+ * 
+ * Appends evaluate only the new rows with the configured engine kernel and
+ * add their per-bucket sums into the prefix rows from the first touched
+ * bucket onward; appending a later day touches only new rows. Day files go
+ * through the analyzer's loader (schema detection, sampling, snapshot
+ * cache); with time weighting each appended store is collapsed on its
+ * own, so a state does not span two appends. Memory is O(buckets x grid)
+ * per symbol; snapshots are not retained. Not thread-safe: callers
+ * serialize appends and queries.
+ */
+class ImpactService {
+public:
+    /**
+     * @param data_folder Root folder with one subdirectory per symbol
+     * @param opts Loader, engine, grid, averaging and file selection
+     * @param bucket_minutes Query time resolution (ranges are rounded to buckets)
+     */
+    ImpactService(const std::string& data_folder, const AnalyzerOptions& opts, int bucket_minutes = 5)
+        : options(opts), loader(data_folder, loaderOptions(opts)),
+          grid{opts.grid_step, opts.max_shares},
+          bucket_ns(static_cast<int64_t>(std::max(bucket_minutes, 1)) * 60 * 1000000000LL) {}
+    
+    /**
+     * @brief Fold snapshots into a symbol's buckets
+     * @return Number of rows evaluated (after any time-weighted collapsing)
+     */
+    size_t appendSnapshots(const std::string& symbol, const SnapshotStore& rows) {
+        size_t evaluated = 0;
+        apply(symbols[symbol], bucketSums(rows, evaluated), false);
+        return evaluated;
+    }
+    
+    /**
+     * @brief Load one day file and fold it into a symbol (files already appended are skipped;
+     *        refresh() re-loads those that changed)
+     * @return Rows evaluated, 0 if the file was already known, unreadable or empty
+     * 
+     * A file is only recorded once it loaded, so one that failed is tried
+     * again by the next append or refresh.
+     */
+    size_t appendFile(const std::string& symbol, const fs::path& path) {
+        size_t rows = 0;
+        loadAndAppend(symbol, path, rows);
+        return rows;
+    }
+    
+    /**
+     * @brief Append every day file that landed or changed since the last refresh
+     * @return Number of files appended or re-loaded
+     * 
+     * Symbols are --symbols or those discovered in the data folder; the
+     * loader's date range applies. A file still being written (copies onto
+     * NFS or object storage mounts land over many seconds) is left for a
+     * later refresh: it is taken once it has not been modified for the
+     * settle time (kSettleSeconds by default), by its modification time or,
+     * for clocks that disagree with the file server's, by its size and
+     * modification time holding across refreshes for that long. The first
+     * refresh of a process therefore loads the existing files right away.
+     * A file appended earlier whose size or modification time has changed
+     * since is re-loaded, once settled, in place of its earlier contents.
+     * A symbol whose folder cannot be listed (missing, unreadable) is
+     * reported on stderr and skipped; the other symbols are still scanned.
+     */
+    size_t refresh() {
+        std::vector<std::string> names = options.symbols.empty() ? loader.discoverSymbols() : options.symbols;
+        size_t appended = 0;
+        for (const auto& symbol : names) {
+            try {
+                for (const auto& path : loader.listDayFiles(symbol)) {
+                    FileStamp stamp;
+                    if (!stampOf(path, stamp)) continue;
+                    auto state = symbols.find(symbol);
+                    const bool known = state != symbols.end() && state->second.files.count(path);
+                    if (known && state->second.files[path].stamp == stamp) continue;
+                    if (!settled(path, stamp)) continue;
+                    if (known) drop(state->second, path);
+                    size_t rows = 0;
+                    if (loadAndAppend(symbol, path, rows)) appended++;
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Could not refresh " << symbol << ": " << e.what() << std::endl;
+            }
+        }
+        return appended;
+    }
+    
+    /**
+     * @brief Time a new or changed file must go unmodified before refresh() takes it
+     */
+    void setSettleTime(std::chrono::milliseconds time) { settle_time = time; }
+    
+    /**
+     * @brief Average g(X) of one side and size over the buckets overlapping [from_ns, to_ns)
+     * @param result Receives order size, impact and impact in bps
+     * @param snapshots Receives the number of contributing snapshots (optional)
+     * @return false for an unknown symbol, a size off the grid or a range without data for that size
+     */
+    bool query(const std::string& symbol, Side side, int order_size, int64_t from_ns, int64_t to_ns,
+               ImpactResult& result, uint64_t* snapshots = nullptr) const {
+        auto it = symbols.find(symbol);
+        if (it == symbols.end() || order_size <= 0 || order_size % grid.step != 0 || order_size > grid.max_shares) {
+            return false;
+        }
+        const SymbolState& state = it->second;
+        size_t lo, hi;
+        bucketRange(state, from_ns, to_ns, lo, hi);
+        const size_t k = static_cast<size_t>(order_size / grid.step) - 1;
+        const Prefix& prefix = side == Side::Buy ? state.buy : state.sell;
+        const size_t points = grid.points();
+        const uint64_t count = prefix.count[hi * points + k] - prefix.count[lo * points + k];
+        const double weight = prefix.weight[hi * points + k] - prefix.weight[lo * points + k];
+        if (count == 0 || !(weight > 0)) return false;
+        const double impact = (prefix.impact[hi * points + k] - prefix.impact[lo * points + k]) / weight;
+        result = ImpactResult{order_size, impact, impact * 10000.0};
+        if (snapshots) *snapshots = count;
+        return true;
+    }
+    
+    /**
+     * @brief Whole g(X) curve of one side over the buckets overlapping [from_ns, to_ns)
+     */
+    std::vector<ImpactResult> curve(const std::string& symbol, Side side, int64_t from_ns, int64_t to_ns) const {
+        std::vector<ImpactResult> out;
+        ImpactResult result{0, 0, 0};
+        for (size_t k = 0; k < grid.points(); ++k) {
+            if (query(symbol, side, grid.orderSize(k), from_ns, to_ns, result)) out.push_back(result);
+        }
+        return out;
+    }
+    
+    /**
+     * @struct Summary
+     * @brief Size of one symbol's state
+     */
+    struct Summary {
+        std::string symbol;
+        uint64_t snapshots = 0;   ///< Snapshots loaded from files
+        size_t buckets = 0;       ///< Non-empty time buckets
+        size_t files = 0;         ///< Day files appended
+    };
+    
+    std::vector<Summary> summaries() const {
+        std::vector<Summary> out;
+        for (const auto& entry : symbols) {
+            out.push_back({entry.first, entry.second.snapshots, entry.second.keys.size(), entry.second.files.size()});
+        }
+        return out;
+    }
+    
+    const OrderSizeGrid& orderSizes() const { return grid; }
+    
+private:
+    /**
+     * @struct Prefix
+     * @brief Prefix sums of one side, (buckets + 1) x grid points, row-major
+     */
+    struct Prefix {
+        std::vector<double> impact;
+        std::vector<double> weight;
+        std::vector<uint64_t> count;
+    };
+    
+    /**
+     * @struct BucketSums
+     * @brief Impact sums of one append per touched bucket, keys.size() x grid points, row-major
+     */
+    struct BucketSums {
+        std::vector<int64_t> keys;     ///< Bucket indices since the epoch, ascending
+        Prefix buy;                    ///< Buy-side sums (not prefixed)
+        Prefix sell;                   ///< Sell-side sums (not prefixed)
+    };
+    
+    /**
+     * @struct FileStamp
+     * @brief Size and modification time of a day file
+     */
+    struct FileStamp {
+        uintmax_t size = 0;
+        fs::file_time_type mtime;
+        
+        bool operator==(const FileStamp& other) const { return size == other.size && mtime == other.mtime; }
+    };
+    
+    /**
+     * @struct LoadedFile
+     * @brief A day file folded into a symbol, with what it added so it can be taken out again
+     */
+    struct LoadedFile {
+        FileStamp stamp;               ///< Stamp when it was loaded
+        uint64_t snapshots = 0;        ///< Snapshots it held
+        BucketSums sums;               ///< Its per-bucket sums
+    };
+    
+    /**
+     * @struct SymbolState
+     * @brief Buckets of one symbol
+     */
+    struct SymbolState {
+        std::vector<int64_t> keys;                ///< Bucket indices since the epoch, ascending
+        Prefix buy;                               ///< Buy-side prefix sums
+        Prefix sell;                              ///< Sell-side prefix sums
+        std::map<fs::path, LoadedFile> files;     ///< Day files appended
+        uint64_t snapshots = 0;                   ///< Snapshots loaded from files
+    };
+    
+    /**
+     * @struct PendingFile
+     * @brief A file refresh() saw still changing: its last stamp and since when it has held
+     */
+    struct PendingFile {
+        FileStamp stamp;
+        std::chrono::steady_clock::time_point since;
+    };
+    
+    /// Default seconds without modification after which refresh() takes a new or changed file
+    static constexpr int kSettleSeconds = 30;
+    
+    AnalyzerOptions options;                   ///< Parsing, engine and averaging configuration
+    OrderBookAnalyzer loader;                  ///< Day file loader (single-threaded)
+    std::map<fs::path, PendingFile> unsettled; ///< Files refresh() saw still changing
+    std::chrono::milliseconds settle_time{kSettleSeconds * 1000};
+    OrderSizeGrid grid;                        ///< Grid of every curve
+    int64_t bucket_ns;                         ///< Bucket width
+    std::map<std::string, SymbolState> symbols;
+    
+    /**
+     * @brief Load a day file and fold it in, recording it only on success
+     * @param rows Receives the rows evaluated
+     * @return false if the file was already appended or failed to load
+     */
+    bool loadAndAppend(const std::string& symbol, const fs::path& path, size_t& rows) {
+        rows = 0;
+        SymbolState& state = symbols[symbol];
+        if (state.files.count(path)) return false;
+        // Stamped before loading: a write during the load shows up as a change next refresh
+        LoadedFile file;
+        if (!stampOf(path, file.stamp)) return false;
+        SnapshotStore snapshots;
+        int rows_loaded = 0;
+        if (!loader.loadFile(path, snapshots, rows_loaded)) return false;
+        unsettled.erase(path);
+        file.snapshots = snapshots.size();
+        file.sums = bucketSums(snapshots, rows);
+        apply(state, file.sums, false);
+        state.snapshots += file.snapshots;
+        state.files.emplace(path, std::move(file));
+        return true;
+    }
+    
+    /**
+     * @brief Take a loaded file's sums and snapshots back out of its symbol and forget it
+     * 
+     * Buckets only it touched stay as empty prefix rows.
+     */
+    void drop(SymbolState& state, const fs::path& path) {
+        auto it = state.files.find(path);
+        if (it == state.files.end()) return;
+        apply(state, it->second.sums, true);
+        state.snapshots -= it->second.snapshots;
+        state.files.erase(it);
+    }
+    
+    static bool stampOf(const fs::path& path, FileStamp& stamp) {
+        std::error_code ec;
+        stamp.size = fs::file_size(path, ec);
+        if (ec) return false;
+        stamp.mtime = fs::last_write_time(path, ec);
+        return !ec;
+    }
+    
+    /**
+     * @brief Whether a file has stopped changing (see refresh())
+     * 
+     * Records when a file was first seen at its current stamp; it settles
+     * once that stamp has held for the settle time, or once its
+     * modification time is that old.
+     */
+    bool settled(const fs::path& path, const FileStamp& stamp) {
+        if (fs::file_time_type::clock::now() - stamp.mtime >= settle_time) return true;
+        const auto now = std::chrono::steady_clock::now();
+        auto it = unsettled.find(path);
+        if (it == unsettled.end() || !(it->second.stamp == stamp)) {
+            unsettled[path] = PendingFile{stamp, now};
+            return false;
+        }
+        return now - it->second.since >= settle_time;
+    }
+    
+    static AnalyzerOptions loaderOptions(AnalyzerOptions opts) {
+        opts.threads = 1;  // appends are small; keep the service single-threaded
+        opts.metrics_path.clear();
+        return opts;
+    }
+    
+    int64_t bucketOf(int64_t ts_ns) const {
+        const int64_t bucket = ts_ns / bucket_ns;
+        return ts_ns % bucket_ns < 0 ? bucket - 1 : bucket;  // floor, also for the open range ends
+    }
+    
+    /**
+     * @brief Prefix rows [lo, hi) of the buckets overlapping [from_ns, to_ns)
+     */
+    void bucketRange(const SymbolState& state, int64_t from_ns, int64_t to_ns, size_t& lo, size_t& hi) const {
+        lo = hi = 0;
+        if (to_ns <= from_ns) return;
+        lo = static_cast<size_t>(std::lower_bound(state.keys.begin(), state.keys.end(), bucketOf(from_ns)) - state.keys.begin());
+        hi = static_cast<size_t>(std::upper_bound(state.keys.begin(), state.keys.end(), bucketOf(to_ns - 1)) - state.keys.begin());
+        hi = std::max(lo, hi);
+    }
+    
+    /**
+     * @brief Per-bucket sums of a store, collapsed to states first with time weighting
+     * @param evaluated Receives the number of rows evaluated
+     */
+    BucketSums bucketSums(const SnapshotStore& snapshots, size_t& evaluated) const {
+        SnapshotStore states;
+        const bool collapse = options.averaging == Averaging::TimeWeighted;
+        if (collapse) states = StateCollapser::collapse(snapshots);
+        const SnapshotStore& rows = collapse ? states : snapshots;
+        evaluated = rows.size();
+        
+        // Runs of consecutive rows in one bucket
+        const ImpactKernel kernel = impactKernelFor(options.engine, options.partial_fills);
+        std::map<int64_t, std::pair<ImpactAccumulator, ImpactAccumulator>> added;
+        for (size_t row = 0; row < rows.size();) {
+            const int64_t bucket = bucketOf(rows.ts_ns[row]);
+            size_t run_end = row + 1;
+            while (run_end < rows.size() && bucketOf(rows.ts_ns[run_end]) == bucket) ++run_end;
+            auto it = added.find(bucket);
+            if (it == added.end()) it = added.emplace(bucket, std::make_pair(ImpactAccumulator(grid), ImpactAccumulator(grid))).first;
+            kernel(rows, row, run_end, Side::Buy, it->second.first);
+            kernel(rows, row, run_end, Side::Sell, it->second.second);
+            row = run_end;
+        }
+        
+        BucketSums sums;
+        for (const auto& entry : added) {
+            sums.keys.push_back(entry.first);
+            for (int s = 0; s < 2; ++s) {
+                const ImpactAccumulator& acc = s == 0 ? entry.second.first : entry.second.second;
+                Prefix& out = s == 0 ? sums.buy : sums.sell;
+                out.impact.insert(out.impact.end(), acc.impact_sum.begin(), acc.impact_sum.end());
+                out.weight.insert(out.weight.end(), acc.weight_sum.begin(), acc.weight_sum.end());
+                out.count.insert(out.count.end(), acc.count.begin(), acc.count.end());
+            }
+        }
+        return sums;
+    }
+    
+    /**
+     * @brief Add (or, with remove, subtract) per-bucket sums into the prefix rows
+     */
+    void apply(SymbolState& state, const BucketSums& sums, bool remove) {
+        const size_t points = grid.points();
+        if (state.buy.impact.empty()) {
+            for (Prefix* prefix : {&state.buy, &state.sell}) {
+                prefix->impact.assign(points, 0.0);
+                prefix->weight.assign(points, 0.0);
+                prefix->count.assign(points, 0);
+            }
+        }
+        for (size_t b = 0; b < sums.keys.size(); ++b) {
+            auto at = std::lower_bound(state.keys.begin(), state.keys.end(), sums.keys[b]);
+            const size_t index = static_cast<size_t>(at - state.keys.begin());
+            if (at == state.keys.end() || *at != sums.keys[b]) {
+                state.keys.insert(at, sums.keys[b]);
+                for (Prefix* prefix : {&state.buy, &state.sell}) insertRow(*prefix, index + 1, points);
+            }
+            addFrom(state.buy, index + 1, sums.buy, b * points, points, remove);
+            addFrom(state.sell, index + 1, sums.sell, b * points, points, remove);
+        }
+    }
+    
+    /**
+     * @brief Insert an empty bucket before prefix row `row` (it repeats row - 1)
+     */
+    static void insertRow(Prefix& prefix, size_t row, size_t points) {
+        auto repeat = [&](auto& values) {
+            using Value = typename std::decay_t<decltype(values)>::value_type;
+            std::vector<Value> copy(values.begin() + static_cast<std::ptrdiff_t>((row - 1) * points),
+                                    values.begin() + static_cast<std::ptrdiff_t>(row * points));
+            values.insert(values.begin() + static_cast<std::ptrdiff_t>(row * points), copy.begin(), copy.end());
+        };
+        repeat(prefix.impact);
+        repeat(prefix.weight);
+        repeat(prefix.count);
+    }
+    
+    /**
+     * @brief Add (or subtract) one bucket's sums, at offset of sums, to prefix rows row, row + 1, ...
+     */
+    static void addFrom(Prefix& prefix, size_t row, const Prefix& sums, size_t offset, size_t points, bool remove) {
+        const size_t rows = prefix.count.size() / points;
+        const double sign = remove ? -1.0 : 1.0;
+        for (size_t r = row; r < rows; ++r) {
+            for (size_t k = 0; k < points; ++k) {
+                prefix.impact[r * points + k] += sign * sums.impact[offset + k];
+                prefix.weight[r * points + k] += sign * sums.weight[offset + k];
+                if (remove) {
+                    prefix.count[r * points + k] -= sums.count[offset + k];
+                } else {
+                    prefix.count[r * points + k] += sums.count[offset + k];
+                }
+            }
+        }
+    }
+};
+
+/**
+ * @brief Parse a service query time: ISO-8601 UTC or integer nanoseconds
+ */
+inline bool parseServiceTime(const std::string& text, int64_t& ns) {
+    return !text.empty() && parseTimestamp(text, ns);
+}
+
+/**
+ * @brief Answer ImpactService commands, one per input line, until "quit" or end of input
+ * @param in Command stream (stdin in --serve)
+ * @param out Response stream
+ * 
+ * Commands (a response starts with "ok" or "error"):
+ * - impact SYMBOL buy|sell SIZE [FROM TO]  ok impact_bps=... snapshots=... micros=...
+ * - curve SYMBOL buy|sell [FROM TO]        ok N, then N lines order_size,avg_impact,impact_bps
+ * - append SYMBOL PATH                     ok rows=N
+ * - refresh                                ok files=N (day files that landed or changed since the last scan)
+ * - symbols                                ok N, then N lines SYMBOL snapshots=.. buckets=.. files=..
+ * - quit
+ * FROM/TO are ISO-8601 UTC ("2025-04-03T14:00:00Z") or nanoseconds; the
+ * range is half-open and rounded out to whole buckets. Blank lines and
+ * lines starting with '#' are ignored. A command that throws answers
+ * "error" with the message, and the next command is read as usual.
+ */
+inline void serveImpactQueries(ImpactService& service, std::istream& in, std::ostream& out) {
+    std::string line;
+    std::vector<std::string> words;
+    while (std::getline(in, line)) {
+        words.clear();
+        std::stringstream ss(line);
+        for (std::string word; ss >> word;) words.push_back(word);
+        if (words.empty() || words[0][0] == '#') continue;
+        const std::string& command = words[0];
         
-        // Calculate basic statistics
-        double total_mid = 0, total_spread = 0;
-        int total_bid_depth = 0, total_ask_depth = 0;
-        int valid_snapshots = 0;
+        auto side = [&](const std::string& text, Side& value) {
+            if (text == "buy") value = Side::Buy;
+            else if (text == "sell") value = Side::Sell;
+            else return false;
+            return true;
+        };
+        auto range = [&](size_t first, int64_t& from, int64_t& to) {
+            from = std::numeric_limits<int64_t>::min();
+            to = std::numeric_limits<int64_t>::max();
+            if (words.size() == first) return true;
+            return words.size() == first + 2 && parseServiceTime(words[first], from) && parseServiceTime(words[first + 1], to);
+        };
         
-        for (const auto& snapshot : snapshots) {
-            double mid = snapshot.getMidPrice();
-            if (mid > 0) {
-                total_mid += mid;
-                total_spread += snapshot.getSpread();
-                total_bid_depth += snapshot.getTotalBidDepth();
-                total_ask_depth += snapshot.getTotalAskDepth();
-                valid_snapshots++;
+        if (command == "quit") break;
+        try {
+            if (command == "impact" && words.size() >= 4) {
+                Side s;
+                int size = 0;
+                int64_t from, to;
+                auto parsed = std::from_chars(words[3].data(), words[3].data() + words[3].size(), size);
+                if (!side(words[2], s) || parsed.ec != std::errc() || !range(4, from, to)) {
+                    out << "error usage: impact SYMBOL buy|sell SIZE [FROM TO]" << std::endl;
+                    continue;
+                }
+                auto start = std::chrono::steady_clock::now();
+                ImpactResult result{0, 0, 0};
+                uint64_t snapshots = 0;
+                bool found = service.query(words[1], s, size, from, to, result, &snapshots);
+                auto micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+                if (!found) {
+                    out << "error no data for " << words[1] << " " << words[2] << " " << words[3] << std::endl;
+                    continue;
+                }
+                out << "ok impact_bps=" << std::fixed << std::setprecision(6) << result.impact_bps
+                    << " snapshots=" << snapshots << " micros=" << std::setprecision(2) << micros << std::endl;
+            } else if (command == "curve" && words.size() >= 3) {
+                Side s;
+                int64_t from, to;
+                if (!side(words[2], s) || !range(3, from, to)) {
+                    out << "error usage: curve SYMBOL buy|sell [FROM TO]" << std::endl;
+                    continue;
+                }
+                std::vector<ImpactResult> results = service.curve(words[1], s, from, to);
+                out << "ok " << results.size() << "\n";
+                for (const auto& result : results) {
+                    out << result.order_size << "," << std::fixed << std::setprecision(6) << result.avg_impact << ","
+                        << result.impact_bps << "\n";
+                }
+                out.flush();
+            } else if (command == "append" && words.size() == 3) {
+                const size_t rows = service.appendFile(words[1], words[2]);
+                out << "ok rows=" << rows << std::endl;
+            } else if (command == "refresh" && words.size() == 1) {
+                const size_t files = service.refresh();
+                out << "ok files=" << files << std::endl;
+            } else if (command == "symbols" && words.size() == 1) {
+                std::vector<ImpactService::Summary> summaries = service.summaries();
+                out << "ok " << summaries.size() << "\n";
+                for (const auto& summary : summaries) {
+                    out << summary.symbol << " snapshots=" << summary.snapshots << " buckets=" << summary.buckets
+                        << " files=" << summary.files << "\n";
+                }
+                out.flush();
+            } else {
+                out << "error unknown command '" << line << "'" << std::endl;
             }
+        } catch (const std::exception& e) {
+            out << "error " << e.what() << std::endl;
+        }
+    }
+}
+
+/**
+ * @class SpscRing
+ * @brief Bounded lock-free single-producer single-consumer queue
+ * 
+ * Slots are allocated once at construction. tryPush() and tryPop() copy
+ * one element and publish it with a release store of their own index, so
+ * neither side locks or allocates. Each side caches the other's index and
+ * only reloads it when the ring looks full (or empty), and the two index
+ * groups sit on separate cache lines. Indices run freely and are masked,
+ * hence the power-of-two capacity.
+ */
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+    
+public:
+    SpscRing() : slots(Capacity) {}
+    
+    /**
+     * @brief Producer side: enqueue a copy of value
+     * @return false if the ring is full
+     */
+    bool tryPush(const T& value) {
+        const size_t head = write_index.load(std::memory_order_relaxed);
+        if (head - cached_read >= Capacity) {
+            cached_read = read_index.load(std::memory_order_acquire);
+            if (head - cached_read >= Capacity) return false;
+        }
+        slots[head & (Capacity - 1)] = value;
+        write_index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    
+    /**
+     * @brief Consumer side: dequeue into value
+     * @return false if the ring is empty
+     */
+    bool tryPop(T& value) {
+        const size_t tail = read_index.load(std::memory_order_relaxed);
+        if (tail == cached_write) {
+            cached_write = write_index.load(std::memory_order_acquire);
+            if (tail == cached_write) return false;
+        }
+        value = slots[tail & (Capacity - 1)];
+        read_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    
+private:
+    alignas(64) std::atomic<size_t> write_index{0};  ///< Next slot to fill (producer)
+    size_t cached_read = 0;                          ///< Producer's copy of read_index
+    alignas(64) std::atomic<size_t> read_index{0};   ///< Next slot to drain (consumer)
+    size_t cached_write = 0;                         ///< Consumer's copy of write_index
+    alignas(64) std::vector<T> slots;                ///< Capacity preallocated elements
+};
+
+/**
+ * @class LatencyHistogram
+ * @brief Fixed-size log-linear nanosecond histogram (8 sub-buckets per octave)
+ * 
+ * record() is one relaxed atomic increment, so a single writer can update
+ * it on a hot path while other threads read percentiles; reported values
+ * are within 12.5% of the recorded ones.
+ */
+class LatencyHistogram {
+public:
+    void record(uint64_t ns) {
+        counts[indexOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        uint64_t seen = max_ns.load(std::memory_order_relaxed);
+        while (ns > seen && !max_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+    }
+    
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (const auto& c : counts) total += c.load(std::memory_order_relaxed);
+        return total;
+    }
+    
+    /**
+     * @brief Approximate value at quantile q in [0, 1], in nanoseconds (0 when empty)
+     */
+    double quantile(double q) const {
+        const uint64_t total = count();
+        if (total == 0) return 0.0;
+        const double rank = q * static_cast<double>(total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (static_cast<double>(seen) > rank) return midpoint(i);
         }
+        return static_cast<double>(max_ns.load(std::memory_order_relaxed));
+    }
+    
+    uint64_t maximum() const { return max_ns.load(std::memory_order_relaxed); }
+    
+private:
+    static constexpr size_t kBuckets = 8 * 62;
+    std::array<std::atomic<uint64_t>, kBuckets> counts{};  ///< Zero-initialized counters
+    std::atomic<uint64_t> max_ns{0};
+    
+    static size_t indexOf(uint64_t ns) {
+        if (ns < 8) return static_cast<size_t>(ns);
+        size_t msb = 63;
+        while (!(ns >> msb)) --msb;
+        return std::min(kBuckets - 1, 8 * (msb - 2) + static_cast<size_t>((ns >> (msb - 3)) & 7));
+    }
+    static double midpoint(size_t index) {
+        if (index < 8) return static_cast<double>(index);
+        const size_t msb = index / 8 + 2;
+        const double low = std::ldexp(static_cast<double>(8 + index % 8), static_cast<int>(msb) - 3);
+        return low + std::ldexp(0.5, static_cast<int>(msb) - 3);
+    }
+};
+
+/**
+ * @struct LiveBookUpdate
+ * @brief One MBP-10 book state as handed from the feed handler to the impact thread
+ */
+struct LiveBookUpdate {
+    int64_t ts_ns = 0;                          ///< Exchange event time (ts_event)
+    int64_t enqueue_ns = 0;                     ///< Steady-clock time of publish()
+    std::array<double, kBookLevels> bid_px{};   ///< Bid prices, best first
+    std::array<double, kBookLevels> ask_px{};   ///< Ask prices, best first
+    std::array<int, kBookLevels> bid_sz{};      ///< Bid sizes
+    std::array<int, kBookLevels> ask_sz{};      ///< Ask sizes
+    
+    /**
+     * @brief Book state of one store row
+     */
+    static LiveBookUpdate fromStore(const SnapshotStore& store, size_t row) {
+        LiveBookUpdate update;
+        update.ts_ns = store.ts_ns[row];
+        std::copy_n(store.bidPrices(row), kBookLevels, update.bid_px.begin());
+        std::copy_n(store.askPrices(row), kBookLevels, update.ask_px.begin());
+        std::copy_n(store.bidSizes(row), kBookLevels, update.bid_sz.begin());
+        std::copy_n(store.askSizes(row), kBookLevels, update.ask_sz.begin());
+        return update;
+    }
+};
+
+/**
+ * @class LiveImpactEstimator
+ * @brief Exponentially decayed g(X) of a live book, updated on a dedicated thread
+ * 
+ * The feed handler publish()es book states into an SpscRing; the impact
+ * thread walks each state with walkSide() - the same kernel as the offline
+ * engines, whose per-snapshot impacts equal calculateTemporaryImpact() -
+ * and folds the result into per-size decayed sums: with decay
+ * d = 2^(-dt / half_life) over event time, S = d S + g and W = d W + 1, and
+ * the estimate is S / W. Sizes beyond the visible depth count at its
+ * full-depth VWAP, as in the offline walk; only an empty side leaves the
+ * sums to decay. A zero half-life disables decay, making the estimate the
+ * offline per-snapshot mean. Buffers are sized at construction and nothing allocates per update.
+ * Estimates are published as relaxed atomics, so any thread can read a
+ * size's latest value; a curve read across sizes may mix adjacent updates.
+ * Update-to-estimate latency (publish() to estimate stored) goes into a
+ * LatencyHistogram.
+ */
+class LiveImpactEstimator {
+public:
+    static constexpr size_t kQueueCapacity = 4096;  ///< Book states the ring can hold
+    
+    /**
+     * @param g Order sizes to estimate
+     * @param half_life_seconds Decay half-life in event time (0 = no decay)
+     */
+    LiveImpactEstimator(const OrderSizeGrid& g, double half_life_seconds)
+        : grid(g),
+          decay_per_ns(half_life_seconds > 0 ? std::log(2.0) / (half_life_seconds * 1e9) : 0.0),
+          ring(std::make_unique<SpscRing<LiveBookUpdate, kQueueCapacity>>()),
+          now_buy(g), now_sell(g),
+          buy(g.points()), sell(g.points()) {
+        book.addRow(0, book.addDay(""));
+    }
+    
+    ~LiveImpactEstimator() { stop(); }
+    
+    LiveImpactEstimator(const LiveImpactEstimator&) = delete;
+    LiveImpactEstimator& operator=(const LiveImpactEstimator&) = delete;
+    
+    /**
+     * @brief Start the impact thread
+     */
+    void start() {
+        if (running.exchange(true)) return;
+        worker = std::thread([this] {
+            LiveBookUpdate update;
+            for (;;) {
+                if (ring->tryPop(update)) {
+                    process(update);
+                } else if (!running.load(std::memory_order_acquire)) {
+                    if (!ring->tryPop(update)) break;  // drained
+                    process(update);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    
+    /**
+     * @brief Process everything already published, then join the impact thread
+     */
+    void stop() {
+        if (!running.exchange(false)) return;
+        worker.join();
+    }
+    
+    /**
+     * @brief Feed handler side: hand a book state to the impact thread
+     * @return false if the ring is full (the state is not queued)
+     */
+    bool publish(LiveBookUpdate update) {
+        update.enqueue_ns = nowNs();
+        if (ring->tryPush(update)) return true;
+        full.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    /**
+     * @brief Fold one book state into the estimates (impact thread, or inline without start())
+     */
+    void process(const LiveBookUpdate& update) {
+        std::copy(update.bid_px.begin(), update.bid_px.end(), book.bid_px.begin());
+        std::copy(update.ask_px.begin(), update.ask_px.end(), book.ask_px.begin());
+        std::copy(update.bid_sz.begin(), update.bid_sz.end(), book.bid_sz.begin());
+        std::copy(update.ask_sz.begin(), update.ask_sz.end(), book.ask_sz.begin());
+        book.ts_ns[0] = update.ts_ns;
         
-        if (valid_snapshots > 0) {
-            std::cout << std::fixed << std::setprecision(4);
-            std::cout << "Average mid price: $" << total_mid / valid_snapshots << std::endl;
-            std::cout << "Average spread: " << (total_spread / total_mid * 10000 / valid_snapshots) << " bps" << std::endl;
-            std::cout << "Average bid depth: " << total_bid_depth / valid_snapshots << " shares" << std::endl;
-            std::cout << "Average ask depth: " << total_ask_depth / valid_snapshots << " shares" << std::endl;
+        double decay = 1.0;
+        if (has_last && decay_per_ns > 0) {
+            decay = std::exp(-static_cast<double>(std::max<int64_t>(update.ts_ns - last_ts, 0)) * decay_per_ns);
         }
+        last_ts = update.ts_ns;
+        has_last = true;
         
-        // Calculate impact functions
-        auto buy_impact = calculateTemporaryImpact(snapshots, "buy");
-        auto sell_impact = calculateTemporaryImpact(snapshots, "sell");
-        
-        // Save results to CSV
-        saveImpactResults(symbol + "_buy_impact.csv", buy_impact);
-        saveImpactResults(symbol + "_sell_impact.csv", sell_impact);
+        now_buy.reset();
+        now_sell.reset();
+        accumulateFusedPass(book, 0, 1, nullptr, now_buy, now_sell);
+        fold(buy, now_buy, decay);
+        fold(sell, now_sell, decay);
         
-        // Print sample results
-        std::cout << "\nSample Buy Impact Results:" << std::endl;
-        std::cout << "Order Size\tImpact (bps)" << std::endl;
-        for (size_t i = 0; i < std::min(static_cast<size_t>(10), buy_impact.size()); ++i) {
-            std::cout << buy_impact[i].order_size << "\t\t" 
-                      << std::setprecision(2) << buy_impact[i].impact_bps << std::endl;
+        updates.fetch_add(1, std::memory_order_relaxed);
+        if (update.enqueue_ns != 0) {
+            histogram.record(static_cast<uint64_t>(std::max<int64_t>(nowNs() - update.enqueue_ns, 0)));
         }
-        
-        std::cout << "\nSample Sell Impact Results:" << std::endl;
-        std::cout << "Order Size\tImpact (bps)" << std::endl;
-        for (size_t i = 0; i < std::min(static_cast<size_t>(10), sell_impact.size()); ++i) {
-            std::cout << sell_impact[i].order_size << "\t\t" 
-                      << std::setprecision(2) << sell_impact[i].impact_bps << std::endl;
+    }
+    
+    /**
+     * @brief Latest estimate of g at one order size
+     * @return false for a size off the grid or one never filled yet
+     */
+    bool estimate(Side side, int order_size, double& impact) const {
+        if (order_size <= 0 || order_size % grid.step != 0 || order_size > grid.max_shares) return false;
+        const double value = (side == Side::Buy ? buy : sell)[static_cast<size_t>(order_size / grid.step) - 1]
+                                 .published.load(std::memory_order_relaxed);
+        if (std::isnan(value)) return false;
+        impact = value;
+        return true;
+    }
+    
+    /**
+     * @struct Report
+     * @brief Counters and update-to-estimate latency percentiles
+     */
+    struct Report {
+        uint64_t updates = 0;   ///< Book states processed
+        uint64_t full = 0;      ///< publish() calls rejected by a full ring
+        double p50_us = 0;      ///< Median latency (microseconds)
+        double p99_us = 0;      ///< 99th percentile latency (microseconds)
+        double max_us = 0;      ///< Largest latency (microseconds)
+    };
+    
+    Report report() const {
+        Report r;
+        r.updates = updates.load(std::memory_order_relaxed);
+        r.full = full.load(std::memory_order_relaxed);
+        r.p50_us = histogram.quantile(0.50) / 1000.0;
+        r.p99_us = histogram.quantile(0.99) / 1000.0;
+        r.max_us = static_cast<double>(histogram.maximum()) / 1000.0;
+        return r;
+    }
+    
+    static int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+private:
+    /**
+     * @struct SizeState
+     * @brief Decayed sums of one order size
+     */
+    struct SizeState {
+        double sum = 0;                                                   ///< Decayed impact sum
+        double weight = 0;                                                ///< Decayed update count
+        std::atomic<double> published{std::numeric_limits<double>::quiet_NaN()};  ///< sum / weight
+    };
+    
+    static void fold(std::vector<SizeState>& sizes, const ImpactAccumulator& now, double decay) {
+        for (size_t k = 0; k < sizes.size(); ++k) {
+            SizeState& state = sizes[k];
+            state.sum *= decay;
+            state.weight *= decay;
+            if (now.count[k] == 0) continue;
+            state.sum += now.impact_sum[k];
+            state.weight += 1.0;
+            state.published.store(state.sum / state.weight, std::memory_order_relaxed);
+        }
+    }
+    
+    OrderSizeGrid grid;
+    double decay_per_ns;                                          ///< ln 2 / half-life (0 = no decay)
+    std::unique_ptr<SpscRing<LiveBookUpdate, kQueueCapacity>> ring;
+    SnapshotStore book;                                           ///< One row, overwritten per update
+    ImpactAccumulator now_buy, now_sell;                          ///< Impacts of the current state
+    std::vector<SizeState> buy, sell;                             ///< Decayed estimates per size
+    int64_t last_ts = 0;
+    bool has_last = false;
+    LatencyHistogram histogram;
+    std::atomic<uint64_t> updates{0};
+    std::atomic<uint64_t> full{0};
+    std::atomic<bool> running{false};
+    std::thread worker;
+};
+
+/**
+ * @brief Replay a day file through LiveImpactEstimator as a stand-in feed handler
+ * @param data_dir Data root (for the loader configuration)
+ * @param options Grid, loader, half-life and pacing
+ * @param path Day file to replay
+ * @return false if the file could not be loaded
+ * 
+ * The calling thread plays the feed handler: it publishes every snapshot
+ * (retrying while the ring is full), optionally paced at --live-rate,
+ * while the estimator's thread updates g(X). Prints update-to-estimate
+ * latency percentiles and the final decayed estimates next to the offline
+ * per-snapshot mean of the same rows.
+ */
+inline bool replayLive(const std::string& data_dir, const AnalyzerOptions& options, const std::string& path) {
+    AnalyzerOptions load_options = options;
+    load_options.threads = 1;
+    OrderBookAnalyzer loader(data_dir, load_options);
+    SnapshotStore store;
+    int rows_loaded = 0;
+    if (!loader.loadFile(path, store, rows_loaded) || store.empty()) {
+        std::cerr << "Could not load " << path << std::endl;
+        return false;
+    }
+    
+    const OrderSizeGrid grid{options.grid_step, options.max_shares};
+    LiveImpactEstimator estimator(grid, options.live_half_life);
+    estimator.start();
+    const int64_t start = LiveImpactEstimator::nowNs();
+    const double interval_ns = options.live_rate > 0 ? 1e9 / options.live_rate : 0.0;
+    for (size_t row = 0; row < store.size(); ++row) {
+        if (interval_ns > 0) {
+            const int64_t due = start + static_cast<int64_t>(static_cast<double>(row) * interval_ns);
+            while (LiveImpactEstimator::nowNs() < due) std::this_thread::yield();
         }
+        const LiveBookUpdate update = LiveBookUpdate::fromStore(store, row);
+        while (!estimator.publish(update)) std::this_thread::yield();
+    }
+    estimator.stop();
+    const double seconds = static_cast<double>(LiveImpactEstimator::nowNs() - start) / 1e9;
+    
+    const LiveImpactEstimator::Report report = estimator.report();
+    std::cout << "Live replay of " << path << ": " << report.updates << " updates in " << std::fixed
+              << std::setprecision(1) << seconds * 1000.0 << " ms (" << std::setprecision(0)
+              << static_cast<double>(report.updates) / seconds << " updates/s), half-life "
+              << std::setprecision(1) << options.live_half_life << " s" << std::endl;
+    std::cout << "Update-to-estimate latency: p50 " << std::setprecision(2) << report.p50_us << " us, p99 "
+              << report.p99_us << " us, max " << report.max_us << " us (ring full on " << report.full
+              << " publishes)" << std::endl;
+    
+    ImpactAccumulator offline_buy(grid), offline_sell(grid);
+    accumulateFusedPass(store, 0, store.size(), nullptr, offline_buy, offline_sell);
+    std::cout << "Order Size\tLive Buy\tLive Sell\tOffline Buy\tOffline Sell (bps)" << std::endl;
+    const size_t step = std::max<size_t>(grid.points() / 10, 1);
+    for (size_t k = step - 1; k < grid.points(); k += step) {
+        double live_buy = 0, live_sell = 0;
+        const int size = grid.orderSize(k);
+        const bool has_buy = estimator.estimate(Side::Buy, size, live_buy);
+        const bool has_sell = estimator.estimate(Side::Sell, size, live_sell);
+        auto offline = [&](const ImpactAccumulator& acc) {
+            return acc.count[k] ? acc.impact_sum[k] / acc.weight_sum[k] * 10000.0 : 0.0;
+        };
+        std::cout << size << "\t\t" << std::setprecision(4) << (has_buy ? live_buy * 10000.0 : 0.0) << "\t\t"
+                  << (has_sell ? live_sell * 10000.0 : 0.0) << "\t\t" << offline(offline_buy) << "\t\t"
+                  << offline(offline_sell) << std::endl;
+    }
+    return true;
+}
+
+/**
+ * @struct SyntheticBookSpec
+ * @brief Shape of a generated MBP-10 book sequence
+ * 
+ * Prices are a random walk on a tick grid. Each row draws its visible
+ * levels per side in [min_levels, max_levels] (0 = empty side) and its
+ * level sizes in [min_size, max_size]. A fraction of rows can be crossed
+ * (best ask below best bid), locked (best ask equal to best bid) or stale
+ * (ts_event behind the latest earlier row). With the defaults the rows
+ * are clean full-depth books.
+ */
+struct SyntheticBookSpec {
+    size_t rows = 200000;            ///< Data rows to write
+    size_t min_levels = kBookLevels; ///< Fewest populated levels per side
+    size_t max_levels = kBookLevels; ///< Most populated levels per side (rest left empty)
+    int min_size = 1;                ///< Level sizes are uniform in [min_size, max_size]
+    int max_size = 400;
+    double base_price = 48.95;       ///< Starting mid price
+    double tick = 0.01;              ///< Price grid
+    double crossed_fraction = 0.0;   ///< Share of rows generated crossed
+    double locked_fraction = 0.0;    ///< Share of rows generated locked
+    double stale_fraction = 0.0;     ///< Share of rows stamped behind the latest earlier row
+    uint64_t seed = 1;               ///< Random walk / size seed
+    std::string date = "2025-04-03"; ///< Trading date for the timestamps
+};
+
+/**
+ * @struct SyntheticRow
+ * @brief One generated book row; prices are in ticks of the spec
+ */
+struct SyntheticRow {
+    int64_t ts_event = 0;                   ///< Nanoseconds since epoch
+    size_t bid_levels = 0;                  ///< Populated bid levels
+    size_t ask_levels = 0;                  ///< Populated ask levels
+    int64_t bid_ticks[kBookLevels] = {};
+    int64_t ask_ticks[kBookLevels] = {};
+    int bid_sz[kBookLevels] = {};
+    int ask_sz[kBookLevels] = {};
+    bool crossed = false;                   ///< Generated crossed, with both sides non-empty
+    bool locked = false;                    ///< Generated locked, with both sides non-empty
+    bool stale = false;                     ///< Stamped behind the latest earlier row
+};
+
+/**
+ * @class SyntheticBookGenerator
+ * @brief Deterministic row source behind writeSyntheticMbp10() and the test fixtures
+ * 
+ * Draws only from the raw mt19937_64 output (no std distributions), so a
+ * seed gives the same rows with every standard library. Draws for the
+ * optional conditions are skipped while their fractions are zero, so the
+ * clean default books do not depend on them.
+ */
+class SyntheticBookGenerator {
+private:
+    SyntheticBookSpec spec;
+    std::mt19937_64 rng;
+    size_t produced = 0;
+    int64_t latest_ts;
+    int64_t mid_ticks;
+    
+    double unit() { return static_cast<double>(rng() >> 11) * 0x1.0p-53; }
+    size_t levels() {
+        return spec.min_levels + static_cast<size_t>(rng() % (spec.max_levels - spec.min_levels + 1));
+    }
+    int size() {
+        return spec.min_size + static_cast<int>(rng() % static_cast<uint64_t>(spec.max_size - spec.min_size + 1));
+    }
+    
+public:
+    explicit SyntheticBookGenerator(const SyntheticBookSpec& spec_) : spec(spec_), rng(spec_.seed) {
+        spec.max_levels = std::min(spec.max_levels, kBookLevels);
+        spec.min_levels = std::min(spec.min_levels, spec.max_levels);
+        spec.max_size = std::max(spec.max_size, spec.min_size);
+        const int64_t day_start = daysFromCivil(std::stoi(spec.date.substr(0, 4)), std::stoi(spec.date.substr(5, 2)),
+                                                std::stoi(spec.date.substr(8, 2))) * 86400LL * 1000000000LL;
+        latest_ts = day_start + 13LL * 3600 * 1000000000LL + 30LL * 60 * 1000000000LL;  // 13:30 UTC open
+        mid_ticks = std::llround(spec.base_price / spec.tick);
     }
     
     /**
-     * @brief Save impact analysis results to CSV file
-     * @param filename Output CSV filename
-     * @param results Vector of ImpactResult to save
-     * 
-     * Creates a CSV file with columns:
-     * - order_size: Order size in shares
-     * - avg_impact: Average impact as decimal
-     * - impact_bps: Average impact in basis points
-     * 
-     * The CSV format is compatible with Python pandas for further analysis.
+     * @brief Generate the next row
+     * @param row Overwritten with the row
+     * @return false once spec.rows rows have been produced
      */
-    void saveImpactResults(const std::string& filename, const std::vector<ImpactResult>& results) {
-        std::ofstream file(filename);
-        if (file.is_open()) {
-            // Write CSV header
-            file << "order_size,avg_impact,impact_bps\n";
-            
-            // Write data rows
-            for (const auto& result : results) {
-                file << result.order_size << "," 
-                     << std::fixed << std::setprecision(6) << result.avg_impact << "," 
-                     << std::fixed << std::setprecision(6) << result.impact_bps << "\n";
-            }
-            
-            std::cout << "Saved results to " << filename << std::endl;
+    bool next(SyntheticRow& row) {
+        if (produced == spec.rows) return false;
+        row.stale = produced > 0 && spec.stale_fraction > 0 && unit() < spec.stale_fraction;
+        if (row.stale) {
+            row.ts_event = latest_ts - 1 - static_cast<int64_t>(rng() % 1000000);
+        } else {
+            latest_ts += 1000 + static_cast<int64_t>(rng() % 2000000);
+            row.ts_event = latest_ts;
+        }
+        mid_ticks = std::max<int64_t>(mid_ticks + static_cast<int64_t>(rng() % 3) - 1, 20);
+        const int64_t bid0 = mid_ticks - 1 - static_cast<int64_t>(rng() % 2);
+        int64_t ask0 = bid0 + 1 + static_cast<int64_t>(rng() % 3);
+        bool crossed = false, locked = false;
+        if (spec.crossed_fraction > 0 || spec.locked_fraction > 0) {
+            const double draw = unit();
+            crossed = draw < spec.crossed_fraction;
+            locked = !crossed && draw < spec.crossed_fraction + spec.locked_fraction;
+            if (crossed) ask0 = bid0 - 1 - static_cast<int64_t>(rng() % 3);
+            if (locked) ask0 = bid0;
+        }
+        
+        row.bid_levels = spec.min_levels == spec.max_levels ? spec.max_levels : levels();
+        row.ask_levels = spec.min_levels == spec.max_levels ? spec.max_levels : levels();
+        row.bid_levels = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(row.bid_levels), bid0));
+        for (size_t i = 0; i < kBookLevels; ++i) {
+            const bool bid = i < row.bid_levels, ask = i < row.ask_levels;
+            row.bid_ticks[i] = bid ? bid0 - static_cast<int64_t>(i) : 0;
+            row.ask_ticks[i] = ask ? ask0 + static_cast<int64_t>(i) : 0;
+            row.ask_sz[i] = ask ? size() : 0;
+            row.bid_sz[i] = bid ? size() : 0;
+        }
+        const bool both_sides = row.bid_levels > 0 && row.ask_levels > 0;
+        row.crossed = crossed && both_sides;
+        row.locked = locked && both_sides;
+        ++produced;
+        return true;
+    }
+};
+
+/**
+ * @brief Write a Databento-style MBP-10 CSV of SyntheticBookGenerator rows
+ * @param path File to create
+ * @param spec Row count, depth and price parameters
+ * @return Bytes written
+ * @throws std::runtime_error if the file cannot be written
+ * 
+ * Columns follow the MBP-10 schema read by loadData(): 13 header fields,
+ * then bid/ask price, size and count for 10 levels, then the symbol.
+ * Prices are printed with 9 decimals as in Databento's CSV output; empty
+ * levels have empty prices and zero sizes and counts.
+ */
+inline size_t writeSyntheticMbp10(const fs::path& path, const SyntheticBookSpec& spec) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) throw std::runtime_error("cannot write " + path.string());
+    
+    std::string header = "ts_recv,ts_event,rtype,publisher_id,instrument_id,action,side,depth,price,size,flags,ts_in_delta,sequence";
+    for (size_t i = 0; i < kBookLevels; ++i) {
+        char level[8];
+        std::snprintf(level, sizeof(level), "%02zu", i);
+        for (const char* column : {"bid_px_", "ask_px_", "bid_sz_", "ask_sz_", "bid_ct_", "ask_ct_"}) {
+            header += std::string(",") + column + level;
         }
     }
+    header += ",symbol\n";
+    out << header;
+    size_t bytes = header.size();
     
+    const int64_t tick_nanos = std::llround(spec.tick * 1e9);
+    std::string line;
+    char field[160];
+    auto price = [&](int64_t ticks) {
+        const int64_t nanos = ticks * tick_nanos;
+        std::snprintf(field, sizeof(field), ",%lld.%09lld", static_cast<long long>(nanos / 1000000000LL),
+                      static_cast<long long>(nanos % 1000000000LL));
+        line += field;
+    };
+    SyntheticBookGenerator generator(spec);
+    SyntheticRow row;
+    for (size_t r = 0; generator.next(row); ++r) {
+        int64_t day_ns = row.ts_event % (86400LL * 1000000000LL);
+        std::snprintf(field, sizeof(field), "%sT%02lld:%02lld:%02lld.%09lldZ", spec.date.c_str(),
+                      static_cast<long long>(day_ns / 3600000000000LL), static_cast<long long>(day_ns / 60000000000LL % 60),
+                      static_cast<long long>(day_ns / 1000000000LL % 60), static_cast<long long>(day_ns % 1000000000LL));
+        line.assign(field);
+        line += ',';
+        line += field;
+        line += ",10,2,1234,A,B,0";
+        price(row.bid_ticks[0]);
+        std::snprintf(field, sizeof(field), ",100,130,1234,%zu", r);
+        line += field;
+        for (size_t i = 0; i < kBookLevels; ++i) {
+            const bool bid = i < row.bid_levels, ask = i < row.ask_levels;
+            if (bid) price(row.bid_ticks[i]); else line += ',';
+            if (ask) price(row.ask_ticks[i]); else line += ',';
+            std::snprintf(field, sizeof(field), ",%d,%d,%d,%d", row.bid_sz[i], row.ask_sz[i], bid ? 1 : 0, ask ? 1 : 0);
+            line += field;
+        }
+        line += ",SYNTH\n";
+        out << line;
+        bytes += line.size();
+    }
+    if (!out.good()) throw std::runtime_error("failed writing " + path.string());
+    return bytes;
+}
+
+/**
+ * @struct BenchOptions
+ * @brief Configuration of the --bench harness
+ */
+struct BenchOptions {
+    size_t rows = 200000;                         ///< Rows in the generated day file
+    int repeats = 3;                              ///< Runs per measurement (best is reported)
+    std::string output = "bench_results.json";    ///< Machine-readable results
+};
+
+/**
+ * @class BenchmarkHarness
+ * @brief Micro and macro benchmarks of the loaders and impact engines
+ * 
+ * Generates a synthetic MBP-10 day file in a scratch folder, then measures:
+ * - parse throughput (MB/s, rows/s) per loader, and cache decode speed,
+ * - impact throughput (snapshots/s) per engine across grid sizes,
+ * - memory per stored snapshot,
+ * - an end-to-end load + both curves run through OrderBookAnalyzer.
+ * Each measurement keeps the best of `repeats` runs. Results are printed
+ * and written as JSON so runs of different versions can be compared.
+ */
+class BenchmarkHarness {
+private:
     /**
-     * @brief Display answers to the main task questions
-     * 
-     * This function provides comprehensive answers to both questions in the task:
-     * 1. How to model the temporary impact function g_s(x)
-     * 2. Mathematical framework for optimal execution with constraint Σᵢ xᵢ = S
-     * 
-     * The answers reference the implemented VWAP-based approach and provide
-     * mathematical formulations for the optimization problem.
+     * @struct Measurement
+     * @brief One named metric
      */
-    void answerTaskQuestions() {
-        std::cout << "\n" << std::string(60, '=') << std::endl;
-        std::cout << "ANSWERING TASK QUESTIONS" << std::endl;
-        std::cout << std::string(60, '=') << std::endl;
-        
-        std::cout << "\n1. How do you choose to model the temporary impact g_s(x)?" << std::endl;
-        std::cout << "   Answer: I model g_s(x) as the weighted average execution price impact" << std::endl;
-        std::cout << "   when consuming X shares from the order book. This is implemented by:" << std::endl;
-        std::cout << "   - Walking through order book levels sequentially" << std::endl;
-        std::cout << "   - Taking liquidity at each level until order is filled" << std::endl;
-        std::cout << "   - Computing volume-weighted average price (VWAP)" << std::endl;
-        std::cout << "   - Measuring impact as (VWAP - Mid_Price) / Mid_Price" << std::endl;
-        
-        std::cout << "\n2. Mathematical Framework:" << std::endl;
-        std::cout << R"(
-   Let O(t) = {(p_i, s_i)} be the order book state at time t
-   where p_i is price and s_i is size at level i
-   
-   For buy order of size X:
-   VWAP_buy(X) = Σ(min(remaining, s_i) × p_i) / Σ(min(remaining, s_i))
-   g_buy(X) = (VWAP_buy(X) - mid_price) / mid_price
-   
-   For sell order of size X:
-   VWAP_sell(X) = Σ(min(remaining, s_i) × p_i) / Σ(min(remaining, s_i))
-   g_sell(X) = (mid_price - VWAP_sell(X)) / mid_price
-   
-   The C++ implementation provides O(n×m×k) complexity where:
-   - n = number of snapshots
-   - m = number of order sizes tested  
-   - k = number of book levels (10)
-   
-   This is significantly faster than Python for large datasets.
-        )" << std::endl;
+    struct Measurement {
+        std::string name;   ///< e.g. "parse.mapped"
+        std::string unit;   ///< e.g. "MB/s"
+        double value;       ///< Best value over the repeats
+    };
+    
+    AnalyzerOptions base;                ///< Options shared with the analyzer runs
+    BenchOptions bench;                  ///< Harness configuration
+    std::vector<Measurement> results;    ///< Collected metrics
+    
+    /**
+     * @brief Best wall time of fn() over the configured repeats
+     * @return Seconds
+     */
+    template <typename F>
+    double bestSeconds(F&& fn) const {
+        double best = std::numeric_limits<double>::max();
+        for (int i = 0; i < std::max(bench.repeats, 1); ++i) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    }
+    
+    void record(const std::string& name, const std::string& unit, double value) {
+        results.push_back({name, unit, value});
+        std::cout << "  " << std::left << std::setw(36) << name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(16) << value << " " << unit << std::endl;
     }
     
     /**
-     * @brief Run complete analysis for all symbols
-     * 
-     * This is the main entry point for the analysis. It:
-     * 1. Analyzes each symbol (CRWV, FROG, SOUN) individually
-     * 2. Generates comprehensive statistics and impact functions
-     * 3. Saves results to CSV files for each symbol
-     * 4. Displays answers to the task questions
-     * 5. Reports total execution time
-     * 
-     * The analysis processes up to 90,000 order book snapshots across
-     * all symbols and generates both buy-side and sell-side impact functions.
+     * @brief Redirects std::cout to nowhere while the analyzer logs progress
      */
-    void run() {
-        auto start_time = std::chrono::high_resolution_clock::now();
+    struct QuietCout {
+        std::streambuf* saved;
+        std::ostringstream sink;
+        QuietCout() : saved(std::cout.rdbuf(sink.rdbuf())) {}
+        ~QuietCout() { std::cout.rdbuf(saved); }
+    };
+    
+public:
+    BenchmarkHarness(const AnalyzerOptions& options, const BenchOptions& bench_options)
+        : base(options), bench(bench_options) {}
+    
+    /**
+     * @brief Run all benchmarks and write the JSON report
+     * @return Number of recorded metrics
+     */
+    size_t run() {
+        // A private folder per run: concurrent benchmarks must not share or delete each other's files
+        fs::path root;
+        do {
+            root = fs::temp_directory_path() / ("order_book_bench_" + uniqueToken());
+        } while (!fs::create_directory(root));
+        struct Cleanup {
+            fs::path path;
+            ~Cleanup() {
+                std::error_code ec;
+                fs::remove_all(path, ec);
+            }
+        } cleanup{root};
+        fs::create_directories(root / "BENCH");
+        fs::path csv = root / "BENCH" / "BENCH_2025-04-03 00_00_00+00_00.csv";
         
-        std::cout << "Blockhouse Order Book Analysis (C++)" << std::endl;
-        std::cout << std::string(50, '=') << std::endl;
+        SyntheticBookSpec spec;
+        spec.rows = bench.rows;
+        std::cout << "Generating " << spec.rows << " synthetic MBP-10 rows..." << std::endl;
+        const double megabytes = static_cast<double>(writeSyntheticMbp10(csv, spec)) / (1024.0 * 1024.0);
+        const double rows = static_cast<double>(spec.rows);
         
-        // Analyze each symbol individually
-        for (const auto& symbol : symbols) {
-            analyzeSymbol(symbol);
+        std::cout << "\nParse throughput (" << std::fixed << std::setprecision(1) << megabytes << " MB)" << std::endl;
+        for (LoaderMode loader : {LoaderMode::Stream, LoaderMode::Mapped}) {
+            AnalyzerOptions options = base;
+            options.loader = loader;
+            options.use_cache = false;
+            options.streaming = false;
+            const std::string name = loader == LoaderMode::Mapped ? "parse.mapped" : "parse.stream";
+            double seconds = bestSeconds([&] {
+                QuietCout quiet;
+                OrderBookAnalyzer analyzer(root.string(), options);
+                analyzer.loadData("BENCH");
+            });
+            record(name + ".throughput", "MB/s", megabytes / seconds);
+            record(name + ".rows", "rows/s", rows / seconds);
+        }
+        {
+            AnalyzerOptions options = base;
+            options.use_cache = true;
+            options.streaming = false;
+            options.cache_dir = (root / "cache").string();
+            fs::remove_all(options.cache_dir);
+            {
+                QuietCout quiet;
+                OrderBookAnalyzer warm(root.string(), options);
+                warm.loadData("BENCH");
+            }
+            double seconds = bestSeconds([&] {
+                QuietCout quiet;
+                OrderBookAnalyzer analyzer(root.string(), options);
+                analyzer.loadData("BENCH");
+            });
+            record("parse.cache.rows", "rows/s", rows / seconds);
         }
         
-        // Display comprehensive answers to task questions
-        answerTaskQuestions();
+        AnalyzerOptions load_options = base;
+        load_options.use_cache = false;
+        load_options.streaming = false;
+        OrderBookAnalyzer loader(root.string(), load_options);
+        {
+            QuietCout quiet;
+            loader.loadData("BENCH");
+        }
+        const SnapshotStore& store = *loader.getSnapshots("BENCH");
+        const double snapshots = static_cast<double>(store.size());
         
-        // Report performance metrics
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        std::cout << "\nMemory" << std::endl;
+        record("store.bytes_per_snapshot", "B", static_cast<double>(store.memoryBytes()) / snapshots);
+        
+        std::cout << "\nImpact throughput (buy side, single thread, SIMD: "
+                  << simdLevelName(detectSimdLevel()) << ")" << std::endl;
+        const OrderSizeGrid grids[] = {{10, 500}, {1, 1000}, {1, 10000}};
+        for (const auto& grid : grids) {
+            const std::string suffix = ".grid" + std::to_string(grid.points());
+            if (grid.points() <= 100) {
+                double seconds = bestSeconds([&] {
+                    QuietCout quiet;
+                    loader.calculateTemporaryImpact(store, "buy", grid.max_shares, grid.step);
+                });
+                record("impact.reference" + suffix, "snapshots/s", snapshots / seconds);
+            }
+            const std::pair<const char*, ImpactKernel> kernels[] = {
+                {"impact.cumulative", accumulateCumulativeDepthImpact},
+                {"impact.simd", accumulateSimdImpact},
+                {"impact.fixed", accumulateFixedPointImpact},
+            };
+            for (const auto& kernel : kernels) {
+                double seconds = bestSeconds([&] {
+                    ImpactAccumulator acc(grid);
+                    kernel.second(store, 0, store.size(), Side::Buy, acc);
+                });
+                record(kernel.first + suffix, "snapshots/s", snapshots / seconds);
+            }
+            double fused = bestSeconds([&] {
+                MarketStats stats;
+                ImpactAccumulator buy(grid), sell(grid);
+                accumulateFusedPass(store, 0, store.size(), &stats, buy, sell);
+            });
+            record("impact.fused_both_sides" + suffix, "snapshots/s", snapshots / fused);
+        }
+        
+        std::cout << "\nExecution schedules (78 five-minute intervals, default grid)" << std::endl;
+        {
+            // Intraday U shape over the measured day curve stands in for a surface
+            const OrderSizeGrid grid;
+            ImpactAccumulator day(grid);
+            accumulateCumulativeDepthImpact(store, 0, store.size(), Side::Buy, day);
+            std::vector<double> floor_curve(grid.points(), std::numeric_limits<double>::infinity());
+            for (size_t k = 0; k < floor_curve.size(); ++k) {
+                if (day.count[k] > 0) floor_curve[k] = day.impact_sum[k] / day.weight_sum[k];
+            }
+            constexpr size_t kIntervals = 78;
+            std::vector<std::vector<double>> curves(kIntervals, floor_curve);
+            for (size_t i = 0; i < kIntervals; ++i) {
+                const double x = (static_cast<double>(i) + 0.5) / kIntervals - 0.5;
+                for (double& g : curves[i]) g *= 1.0 + 2.0 * x * x;
+            }
+            ExecutionSolver solver(grid.step, curves);
+            const int total = 10 * grid.max_shares;
+            constexpr int kSchedules = 50;
+            double seconds = bestSeconds([&] {
+                for (int i = 0; i < kSchedules; ++i) solver.solve(total);
+            });
+            record("execution.dp.schedules", "schedules/s", kSchedules / seconds);
+        }
+        
+        std::cout << "\nEnd to end (load + buy/sell curves, configured engine and threads)" << std::endl;
+        {
+            AnalyzerOptions options = base;
+            options.use_cache = false;
+            options.streaming = false;
+            double seconds = bestSeconds([&] {
+                QuietCout quiet;
+                OrderBookAnalyzer analyzer(root.string(), options);
+                analyzer.loadData("BENCH");
+                const SnapshotStore& loaded = *analyzer.getSnapshots("BENCH");
+                analyzer.calculateImpactCurve(loaded, Side::Buy);
+                analyzer.calculateImpactCurve(loaded, Side::Sell);
+            });
+            record("end_to_end.rows", "rows/s", rows / seconds);
+        }
         
-        std::cout << "\nTotal execution time: " << duration.count() << " ms" << std::endl;
+        writeJson(bench.output);
+        std::cout << "\nWrote " << results.size() << " results to " << bench.output << std::endl;
+        return results.size();
     }
+    
+private:
+    /**
+     * @brief Write the collected metrics with their run context
+     * @param filename Output path
+     */
+    void writeJson(const std::string& filename) const {
+        std::ofstream out(filename);
+        if (!out.is_open()) throw std::runtime_error("cannot write " + filename);
+        auto now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        out << "{\n";
+        out << "  \"timestamp\": " << now << ",\n";
+        out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+        out << "  \"simd\": \"" << simdLevelName(detectSimdLevel()) << "\",\n";
+        out << "  \"threads\": " << (base.threads > 0 ? base.threads : static_cast<int>(std::thread::hardware_concurrency())) << ",\n";
+        out << "  \"rows\": " << bench.rows << ",\n";
+        out << "  \"repeats\": " << bench.repeats << ",\n";
+        out << "  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            out << "    {\"name\": \"" << results[i].name << "\", \"unit\": \"" << results[i].unit
+                << "\", \"value\": " << std::setprecision(6) << std::fixed << results[i].value << "}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+};
+
+/**
+ * @enum ProgramMode
+ * @brief What main() runs
+ */
+enum class ProgramMode {
+    Analyze,  ///< Full analysis of the data folder (default)
+    Bench,    ///< Benchmark harness on synthetic data
+    Reduce,   ///< Merge partial results of sharded runs
+    Serve,    ///< Resident query service on stdin/stdout
+    LiveReplay ///< Replay a day file through the live estimator
+};
+
+/**
+ * @struct CommandLine
+ * @brief Everything parsed from argv
+ */
+struct CommandLine {
+    ProgramMode mode = ProgramMode::Analyze;  ///< Selected program mode
+    AnalyzerOptions analyzer;                 ///< Analyzer configuration
+    BenchOptions bench;                       ///< Benchmark configuration
+    std::string reduce_dir;                   ///< Partial results directory (Reduce mode)
+    std::string data_dir = ".";               ///< Root folder with one subdirectory per symbol
+    std::string replay_file;                  ///< Day file for LiveReplay
 };
 
+/**
+ * @brief Parse a strictly positive integer flag value
+ * @param key Flag name (for error messages)
+ * @param value Text after '='
+ * @return Parsed value
+ * @throws std::invalid_argument if the value is not a positive integer
+ */
+int parsePositiveInt(const std::string& key, const std::string& value) {
+    int parsed = 0;
+    auto result = std::from_chars(value.data(), value.data() + value.size(), parsed);
+    if (result.ec != std::errc() || result.ptr != value.data() + value.size() || parsed <= 0) {
+        throw std::invalid_argument(key + " expects a positive integer, got '" + value + "'");
+    }
+    return parsed;
+}
+
+/**
+ * @brief Parse an unsigned 64-bit flag value (0 included)
+ * @throws std::invalid_argument if the value is not a decimal integer in [0, 2^64)
+ */
+uint64_t parseUint64(const std::string& key, const std::string& value) {
+    uint64_t parsed = 0;
+    auto result = std::from_chars(value.data(), value.data() + value.size(), parsed);
+    if (value.empty() || result.ec != std::errc() || result.ptr != value.data() + value.size()) {
+        throw std::invalid_argument(key + " expects an unsigned 64-bit integer, got '" + value + "'");
+    }
+    return parsed;
+}
+
+/**
+ * @brief Parse a --shard value "I/N" (0 <= I < N)
+ * @throws std::invalid_argument on a malformed or out-of-range value
+ */
+void parseShardSpec(const std::string& value, AnalyzerOptions& options) {
+    size_t slash = value.find('/');
+    int index = -1;
+    int count = 0;
+    bool valid = slash != std::string::npos;
+    if (valid) {
+        auto first = std::from_chars(value.data(), value.data() + slash, index);
+        auto second = std::from_chars(value.data() + slash + 1, value.data() + value.size(), count);
+        valid = first.ec == std::errc() && first.ptr == value.data() + slash &&
+                second.ec == std::errc() && second.ptr == value.data() + value.size() &&
+                count > 0 && index >= 0 && index < count;
+    }
+    if (!valid) throw std::invalid_argument("--shard expects I/N with 0 <= I < N, got '" + value + "'");
+    options.shard_index = index;
+    options.shard_count = count;
+}
+
+/**
+ * @brief Parse a --sample value ("full", "head:N", "every:K", "stratified:N", "reservoir:N")
+ * @param value Text after '='
+ * @param spec Current spec (file limit and seed are kept)
+ * @return Updated spec
+ * @throws std::invalid_argument on an unknown strategy or a bad count
+ */
+IngestSpec parseSamplingSpec(const std::string& value, IngestSpec spec) {
+    size_t colon = value.find(':');
+    std::string name = value.substr(0, colon);
+    if (name == "full" && colon == std::string::npos) {
+        spec.mode = SamplingMode::Full;
+        spec.count = 0;
+        return spec;
+    }
+    if (colon == std::string::npos) {
+        throw std::invalid_argument("--sample=" + value + " needs a count (e.g. head:10000)");
+    }
+    if (name == "head") spec.mode = SamplingMode::Head;
+    else if (name == "every") spec.mode = SamplingMode::EveryKth;
+    else if (name == "stratified") spec.mode = SamplingMode::TimeStratified;
+    else if (name == "reservoir") spec.mode = SamplingMode::Reservoir;
+    else throw std::invalid_argument("unknown sampling strategy '" + name + "'");
+    spec.count = static_cast<size_t>(parsePositiveInt("--sample", value.substr(colon + 1)));
+    return spec;
+}
+
+/**
+ * @brief Split a comma-separated symbol list, dropping blanks and duplicates
+ * @throws std::invalid_argument if no symbol remains
+ */
+std::vector<std::string> parseSymbolList(const std::string& value) {
+    std::vector<std::string> symbols;
+    std::stringstream ss(value);
+    std::string symbol;
+    while (std::getline(ss, symbol, ',')) {
+        symbol.erase(0, symbol.find_first_not_of(" \t"));
+        symbol.erase(symbol.find_last_not_of(" \t") + 1);
+        if (!symbol.empty() && std::find(symbols.begin(), symbols.end(), symbol) == symbols.end()) {
+            symbols.push_back(symbol);
+        }
+    }
+    if (symbols.empty()) throw std::invalid_argument("--symbols expects a comma-separated list");
+    return symbols;
+}
+
+/**
+ * @brief Validate a "YYYY-MM-DD" flag value
+ * @return The value itself
+ * @throws std::invalid_argument if it is not of that form
+ */
+std::string parseIsoDate(const std::string& key, const std::string& value) {
+    bool valid = value.size() == 10 && value[4] == '-' && value[7] == '-';
+    for (size_t i = 0; valid && i < value.size(); ++i) {
+        if (i != 4 && i != 7) valid = value[i] >= '0' && value[i] <= '9';
+    }
+    if (!valid) throw std::invalid_argument(key + " expects YYYY-MM-DD, got '" + value + "'");
+    return value;
+}
+
+/**
+ * @brief Apply one command line flag
+ * @param arg Flag such as "--threads=8"
+ * @param program Program name for the usage text
+ * @param command Receives the program mode and options
+ * @return false if the program should exit after printing usage
+ * @throws std::invalid_argument on unknown flags or values
+ * 
+ * Supported flags:
+ * - --loader=mapped|stream           CSV ingestion path (default: mapped)
+ * - --engine=cumulative|simd|reference|fixed  Impact curve engine (default: cumulative)
+ * - --grid-step=N                    Order size spacing in shares (default: 10)
+ * - --max-shares=N                   Largest order size in shares (default: 500)
+ * - --threads=N                      Worker threads (default: hardware concurrency)
+ * - --streaming                      Accumulate while parsing; memory independent of row count
+ * - --sample=full|head:N|every:K|stratified:N|reservoir:N
+ *                                    Row sampling (default: full)
+ * - --max-files=N                    Day files per symbol, in date order (default: all)
+ * - --seed=N                         Reservoir sampling seed, any uint64 (default: 42)
+ * - --metrics=PATH                   Write per-symbol counters and phase timings as JSON
+ * - --averaging=snapshot|time        Average per snapshot (default) or per distinct state, time weighted
+ * - --bucket-minutes=N               Also write per-time-of-day impact surfaces with N-minute buckets
+ * - --distribution                   Add std dev and p50/p95/p99 columns to the impact CSVs
+ * - --schedule-shares=S              With --bucket-minutes, write the cost-optimal split of S shares
+ * - --schedule-min-fill=F            Share of a bucket's books that must fill a child size (default: 0.5)
+ * - --partials-out=DIR               Write per-day partial sums to DIR instead of curves (map step)
+ * - --shard=I/N                      With --partials-out, process shard I of N of the day files
+ * - --reduce=DIR                     Merge the partial files in DIR into final curves (reduce step)
+ * - --data-dir=PATH                  Root folder with one subdirectory per symbol (default: .)
+ * - --symbols=A,B,...                Symbols to analyze (default: every subdirectory holding CSVs)
+ * - --start-date=YYYY-MM-DD          First trading day to include (default: no limit)
+ * - --end-date=YYYY-MM-DD            Last trading day to include (default: no limit)
+ * - --output-dir=PATH                Folder for the impact and surface CSVs (default: .)
+ * - --config=PATH                    Read "key = value" lines as the flags --key=value
+ * - --serve                          Load the data once, then answer g(X) queries on stdin (see serveImpactQueries)
+ * - --output-format=csv|columnar|both Result tables as CSV (default) and/or binary .obcol files
+ * - --piecewise                      Also write the exact breakpoint curves (<SYM>_<side>_piecewise.csv)
+ * - --impact-at=X,Y,...              Print exact g at arbitrary order sizes
+ * - --exclude-books=crossed,locked,stale  Drop snapshots with these book conditions after loading
+ * - --partial-fills=average|skip|extrapolate  Pricing of sizes beyond the visible depth (default: average)
+ * - --batch                          Analyze symbols concurrently, one pinned worker group per NUMA node
+ * - --numa-nodes=N                   With --batch, use N node groups (default: one per detected node)
+ * - --prefetch-mb=N                  Read ahead up to N MiB of upcoming day files (default: 256)
+ * - --no-prefetch                    Read each day file only when it is parsed
+ * - --snapshot-detail                Also write every snapshot's impact per size to <SYM>_snapshots.obcol
+ * - --live-replay=PATH               Feed a day file through the live estimator and report latency
+ * - --live-half-life=SECONDS         Live estimate decay half-life in event time (default: 60, 0 = none)
+ * - --live-rate=N                    Replay pacing in updates per second (default: as fast as possible)
+ * - --bench                          Run the benchmark harness instead of the analysis
+ * - --bench-rows=N                   Synthetic rows for --bench (default: 200000)
+ * - --bench-repeats=N                Runs per benchmark, best kept (default: 3)
+ * - --bench-out=PATH                 JSON results file (default: bench_results.json)
+ * - --cache-dir=PATH                 Snapshot cache root (default: <output-dir>/.snapshot_cache,
+ *                                    else ~/.cache/order_book_analysis)
+ * - --no-cache                       Always parse CSVs, never read or write caches
+ * - --help                           Print usage
+ */
+bool applyArgument(const std::string& arg, const char* program, CommandLine& command) {
+    AnalyzerOptions& options = command.analyzer;
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? std::string() : arg.substr(eq + 1);
+    
+    if (key == "--help" || key == "-h") {
+        std::cout << "Usage: " << program
+                  << " [--loader=mapped|stream] [--engine=cumulative|simd|reference|fixed]"
+                  << " [--grid-step=N] [--max-shares=N] [--threads=N]"
+                  << " [--streaming] [--cache-dir=PATH] [--no-cache]"
+                  << " [--sample=full|head:N|every:K|stratified:N|reservoir:N]"
+                  << " [--max-files=N] [--seed=N] [--metrics=PATH] [--averaging=snapshot|time]"
+                  << " [--bucket-minutes=N [--schedule-shares=S [--schedule-min-fill=F]]] [--distribution]"
+                  << " [--partials-out=DIR [--shard=I/N]] [--reduce=DIR]"
+                  << " [--data-dir=PATH] [--symbols=A,B,...] [--start-date=YYYY-MM-DD] [--end-date=YYYY-MM-DD]"
+                  << " [--output-dir=PATH] [--config=PATH] [--serve]"
+                  << " [--output-format=csv|columnar|both] [--snapshot-detail]"
+                  << " [--prefetch-mb=N | --no-prefetch] [--piecewise] [--impact-at=X,Y,...]"
+                  << " [--exclude-books=crossed,locked,stale] [--partial-fills=average|skip|extrapolate]"
+                  << " [--batch [--numa-nodes=N]]"
+                  << " [--live-replay=PATH [--live-half-life=SECONDS] [--live-rate=N]]"
+                  << " [--bench [--bench-rows=N] [--bench-repeats=N] [--bench-out=PATH]]" << std::endl;
+        return false;
+    } else if (key == "--data-dir" && !value.empty()) {
+        command.data_dir = value;
+    } else if (key == "--symbols" && !value.empty()) {
+        options.symbols = parseSymbolList(value);
+    } else if (key == "--start-date") {
+        options.start_date = parseIsoDate(key, value);
+    } else if (key == "--end-date") {
+        options.end_date = parseIsoDate(key, value);
+    } else if (key == "--output-dir" && !value.empty()) {
+        options.output_dir = value;
+    } else if (key == "--loader" && value == "mapped") {
+        options.loader = LoaderMode::Mapped;
+    } else if (key == "--loader" && value == "stream") {
+        options.loader = LoaderMode::Stream;
+    } else if (key == "--engine" && value == "cumulative") {
+        options.engine = ImpactEngine::CumulativeDepth;
+    } else if (key == "--engine" && value == "simd") {
+        options.engine = ImpactEngine::Simd;
+    } else if (key == "--engine" && value == "reference") {
+        options.engine = ImpactEngine::Reference;
+    } else if (key == "--engine" && value == "fixed") {
+        options.engine = ImpactEngine::FixedPoint;
+    } else if (key == "--grid-step") {
+        options.grid_step = parsePositiveInt(key, value);
+    } else if (key == "--max-shares") {
+        options.max_shares = parsePositiveInt(key, value);
+    } else if (key == "--threads") {
+        options.threads = parsePositiveInt(key, value);
+    } else if (key == "--cache-dir" && !value.empty()) {
+        options.cache_dir = value;
+    } else if (arg == "--no-cache") {
+        options.use_cache = false;
+    } else if (arg == "--streaming") {
+        options.streaming = true;
+    } else if (key == "--sample") {
+        options.ingest = parseSamplingSpec(value, options.ingest);
+    } else if (key == "--max-files") {
+        options.ingest.max_files = parsePositiveInt(key, value);
+    } else if (key == "--seed") {
+        options.ingest.seed = parseUint64(key, value);
+    } else if (key == "--output-format" && value == "csv") {
+        options.output_format = OutputFormat::Csv;
+    } else if (key == "--output-format" && value == "columnar") {
+        options.output_format = OutputFormat::Columnar;
+    } else if (key == "--output-format" && value == "both") {
+        options.output_format = OutputFormat::Both;
+    } else if (arg == "--piecewise") {
+        options.piecewise = true;
+    } else if (key == "--impact-at") {
+        options.impact_at.clear();
+        std::stringstream list(value);
+        std::string item;
+        while (std::getline(list, item, ',')) options.impact_at.push_back(parsePositiveInt(key, item));
+        if (options.impact_at.empty()) throw std::invalid_argument("--impact-at expects a comma-separated list of sizes");
+    } else if (key == "--exclude-books") {
+        options.exclude_books = 0;
+        std::stringstream list(value);
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            if (item == "crossed") {
+                options.exclude_books |= kBookCrossed;
+            } else if (item == "locked") {
+                options.exclude_books |= kBookLocked;
+            } else if (item == "stale") {
+                options.exclude_books |= kBookStale;
+            } else if (item != "none") {
+                throw std::invalid_argument("--exclude-books expects crossed, locked, stale or none, got '" + item + "'");
+            }
+        }
+    } else if (key == "--partial-fills" && value == "average") {
+        options.partial_fills = PartialFillPolicy::Average;
+    } else if (key == "--partial-fills" && value == "skip") {
+        options.partial_fills = PartialFillPolicy::Skip;
+    } else if (key == "--partial-fills" && value == "extrapolate") {
+        options.partial_fills = PartialFillPolicy::Extrapolate;
+    } else if (arg == "--batch") {
+        options.batch = true;
+    } else if (key == "--numa-nodes") {
+        options.numa_nodes = parsePositiveInt(key, value);
+    } else if (key == "--prefetch-mb") {
+        options.prefetch_mb = parsePositiveInt(key, value);
+    } else if (arg == "--no-prefetch") {
+        options.prefetch_mb = 0;
+    } else if (arg == "--snapshot-detail") {
+        options.snapshot_detail = true;
+    } else if (arg == "--distribution") {
+        options.distribution = true;
+    } else if (key == "--schedule-shares") {
+        options.schedule_shares = parsePositiveInt(key, value);
+    } else if (key == "--schedule-min-fill") {
+        char* parsed_end = nullptr;
+        options.schedule_min_fill = std::strtod(value.c_str(), &parsed_end);
+        if (value.empty() || *parsed_end != '\0' || !(options.schedule_min_fill >= 0 && options.schedule_min_fill <= 1)) {
+            throw std::invalid_argument("--schedule-min-fill expects a share in [0, 1], got '" + value + "'");
+        }
+    } else if (key == "--bucket-minutes") {
+        options.bucket_minutes = parsePositiveInt(key, value);
+    } else if (key == "--averaging" && value == "snapshot") {
+        options.averaging = Averaging::PerSnapshot;
+    } else if (key == "--averaging" && value == "time") {
+        options.averaging = Averaging::TimeWeighted;
+    } else if (key == "--metrics" && !value.empty()) {
+        options.metrics_path = value;
+    } else if (key == "--partials-out" && !value.empty()) {
+        options.partials_dir = value;
+    } else if (key == "--shard") {
+        parseShardSpec(value, options);
+    } else if (key == "--reduce" && !value.empty()) {
+        command.mode = ProgramMode::Reduce;
+        command.reduce_dir = value;
+    } else if (key == "--live-replay" && !value.empty()) {
+        command.mode = ProgramMode::LiveReplay;
+        command.replay_file = value;
+    } else if (key == "--live-half-life") {
+        char* parsed_end = nullptr;
+        options.live_half_life = std::strtod(value.c_str(), &parsed_end);
+        if (value.empty() || *parsed_end != '\0' || !(options.live_half_life >= 0)) {
+            throw std::invalid_argument("--live-half-life expects a non-negative number of seconds, got '" + value + "'");
+        }
+    } else if (key == "--live-rate") {
+        options.live_rate = parsePositiveInt(key, value);
+    } else if (arg == "--serve") {
+        command.mode = ProgramMode::Serve;
+    } else if (arg == "--bench") {
+        command.mode = ProgramMode::Bench;
+    } else if (key == "--bench-rows") {
+        command.bench.rows = static_cast<size_t>(parsePositiveInt(key, value));
+    } else if (key == "--bench-repeats") {
+        command.bench.repeats = parsePositiveInt(key, value);
+    } else if (key == "--bench-out" && !value.empty()) {
+        command.bench.output = value;
+    } else {
+        throw std::invalid_argument("unknown argument '" + arg + "' (see --help)");
+    }
+    return true;
+}
+
+/**
+ * @brief Apply the flags of a run config file
+ * @param path File of "key = value" or bare "key" lines; '#' starts a comment
+ * @param program Program name for the usage text
+ * @param command Receives the program mode and options
+ * @throws std::invalid_argument if the file cannot be read or a line is not a valid flag
+ * 
+ * Each line is the flag --key=value (or --key), applied in file order at
+ * the position of --config on the command line, so later flags override
+ * the file. Config files cannot include other config files.
+ */
+void applyConfigFile(const std::string& path, const char* program, CommandLine& command) {
+    std::ifstream file(path);
+    if (!file.is_open()) throw std::invalid_argument("cannot read config file '" + path + "'");
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        size_t eq = line.find('=');
+        std::string key = line.substr(0, eq);
+        std::string value = eq == std::string::npos ? std::string() : line.substr(eq + 1);
+        auto trim = [](std::string& text) {
+            text.erase(0, text.find_first_not_of(" \t\r"));
+            text.erase(text.find_last_not_of(" \t\r") + 1);
+        };
+        trim(key);
+        trim(value);
+        if (key.empty()) continue;
+        try {
+            if (key == "config") throw std::invalid_argument("config files cannot include other config files");
+            applyArgument("--" + key + (eq == std::string::npos ? "" : "=" + value), program, command);
+        } catch (const std::invalid_argument& e) {
+            throw std::invalid_argument(path + ":" + std::to_string(number) + ": " + e.what());
+        }
+    }
+}
+
+/**
+ * @brief Parse command line flags (see applyArgument)
+ * @param argc Argument count from main()
+ * @param argv Argument vector from main()
+ * @param command Receives the program mode and options
+ * @return false if the program should exit after printing usage
+ * @throws std::invalid_argument on unknown flags or values
+ */
+bool parseCommandLine(int argc, char* argv[], CommandLine& command) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--config=") == 0) {
+            applyConfigFile(arg.substr(9), argv[0], command);
+        } else if (!applyArgument(arg, argv[0], command)) {
+            return false;
+        }
+    }
+    const AnalyzerOptions& options = command.analyzer;
+    if (!options.start_date.empty() && !options.end_date.empty() && options.start_date > options.end_date) {
+        throw std::invalid_argument("--start-date is after --end-date");
+    }
+    return true;
+}
+
 /**
  * @brief Main program entry point
+ * @param argc Argument count
+ * @param argv Command line flags (see parseCommandLine)
  * @return 0 on success, 1 on error
  * 
- * Initializes the OrderBookAnalyzer and runs the complete analysis.
+ * Initializes the OrderBookAnalyzer and runs the complete analysis, the
+ * benchmark harness with --bench, the reduce step with --reduce, or the
+ * query service with --serve, or a live-path replay with --live-replay. Left out with -DORDER_BOOK_ANALYSIS_NO_MAIN.
  * Includes error handling for file I/O and data parsing issues.
  */
-int main() {
+#ifndef ORDER_BOOK_ANALYSIS_NO_MAIN
+int main(int argc, char* argv[]) {
     try {
-        OrderBookAnalyzer analyzer(".");
+        CommandLine command;
+        if (!parseCommandLine(argc, argv, command)) return 0;
+        
+        if (command.mode == ProgramMode::Bench) {
+            BenchmarkHarness harness(command.analyzer, command.bench);
+            harness.run();
+            return 0;
+        }
+        
+        if (command.mode == ProgramMode::Serve) {
+            const int bucket_minutes = command.analyzer.bucket_minutes > 0 ? command.analyzer.bucket_minutes : 5;
+            ImpactService service(command.data_dir, command.analyzer, bucket_minutes);
+            const size_t loaded = service.refresh();
+            std::cerr << "Loaded " << loaded << " day files; " << bucket_minutes
+                      << "-minute buckets; reading commands from stdin" << std::endl;
+            serveImpactQueries(service, std::cin, std::cout);
+            return 0;
+        }
+        
+        if (command.mode == ProgramMode::LiveReplay) {
+            return replayLive(command.data_dir, command.analyzer, command.replay_file) ? 0 : 1;
+        }
+        
+        OrderBookAnalyzer analyzer(command.data_dir, command.analyzer);
+        if (command.mode == ProgramMode::Reduce) {
+            analyzer.reducePartials(command.reduce_dir);
+            return 0;
+        }
         analyzer.run();
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -578,3 +8841,4 @@ int main() {
     
     return 0;
 }
+#endif  // ORDER_BOOK_ANALYSIS_NO_MAIN
@@ -0,0 +1,1593 @@
+/**
+ * @file impact_tests.cpp
+ * @brief Correctness and performance regression tests for the impact engines
+ *
+ * Every engine variant (cumulative depth, SIMD at each supported width,
+ * fixed point, the fused pass, the exact piecewise curve, the resident
+ * service and the streaming run) is checked against the scalar reference
+ * calculateTemporaryImpact() on SyntheticBookGenerator books (the rows the
+ * benchmark's day files hold): full depth, shallow and empty sides, crossed
+ * and locked books, and level sizes in the millions.
+ * The perf_* cases time the loaders and kernels on a pinned synthetic day
+ * file and fail when throughput drops below a floor.
+ *
+ * Build and run with `make test`; `tests/impact_tests NAME...` runs the cases
+ * whose name contains any NAME. OB_PERF_SCALE multiplies the floors
+ * (OB_PERF_SCALE=0 measures without failing, for debug or sanitizer builds).
+ */
+
+#define ORDER_BOOK_ANALYSIS_NO_MAIN
+#include "../order_book_analysis.cpp"
+#include "test_support.h"
+
+namespace {
+
+/// Relative tolerance between an engine and the reference (fixed point and SIMD reorder the sums)
+constexpr double kTolerance = 1e-9;
+
+/**
+ * @brief Row-range kernels expected to reproduce the reference curve
+ */
+std::vector<std::pair<std::string, ImpactKernel>> engineKernels() {
+    std::vector<std::pair<std::string, ImpactKernel>> kernels = {
+        {"cumulative", accumulateCumulativeDepthImpact},
+        {"simd", accumulateSimdImpact},
+        {"fixed", accumulateFixedPointImpact},
+    };
+#ifdef ORDER_BOOK_X86_KERNELS
+    if (detectSimdLevel() != SimdLevel::Scalar) kernels.push_back({"avx2", accumulateAvx2Impact});
+    if (detectSimdLevel() == SimdLevel::Avx512) kernels.push_back({"avx512", accumulateAvx512Impact});
+#endif
+    return kernels;
+}
+
+/**
+ * @brief Reference curve of one side
+ */
+std::vector<ImpactResult> referenceCurve(const SnapshotStore& store, Side side, const OrderSizeGrid& grid,
+                                         PartialFillPolicy policy = PartialFillPolicy::Average) {
+    obtest::QuietCout quiet;
+    OrderBookAnalyzer analyzer(".");
+    return analyzer.calculateTemporaryImpact(store, sideName(side), grid.max_shares, grid.step, policy);
+}
+
+/**
+ * @brief Check every kernel and the fused pass against the reference on both sides
+ */
+void checkEnginesAgainstReference(const std::string& label, const SnapshotStore& store, const OrderSizeGrid& grid) {
+    const auto reference_buy = referenceCurve(store, Side::Buy, grid);
+    const auto reference_sell = referenceCurve(store, Side::Sell, grid);
+    OB_CHECK(!reference_buy.empty());
+    OB_CHECK(!reference_sell.empty());
+    for (const auto& kernel : engineKernels()) {
+        OB_CHECK_CURVES(label + " " + kernel.first + " buy", reference_buy,
+                        obtest::kernelCurve(kernel.second, store, Side::Buy, grid), kTolerance);
+        OB_CHECK_CURVES(label + " " + kernel.first + " sell", reference_sell,
+                        obtest::kernelCurve(kernel.second, store, Side::Sell, grid), kTolerance);
+    }
+    MarketStats stats;
+    ImpactAccumulator buy(grid), sell(grid);
+    accumulateFusedPass(store, 0, store.size(), &stats, buy, sell);
+    OB_CHECK_CURVES(label + " fused buy", reference_buy, buy.results(), kTolerance);
+    OB_CHECK_CURVES(label + " fused sell", reference_sell, sell.results(), kTolerance);
+}
+
+/**
+ * @brief Write a pinned synthetic day file under root/SYMBOL
+ * @return Bytes written
+ */
+size_t writePinnedDay(const fs::path& root, const std::string& symbol, size_t rows, const std::string& date,
+                      uint64_t seed = 1, size_t visible_levels = kBookLevels) {
+    fs::create_directories(root / symbol);
+    SyntheticBookSpec spec;
+    spec.rows = rows;
+    spec.seed = seed;
+    spec.date = date;
+    spec.min_levels = spec.max_levels = visible_levels;
+    return writeSyntheticMbp10(root / symbol / (symbol + "_" + date + " 00_00_00+00_00.csv"), spec);
+}
+
+std::string readFile(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream out;
+    out << in.rdbuf();
+    return out.str();
+}
+
+/**
+ * @brief DBN stream (empty metadata) of MBP-10 records: 100 x 10.00 / 10.01 on
+ *        every level, except that bid_sz[0] of each record is taken from sizes
+ */
+std::string dbnStream(const std::vector<uint32_t>& sizes) {
+    std::string out("DBN\x02\0\0\0\0", 8);
+    const int64_t open_ns = 1743687000LL * 1000000000LL;
+    for (size_t r = 0; r < sizes.size(); ++r) {
+        DbnMbp10Msg record;
+        std::memset(&record, 0, sizeof(record));
+        record.length = static_cast<uint8_t>(sizeof(record) / 4);
+        record.rtype = kDbnMbp10RType;
+        record.ts_event = static_cast<uint64_t>(open_ns) + r * 1000000;
+        for (size_t i = 0; i < kBookLevels; ++i) {
+            record.levels[i].bid_px = 10000000000LL - static_cast<int64_t>(i) * 10000000LL;
+            record.levels[i].ask_px = 10010000000LL + static_cast<int64_t>(i) * 10000000LL;
+            record.levels[i].bid_sz = i == 0 ? sizes[r] : 100;
+            record.levels[i].ask_sz = 100;
+        }
+        out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    return out;
+}
+
+bool sameStore(const SnapshotStore& a, const SnapshotStore& b) {
+    return a.bid_px == b.bid_px && a.ask_px == b.ask_px && a.bid_sz == b.bid_sz && a.ask_sz == b.ask_sz &&
+           a.ts_ns == b.ts_ns && a.day == b.day && a.days == b.days;
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// Engines against the reference
+// ---------------------------------------------------------------------------
+
+OB_TEST(engines_match_reference_full_depth) {
+    SyntheticBookSpec spec;
+    spec.rows = 5000;
+    checkEnginesAgainstReference("full depth", obtest::generateBooks(spec).store, OrderSizeGrid{10, 500});
+}
+
+OB_TEST(engines_match_reference_shallow_books) {
+    // 0-4 visible levels per side: empty sides, and most large sizes only partially filled
+    SyntheticBookSpec spec;
+    spec.rows = 5000;
+    spec.min_levels = 0;
+    spec.max_levels = 4;
+    spec.max_size = 150;
+    spec.seed = 11;
+    checkEnginesAgainstReference("shallow", obtest::generateBooks(spec).store, OrderSizeGrid{25, 2000});
+}
+
+OB_TEST(engines_match_reference_crossed_and_locked) {
+    SyntheticBookSpec spec;
+    spec.rows = 5000;
+    spec.crossed_fraction = 0.2;
+    spec.locked_fraction = 0.2;
+    spec.stale_fraction = 0.1;
+    spec.seed = 12;
+    const obtest::GeneratedBooks books = obtest::generateBooks(spec);
+    OB_CHECK(books.crossed > 0 && books.locked > 0);
+    checkEnginesAgainstReference("crossed/locked", books.store, OrderSizeGrid{10, 500});
+}
+
+OB_TEST(engines_match_reference_extreme_sizes) {
+    // Level sizes up to 2M shares at ~$20: int64 tick notionals stay well inside the fixed-point range
+    SyntheticBookSpec spec;
+    spec.rows = 2000;
+    spec.min_size = 100000;
+    spec.max_size = 2000000;
+    spec.base_price = 20.0;
+    spec.min_levels = 1;
+    spec.seed = 13;
+    checkEnginesAgainstReference("extreme sizes", obtest::generateBooks(spec).store, OrderSizeGrid{250000, 25000000});
+}
+
+OB_TEST(engines_match_reference_fine_grid) {
+    SyntheticBookSpec spec;
+    spec.rows = 1000;
+    spec.min_levels = 1;
+    spec.max_size = 120;
+    spec.seed = 14;
+    checkEnginesAgainstReference("fine grid", obtest::generateBooks(spec).store, OrderSizeGrid{1, 1000});
+}
+
+OB_TEST(partial_fill_policies_match_reference) {
+    SyntheticBookSpec spec;
+    spec.rows = 5000;
+    spec.min_levels = 0;
+    spec.max_levels = 5;
+    spec.max_size = 200;
+    spec.seed = 15;
+    const SnapshotStore store = obtest::generateBooks(spec).store;
+    const OrderSizeGrid grid{20, 1500};
+    for (PartialFillPolicy policy : {PartialFillPolicy::Average, PartialFillPolicy::Skip, PartialFillPolicy::Extrapolate}) {
+        const std::string name = policy == PartialFillPolicy::Skip ? "skip"
+                               : policy == PartialFillPolicy::Extrapolate ? "extrapolate" : "average";
+        const auto reference_buy = referenceCurve(store, Side::Buy, grid, policy);
+        const auto reference_sell = referenceCurve(store, Side::Sell, grid, policy);
+        const ImpactKernel kernel = impactKernelFor(ImpactEngine::CumulativeDepth, policy);
+        OB_CHECK_CURVES(name + " buy", reference_buy, obtest::kernelCurve(kernel, store, Side::Buy, grid), kTolerance);
+        OB_CHECK_CURVES(name + " sell", reference_sell, obtest::kernelCurve(kernel, store, Side::Sell, grid), kTolerance);
+    }
+    // No book is 1500 shares deep, so skip leaves the deepest sizes without any snapshot
+    const auto average = referenceCurve(store, Side::Buy, grid, PartialFillPolicy::Average);
+    const auto skip = referenceCurve(store, Side::Buy, grid, PartialFillPolicy::Skip);
+    OB_CHECK(skip.size() < average.size());
+
+    ImpactAccumulator buy(grid), sell(grid);
+    accumulateFusedPass<PartialFillPolicy::Extrapolate>(store, 0, store.size(), nullptr, buy, sell);
+    OB_CHECK_CURVES("fused extrapolate buy", referenceCurve(store, Side::Buy, grid, PartialFillPolicy::Extrapolate),
+                    buy.results(), kTolerance);
+    OB_CHECK_CURVES("fused extrapolate sell", referenceCurve(store, Side::Sell, grid, PartialFillPolicy::Extrapolate),
+                    sell.results(), kTolerance);
+}
+
+OB_TEST(extrapolation_prices_the_continued_ladder) {
+    // One row: asks 10.00 x 100, 10.02 x 300 -> mean size 200, step 0.02; a 700-share
+    // order fills 400 visible, then 200 @ 10.04 and 100 @ 10.06
+    SnapshotStore store;
+    const size_t row = store.addRow(1, store.addDay("2025-04-03"));
+    store.bid_px[row * kBookLevels] = 9.98;
+    store.bid_sz[row * kBookLevels] = 50;
+    store.ask_px[row * kBookLevels] = 10.00;
+    store.ask_sz[row * kBookLevels] = 100;
+    store.ask_px[row * kBookLevels + 1] = 10.02;
+    store.ask_sz[row * kBookLevels + 1] = 300;
+    const auto curve = referenceCurve(store, Side::Buy, OrderSizeGrid{700, 700}, PartialFillPolicy::Extrapolate);
+    OB_CHECK_EQ(curve.size(), size_t{1});
+    const double cost = 100 * 10.00 + 300 * 10.02 + 200 * 10.04 + 100 * 10.06;
+    const double expected = (cost / 700 - 9.99) / 9.99;
+    OB_CHECK(std::abs(curve[0].avg_impact - expected) <= 1e-12);
+}
+
+OB_TEST(cumulative_walk_handles_sizes_near_int_max) {
+    // Two 1.2B-share levels a side: the depth past the first level exceeds INT_MAX
+    SnapshotStore store;
+    const size_t row = store.addRow(1, store.addDay("2025-04-03"));
+    for (size_t i = 0; i < 2; ++i) {
+        store.bid_px[row * kBookLevels + i] = 9.99 - 0.01 * static_cast<double>(i);
+        store.bid_sz[row * kBookLevels + i] = 1200000000;
+        store.ask_px[row * kBookLevels + i] = 10.01 + 0.01 * static_cast<double>(i);
+        store.ask_sz[row * kBookLevels + i] = 1200000000;
+    }
+    const OrderSizeGrid grid{500000000, 1500000000};
+    for (PartialFillPolicy policy : {PartialFillPolicy::Average, PartialFillPolicy::Skip, PartialFillPolicy::Extrapolate}) {
+        const ImpactKernel kernel = impactKernelFor(ImpactEngine::CumulativeDepth, policy);
+        OB_CHECK_CURVES("near INT_MAX buy", referenceCurve(store, Side::Buy, grid, policy),
+                        obtest::kernelCurve(kernel, store, Side::Buy, grid), kTolerance);
+        OB_CHECK_CURVES("near INT_MAX sell", referenceCurve(store, Side::Sell, grid, policy),
+                        obtest::kernelCurve(kernel, store, Side::Sell, grid), kTolerance);
+    }
+    // 1.5B shares: 1.2B @ 10.01 and 0.3B @ 10.02
+    const auto curve = referenceCurve(store, Side::Buy, grid, PartialFillPolicy::Average);
+    OB_CHECK_EQ(curve.size(), size_t{3});
+    const double expected = ((1.2e9 * 10.01 + 0.3e9 * 10.02) / 1.5e9 - 10.0) / 10.0;
+    OB_CHECK(std::abs(curve[2].avg_impact - expected) <= 1e-12);
+}
+
+// ---------------------------------------------------------------------------
+// Book screening
+// ---------------------------------------------------------------------------
+
+OB_TEST(book_quality_matches_generated_conditions) {
+    SyntheticBookSpec spec;
+    spec.rows = 5000;
+    spec.min_levels = 0;
+    spec.crossed_fraction = 0.05;
+    spec.locked_fraction = 0.03;
+    spec.stale_fraction = 0.02;
+    spec.seed = 21;
+    const obtest::GeneratedBooks books = obtest::generateBooks(spec);
+    const SnapshotStore& store = books.store;
+    BookQuality quality;
+    BookQuality::Clock clock;
+    quality.scan(store, clock);
+    const BookQuality::Counts counts = quality.counts();
+    OB_CHECK_EQ(counts.crossed, books.crossed);
+    OB_CHECK_EQ(counts.locked, books.locked);
+    OB_CHECK_EQ(counts.stale, books.stale);
+    OB_CHECK_EQ(clock.latest_ts, *std::max_element(store.ts_ns.begin(), store.ts_ns.end()));
+
+    // Batches scanned with the carried clock and appended give the whole scan
+    SnapshotStore first, second;
+    for (size_t row = 0; row < store.size(); ++row) {
+        SnapshotStore& part = row < 1000 ? first : second;
+        part.copyRow(store, row, part.addDay(store.days[store.day[row]]));
+    }
+    BookQuality joined, rest;
+    BookQuality::Clock batch_clock;
+    joined.scan(first, batch_clock);
+    rest.scan(second, batch_clock);
+    joined.append(rest);
+    OB_CHECK(joined.crossed == quality.crossed && joined.locked == quality.locked && joined.stale == quality.stale);
+    OB_CHECK(joined.ask_depth == quality.ask_depth && joined.bid_levels == quality.bid_levels);
+
+    // A new day restarts the stale rule, in one store or across batches
+    SnapshotStore days;
+    const std::pair<const char*, int64_t> rows[] = {{"2025-04-03", 20}, {"2025-04-03", 10}, {"2025-04-04", 5}};
+    for (const auto& row : rows) {
+        days.copyRow(store, 0, days.addDay(row.first));
+        days.ts_ns.back() = row.second;
+    }
+    BookQuality by_day;
+    by_day.scan(days);
+    OB_CHECK_EQ(by_day.counts().stale, uint64_t{1});
+    OB_CHECK(BookQuality::test(by_day.stale, 1) && !BookQuality::test(by_day.stale, 2));
+
+    for (size_t row = 0; row < store.size(); ++row) {
+        size_t bids = 0, asks = 0;
+        int64_t bid_depth = 0, ask_depth = 0;
+        while (bids < kBookLevels && store.bidPrices(row)[bids] > 0 && store.bidSizes(row)[bids] > 0) {
+            bid_depth += store.bidSizes(row)[bids++];
+        }
+        while (asks < kBookLevels && store.askPrices(row)[asks] > 0 && store.askSizes(row)[asks] > 0) {
+            ask_depth += store.askSizes(row)[asks++];
+        }
+        OB_CHECK_EQ(static_cast<size_t>(quality.bid_levels[row]), bids);
+        OB_CHECK_EQ(static_cast<size_t>(quality.ask_levels[row]), asks);
+        OB_CHECK_EQ(quality.bid_depth[row], bid_depth);
+        OB_CHECK_EQ(quality.ask_depth[row], ask_depth);
+    }
+
+    const std::vector<size_t> kept = quality.rowsWithout(kBookCrossed | kBookLocked | kBookStale, store.size());
+    for (size_t row : kept) {
+        OB_CHECK(!BookQuality::test(quality.crossed, row));
+        OB_CHECK(!BookQuality::test(quality.locked, row));
+        OB_CHECK(!BookQuality::test(quality.stale, row));
+    }
+    OB_CHECK(books.flagged > 0);
+    OB_CHECK_EQ(static_cast<uint64_t>(kept.size()), store.size() - books.flagged);
+}
+
+// ---------------------------------------------------------------------------
+// Curve models against the reference
+// ---------------------------------------------------------------------------
+
+OB_TEST(piecewise_curve_matches_reference) {
+    SyntheticBookSpec spec;
+    spec.rows = 5000;
+    spec.min_levels = 0;
+    spec.max_levels = 6;
+    spec.max_size = 250;
+    spec.seed = 31;
+    SnapshotStore store = obtest::generateBooks(spec).store;
+    const OrderSizeGrid grid{15, 1800};
+    for (bool weighted : {false, true}) {
+        if (weighted) {
+            // Fractional weights, as --averaging=time gives: the +w/-w changes no longer cancel exactly
+            std::mt19937_64 rng(spec.seed);
+            std::uniform_real_distribution<double> seconds(0.0001, 3.7);
+            store.weight.resize(store.size());
+            for (double& w : store.weight) w = seconds(rng);
+        }
+        const std::string label = weighted ? "time-weighted " : "";
+        for (Side side : {Side::Buy, Side::Sell}) {
+            PiecewiseImpactCurve curve;
+            curve.add(store, 0, store.size(), side);
+            curve.finalize();
+            // impact_with_partial is the grid engines' value; impact is the mean over
+            // snapshots that fill the size, i.e. the skip policy. The reference walk
+            // ignores row weights, so weighted rows are checked against the cumulative
+            // kernel (itself checked against the reference above)
+            auto expected = [&](PartialFillPolicy policy) {
+                return weighted ? obtest::kernelCurve(impactKernelFor(ImpactEngine::CumulativeDepth, policy), store,
+                                                      side, grid)
+                                : referenceCurve(store, side, grid, policy);
+            };
+            const auto average = expected(PartialFillPolicy::Average);
+            const auto skip = expected(PartialFillPolicy::Skip);
+            std::vector<ImpactResult> with_partial, filled;
+            PiecewiseImpactCurve::Point point;
+            for (size_t k = 0; k < grid.points(); ++k) {
+                const int size = grid.orderSize(k);
+                OB_CHECK(curve.evaluate(size, point));
+                with_partial.push_back({size, point.impact_with_partial, point.impact_with_partial * 10000.0});
+                if (point.fill_fraction > 0) filled.push_back({size, point.impact, point.impact * 10000.0});
+            }
+            OB_CHECK_CURVES("piecewise " + label + "with partial " + sideName(side), average, with_partial, kTolerance);
+            OB_CHECK_CURVES("piecewise " + label + "filled " + sideName(side), skip, filled, kTolerance);
+
+            // Past every book's depth nothing fills, exactly
+            OB_CHECK(curve.evaluate(100000000, point));
+            OB_CHECK_EQ(point.fill_fraction, 0.0);
+            OB_CHECK(std::isnan(point.impact));
+        }
+    }
+}
+
+OB_TEST(surfaces_fill_in_the_curve_pass) {
+    // 40k rows 50 ms apart: 34 one-minute buckets, three chunks split mid-bucket
+    SyntheticBookSpec spec;
+    spec.rows = 40000;
+    spec.min_levels = 1;
+    spec.seed = 33;
+    SnapshotStore store = obtest::generateBooks(spec).store;
+    for (size_t row = 0; row < store.size(); ++row) {
+        store.ts_ns[row] = store.ts_ns.front() + static_cast<int64_t>(row) * 50000000LL;
+    }
+    AnalyzerOptions options;
+    options.threads = 3;
+    options.bucket_minutes = 1;
+    options.schedule_shares = 500;
+    const OrderSizeGrid grid{options.grid_step, options.max_shares};
+    OrderBookAnalyzer analyzer(".", options);
+    MarketStats stats;
+    ImpactAccumulator buy(grid), sell(grid);
+    ImpactSurface surface(grid, 1), schedule(grid, 1);
+    analyzer.reduceChunks(store, &stats, &buy, &sell, &surface, &schedule);
+    OB_CHECK_CURVES("surface pass buy", referenceCurve(store, Side::Buy, grid), buy.results(), kTolerance);
+    OB_CHECK_CURVES("surface pass sell", referenceCurve(store, Side::Sell, grid), sell.results(), kTolerance);
+
+    ImpactSurface expected(grid, 1), expected_schedule(grid, 1);
+    expected.add(store, 0, store.size(), analyzer.impactKernel(), obtest::serial);
+    expected_schedule.add(store, 0, store.size(), OrderBookAnalyzer::scheduleKernel(), obtest::serial);
+    OB_CHECK(surface.bucketIndices() == expected.bucketIndices());
+    OB_CHECK(schedule.bucketIndices() == expected.bucketIndices());
+    OB_CHECK(surface.buckets() > 30);
+    for (int64_t bucket : expected.bucketIndices()) {
+        for (Side side : {Side::Buy, Side::Sell}) {
+            const std::vector<double> want = expected.bucketCurve(bucket, side);
+            const std::vector<double> got = surface.bucketCurve(bucket, side);
+            const std::vector<double> want_schedule = expected_schedule.bucketCurve(bucket, side, 0.5);
+            const std::vector<double> got_schedule = schedule.bucketCurve(bucket, side, 0.5);
+            for (size_t k = 0; k < want.size(); ++k) {
+                OB_CHECK(std::abs(got[k] - want[k]) <= kTolerance * std::abs(want[k]));
+                OB_CHECK(std::isinf(got_schedule[k]) == std::isinf(want_schedule[k]));
+                if (std::isfinite(want_schedule[k])) {
+                    OB_CHECK(std::abs(got_schedule[k] - want_schedule[k]) <= kTolerance * std::abs(want_schedule[k]));
+                }
+            }
+        }
+    }
+}
+
+OB_TEST(distribution_columns_match_known_values) {
+    // Weighted moments: {1, 2, 3, 4} has mean 2.5 and population variance 1.25;
+    // 1 (weight 3) and 5 (weight 1) have mean 2 and variance 3
+    WeightedMoments unit, weighted, first_half, second_half;
+    for (double x : {1.0, 2.0, 3.0, 4.0}) unit.add(x, 1.0);
+    OB_CHECK(std::abs(unit.mean - 2.5) < 1e-15 && std::abs(unit.variance() - 1.25) < 1e-15);
+    weighted.add(1.0, 3.0);
+    weighted.add(5.0, 1.0);
+    OB_CHECK(std::abs(weighted.mean - 2.0) < 1e-15 && std::abs(weighted.variance() - 3.0) < 1e-15);
+    first_half.add(1.0, 1.0);
+    first_half.add(2.0, 1.0);
+    second_half.add(3.0, 1.0);
+    second_half.add(4.0, 1.0);
+    first_half.merge(second_half);
+    OB_CHECK(std::abs(first_half.mean - 2.5) < 1e-15 && std::abs(first_half.variance() - 1.25) < 1e-15);
+
+    // Quantiles within 1% of the exact rank statistic; a merge of any split is exact
+    QuantileSketch all, odd, even, negative, zeros;
+    for (int i = 1; i <= 1000; ++i) {
+        all.add(i * 1e-4, 1.0);
+        (i % 2 ? odd : even).add(i * 1e-4, 1.0);
+        negative.add(-i * 1e-4, 1.0);
+    }
+    auto near = [](double got, double want) { return std::abs(got - want) <= 0.0100001 * std::abs(want); };
+    OB_CHECK(near(all.quantile(0.50), 0.0501));
+    OB_CHECK(near(all.quantile(0.95), 0.0951));
+    OB_CHECK(near(all.quantile(0.99), 0.0991));
+    OB_CHECK(near(negative.quantile(0.05), -0.0950));
+    OB_CHECK(near(negative.quantile(0.50), -0.0500));
+    odd.merge(even);
+    for (double q : {0.01, 0.25, 0.5, 0.75, 0.95, 0.99}) OB_CHECK_EQ(odd.quantile(q), all.quantile(q));
+    zeros.add(0.0, 3.0);
+    zeros.add(0.01, 1.0);
+    OB_CHECK_EQ(zeros.quantile(0.5), 0.0);
+    OB_CHECK(near(zeros.quantile(0.9), 0.01));
+    OB_CHECK_EQ(QuantileSketch().quantile(0.5), 0.0);
+
+    // The accumulator's result columns, in bps
+    ImpactAccumulator acc(OrderSizeGrid{10, 20}, true);
+    for (double impact : {0.001, 0.002, 0.003, 0.004}) acc.add(0, impact, 1.0);
+    const std::vector<ImpactResult> results = acc.results();
+    OB_CHECK_EQ(results.size(), size_t{1});
+    OB_CHECK(std::abs(results[0].impact_bps - 25.0) < 1e-9);
+    OB_CHECK(std::abs(results[0].std_bps - std::sqrt(1.25e-6) * 10000.0) < 1e-9);
+    OB_CHECK(near(results[0].p50_bps, 30.0));
+    OB_CHECK(near(results[0].p99_bps, 40.0));
+
+    // Whole runs write the same columns whatever the threads or streaming
+    obtest::TempDir data("distribution");
+    writePinnedDay(data.path, "SYNA", 5000, "2025-04-03", 1);
+    writePinnedDay(data.path, "SYNA", 4000, "2025-04-04", 2);
+    auto runTo = [&](const std::string& name, int threads, bool streaming) {
+        AnalyzerOptions options;
+        options.distribution = true;
+        options.threads = threads;
+        options.streaming = streaming;
+        options.use_cache = false;
+        options.output_dir = (data.path / name).string();
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer(data.path.string(), options).run();
+        return readFile(data.path / name / "SYNA_buy_impact.csv");
+    };
+    const std::string serial = runTo("out_1", 1, false);
+    OB_CHECK(serial.find(",std_bps,p50_bps,p95_bps,p99_bps\n") < serial.find('\n') + 1);
+    OB_CHECK(runTo("out_3", 3, false) == serial);
+    OB_CHECK(runTo("out_stream", 2, true) == serial);
+}
+
+OB_TEST(impact_service_matches_reference) {
+    SyntheticBookSpec spec;
+    spec.rows = 6000;
+    spec.min_levels = 2;
+    spec.seed = 32;
+    const SnapshotStore store = obtest::generateBooks(spec).store;
+    AnalyzerOptions options;
+    options.threads = 1;
+    ImpactService service(".", options, 5);
+    // Two appends that split a bucket exercise the incremental prefix update
+    std::vector<size_t> first(store.size() / 2), second(store.size() - store.size() / 2);
+    std::iota(first.begin(), first.end(), size_t{0});
+    std::iota(second.begin(), second.end(), store.size() / 2);
+    SnapshotStore head = store, tail = store;
+    head.keepRows(first);
+    tail.keepRows(second);
+    service.appendSnapshots("GEN", head);
+    service.appendSnapshots("GEN", tail);
+    const OrderSizeGrid grid{options.grid_step, options.max_shares};
+    const int64_t from = store.ts_ns.front();
+    const int64_t to = store.ts_ns.back() + 1;
+    for (Side side : {Side::Buy, Side::Sell}) {
+        OB_CHECK_CURVES(std::string("service ") + sideName(side), referenceCurve(store, side, grid),
+                        service.curve("GEN", side, from, to), kTolerance);
+    }
+}
+
+OB_TEST(impact_service_skips_missing_symbols) {
+    // A mistyped symbol is reported on stderr; the service keeps answering
+    obtest::TempDir data("serve_missing");
+    writePinnedDay(data.path, "SYNA", 2000, "2025-04-03", 5);
+    fs::last_write_time(data.path / "SYNA" / "SYNA_2025-04-03 00_00_00+00_00.csv",
+                        fs::file_time_type::clock::now() - std::chrono::hours(1));
+    AnalyzerOptions options;
+    options.use_cache = false;
+    options.symbols = {"SYNA", "NOPE"};
+    ImpactService service(data.path.string(), options, 5);
+    obtest::QuietCout quiet;
+    OB_CHECK_EQ(service.refresh(), size_t{1});
+    std::istringstream in("refresh\nimpact SYNA buy 100\n");
+    std::ostringstream out;
+    serveImpactQueries(service, in, out);
+    OB_CHECK(out.str().rfind("ok files=0\nok impact_bps=", 0) == 0);
+}
+
+OB_TEST(impact_service_refresh_waits_for_settled_files) {
+    obtest::TempDir data("refresh");
+    const fs::path folder = data.path / "SYNE";
+    const auto age = [](const fs::path& path) {
+        fs::last_write_time(path, fs::file_time_type::clock::now() - std::chrono::hours(1));
+    };
+    writePinnedDay(data.path, "SYNE", 3000, "2025-04-03", 41);
+    age(folder / "SYNE_2025-04-03 00_00_00+00_00.csv");
+    AnalyzerOptions options;
+    options.use_cache = false;
+    ImpactService service(data.path.string(), options, 5);
+    const auto settle = std::chrono::milliseconds(400);
+    service.setSettleTime(settle);
+    obtest::QuietCout quiet;
+    OB_CHECK_EQ(service.refresh(), size_t{1});  // old files load on the first refresh
+    OB_CHECK_EQ(service.refresh(), size_t{0});
+
+    // A day file still being copied in: only its complete contents are folded
+    const fs::path full = data.path / "full.csv";
+    const fs::path landing = folder / "SYNE_2025-04-04 00_00_00+00_00.csv";
+    SyntheticBookSpec spec;
+    spec.rows = 4000;
+    spec.seed = 42;
+    spec.date = "2025-04-04";
+    writeSyntheticMbp10(full, spec);
+    const std::string contents = readFile(full);
+    std::ofstream(landing, std::ios::binary) << contents.substr(0, contents.size() / 2);
+    OB_CHECK_EQ(service.refresh(), size_t{0});
+    std::ofstream(landing, std::ios::binary) << contents;
+    OB_CHECK_EQ(service.refresh(), size_t{0});  // grew since the last refresh
+    OB_CHECK_EQ(service.refresh(), size_t{0});  // unchanged, but not for the settle time yet
+    std::this_thread::sleep_for(settle + std::chrono::milliseconds(100));
+    OB_CHECK_EQ(service.refresh(), size_t{1});
+    OB_CHECK_EQ(service.summaries().front().snapshots, uint64_t{7000});
+
+    // A file that fails to load is not recorded and is retried
+    const fs::path broken = folder / "SYNE_2025-04-07 00_00_00+00_00.csv";
+    std::ofstream(broken, std::ios::binary) << "DBN\x01\xff";  // DBN magic without metadata
+    age(broken);
+    OB_CHECK_EQ(service.refresh(), size_t{0});
+    spec.date = "2025-04-07";
+    writeSyntheticMbp10(broken, spec);
+    age(broken);
+    OB_CHECK_EQ(service.refresh(), size_t{1});
+    OB_CHECK_EQ(service.summaries().front().files, size_t{3});
+    OB_CHECK_EQ(service.summaries().front().snapshots, uint64_t{11000});
+
+    // A loaded file that is rewritten is re-loaded in place of its old contents
+    const fs::path first = folder / "SYNE_2025-04-03 00_00_00+00_00.csv";
+    writePinnedDay(data.path, "SYNE", 1000, "2025-04-03", 43);
+    age(first);
+    OB_CHECK_EQ(service.refresh(), size_t{1});
+    OB_CHECK_EQ(service.refresh(), size_t{0});
+    OB_CHECK_EQ(service.summaries().front().files, size_t{3});
+    OB_CHECK_EQ(service.summaries().front().snapshots, uint64_t{9000});
+    SnapshotStore expected;
+    for (const fs::path& path : {first, landing, broken}) {
+        OrderBookAnalyzer reader(data.path.string(), options);
+        int rows = 0;
+        OB_CHECK(reader.loadFile(path, expected, rows));
+    }
+    const OrderSizeGrid grid{options.grid_step, options.max_shares};
+    const int64_t from = *std::min_element(expected.ts_ns.begin(), expected.ts_ns.end());
+    const int64_t to = *std::max_element(expected.ts_ns.begin(), expected.ts_ns.end()) + 1;
+    for (Side side : {Side::Buy, Side::Sell}) {
+        OB_CHECK_CURVES(std::string("re-loaded service ") + sideName(side),
+                        obtest::kernelCurve(accumulateCumulativeDepthImpact, expected, side, grid),
+                        service.curve("SYNE", side, from, to), kTolerance);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Whole runs and loaders
+// ---------------------------------------------------------------------------
+
+OB_TEST(streaming_and_in_memory_runs_match_reference) {
+    obtest::TempDir data("runs");
+    writePinnedDay(data.path, "SYNA", 20000, "2025-04-03", 1);
+    writePinnedDay(data.path, "SYNA", 15000, "2025-04-04", 2, 4);
+    writePinnedDay(data.path, "SYNB", 25000, "2025-04-03", 3, 7);
+
+    struct Variant {
+        std::string name;
+        ImpactEngine engine;
+        bool streaming;
+    };
+    const Variant variants[] = {
+        {"reference", ImpactEngine::Reference, false},
+        {"cumulative", ImpactEngine::CumulativeDepth, false},
+        {"streaming", ImpactEngine::CumulativeDepth, true},
+        {"simd", ImpactEngine::Simd, false},
+        {"fixed", ImpactEngine::FixedPoint, true},
+    };
+    const std::string files[] = {"SYNA_buy_impact.csv", "SYNA_sell_impact.csv", "SYNB_buy_impact.csv",
+                                 "SYNB_sell_impact.csv"};
+    for (const Variant& variant : variants) {
+        AnalyzerOptions options;
+        options.engine = variant.engine;
+        options.streaming = variant.streaming;
+        options.use_cache = false;
+        options.threads = 2;
+        options.output_dir = (data.path / ("out_" + variant.name)).string();
+        {
+            obtest::QuietCout quiet;
+            OrderBookAnalyzer analyzer(data.path.string(), options);
+            analyzer.run();
+        }
+        // The curves are printed to 6 decimals, so every engine writes the reference's bytes
+        for (const std::string& file : files) {
+            const std::string written = readFile(fs::path(options.output_dir) / file);
+            OB_CHECK(written.find('\n') != written.rfind('\n'));  // header and at least one size
+            if (written != readFile(data.path / "out_reference" / file)) {
+                obtest::fail(__FILE__, __LINE__, variant.name + " " + file + " differs from the reference run");
+            }
+        }
+    }
+}
+
+OB_TEST(reservoir_is_drawn_while_rows_arrive) {
+    SyntheticBookSpec spec;
+    spec.rows = 5000;
+    spec.seed = 61;
+    const SnapshotStore store = obtest::generateBooks(spec).store;
+    for (size_t target : {size_t{700}, size_t{6000}}) {
+        ReservoirSampler sampler(target, 0);
+        for (size_t first = 0; first < store.size(); first += 333) {
+            SnapshotStore batch;
+            for (size_t row = first; row < std::min(store.size(), first + 333); ++row) {
+                batch.copyRow(store, row, batch.addDay(store.days[store.day[row]]));
+            }
+            sampler.add(batch);
+        }
+        SnapshotStore whole = store;
+        whole.keepRows(sampleReservoir(store.size(), target, 0));
+        OB_CHECK_EQ(sampler.rowsSeen(), store.size());
+        OB_CHECK(sameStore(sampler.take(), whole));
+    }
+
+    // Streaming and in-memory runs keep the same sample, so write the same curves
+    obtest::TempDir data("reservoir");
+    writePinnedDay(data.path, "SYNA", 9000, "2025-04-03", 1);
+    writePinnedDay(data.path, "SYNA", 7000, "2025-04-04", 2);
+    writePinnedDay(data.path, "SYNA", 8000, "2025-04-07", 3);
+    for (bool streaming : {false, true}) {
+        AnalyzerOptions options;
+        options.ingest.mode = SamplingMode::Reservoir;
+        options.ingest.count = 5000;
+        options.ingest.seed = 0;
+        options.streaming = streaming;
+        options.use_cache = false;
+        options.threads = 2;
+        options.output_dir = (data.path / (streaming ? "out_streaming" : "out_memory")).string();
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer analyzer(data.path.string(), options);
+        analyzer.run();
+    }
+    for (const char* file : {"SYNA_buy_impact.csv", "SYNA_sell_impact.csv"}) {
+        const std::string written = readFile(data.path / "out_memory" / file);
+        OB_CHECK(written.find('\n') != written.rfind('\n'));
+        OB_CHECK(readFile(data.path / "out_streaming" / file) == written);
+    }
+}
+
+OB_TEST(excluded_books_match_between_streaming_and_in_memory_runs) {
+    // Crossed, locked and stale rows on every day. The streamed batches end
+    // inside each file, and with these seeds the first row of every batch is
+    // stale, so the stale rule must carry across batches (and restart per day)
+    obtest::TempDir data("exclude");
+    const char* dates[] = {"2025-04-03", "2025-04-04", "2025-04-07"};
+    fs::create_directories(data.path / "SYNA");
+    for (uint64_t day = 0; day < 3; ++day) {
+        SyntheticBookSpec spec;
+        spec.rows = kImpactChunkRows + 4000;
+        spec.min_levels = 1;
+        spec.crossed_fraction = 0.04;
+        spec.locked_fraction = 0.03;
+        spec.stale_fraction = 0.25;
+        spec.seed = 42 + day;
+        spec.date = dates[day];
+        writeSyntheticMbp10(data.path / "SYNA" / ("SYNA_" + spec.date + " 00_00_00+00_00.csv"), spec);
+    }
+    auto runTo = [&](const std::string& name, bool streaming, uint8_t exclude) {
+        AnalyzerOptions options;
+        options.streaming = streaming;
+        options.exclude_books = exclude;
+        options.use_cache = false;
+        options.threads = 2;
+        options.output_dir = (data.path / name).string();
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer(data.path.string(), options).run();
+    };
+    const uint8_t all = kBookCrossed | kBookLocked | kBookStale;
+    runTo("out_memory", false, all);
+    runTo("out_streaming", true, all);
+    runTo("out_kept", false, 0);
+    for (const char* file : {"SYNA_buy_impact.csv", "SYNA_sell_impact.csv"}) {
+        const std::string written = readFile(data.path / "out_memory" / file);
+        OB_CHECK(written.find('\n') != written.rfind('\n'));
+        OB_CHECK(readFile(data.path / "out_streaming" / file) == written);
+        OB_CHECK(readFile(data.path / "out_kept" / file) != written);
+    }
+}
+
+OB_TEST(discovery_skips_output_and_unnamed_folders) {
+    obtest::TempDir data("discover");
+    writePinnedDay(data.path, "SYNA", 100, "2025-04-03", 1);
+    writePinnedDay(data.path, "SYNB", 100, "2025-04-03", 2);
+    fs::create_directories(data.path / "results");
+    std::ofstream(data.path / "results" / "SYNA_buy_impact.csv") << "order_size,avg_impact_bps\n";
+    fs::create_directories(data.path / "notes");
+    std::ofstream(data.path / "notes" / "SYNA_2025-04-03.csv") << "\n";  // not named for its folder
+
+    AnalyzerOptions options;
+    OrderBookAnalyzer plain(data.path.string(), options);
+    OB_CHECK(plain.discoverSymbols() == std::vector<std::string>({"SYNA", "SYNB"}));
+
+    // Output folders are skipped even when their files look like day files
+    std::ofstream(data.path / "results" / "results_2025-04-03.csv") << "\n";
+    OB_CHECK(plain.discoverSymbols() == std::vector<std::string>({"SYNA", "SYNB", "results"}));
+    options.output_dir = (data.path / "results").string();
+    OrderBookAnalyzer writing(data.path.string(), options);
+    OB_CHECK(writing.discoverSymbols() == std::vector<std::string>({"SYNA", "SYNB"}));
+
+    // A mistyped --symbols entry fails the run before anything is written
+    options.symbols = {"SYNA", "SYNX"};
+    options.use_cache = false;
+    bool failed = false;
+    try {
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer(data.path.string(), options).run();
+    } catch (const std::runtime_error&) {
+        failed = true;
+    }
+    OB_CHECK(failed);
+    OB_CHECK(!fs::exists(data.path / "results" / "SYNA_sell_impact.csv"));
+}
+
+OB_TEST(sharded_runs_reduce_only_when_complete) {
+    // SYNB has one day, so two of the three shards hold none of it
+    obtest::TempDir data("shards");
+    writePinnedDay(data.path, "SYNA", 6000, "2025-04-03", 1);
+    writePinnedDay(data.path, "SYNA", 5000, "2025-04-04", 2);
+    writePinnedDay(data.path, "SYNA", 4000, "2025-04-07", 3);
+    writePinnedDay(data.path, "SYNB", 5000, "2025-04-03", 4);
+    const fs::path parts = data.path / "parts";
+    AnalyzerOptions options;
+    options.use_cache = false;
+    options.threads = 2;
+    for (int shard = 0; shard < 3; ++shard) {
+        AnalyzerOptions worker = options;
+        worker.symbols = {"SYNA", "SYNB"};
+        worker.partials_dir = parts.string();
+        worker.shard_index = shard;
+        worker.shard_count = 3;
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer(data.path.string(), worker).run();
+    }
+    for (const char* symbol : {"SYNA", "SYNB"}) {
+        for (int shard = 0; shard < 3; ++shard) {
+            OB_CHECK(fs::exists(parts / (std::string(symbol) + ".shard-" + std::to_string(shard) + "-of-3.obpart")));
+        }
+    }
+
+    AnalyzerOptions whole = options;
+    whole.symbols = {"SYNA", "SYNB"};
+    whole.output_dir = (data.path / "out_whole").string();
+    AnalyzerOptions reduce = options;
+    reduce.output_dir = (data.path / "out_reduce").string();
+    {
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer(data.path.string(), whole).run();
+        OrderBookAnalyzer(data.path.string(), reduce).reducePartials(parts.string());
+    }
+    for (const char* file : {"SYNA_buy_impact.csv", "SYNA_sell_impact.csv", "SYNB_buy_impact.csv", "SYNB_sell_impact.csv"}) {
+        OB_CHECK(readFile(fs::path(reduce.output_dir) / file) == readFile(fs::path(whole.output_dir) / file));
+    }
+
+    // A lost worker output fails the reduce, even for a shard that had no days
+    fs::remove(parts / "SYNB.shard-1-of-3.obpart");
+    bool failed = false;
+    try {
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer(data.path.string(), reduce).reducePartials(parts.string());
+    } catch (const std::runtime_error&) {
+        failed = true;
+    }
+    OB_CHECK(failed);
+}
+
+OB_TEST(batch_runs_match_serial_runs) {
+    obtest::TempDir data("batch");
+    writePinnedDay(data.path, "SYNA", 6000, "2025-04-03", 1);
+    writePinnedDay(data.path, "SYNA", 4000, "2025-04-04", 2);
+    writePinnedDay(data.path, "SYNB", 5000, "2025-04-03", 3);
+    writePinnedDay(data.path, "SYNC", 3000, "2025-04-03", 4, 4);
+    AnalyzerOptions serial;
+    serial.use_cache = false;
+    serial.threads = 2;
+    serial.output_dir = (data.path / "out_serial").string();
+    AnalyzerOptions batch = serial;
+    batch.batch = true;
+    batch.numa_nodes = 2;  // two node groups, whatever this host has
+    batch.output_dir = (data.path / "out_batch").string();
+    {
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer(data.path.string(), serial).run();
+        OrderBookAnalyzer(data.path.string(), batch).run();
+    }
+    for (const char* symbol : {"SYNA", "SYNB", "SYNC"}) {
+        for (const char* side : {"_buy_impact.csv", "_sell_impact.csv"}) {
+            const std::string file = std::string(symbol) + side;
+            const std::string written = readFile(fs::path(serial.output_dir) / file);
+            OB_CHECK(written.find('\n') != written.rfind('\n'));
+            OB_CHECK(readFile(fs::path(batch.output_dir) / file) == written);
+        }
+    }
+}
+
+OB_TEST(loaders_produce_identical_stores) {
+    obtest::TempDir data("loaders");
+    writePinnedDay(data.path, "SYNC", 8000, "2025-04-03", 5, 6);
+    writePinnedDay(data.path, "SYNC", 8000, "2025-04-04", 6);
+
+    auto load = [&](LoaderMode mode, bool cache) {
+        AnalyzerOptions options;
+        options.loader = mode;
+        options.use_cache = cache;
+        options.cache_dir = (data.path / "cache").string();
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer analyzer(data.path.string(), options);
+        OB_CHECK(analyzer.loadData("SYNC"));
+        return *analyzer.getSnapshots("SYNC");
+    };
+    const SnapshotStore mapped = load(LoaderMode::Mapped, false);
+    OB_CHECK_EQ(mapped.size(), size_t{16000});
+    OB_CHECK(sameStore(mapped, load(LoaderMode::Stream, false)));
+    OB_CHECK(sameStore(mapped, load(LoaderMode::Mapped, true)));  // writes the cache
+    OB_CHECK(sameStore(mapped, load(LoaderMode::Mapped, true)));  // reads it back
+
+    // Without --cache-dir the cache goes next to the results, never into the data folder
+    obtest::TempDir out("loaders_out");
+    AnalyzerOptions options;
+    options.output_dir = out.path.string();
+    {
+        obtest::QuietCout quiet;
+        OrderBookAnalyzer analyzer(data.path.string(), options);
+        OB_CHECK(analyzer.loadData("SYNC"));
+    }
+    size_t caches = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(out.path / ".snapshot_cache")) {
+        caches += entry.path().extension() == ".obsc";
+    }
+    OB_CHECK_EQ(caches, size_t{2});
+    OB_CHECK(!fs::exists(data.path / ".snapshot_cache"));
+    for (const auto& entry : fs::directory_iterator(data.path / "SYNC")) OB_CHECK(isDayFile(entry.path()));
+}
+
+OB_TEST(event_feeds_rebuild_known_books) {
+    using Levels = std::vector<std::pair<double, int>>;
+    struct Book {
+        Levels bids, asks;
+    };
+    auto checkRow = [](const SnapshotStore& store, size_t row, const Book& book) {
+        for (size_t i = 0; i < kBookLevels; ++i) {
+            const std::pair<double, int> none{0.0, 0};
+            const auto bid = i < book.bids.size() ? book.bids[i] : none;
+            const auto ask = i < book.asks.size() ? book.asks[i] : none;
+            OB_CHECK(std::abs(store.bidPrices(row)[i] - bid.first) < 1e-9 && store.bidSizes(row)[i] == bid.second);
+            OB_CHECK(std::abs(store.askPrices(row)[i] - ask.first) < 1e-9 && store.askSizes(row)[i] == ask.second);
+        }
+    };
+
+    // Deeper than kBookLevels: the top ten levels come out best first
+    IncrementalBook deep;
+    for (int i = 0; i < 12; ++i) {
+        deep.apply('A', 'B', (1000 + i) * 10000000LL, 10 + i, static_cast<uint64_t>(i));
+        deep.apply('A', 'A', (1100 - i) * 10000000LL, 20 + i, static_cast<uint64_t>(100 + i));
+    }
+    SnapshotStore top;
+    const size_t top_row = top.addRow(0, top.addDay("2025-04-03"));
+    deep.writeTop(top.bid_px.data(), top.bid_sz.data(), top.ask_px.data(), top.ask_sz.data());
+    Book deep_book;
+    for (int i = 0; i < 10; ++i) {
+        deep_book.bids.emplace_back((1011 - i) * 0.01, 21 - i);
+        deep_book.asks.emplace_back((1089 + i) * 0.01, 31 - i);
+    }
+    checkRow(top, top_row, deep_book);
+
+    obtest::TempDir data("events");
+    fs::create_directories(data.path / "SYNM");
+    const fs::path mbo = data.path / "SYNM" / "SYNM_2025-04-03 00_00_00+00_00.csv";
+    {
+        std::ofstream out(mbo, std::ios::binary);
+        out << "ts_recv,ts_event,rtype,publisher_id,instrument_id,action,side,price,size,channel_id,order_id,flags,"
+               "ts_in_delta,sequence,symbol\n";
+        int second = 0;  // one event per second
+        auto event = [&](char action, char side, const char* price, int size, int id, int flags) {
+            char ts[32];
+            std::snprintf(ts, sizeof(ts), "2025-04-03T13:30:%02dZ", second++);
+            out << ts << "," << ts << ",160,2,1," << action << "," << side << "," << price << "," << size << ",0," << id
+                << "," << flags << ",0,0,SYNM\n";
+        };
+        event('A', 'B', "10.00", 100, 1, 0);      // mid-batch: no snapshot
+        event('A', 'A', "10.02", 50, 2, 128);     // snapshot 0
+        event('A', 'B', "10.01", 30, 3, 0);
+        event('A', 'A', "10.02", 25, 4, 128);     // snapshot 1: same-price orders aggregate
+        event('C', 'B', "10.01", 10, 3, 128);     // snapshot 2: partial cancel
+        event('M', 'A', "10.03", 40, 2, 128);     // snapshot 3: modify moves the order
+        event('T', 'B', "10.02", 5, 9, 128);      // snapshot 4: trades leave the book alone
+        event('C', 'A', "10.02", 25, 4, 0);
+        event('R', 'N', "", 0, 0, 128);           // cleared: empty book, no snapshot
+        event('A', 'B', "9.99", 10, 5, 0);
+        event('A', 'A', "10.05", 10, 6, 128);     // snapshot 5
+    }
+    AnalyzerOptions options;
+    options.use_cache = false;
+    OrderBookAnalyzer loader(data.path.string(), options);
+    SnapshotStore events;
+    int rows = 0;
+    {
+        obtest::QuietCout quiet;
+        OB_CHECK(loader.loadFile(mbo, events, rows));
+    }
+    const Book expected[] = {
+        {{{10.00, 100}}, {{10.02, 50}}},
+        {{{10.01, 30}, {10.00, 100}}, {{10.02, 75}}},
+        {{{10.01, 20}, {10.00, 100}}, {{10.02, 75}}},
+        {{{10.01, 20}, {10.00, 100}}, {{10.02, 25}, {10.03, 40}}},
+        {{{10.01, 20}, {10.00, 100}}, {{10.02, 25}, {10.03, 40}}},
+        {{{9.99, 10}}, {{10.05, 10}}},
+    };
+    OB_CHECK_EQ(events.size(), size_t{6});
+    const int seconds[] = {1, 3, 4, 5, 6, 10};
+    for (size_t row = 0; row < events.size(); ++row) {
+        checkRow(events, row, expected[row]);
+        OB_CHECK_EQ(events.ts_ns[row], 1743687000LL * 1000000000LL + seconds[row] * 1000000000LL);
+    }
+
+    // MBP-1: one snapshot per row with a two-sided top of book, deeper levels empty
+    const fs::path mbp1 = data.path / "SYNM" / "SYNM_2025-04-04 00_00_00+00_00.csv";
+    {
+        std::ofstream out(mbp1, std::ios::binary);
+        out << "ts_recv,ts_event,rtype,publisher_id,instrument_id,action,side,depth,price,size,flags,ts_in_delta,"
+               "sequence,bid_px_00,ask_px_00,bid_sz_00,ask_sz_00,bid_ct_00,ask_ct_00,symbol\n"
+               "2025-04-04T13:30:00Z,2025-04-04T13:30:00Z,1,2,1,A,B,0,20.00,5,128,0,0,20.00,20.03,5,7,1,1,SYNM\n"
+               "2025-04-04T13:30:01Z,2025-04-04T13:30:01Z,1,2,1,C,A,0,20.03,7,128,0,0,20.00,,5,0,1,0,SYNM\n"
+               "2025-04-04T13:30:02Z,2025-04-04T13:30:02Z,1,2,1,A,A,0,20.02,9,128,0,0,20.01,20.02,3,9,1,1,SYNM\n";
+    }
+    SnapshotStore tops;
+    rows = 0;
+    {
+        obtest::QuietCout quiet;
+        OB_CHECK(loader.loadFile(mbp1, tops, rows));
+    }
+    OB_CHECK_EQ(tops.size(), size_t{2});
+    checkRow(tops, 0, Book{{{20.00, 5}}, {{20.03, 7}}});
+    checkRow(tops, 1, Book{{{20.01, 3}}, {{20.02, 9}}});
+}
+
+OB_TEST(reservation_ignores_a_short_first_row) {
+    // A 1-byte first row (blank line) must not reserve a row per payload byte
+    const uint64_t payload = 1 << 20;
+    SnapshotStore store;
+    reserveForFile(store, payload, 1, ParseLimits());
+    OB_CHECK(store.ts_ns.capacity() <= payload / kMinRowBytes + payload / kMinRowBytes / 16 + 2);
+    SnapshotStore wide;
+    reserveForFile(wide, payload, 400, ParseLimits());
+    OB_CHECK(wide.ts_ns.capacity() >= payload / 400);
+}
+
+OB_TEST(dbn_sizes_beyond_int_are_rejected) {
+    obtest::TempDir data("dbn");
+    fs::create_directories(data.path / "SYNF");
+    std::ofstream(data.path / "SYNF" / "SYNF_2025-04-03 00_00_00+00_00.dbn", std::ios::binary)
+        << dbnStream({100, 0xFFFFFFFFu, 2147483647u, 2147483648u, 300});
+    AnalyzerOptions options;
+    options.use_cache = false;
+    obtest::QuietCout quiet;
+    OrderBookAnalyzer analyzer(data.path.string(), options);
+    OB_CHECK(analyzer.loadData("SYNF"));
+    const SnapshotStore& store = *analyzer.getSnapshots("SYNF");
+    OB_CHECK_EQ(store.size(), size_t{3});
+    OB_CHECK_EQ(store.bid_sz[0], 100);
+    OB_CHECK_EQ(store.bid_sz[kBookLevels], 2147483647);
+    OB_CHECK_EQ(store.bid_sz[2 * kBookLevels], 300);
+}
+
+OB_TEST(dbn_corrupt_record_headers_fail_the_file) {
+    obtest::TempDir data("dbn_corrupt");
+    std::string bytes = dbnStream(std::vector<uint32_t>(5, 100));
+    const size_t records = bytes.size() - 5 * sizeof(DbnMbp10Msg);
+    bytes[records + 2 * sizeof(DbnMbp10Msg)] = 0;  // third record claims a zero length
+    fs::create_directories(data.path / "SYNF");
+    std::ofstream(data.path / "SYNF" / "SYNF_2025-04-03 00_00_00+00_00.dbn", std::ios::binary) << bytes;
+    AnalyzerOptions options;
+    options.use_cache = false;
+    obtest::QuietCout quiet;
+    OrderBookAnalyzer analyzer(data.path.string(), options);
+    OB_CHECK(!analyzer.loadData("SYNF"));
+}
+
+#ifdef ORDER_BOOK_ANALYSIS_ZSTD
+OB_TEST(zstd_files_load_and_truncated_files_fail) {
+    obtest::TempDir data("zstd");
+    const fs::path csv = data.path / "plain.csv";
+    SyntheticBookSpec spec;
+    spec.rows = 5000;
+    spec.seed = 51;
+    writeSyntheticMbp10(csv, spec);
+    const std::vector<uint32_t> dbn_sizes(3000, 250);
+    auto compress = [](const std::string& bytes) {
+        std::string out(ZSTD_compressBound(bytes.size()), '\0');
+        out.resize(ZSTD_compress(&out[0], out.size(), bytes.data(), bytes.size(), 3));
+        return out;
+    };
+    const std::string csv_bytes = compress(readFile(csv));
+    const std::string dbn_bytes = compress(dbnStream(dbn_sizes));
+    const std::string name = "_2025-04-03 00_00_00+00_00";
+    auto write = [&](const std::string& symbol, const std::string& suffix, const std::string& bytes) {
+        fs::create_directories(data.path / symbol);
+        std::ofstream(data.path / symbol / (symbol + name + suffix), std::ios::binary) << bytes;
+    };
+    write("ZCSV", ".csv.zst", csv_bytes);
+    write("ZDBN", ".dbn.zst", dbn_bytes);
+    // Two frames back to back, as concatenated .zst files are
+    const std::string whole = dbnStream(dbn_sizes);
+    write("ZTWO", ".dbn.zst", compress(whole.substr(0, 100000)) + compress(whole.substr(100000)));
+    write("ZCUT", ".csv.zst", csv_bytes.substr(0, csv_bytes.size() - 64));
+    write("ZDCUT", ".dbn.zst", dbn_bytes.substr(0, dbn_bytes.size() / 2));
+    std::string corrupt = dbnStream(dbn_sizes);
+    corrupt[corrupt.size() - 10 * sizeof(DbnMbp10Msg)] = 0;  // a zero-length record header
+    write("ZDBAD", ".dbn.zst", compress(corrupt));
+
+    AnalyzerOptions options;
+    options.use_cache = false;
+    obtest::QuietCout quiet;
+    OrderBookAnalyzer analyzer(data.path.string(), options);
+    OB_CHECK(analyzer.loadData("ZCSV"));
+    OB_CHECK_EQ(analyzer.getSnapshots("ZCSV")->size(), spec.rows);
+    OB_CHECK(analyzer.loadData("ZDBN"));
+    OB_CHECK_EQ(analyzer.getSnapshots("ZDBN")->size(), dbn_sizes.size());
+    OB_CHECK(analyzer.loadData("ZTWO"));
+    OB_CHECK(sameStore(*analyzer.getSnapshots("ZDBN"), *analyzer.getSnapshots("ZTWO")));
+    OB_CHECK(!analyzer.loadData("ZCUT"));
+    OB_CHECK(!analyzer.loadData("ZDCUT"));
+    OB_CHECK(!analyzer.loadData("ZDBAD"));
+
+    fs::create_directories(data.path / "PLAIN");
+    fs::copy_file(csv, data.path / "PLAIN" / ("PLAIN" + name + ".csv"));
+    OB_CHECK(analyzer.loadData("PLAIN"));
+    SnapshotStore plain = *analyzer.getSnapshots("PLAIN");
+    OB_CHECK(sameStore(plain, *analyzer.getSnapshots("ZCSV")));
+}
+#endif
+
+OB_TEST(prefetch_discards_unclaimed_files) {
+    obtest::TempDir data("prefetch");
+    std::vector<std::pair<fs::path, fs::path>> files;
+    for (const char* name : {"a.csv", "b.csv", "c.csv"}) {
+        std::ofstream(data.path / name) << std::string(1 << 16, 'x');
+        files.emplace_back(data.path / name, data.path / name);
+    }
+    auto finished = [](const Prefetcher& prefetcher) {
+        const PrefetchCounters counters = prefetcher.counters();
+        return counters.files_read + counters.files_resident;
+    };
+    auto waitFor = [&](const Prefetcher& prefetcher, uint64_t files_done) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (finished(prefetcher) < files_done && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return finished(prefetcher) >= files_done;
+    };
+
+    // A one-byte window holds one file: the reader stops after a.csv until it leaves
+    Prefetcher prefetcher(files, 1);
+    OB_CHECK(waitFor(prefetcher, 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    OB_CHECK_EQ(finished(prefetcher), 1u);
+    prefetcher.discard({data.path / "a.csv"});
+    OB_CHECK(waitFor(prefetcher, 2));
+    { Prefetcher::Lease lease = prefetcher.acquire(data.path / "b.csv"); }
+    OB_CHECK(waitFor(prefetcher, 3));
+}
+
+OB_TEST(columnar_files_round_trip) {
+    // Pins the .obcol layout that create_cpp_charts.py reads
+    obtest::TempDir out("obcol");
+    const fs::path path = out.path / "round_trip.obcol";
+    const std::vector<int64_t> keys = {1743687000000000000LL, 1743687000000000100LL, 5, -7, 0, 300, 300};
+    const std::vector<double> values = {0.5, -1.25, 1e-300, 3.0, -0.0, 42.0, 7.75};
+    {
+        ColumnarWriter writer(path.string(), 3);
+        writer.setMetadata("symbol", "SYNA");
+        writer.setMetadata("side", "buy");
+        const size_t key_col = writer.addColumn("ts_ns", ColumnarWriter::Encoding::DeltaInt64);
+        const size_t value_col = writer.addColumn("avg_impact", ColumnarWriter::Encoding::Float64);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            writer.append(key_col, keys[i]);
+            writer.append(value_col, values[i]);
+            writer.endRow();
+        }
+        OB_CHECK(writer.finish());
+    }
+    OB_CHECK_EQ(static_cast<size_t>(std::distance(fs::directory_iterator(out.path), fs::directory_iterator())), size_t{1});
+
+    const std::string bytes = readFile(path);
+    size_t cursor = 0;
+    auto read = [&](auto& value) {
+        OB_CHECK(cursor + sizeof(value) <= bytes.size());
+        std::memcpy(&value, bytes.data() + cursor, sizeof(value));
+        cursor += sizeof(value);
+    };
+    auto text = [&](size_t length) {
+        OB_CHECK(cursor + length <= bytes.size());
+        cursor += length;
+        return bytes.substr(cursor - length, length);
+    };
+    OB_CHECK(bytes.size() >= 80);
+    OB_CHECK(bytes.compare(0, 8, std::string("OBCOL\0\0\0", 8)) == 0);
+    OB_CHECK(bytes.compare(bytes.size() - 8, 8, "OBCOLEND") == 0);
+    uint64_t footer = 0;
+    cursor = bytes.size() - 16;
+    read(footer);
+
+    cursor = footer;
+    uint32_t version = 0, column_count = 0, group_count = 0, metadata_count = 0;
+    uint64_t rows = 0;
+    read(version);
+    read(column_count);
+    read(rows);
+    read(group_count);
+    read(metadata_count);
+    OB_CHECK_EQ(version, ColumnarWriter::kVersion);
+    OB_CHECK_EQ(column_count, uint32_t{2});
+    OB_CHECK_EQ(rows, uint64_t{7});
+    OB_CHECK_EQ(group_count, uint32_t{3});
+    OB_CHECK_EQ(metadata_count, uint32_t{2});
+    const std::pair<std::string, uint8_t> schema[] = {{"ts_ns", 1}, {"avg_impact", 0}};
+    for (const auto& column : schema) {
+        uint8_t encoding = 9, reserved = 9;
+        uint16_t length = 0;
+        read(encoding);
+        read(reserved);
+        read(length);
+        OB_CHECK_EQ(static_cast<int>(encoding), static_cast<int>(column.second));
+        OB_CHECK_EQ(static_cast<int>(reserved), 0);
+        OB_CHECK_EQ(text(length), column.first);
+    }
+    const std::pair<std::string, std::string> metadata[] = {{"symbol", "SYNA"}, {"side", "buy"}};
+    for (const auto& entry : metadata) {
+        uint16_t key_length = 0;
+        uint32_t value_length = 0;
+        read(key_length);
+        OB_CHECK_EQ(text(key_length), entry.first);
+        read(value_length);
+        OB_CHECK_EQ(text(value_length), entry.second);
+    }
+
+    std::vector<int64_t> read_keys;
+    std::vector<double> read_values;
+    for (uint32_t g = 0; g < group_count; ++g) {
+        uint64_t group_rows = 0, key_offset = 0, key_bytes = 0, value_offset = 0, value_bytes = 0;
+        read(group_rows);
+        read(key_offset);
+        read(key_bytes);
+        read(value_offset);
+        read(value_bytes);
+        OB_CHECK_EQ(group_rows, uint64_t{g < 2 ? 3u : 1u});
+        OB_CHECK(key_offset % 64 == 0 && value_offset % 64 == 0);
+        OB_CHECK(key_offset + key_bytes <= value_offset && value_offset + value_bytes <= footer);
+        OB_CHECK_EQ(value_bytes, group_rows * sizeof(double));
+        int64_t previous = 0;
+        size_t at = key_offset;
+        for (uint64_t r = 0; r < group_rows; ++r) {
+            uint64_t zigzag = 0;
+            for (int shift = 0;; shift += 7) {
+                const uint8_t byte = static_cast<uint8_t>(bytes[at++]);
+                zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) break;
+            }
+            const uint64_t delta = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+            previous = static_cast<int64_t>(static_cast<uint64_t>(previous) + delta);
+            read_keys.push_back(previous);
+            double value = 0;
+            std::memcpy(&value, bytes.data() + value_offset + r * sizeof(double), sizeof(double));
+            read_values.push_back(value);
+        }
+        OB_CHECK_EQ(at, key_offset + key_bytes);
+    }
+    OB_CHECK_EQ(cursor, bytes.size() - 16);
+    OB_CHECK(read_keys == keys);
+    OB_CHECK(std::memcmp(read_values.data(), values.data(), values.size() * sizeof(double)) == 0);
+}
+
+// ---------------------------------------------------------------------------
+// Execution schedules
+// ---------------------------------------------------------------------------
+
+OB_TEST(analyzer_rejects_empty_grids) {
+    for (std::pair<int, int> grid : {std::make_pair(0, 1000), std::make_pair(-10, 1000), std::make_pair(100, 50)}) {
+        AnalyzerOptions options;
+        options.grid_step = grid.first;
+        options.max_shares = grid.second;
+        bool rejected = false;
+        try {
+            OrderBookAnalyzer analyzer(".", options);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        OB_CHECK(rejected);
+    }
+}
+
+OB_TEST(schedule_respects_visible_depth) {
+    // 13:30 bucket: asks 100 @ 10.00 and 100 @ 10.02 (200 shares deep);
+    // 14:00 bucket: 10 ask levels of 1000 shares
+    SnapshotStore store;
+    const uint16_t day = store.addDay("2025-04-03");
+    const int64_t open_ns = 1743687000LL * 1000000000LL;
+    for (int64_t bucket = 0; bucket < 2; ++bucket) {
+        for (int64_t i = 0; i < 10; ++i) {
+            const size_t row = store.addRow(open_ns + bucket * 1800 * 1000000000LL + i * 1000000000LL, day);
+            store.bid_px[row * kBookLevels] = 9.98;
+            store.bid_sz[row * kBookLevels] = 5000;
+            const size_t levels = bucket == 0 ? 2 : kBookLevels;
+            for (size_t level = 0; level < levels; ++level) {
+                store.ask_px[row * kBookLevels + level] = 10.00 + 0.02 * static_cast<double>(level);
+                store.ask_sz[row * kBookLevels + level] = bucket == 0 ? 100 : 1000;
+            }
+        }
+    }
+    const OrderSizeGrid grid{100, 1000};
+    ImpactSurface surface(grid, 30);
+    surface.add(store, 0, store.size(), OrderBookAnalyzer::scheduleKernel(), obtest::serial);
+    OB_CHECK_EQ(surface.buckets(), size_t{2});
+
+    const std::vector<double> shallow = surface.bucketCurve(surface.bucketIndices()[0], Side::Buy);
+    OB_CHECK(std::isfinite(shallow[1]));  // 200 shares fill
+    for (size_t k = 2; k < shallow.size(); ++k) OB_CHECK(std::isinf(shallow[k]));
+
+    const ExecutionSolver solver = ExecutionSolver::fromSurface(surface, Side::Buy);
+    const ExecutionSolver::Schedule schedule = solver.solve(1000);
+    OB_CHECK(schedule.feasible);
+    OB_CHECK_EQ(schedule.shares.size(), size_t{2});
+    OB_CHECK(schedule.shares[0] <= 200);
+    OB_CHECK_EQ(schedule.shares[0] + schedule.shares[1], 1000);
+
+    // Only the shallow bucket: 500 shares cannot be placed
+    SnapshotStore first = store;
+    std::vector<size_t> rows(10);
+    std::iota(rows.begin(), rows.end(), size_t{0});
+    first.keepRows(rows);
+    ImpactSurface shallow_only(grid, 30);
+    shallow_only.add(first, 0, first.size(), OrderBookAnalyzer::scheduleKernel(), obtest::serial);
+    OB_CHECK(!ExecutionSolver::fromSurface(shallow_only, Side::Buy).solve(500).feasible);
+    OB_CHECK(ExecutionSolver::fromSurface(shallow_only, Side::Buy).solve(200).feasible);
+}
+
+OB_TEST(schedule_ignores_rare_deep_books) {
+    // 13:30 bucket: 9 of 10 books hold 100 asks @ 10.00, one holds 10 levels of
+    // 1000 from 10.00; 14:00 bucket: every book holds 10 levels of 1000 from 10.03
+    SnapshotStore store;
+    const uint16_t day = store.addDay("2025-04-03");
+    const int64_t open_ns = 1743687000LL * 1000000000LL;
+    for (int64_t bucket = 0; bucket < 2; ++bucket) {
+        for (int64_t i = 0; i < 10; ++i) {
+            const size_t row = store.addRow(open_ns + bucket * 1800 * 1000000000LL + i * 1000000000LL, day);
+            store.bid_px[row * kBookLevels] = 9.98;
+            store.bid_sz[row * kBookLevels] = 5000;
+            const bool deep = bucket == 1 || i == 4;
+            for (size_t level = 0; level < (deep ? kBookLevels : 1); ++level) {
+                store.ask_px[row * kBookLevels + level] = (bucket == 0 ? 10.00 : 10.03) + 0.01 * static_cast<double>(level);
+                store.ask_sz[row * kBookLevels + level] = deep ? 1000 : 100;
+            }
+        }
+    }
+    ImpactSurface surface(OrderSizeGrid{100, 1000}, 30);
+    surface.add(store, 0, store.size(), OrderBookAnalyzer::scheduleKernel(), obtest::serial);
+
+    // Averaged over the books that fill, the one deep book makes 1000 shares look cheapest at 13:30
+    const ExecutionSolver::Schedule survivors = ExecutionSolver::fromSurface(surface, Side::Buy).solve(1000);
+    OB_CHECK(survivors.feasible);
+    OB_CHECK_EQ(survivors.shares[0], 1000);
+
+    const ExecutionSolver::Schedule schedule = ExecutionSolver::fromSurface(surface, Side::Buy, 0.5).solve(1000);
+    OB_CHECK(schedule.feasible);
+    OB_CHECK_EQ(schedule.shares[0], 100);
+    OB_CHECK_EQ(schedule.shares[1], 900);
+    const std::vector<double> sparse = surface.bucketCurve(surface.bucketIndices()[0], Side::Buy, 0.5);
+    OB_CHECK(std::isfinite(sparse[0]));
+    for (size_t k = 1; k < sparse.size(); ++k) OB_CHECK(std::isinf(sparse[k]));
+}
+
+OB_TEST(schedule_run_respects_visible_depth) {
+    // One visible level of 1-400 shares in one bucket: with any filling book enough,
+    // 300 shares can be placed but 500 cannot; with half the books required to fill,
+    // 100 shares can (3 in 4 books) but 300 cannot (1 in 4). The same with the
+    // default (average) partial fills and in streaming runs alike
+    obtest::TempDir data("schedule");
+    writePinnedDay(data.path, "SYND", 5000, "2025-04-03", 8, 1);
+    struct Case {
+        double min_fill;
+        int shares;
+        bool feasible;
+    };
+    const Case cases[] = {{0.0, 300, true}, {0.0, 500, false}, {0.5, 100, true}, {0.5, 300, false}};
+    for (bool streaming : {false, true}) {
+        for (const Case& c : cases) {
+            AnalyzerOptions options;
+            options.streaming = streaming;
+            options.use_cache = false;
+            options.bucket_minutes = 30;
+            options.schedule_shares = c.shares;
+            options.schedule_min_fill = c.min_fill;
+            options.grid_step = 100;
+            options.max_shares = 500;
+            options.output_dir = (data.path / ("out_" + std::to_string(c.shares) + "_" + std::to_string(c.min_fill) +
+                                               (streaming ? "s" : ""))).string();
+            {
+                obtest::QuietCout quiet;
+                OrderBookAnalyzer analyzer(data.path.string(), options);
+                analyzer.run();
+            }
+            const fs::path schedule = fs::path(options.output_dir) / "SYND_buy_schedule.csv";
+            OB_CHECK_EQ(fs::exists(schedule), c.feasible);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Live path
+// ---------------------------------------------------------------------------
+
+OB_TEST(spsc_ring_wraps_and_reports_full_and_empty) {
+    SpscRing<int, 4> ring;
+    int value = -1;
+    OB_CHECK(!ring.tryPop(value));
+    // Three laps of partial fills move the indices across the slot boundary many times
+    int pushed = 0, popped = 0;
+    for (int lap = 0; lap < 3; ++lap) {
+        while (ring.tryPush(pushed)) ++pushed;
+        OB_CHECK_EQ(pushed - popped, 4);
+        for (int i = 0; i < 3; ++i) {
+            OB_CHECK(ring.tryPop(value));
+            OB_CHECK_EQ(value, popped++);
+        }
+        OB_CHECK(ring.tryPush(pushed++));
+        OB_CHECK(ring.tryPush(pushed++));
+        OB_CHECK(ring.tryPush(pushed++));
+        OB_CHECK(!ring.tryPush(pushed));
+    }
+    while (ring.tryPop(value)) OB_CHECK_EQ(value, popped++);
+    OB_CHECK_EQ(popped, pushed);
+    OB_CHECK(!ring.tryPop(value));
+
+    // One producer and one consumer thread: every value arrives once, in order
+    auto shared = std::make_unique<SpscRing<int, 64>>();
+    constexpr int kValues = 200000;
+    std::thread producer([&] {
+        for (int i = 0; i < kValues; ++i) {
+            while (!shared->tryPush(i)) std::this_thread::yield();
+        }
+    });
+    int expected = 0;
+    while (expected < kValues) {
+        if (!shared->tryPop(value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (value != expected) break;
+        ++expected;
+    }
+    producer.join();
+    OB_CHECK_EQ(expected, kValues);
+    OB_CHECK(!shared->tryPop(value));
+}
+
+OB_TEST(live_estimator_matches_decayed_walks) {
+    // A full book, a shallow ask side (large sizes at its full-depth VWAP), an
+    // empty bid side (no mid: both sides only decay) and a shallow full book
+    SnapshotStore store;
+    const uint16_t day = store.addDay("2025-04-03");
+    const int64_t open_ns = 1743687000LL * 1000000000LL;
+    const int64_t offsets[] = {0, 1000000000LL, 3000000000LL, 3500000000LL};
+    const size_t ask_levels[] = {kBookLevels, 2, kBookLevels, 3};
+    const size_t bid_levels[] = {kBookLevels, kBookLevels, 0, kBookLevels};
+    for (size_t r = 0; r < 4; ++r) {
+        const size_t row = store.addRow(open_ns + offsets[r], day);
+        for (size_t i = 0; i < kBookLevels; ++i) {
+            if (i < bid_levels[r]) {
+                store.bid_px[row * kBookLevels + i] = 10.00 - 0.01 * static_cast<double>(i + r);
+                store.bid_sz[row * kBookLevels + i] = 50 + 10 * static_cast<int>(i);
+            }
+            if (i < ask_levels[r]) {
+                store.ask_px[row * kBookLevels + i] = 10.01 + 0.01 * static_cast<double>(i + r);
+                store.ask_sz[row * kBookLevels + i] = 40 + 20 * static_cast<int>(r);
+            }
+        }
+    }
+    const OrderSizeGrid grid{25, 400};
+    const double half_life = 1.5;
+    LiveImpactEstimator estimator(grid, half_life);
+    estimator.start();
+    for (size_t row = 0; row < store.size(); ++row) OB_CHECK(estimator.publish(LiveBookUpdate::fromStore(store, row)));
+    estimator.stop();
+    OB_CHECK_EQ(estimator.report().updates, uint64_t{4});
+
+    for (Side side : {Side::Buy, Side::Sell}) {
+        std::vector<double> sum(grid.points(), 0.0), weight(grid.points(), 0.0);
+        for (size_t row = 0; row < store.size(); ++row) {
+            const double decay = row ? std::exp2(-static_cast<double>(offsets[row] - offsets[row - 1]) / 1e9 / half_life) : 1.0;
+            ImpactAccumulator acc(grid);
+            const double mid_price = store.midPrice(row);
+            if (mid_price > 0 && side == Side::Buy) walkSide<Side::Buy>(store, row, mid_price, acc);
+            if (mid_price > 0 && side == Side::Sell) walkSide<Side::Sell>(store, row, mid_price, acc);
+            for (size_t k = 0; k < grid.points(); ++k) {
+                sum[k] = sum[k] * decay + (acc.count[k] ? acc.impact_sum[k] : 0.0);
+                weight[k] = weight[k] * decay + (acc.count[k] ? 1.0 : 0.0);
+            }
+        }
+        for (size_t k = 0; k < grid.points(); ++k) {
+            double live = 0;
+            OB_CHECK(estimator.estimate(side, grid.orderSize(k), live));
+            const double want = sum[k] / weight[k];
+            OB_CHECK(std::isfinite(want) && std::abs(live - want) <= 1e-12 * std::abs(want));
+        }
+    }
+    double unused = 0;
+    OB_CHECK(!estimator.estimate(Side::Buy, 30, unused));   // off the grid
+    OB_CHECK(!estimator.estimate(Side::Buy, 425, unused));  // beyond max_shares
+}
+
+// ---------------------------------------------------------------------------
+// Throughput floors
+//
+// Pinned dataset: writeSyntheticMbp10() with seed 1, 100k rows, 10 levels.
+// Floors sit at roughly a quarter of a single 2020s x86 core with -O3, so
+// they trip on algorithmic regressions (an extra pass, a lost vectorization,
+// per-row allocation), not on machine noise. Best of 3 runs each.
+// ---------------------------------------------------------------------------
+
+namespace {
+
+constexpr size_t kPerfRows = 100000;
+constexpr int kPerfRepeats = 3;
+
+}  // namespace
+
+OB_TEST(perf_parse_throughput) {
+    obtest::TempDir data("perf_parse");
+    const double megabytes = static_cast<double>(writePinnedDay(data.path, "PERF", kPerfRows, "2025-04-03")) /
+                             (1024.0 * 1024.0);
+    const double rows = static_cast<double>(kPerfRows);
+    auto loadSeconds = [&](LoaderMode mode, bool cache) {
+        AnalyzerOptions options;
+        options.loader = mode;
+        options.use_cache = cache;
+        options.cache_dir = (data.path / "cache").string();
+        return obtest::bestSeconds(kPerfRepeats, [&] {
+            obtest::QuietCout quiet;
+            OrderBookAnalyzer analyzer(data.path.string(), options);
+            analyzer.loadData("PERF");
+        });
+    };
+    const double mapped = loadSeconds(LoaderMode::Mapped, false);
+    OB_CHECK_FLOOR("parse.mapped.throughput", megabytes / mapped, 60.0, "MB/s");
+    OB_CHECK_FLOOR("parse.mapped.rows", rows / mapped, 150000.0, "rows/s");
+    OB_CHECK_FLOOR("parse.stream.throughput", megabytes / loadSeconds(LoaderMode::Stream, false), 20.0, "MB/s");
+    loadSeconds(LoaderMode::Mapped, true);  // first run writes the cache
+    OB_CHECK_FLOOR("parse.cache.rows", rows / loadSeconds(LoaderMode::Mapped, true), 1000000.0, "rows/s");
+}
+
+OB_TEST(perf_impact_throughput) {
+    obtest::TempDir data("perf_impact");
+    writePinnedDay(data.path, "PERF", kPerfRows, "2025-04-03");
+    AnalyzerOptions options;
+    options.use_cache = false;
+    OrderBookAnalyzer loader(data.path.string(), options);
+    {
+        obtest::QuietCout quiet;
+        OB_CHECK(loader.loadData("PERF"));
+    }
+    const SnapshotStore& store = *loader.getSnapshots("PERF");
+    const double snapshots = static_cast<double>(store.size());
+    const OrderSizeGrid grid50{10, 500};
+    const OrderSizeGrid grid1000{1, 1000};
+
+    const double reference = obtest::bestSeconds(kPerfRepeats, [&] {
+        obtest::QuietCout quiet;
+        loader.calculateTemporaryImpact(store, "buy", grid50.max_shares, grid50.step);
+    });
+    OB_CHECK_FLOOR("impact.reference.grid50", snapshots / reference, 150000.0, "snapshots/s");
+
+    const std::pair<const char*, ImpactKernel> kernels[] = {
+        {"impact.cumulative.grid50", accumulateCumulativeDepthImpact},
+        {"impact.simd.grid50", accumulateSimdImpact},
+        {"impact.fixed.grid50", accumulateFixedPointImpact},
+    };
+    for (const auto& kernel : kernels) {
+        const double seconds = obtest::bestSeconds(kPerfRepeats, [&] {
+            ImpactAccumulator acc(grid50);
+            kernel.second(store, 0, store.size(), Side::Buy, acc);
+        });
+        OB_CHECK_FLOOR(kernel.first, snapshots / seconds, 400000.0, "snapshots/s");
+    }
+    const double fused = obtest::bestSeconds(kPerfRepeats, [&] {
+        MarketStats stats;
+        ImpactAccumulator buy(grid50), sell(grid50);
+        accumulateFusedPass(store, 0, store.size(), &stats, buy, sell);
+    });
+    OB_CHECK_FLOOR("impact.fused_both_sides.grid50", snapshots / fused, 400000.0, "snapshots/s");
+    const double fine = obtest::bestSeconds(kPerfRepeats, [&] {
+        ImpactAccumulator acc(grid1000);
+        accumulateCumulativeDepthImpact(store, 0, store.size(), Side::Buy, acc);
+    });
+    OB_CHECK_FLOOR("impact.cumulative.grid1000", snapshots / fine, 40000.0, "snapshots/s");
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> filters(argv + 1, argv + argc);
+    size_t passed = 0;
+    std::vector<std::string> failed;
+    for (const obtest::TestCase& test : obtest::registry()) {
+        const std::string name = test.name;
+        if (!filters.empty() && std::none_of(filters.begin(), filters.end(), [&](const std::string& filter) {
+                return name.find(filter) != std::string::npos;
+            })) {
+            continue;
+        }
+        std::cout << "[ RUN  ] " << name << std::endl;
+        auto start = std::chrono::steady_clock::now();
+        try {
+            test.run();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << "[  OK  ] " << name << " (" << std::fixed << std::setprecision(0) << elapsed.count()
+                      << " ms)" << std::endl;
+            passed++;
+        } catch (const std::exception& e) {
+            std::cout << "[ FAIL ] " << name << ": " << e.what() << std::endl;
+            failed.push_back(name);
+        }
+    }
+    std::cout << "\n" << passed << " passed, " << failed.size() << " failed" << std::endl;
+    for (const auto& name : failed) std::cout << "  FAILED: " << name << std::endl;
+    return failed.empty() && passed > 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+/**
+ * @file test_support.h
+ * @brief Test registry, checks and synthetic order book stores for the impact tests
+ *
+ * Included by impact_tests.cpp after order_book_analysis.cpp (compiled with
+ * ORDER_BOOK_ANALYSIS_NO_MAIN), so everything here sees the library types.
+ * Standard library only, like the program itself.
+ */
+
+#pragma once
+
+namespace obtest {
+
+/**
+ * @struct TestCase
+ * @brief One registered test
+ */
+struct TestCase {
+    const char* name;  ///< Function name; perf_* cases assert throughput floors
+    void (*run)();     ///< Throws Failure (or anything else) to fail
+};
+
+inline std::vector<TestCase>& registry() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+struct Registrar {
+    Registrar(const char* name, void (*run)()) { registry().push_back({name, run}); }
+};
+
+/**
+ * @struct Failure
+ * @brief Thrown by a failed check; carries file, line and the failed expression
+ */
+struct Failure : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] inline void fail(const char* file, int line, const std::string& message) {
+    throw Failure(std::string(file) + ":" + std::to_string(line) + ": " + message);
+}
+
+/**
+ * @brief Redirects std::cout to nowhere while library code logs progress
+ */
+struct QuietCout {
+    std::streambuf* saved;
+    std::ostringstream sink;
+    QuietCout() : saved(std::cout.rdbuf(sink.rdbuf())) {}
+    ~QuietCout() { std::cout.rdbuf(saved); }
+};
+
+/**
+ * @brief Scratch directory under the system temp folder, removed on destruction
+ */
+struct TempDir {
+    fs::path path;
+    explicit TempDir(const std::string& name)
+        : path(fs::temp_directory_path() / ("order_book_tests_" + name + "_" + std::to_string(::getpid()))) {
+        fs::remove_all(path);
+        fs::create_directories(path);
+    }
+    ~TempDir() {
+        std::error_code ec;
+        fs::remove_all(path, ec);
+    }
+};
+
+/**
+ * @struct GeneratedBooks
+ * @brief A generated store and the conditions injected into it
+ */
+struct GeneratedBooks {
+    SnapshotStore store;
+    uint64_t crossed = 0;  ///< Rows generated crossed (both sides non-empty)
+    uint64_t locked = 0;   ///< Rows generated locked (both sides non-empty)
+    uint64_t stale = 0;    ///< Rows whose timestamp is behind an earlier row's
+    uint64_t flagged = 0;  ///< Rows with any of the three conditions
+};
+
+/**
+ * @brief The rows writeSyntheticMbp10() would write for spec, as an in-memory store
+ */
+inline GeneratedBooks generateBooks(const SyntheticBookSpec& spec) {
+    GeneratedBooks out;
+    SnapshotStore& store = out.store;
+    const uint16_t day = store.addDay(spec.date);
+    store.reserve(spec.rows);
+    SyntheticBookGenerator generator(spec);
+    SyntheticRow generated;
+    while (generator.next(generated)) {
+        const size_t row = store.addRow(generated.ts_event, day);
+        for (size_t i = 0; i < generated.bid_levels; ++i) {
+            store.bid_px[row * kBookLevels + i] = static_cast<double>(generated.bid_ticks[i]) * spec.tick;
+            store.bid_sz[row * kBookLevels + i] = generated.bid_sz[i];
+        }
+        for (size_t i = 0; i < generated.ask_levels; ++i) {
+            store.ask_px[row * kBookLevels + i] = static_cast<double>(generated.ask_ticks[i]) * spec.tick;
+            store.ask_sz[row * kBookLevels + i] = generated.ask_sz[i];
+        }
+        out.crossed += generated.crossed;
+        out.locked += generated.locked;
+        out.stale += generated.stale;
+        out.flagged += generated.crossed || generated.locked || generated.stale;
+    }
+    return out;
+}
+
+/**
+ * @brief Parallel-for that runs every index in order on the calling thread
+ */
+inline void serial(size_t count, const std::function<void(size_t)>& fn) {
+    for (size_t i = 0; i < count; ++i) fn(i);
+}
+
+/**
+ * @brief Curve of one row-range kernel over a whole store
+ */
+inline std::vector<ImpactResult> kernelCurve(ImpactKernel kernel, const SnapshotStore& store, Side side,
+                                             const OrderSizeGrid& grid) {
+    ImpactAccumulator acc(grid);
+    kernel(store, 0, store.size(), side, acc);
+    return acc.results();
+}
+
+/**
+ * @brief Check two curves cover the same sizes and agree within a relative tolerance
+ * @param what Label for the failure message
+ * @param expected Reference curve
+ * @param actual Curve under test
+ * @param tolerance Allowed |actual - expected| relative to |expected| (plus 1e-13 absolute,
+ *        for the near-zero impacts of locked books)
+ */
+inline void checkCurvesNear(const std::string& what, const std::vector<ImpactResult>& expected,
+                            const std::vector<ImpactResult>& actual, double tolerance, const char* file, int line) {
+    if (expected.size() != actual.size()) {
+        fail(file, line, what + ": " + std::to_string(actual.size()) + " sizes, expected " +
+                         std::to_string(expected.size()));
+    }
+    for (size_t k = 0; k < expected.size(); ++k) {
+        const double want = expected[k].avg_impact;
+        const double got = actual[k].avg_impact;
+        if (actual[k].order_size != expected[k].order_size || !(std::abs(got - want) <= tolerance * std::abs(want) + 1e-13)) {
+            std::ostringstream message;
+            message << what << ": size " << actual[k].order_size << " impact " << std::setprecision(17) << got
+                    << ", expected size " << expected[k].order_size << " impact " << want;
+            fail(file, line, message.str());
+        }
+    }
+}
+
+/**
+ * @brief Multiplier of the perf_* floors from OB_PERF_SCALE (default 1; 0 skips the floors)
+ *
+ * Lets slow or instrumented builds (sanitizers, emulation, loaded CI
+ * hosts) run the suite without rewriting the floors.
+ */
+inline double perfScale() {
+    const char* value = std::getenv("OB_PERF_SCALE");
+    if (!value || !*value) return 1.0;
+    char* end = nullptr;
+    const double scale = std::strtod(value, &end);
+    return end && *end == '\0' && scale >= 0 ? scale : 1.0;
+}
+
+/**
+ * @brief Best wall time of fn() over a few runs, in seconds
+ */
+template <typename F>
+double bestSeconds(int repeats, F&& fn) {
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+/**
+ * @brief Print a throughput and fail if it is below floor x perfScale()
+ */
+inline void checkFloor(const std::string& name, double value, double floor, const char* unit, const char* file, int line) {
+    const double scaled = floor * perfScale();
+    std::cout << "    " << std::left << std::setw(34) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(14) << value << " " << unit << "  (floor " << scaled << ")" << std::endl;
+    if (value < scaled) {
+        std::ostringstream message;
+        message << name << " " << std::fixed << std::setprecision(1) << value << " " << unit << " is below the floor of "
+                << scaled << " " << unit;
+        fail(file, line, message.str());
+    }
+}
+
+}  // namespace obtest
+
+/// Define and register a test case
+#define OB_TEST(name)                                                   \
+    static void name();                                                 \
+    static const obtest::Registrar name##_registrar(#name, name);       \
+    static void name()
+
+/// Fail the current test unless cond holds
+#define OB_CHECK(cond)                                                              \
+    do {                                                                            \
+        if (!(cond)) obtest::fail(__FILE__, __LINE__, "check failed: " #cond);      \
+    } while (0)
+
+/// Fail unless a == b (values printed on failure)
+#define OB_CHECK_EQ(a, b)                                                                   \
+    do {                                                                                    \
+        const auto& ob_a = (a);                                                             \
+        const auto& ob_b = (b);                                                             \
+        if (!(ob_a == ob_b)) {                                                              \
+            std::ostringstream ob_message;                                                  \
+            ob_message << #a " == " #b " failed: " << ob_a << " vs " << ob_b;               \
+            obtest::fail(__FILE__, __LINE__, ob_message.str());                             \
+        }                                                                                   \
+    } while (0)
+
+/// Fail unless two impact curves agree within a relative tolerance
+#define OB_CHECK_CURVES(what, expected, actual, tolerance) \
+    obtest::checkCurvesNear(what, expected, actual, tolerance, __FILE__, __LINE__)
+
+/// Fail if a measured throughput is below its (scaled) floor
+#define OB_CHECK_FLOOR(name, value, floor, unit) obtest::checkFloor(name, value, floor, unit, __FILE__, __LINE__)